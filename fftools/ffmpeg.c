@@ -43,6 +43,7 @@
 #include "libavformat/avformat.h"
 #include "libavdevice/avdevice.h"
 #include "libswresample/swresample.h"
+#include "libswscale/swscale.h"
 #include "libavutil/opt.h"
 #include "libavutil/channel_layout.h"
 #include "libavutil/parseutils.h"
@@ -167,6 +168,7 @@ static int restore_tty;
 
 #if HAVE_THREADS
 static void free_input_threads(void);
+static int free_mux_thread(OutputFile *of, int flush);
 #endif
 
 /* sub2video hack:
@@ -572,6 +574,9 @@ static void ffmpeg_cleanup(int ret)
         AVFormatContext *s;
         if (!of)
             continue;
+#if HAVE_THREADS
+        free_mux_thread(of, 0);
+#endif
         s = of->ctx;
         if (s && s->oformat && !(s->oformat->flags & AVFMT_NOFILE))
             avio_closep(&s->pb);
@@ -586,6 +591,7 @@ static void ffmpeg_cleanup(int ret)
         if (!ost)
             continue;
 
+        segenc_free(&ost->segenc);
         av_bsf_free(&ost->bsf_ctx);
 
         av_frame_free(&ost->filtered_frame);
@@ -715,13 +721,280 @@ static void update_benchmark(const char *fmt, ...)
     }
 }
 
+/*
+ * The statistics of the streams of an output file written by a muxing
+ * thread are only accessed with the stats lock of the file held. So is
+ * the finished state, which the thread reads when flushing an encoder.
+ */
+static void lock_output_stats(OutputStream *ost)
+{
+#if HAVE_THREADS
+    OutputFile *of = output_files[ost->file_index];
+
+    if (of->mux_thread_queue)
+        pthread_mutex_lock(&of->stats_lock);
+#endif
+}
+
+static void unlock_output_stats(OutputStream *ost)
+{
+#if HAVE_THREADS
+    OutputFile *of = output_files[ost->file_index];
+
+    if (of->mux_thread_queue)
+        pthread_mutex_unlock(&of->stats_lock);
+#endif
+}
+
 static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream, OSTFinished others)
 {
     int i;
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost2 = output_streams[i];
+        lock_output_stats(ost2);
         ost2->finished |= ost == ost2 ? this_stream : others;
+        unlock_output_stats(ost2);
+    }
+}
+
+static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame);
+static int flush_encoder(OutputFile *of, OutputStream *ost);
+
+#if HAVE_THREADS
+/*
+ * Work for the muxing thread of an output file, done in the order it is
+ * queued: a packet to write, a frame to encode or, with neither, the end
+ * of the stream for the encoder.
+ */
+typedef struct MuxThreadMsg {
+    OutputStream *ost;
+    AVPacket *pkt;
+    AVFrame *frame;
+} MuxThreadMsg;
+
+static void mux_thread_update_stats(OutputFile *of)
+{
+    AVFormatContext *s = of->ctx;
+    int i;
+
+    if (s->pb)
+        atomic_store(&of->mux_filesize, avio_tell(s->pb));
+
+    pthread_mutex_lock(&of->stats_lock);
+    for (i = 0; i < s->nb_streams; i++) {
+        OutputStream *ost = output_streams[of->ost_index + i];
+        ost->mux_end_pts = av_stream_get_end_pts(ost->st);
+    }
+    pthread_mutex_unlock(&of->stats_lock);
+}
+
+static void *mux_thread(void *arg)
+{
+    OutputFile *of = arg;
+    AVFormatContext *s = of->ctx;
+    MuxThreadMsg msg;
+    int ret;
+
+    while (1) {
+        ret = av_thread_message_queue_recv(of->mux_thread_queue, &msg, 0);
+        if (ret < 0)
+            break;
+
+        if (msg.pkt) {
+            ret = av_interleaved_write_frame(s, msg.pkt);
+            av_packet_free(&msg.pkt);
+        } else {
+            ret = msg.frame ? encode_frame(of, msg.ost, msg.frame) :
+                              flush_encoder(of, msg.ost);
+            if (ret < 0) {
+                if (msg.frame)
+                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed\n",
+                           msg.ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO ?
+                           "Video" : "Audio");
+                of->enc_failed = 1;
+            } else {
+                /* errors of the muxer are stored by write_packet() */
+                ret = of->mux_thread_ret;
+            }
+            av_frame_free(&msg.frame);
+        }
+        mux_thread_update_stats(of);
+        if (ret < 0) {
+            of->mux_thread_ret = ret;
+            av_thread_message_queue_set_err_send(of->mux_thread_queue, ret);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void mux_thread_free_msg(void *msg)
+{
+    MuxThreadMsg *m = msg;
+
+    av_packet_free(&m->pkt);
+    av_frame_free(&m->frame);
+}
+
+static int init_mux_thread(OutputFile *of)
+{
+    int ret, i;
+
+    if (of->thread_queue_size < 0)
+        of->thread_queue_size = (nb_output_files > 1 ? 8 : 0);
+    if (!of->thread_queue_size)
+        return 0;
+
+    ret = av_thread_message_queue_alloc(&of->mux_thread_queue,
+                                        of->thread_queue_size, sizeof(MuxThreadMsg));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(of->mux_thread_queue, mux_thread_free_msg);
+
+    if ((ret = pthread_mutex_init(&of->stats_lock, NULL))) {
+        av_thread_message_queue_free(&of->mux_thread_queue);
+        return AVERROR(ret);
+    }
+
+    if (of->ctx->pb)
+        atomic_init(&of->mux_filesize, avio_tell(of->ctx->pb));
+
+    for (i = 0; i < of->ctx->nb_streams; i++) {
+        OutputStream *ost = output_streams[of->ost_index + i];
+        enum AVMediaType type = ost->enc_ctx->codec_type;
+
+        ost->mux_end_pts = av_stream_get_end_pts(ost->st);
+        ost->last_enc_pts = AV_NOPTS_VALUE;
+        /* -vstats, -benchmark_all and -xerror need the encoding to be done
+         * from the main thread; audio packets are counted for -frames when
+         * they are written, which the main thread must see in time */
+        ost->threaded_encode = ost->encoding_needed &&
+                               (type == AVMEDIA_TYPE_VIDEO ||
+                                (type == AVMEDIA_TYPE_AUDIO && ost->max_frames == INT64_MAX)) &&
+                               !vstats_filename && !do_benchmark_all && !exit_on_error;
     }
+
+    if ((ret = pthread_create(&of->mux_thread, NULL, mux_thread, of))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        for (i = 0; i < of->ctx->nb_streams; i++)
+            output_streams[of->ost_index + i]->threaded_encode = 0;
+        pthread_mutex_destroy(&of->stats_lock);
+        av_thread_message_queue_free(&of->mux_thread_queue);
+        return AVERROR(ret);
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the muxing thread of an output file. If flush is set, the work
+ * still queued is done before the thread exits, otherwise it is
+ * discarded. Returns the first error the thread reported, if any.
+ */
+static int free_mux_thread(OutputFile *of, int flush)
+{
+    int i;
+
+    if (!of || !of->mux_thread_queue)
+        return 0;
+
+    if (!flush)
+        av_thread_message_flush(of->mux_thread_queue);
+    av_thread_message_queue_set_err_recv(of->mux_thread_queue, AVERROR_EOF);
+    pthread_join(of->mux_thread, NULL);
+
+    av_thread_message_queue_free(&of->mux_thread_queue);
+    pthread_mutex_destroy(&of->stats_lock);
+    for (i = 0; i < of->ctx->nb_streams; i++)
+        output_streams[of->ost_index + i]->threaded_encode = 0;
+
+    return of->mux_thread_ret;
+}
+
+static int mux_thread_send_packet(OutputFile *of, AVPacket *pkt)
+{
+    MuxThreadMsg msg = { 0 };
+    int ret;
+
+    ret = av_packet_make_refcounted(pkt);
+    if (ret < 0)
+        goto fail;
+
+    msg.pkt = av_packet_alloc();
+    if (!msg.pkt) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    av_packet_move_ref(msg.pkt, pkt);
+
+    ret = av_thread_message_queue_send(of->mux_thread_queue, &msg, 0);
+    if (ret < 0) {
+        av_packet_free(&msg.pkt);
+        /* the thread has exited; the error is reported by the caller */
+        of->mux_thread_ret = 0;
+    }
+    return ret;
+fail:
+    av_packet_unref(pkt);
+    return ret;
+}
+
+/*
+ * Pass a frame to the muxing thread for encoding, or signal the end of the
+ * stream to the encoder if frame is NULL. The frame is not consumed.
+ */
+static void mux_thread_send_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+    MuxThreadMsg msg = { .ost = ost };
+    int ret;
+
+    if (frame) {
+        msg.frame = av_frame_clone(frame);
+        if (!msg.frame)
+            exit_program(1);
+    }
+
+    ret = av_thread_message_queue_send(of->mux_thread_queue, &msg, 0);
+    if (ret < 0) {
+        av_frame_free(&msg.frame);
+        /* the thread has already printed why the encoder failed */
+        if (of->enc_failed)
+            exit_program(1);
+        of->mux_thread_ret = 0;
+        print_error("av_interleaved_write_frame()", ret);
+        main_return_code = 1;
+        close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+    }
+}
+#endif
+
+static int64_t output_stream_end_pts(OutputStream *ost)
+{
+#if HAVE_THREADS
+    if (output_files[ost->file_index]->mux_thread_queue)
+        return ost->mux_end_pts;
+#endif
+    return av_stream_get_end_pts(ost->st);
+}
+
+/* Return the number of bytes written so far into the output file. */
+static int64_t output_file_size(OutputFile *of)
+{
+    AVIOContext *pb = of->ctx->pb;
+    int64_t size;
+
+#if HAVE_THREADS
+    if (of->mux_thread_queue)
+        return atomic_load(&of->mux_filesize);
+#endif
+    if (!pb)
+        return 0;
+
+    size = avio_size(pb);
+    if (size <= 0) // FIXME improve avio_size() so it works with non seekable output too
+        size = avio_tell(pb);
+    return size;
 }
 
 static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
@@ -730,6 +1003,14 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
     AVStream *st = ost->st;
     int ret;
 
+#if HAVE_THREADS
+    /* a muxer error stops the encoding in the muxing thread */
+    if (ost->threaded_encode && !unqueue && of->mux_thread_ret < 0) {
+        av_packet_unref(pkt);
+        return;
+    }
+#endif
+
     /*
      * Audio encoders may split the packets --  #frames in != #packets out.
      * But there is no reordering, so we can limit the number of output packets
@@ -739,11 +1020,14 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
      * Do not count the packet when unqueued because it has been counted when queued.
      */
     if (!(st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ost->encoding_needed) && !unqueue) {
+        lock_output_stats(ost);
         if (ost->frame_number >= ost->max_frames) {
+            unlock_output_stats(ost);
             av_packet_unref(pkt);
             return;
         }
         ost->frame_number++;
+        unlock_output_stats(ost);
     }
 
     if (!of->header_written) {
@@ -786,6 +1070,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
         int i;
         uint8_t *sd = av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS,
                                               NULL);
+        lock_output_stats(ost);
         ost->quality = sd ? AV_RL32(sd) : -1;
         ost->pict_type = sd ? sd[4] : AV_PICTURE_TYPE_NONE;
 
@@ -795,6 +1080,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
             else
                 ost->error[i] = -1;
         }
+        unlock_output_stats(ost);
 
         if (ost->frame_rate.num && ost->is_cfr) {
             if (pkt->duration > 0)
@@ -843,10 +1129,12 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
             }
         }
     }
+    lock_output_stats(ost);
     ost->last_mux_dts = pkt->dts;
 
     ost->data_size += pkt->size;
     ost->packets_written++;
+    unlock_output_stats(ost);
 
     pkt->stream_index = ost->index;
 
@@ -860,7 +1148,20 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
               );
     }
 
-    ret = av_interleaved_write_frame(s, pkt);
+#if HAVE_THREADS
+    if (ost->threaded_encode && !unqueue) {
+        /* called from the muxing thread, the error is reported by the
+         * main thread once the thread has stopped */
+        ret = av_interleaved_write_frame(s, pkt);
+        if (ret < 0)
+            of->mux_thread_ret = ret;
+        return;
+    }
+    if (of->mux_thread_queue)
+        ret = mux_thread_send_packet(of, pkt);
+    else
+#endif
+        ret = av_interleaved_write_frame(s, pkt);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
         main_return_code = 1;
@@ -873,7 +1174,9 @@ static void close_output_stream(OutputStream *ost)
     OutputFile *of = output_files[ost->file_index];
     AVRational time_base = ost->stream_copy ? ost->mux_timebase : ost->enc_ctx->time_base;
 
+    lock_output_stats(ost);
     ost->finished |= ENCODER_FINISHED;
+    unlock_output_stats(ost);
     if (of->shortest) {
         int64_t end = av_rescale_q(ost->sync_opts - ost->first_pts, time_base, AV_TIME_BASE_Q);
         of->recording_time = FFMIN(of->recording_time, end);
@@ -998,13 +1301,91 @@ static int init_output_stream_wrapper(OutputStream *ost, AVFrame *frame,
     return ret;
 }
 
-static void do_audio_out(OutputFile *of, OutputStream *ost,
-                         AVFrame *frame)
+/*
+ * Encode a frame and send the packets to the output. For the streams with
+ * threaded_encode set, this runs in the muxing thread of the output file.
+ */
+static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket *pkt = ost->pkt;
+    const char *type_desc = av_get_media_type_string(enc->codec_type);
+    int64_t frame_pts = frame->pts;
+    int frame_size = 0;
     int ret;
 
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && !ost->frame_aspect_ratio.num)
+        enc->sample_aspect_ratio = frame->sample_aspect_ratio;
+
+    ret = ost->segenc ? segenc_send_frame(ost->segenc, frame) :
+                        avcodec_send_frame(enc, frame);
+    if (ret < 0)
+        return ret;
+
+    while (1) {
+        ret = ost->segenc ? segenc_receive_packet(ost->segenc, pkt) :
+                            avcodec_receive_packet(enc, pkt);
+        update_benchmark("encode_%s %d.%d", type_desc, ost->file_index, ost->index);
+        if (ret == AVERROR(EAGAIN))
+            break;
+        if (ret < 0)
+            return ret;
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:%s "
+                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                   type_desc,
+                   av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
+                   av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
+        }
+
+        if (enc->codec_type == AVMEDIA_TYPE_VIDEO &&
+            pkt->pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
+            pkt->pts = frame_pts;
+
+        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:%s "
+                "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                type_desc,
+                av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &ost->mux_timebase),
+                av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &ost->mux_timebase));
+        }
+
+        frame_size = pkt->size;
+        output_packet(of, pkt, ost, 0);
+
+        /* if two pass, output log */
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+    }
+
+    if (enc->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename && frame_size)
+        do_video_stats(ost, frame_size);
+
+    return 0;
+}
+
+/* Encode a frame, from the muxing thread of the output file if it has one. */
+static int send_frame_to_encoder(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+#if HAVE_THREADS
+    if (ost->threaded_encode) {
+        ost->last_enc_pts = frame->pts;
+        mux_thread_send_frame(of, ost, frame);
+        return 0;
+    }
+#endif
+    return encode_frame(of, ost, frame);
+}
+
+static void do_audio_out(OutputFile *of, OutputStream *ost,
+                         AVFrame *frame)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+
     adjust_frame_pts_to_encoder_tb(of, ost, frame);
 
     if (!check_recording_time(ost))
@@ -1024,35 +1405,10 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
                enc->time_base.num, enc->time_base.den);
     }
 
-    ret = avcodec_send_frame(enc, frame);
-    if (ret < 0)
-        goto error;
-
-    while (1) {
-        ret = avcodec_receive_packet(enc, pkt);
-        if (ret == AVERROR(EAGAIN))
-            break;
-        if (ret < 0)
-            goto error;
-
-        update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
-
-        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-
-        if (debug_ts) {
-            av_log(NULL, AV_LOG_INFO, "encoder -> type:audio "
-                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                   av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
-                   av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
-        }
-
-        output_packet(of, pkt, ost, 0);
+    if (send_frame_to_encoder(of, ost, frame) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
+        exit_program(1);
     }
-
-    return;
-error:
-    av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
-    exit_program(1);
 }
 
 static void do_subtitle_out(OutputFile *of,
@@ -1144,14 +1500,12 @@ static void do_video_out(OutputFile *of,
                          AVFrame *next_picture)
 {
     int ret;
-    AVPacket *pkt = ost->pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVRational frame_rate;
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
     double sync_ipts = AV_NOPTS_VALUE;
-    int frame_size = 0;
     InputStream *ist = NULL;
     AVFilterContext *filter = ost->filter->filter;
 
@@ -1349,47 +1703,12 @@ static void do_video_out(OutputFile *of,
 
         ost->frames_encoded++;
 
-        ret = avcodec_send_frame(enc, in_picture);
+        ret = send_frame_to_encoder(of, ost, in_picture);
         if (ret < 0)
             goto error;
         // Make sure Closed Captions will not be duplicated
         av_frame_remove_side_data(in_picture, AV_FRAME_DATA_A53_CC);
 
-        while (1) {
-            ret = avcodec_receive_packet(enc, pkt);
-            update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
-            if (ret == AVERROR(EAGAIN))
-                break;
-            if (ret < 0)
-                goto error;
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                       "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                       av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &enc->time_base),
-                       av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &enc->time_base));
-            }
-
-            if (pkt->pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
-                pkt->pts = ost->sync_opts;
-
-            av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                    av_ts2str(pkt->pts), av_ts2timestr(pkt->pts, &ost->mux_timebase),
-                    av_ts2str(pkt->dts), av_ts2timestr(pkt->dts, &ost->mux_timebase));
-            }
-
-            frame_size = pkt->size;
-            output_packet(of, pkt, ost, 0);
-
-            /* if two pass, output log */
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-        }
         ost->sync_opts++;
         /*
          * For video, number of frames in == number of packets out.
@@ -1397,9 +1716,6 @@ static void do_video_out(OutputFile *of,
          * flush, we need to limit them here, before they go into encoder.
          */
         ost->frame_number++;
-
-        if (vstats_filename && frame_size)
-            do_video_stats(ost, frame_size);
     }
 
     av_frame_unref(ost->last_frame);
@@ -1465,7 +1781,9 @@ static void finish_output_stream(OutputStream *ost)
     OutputFile *of = output_files[ost->file_index];
     AVRational time_base = ost->stream_copy ? ost->mux_timebase : ost->enc_ctx->time_base;
 
+    lock_output_stats(ost);
     ost->finished = ENCODER_FINISHED | MUXER_FINISHED;
+    unlock_output_stats(ost);
 
     if (of->shortest) {
         int64_t end = av_rescale_q(ost->sync_opts - ost->first_pts, time_base, AV_TIME_BASE_Q);
@@ -1530,9 +1848,6 @@ static int reap_filters(int flush)
 
             switch (av_buffersink_get_type(filter)) {
             case AVMEDIA_TYPE_VIDEO:
-                if (!ost->frame_aspect_ratio.num)
-                    enc->sample_aspect_ratio = filtered_frame->sample_aspect_ratio;
-
                 do_video_out(of, ost, filtered_frame);
                 break;
             case AVMEDIA_TYPE_AUDIO:
@@ -1677,7 +1992,6 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
 {
     AVBPrint buf, buf_script;
     OutputStream *ost;
-    AVFormatContext *oc;
     int64_t total_size;
     AVCodecContext *enc;
     int frame_number, vid, i;
@@ -1708,19 +2022,17 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
     t = (cur_time-timer_start) / 1000000.0;
 
 
-    oc = output_files[0]->ctx;
-
-    total_size = avio_size(oc->pb);
-    if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
-        total_size = avio_tell(oc->pb);
+    total_size = output_file_size(output_files[0]);
 
     vid = 0;
     av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
     av_bprint_init(&buf_script, 0, AV_BPRINT_SIZE_AUTOMATIC);
     for (i = 0; i < nb_output_streams; i++) {
         float q = -1;
+        int64_t end_pts;
         ost = output_streams[i];
         enc = ost->enc_ctx;
+        lock_output_stats(ost);
         if (!ost->stream_copy)
             q = ost->quality / (float) FF_QP2LAMBDA;
 
@@ -1783,8 +2095,10 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
             vid = 1;
         }
         /* compute min output value */
-        if (av_stream_get_end_pts(ost->st) != AV_NOPTS_VALUE) {
-            pts = FFMAX(pts, av_rescale_q(av_stream_get_end_pts(ost->st),
+        end_pts = output_stream_end_pts(ost);
+        unlock_output_stats(ost);
+        if (end_pts != AV_NOPTS_VALUE) {
+            pts = FFMAX(pts, av_rescale_q(end_pts,
                                           ost->st->time_base, AV_TIME_BASE_Q));
             if (copy_ts) {
                 if (copy_ts_first_pts == AV_NOPTS_VALUE && pts > 1)
@@ -1896,6 +2210,77 @@ static void ifilter_parameters_from_codecpar(InputFilter *ifilter, AVCodecParame
     ifilter->sample_aspect_ratio    = par->sample_aspect_ratio;
 }
 
+/*
+ * Drain the encoder of an output stream. For the streams with
+ * threaded_encode set, this runs in the muxing thread of the output file.
+ */
+static int flush_encoder(OutputFile *of, OutputStream *ost)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+    int ret, finished;
+
+    for (;;) {
+        const char *desc = NULL;
+        AVPacket *pkt = ost->pkt;
+        int pkt_size;
+
+        switch (enc->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            desc   = "audio";
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            desc   = "video";
+            break;
+        default:
+            av_assert0(0);
+        }
+
+        update_benchmark(NULL);
+
+        while ((ret = ost->segenc ? segenc_receive_packet(ost->segenc, pkt) :
+                                    avcodec_receive_packet(enc, pkt)) == AVERROR(EAGAIN)) {
+            ret = ost->segenc ? segenc_send_frame(ost->segenc, NULL) :
+                                avcodec_send_frame(enc, NULL);
+            if (ret < 0) {
+                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                       desc,
+                       av_err2str(ret));
+                return ret;
+            }
+        }
+
+        update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
+        if (ret < 0 && ret != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                   desc,
+                   av_err2str(ret));
+            return ret;
+        }
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+        if (ret == AVERROR_EOF) {
+            output_packet(of, pkt, ost, 1);
+            break;
+        }
+        lock_output_stats(ost);
+        finished = ost->finished & MUXER_FINISHED;
+        unlock_output_stats(ost);
+        if (finished) {
+            av_packet_unref(pkt);
+            continue;
+        }
+        av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
+        pkt_size = pkt->size;
+        output_packet(of, pkt, ost, 0);
+        if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
+            do_video_stats(ost, pkt_size);
+        }
+    }
+
+    return 0;
+}
+
 static void flush_encoders(void)
 {
     int i, ret;
@@ -1943,59 +2328,16 @@ static void flush_encoders(void)
         if (enc->codec_type != AVMEDIA_TYPE_VIDEO && enc->codec_type != AVMEDIA_TYPE_AUDIO)
             continue;
 
-        for (;;) {
-            const char *desc = NULL;
-            AVPacket *pkt = ost->pkt;
-            int pkt_size;
-
-            switch (enc->codec_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                desc   = "audio";
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                desc   = "video";
-                break;
-            default:
-                av_assert0(0);
-            }
-
-            update_benchmark(NULL);
-
-            while ((ret = avcodec_receive_packet(enc, pkt)) == AVERROR(EAGAIN)) {
-                ret = avcodec_send_frame(enc, NULL);
-                if (ret < 0) {
-                    av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                           desc,
-                           av_err2str(ret));
-                    exit_program(1);
-                }
-            }
-
-            update_benchmark("flush_%s %d.%d", desc, ost->file_index, ost->index);
-            if (ret < 0 && ret != AVERROR_EOF) {
-                av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
-                       desc,
-                       av_err2str(ret));
-                exit_program(1);
-            }
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-            if (ret == AVERROR_EOF) {
-                output_packet(of, pkt, ost, 1);
-                break;
-            }
-            if (ost->finished & MUXER_FINISHED) {
-                av_packet_unref(pkt);
-                continue;
-            }
-            av_packet_rescale_ts(pkt, enc->time_base, ost->mux_timebase);
-            pkt_size = pkt->size;
-            output_packet(of, pkt, ost, 0);
-            if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
-                do_video_stats(ost, pkt_size);
-            }
+#if HAVE_THREADS
+        if (ost->threaded_encode) {
+            /* nothing can be written after a muxing error */
+            if (!(ost->finished & MUXER_FINISHED))
+                mux_thread_send_frame(of, ost, NULL);
+            continue;
         }
+#endif
+        if (flush_encoder(of, ost) < 0)
+            exit_program(1);
     }
 }
 
@@ -2144,6 +2486,43 @@ static int ifilter_has_all_input_formats(FilterGraph *fg)
     return 1;
 }
 
+/* Whether the scaler at the input of the graph can take this frame. */
+static int ifilter_can_update_in_place(const InputFilter *ifilter, const AVFrame *frame)
+{
+    return CONFIG_SWSCALE && ifilter->in_place && !frame->hw_frames_ctx &&
+           sws_isSupportedInput(frame->format);
+}
+
+static int ifilter_update_in_place(InputFilter *ifilter, const AVFrame *frame)
+{
+    AVBufferSrcParameters *par = av_buffersrc_parameters_alloc();
+    int ret;
+
+    if (!par)
+        return AVERROR(ENOMEM);
+
+    av_log(NULL, AV_LOG_INFO, "Input stream #%d:%d frame changed from size:%dx%d fmt:%s "
+           "to size:%dx%d fmt:%s, scaling it without reinitializing the filtergraph\n",
+           ifilter->ist->file_index, ifilter->ist->st->index,
+           ifilter->width, ifilter->height, av_get_pix_fmt_name(ifilter->format),
+           frame->width, frame->height, av_get_pix_fmt_name(frame->format));
+
+    ifilter->format              = frame->format;
+    ifilter->width               = frame->width;
+    ifilter->height              = frame->height;
+    ifilter->sample_aspect_ratio = frame->sample_aspect_ratio;
+
+    /* only to keep the buffer source from warning about every frame */
+    par->format              = frame->format;
+    par->width               = frame->width;
+    par->height              = frame->height;
+    par->sample_aspect_ratio = frame->sample_aspect_ratio;
+    ret = av_buffersrc_parameters_set(ifilter->filter, par);
+    av_freep(&par);
+
+    return ret;
+}
+
 static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int keep_reference)
 {
     FilterGraph *fg = ifilter->graph;
@@ -2172,6 +2551,16 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame, int keep_ref
     if (!ifilter->ist->reinit_filters && fg->graph)
         need_reinit = 0;
 
+    /* the scaler at the input of the graph takes the new size and format,
+     * the rest of the graph keeps running; a pixel format swscale cannot
+     * read still reinitializes the graph */
+    if (need_reinit && fg->graph && ifilter_can_update_in_place(ifilter, frame)) {
+        ret = ifilter_update_in_place(ifilter, frame);
+        if (ret < 0)
+            return ret;
+        need_reinit = 0;
+    }
+
     if (!!ifilter->hw_frames_ctx != !!frame->hw_frames_ctx ||
         (ifilter->hw_frames_ctx && ifilter->hw_frames_ctx->data != frame->hw_frames_ctx->data))
         need_reinit = 1;
@@ -2964,6 +3353,12 @@ static int check_init_output_file(OutputFile *of, int file_index)
     //assert_avoptions(of->opts);
     of->header_written = 1;
 
+#if HAVE_THREADS
+    ret = init_mux_thread(of);
+    if (ret < 0)
+        return ret;
+#endif
+
     av_dump_format(of->ctx, file_index, of->ctx->url, 1);
     nb_output_dumped++;
 
@@ -3483,6 +3878,18 @@ static int init_output_stream(OutputStream *ost, AVFrame *frame,
             }
         }
 
+        if (ost->enc_segments > 1 && (ret = segenc_init(ost)) < 0) {
+            snprintf(error, error_len, "Error initializing segment-parallel "
+                     "encoding for output stream #%d:%d",
+                     ost->file_index, ost->index);
+            return ret;
+        }
+
+        /* With segment-parallel encoding, this encoder only provides the
+         * stream parameters and extradata, it never gets any frame. */
+        if (ost->segenc)
+            av_dict_set(&ost->encoder_opts, "threads", "1", 0);
+
         if ((ret = avcodec_open2(ost->enc_ctx, codec, &ost->encoder_opts)) < 0) {
             if (ret == AVERROR_EXPERIMENTAL)
                 abort_codec_experimental(codec, 1);
@@ -3778,12 +4185,15 @@ static int need_output(void)
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
-        AVFormatContext *os  = output_files[ost->file_index]->ctx;
+        int frame_number;
 
         if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+            (of->ctx->pb && output_file_size(of) >= of->limit_filesize))
             continue;
-        if (ost->frame_number >= ost->max_frames) {
+        lock_output_stats(ost);
+        frame_number = ost->frame_number;
+        unlock_output_stats(ost);
+        if (frame_number >= ost->max_frames) {
             int j;
             for (j = 0; j < of->ctx->nb_streams; j++)
                 close_output_stream(output_streams[of->ost_index + j]);
@@ -3809,10 +4219,22 @@ static OutputStream *choose_output(void)
 
     for (i = 0; i < nb_output_streams; i++) {
         OutputStream *ost = output_streams[i];
-        int64_t opts = ost->last_mux_dts == AV_NOPTS_VALUE ? INT64_MIN :
-                       av_rescale_q(ost->last_mux_dts, ost->st->time_base,
-                                    AV_TIME_BASE_Q);
-        if (ost->last_mux_dts == AV_NOPTS_VALUE)
+        int64_t last_dts, opts;
+        AVRational tb;
+
+        /* the muxing thread lags behind by a varying amount, so only use
+         * what the main thread has sent to it to keep the order of the
+         * inputs reproducible */
+        if (ost->threaded_encode) {
+            last_dts = ost->last_enc_pts;
+            tb       = ost->enc_ctx->time_base;
+        } else {
+            last_dts = ost->last_mux_dts;
+            tb       = ost->st->time_base;
+        }
+        opts = last_dts == AV_NOPTS_VALUE ? INT64_MIN :
+               av_rescale_q(last_dts, tb, AV_TIME_BASE_Q);
+        if (last_dts == AV_NOPTS_VALUE)
             av_log(NULL, AV_LOG_DEBUG,
                 "cur_dts is invalid st:%d (%d) [init:%d i_done:%d finish:%d] (this is harmless if it occurs once at the start per stream)\n",
                 ost->st->index, ost->st->id, ost->initialized, ost->inputs_done, ost->finished);
@@ -4709,6 +5131,15 @@ static int transcode(void)
                    i, os->url);
             continue;
         }
+#if HAVE_THREADS
+        if ((ret = free_mux_thread(output_files[i], 1)) < 0) {
+            /* the thread has already printed why the encoder failed */
+            if (output_files[i]->enc_failed)
+                exit_program(1);
+            print_error("av_interleaved_write_frame()", ret);
+            main_return_code = 1;
+        }
+#endif
         if ((ret = av_write_trailer(os)) < 0) {
             av_log(NULL, AV_LOG_ERROR, "Error writing trailer of %s: %s\n", os->url, av_err2str(ret));
             if (exit_on_error)
@@ -21,6 +21,7 @@
 
 #include "config.h"
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <signal.h>
@@ -202,6 +203,8 @@ typedef struct OptionsContext {
     int        nb_filter_scripts;
     SpecifierOpt *reinit_filters;
     int        nb_reinit_filters;
+    SpecifierOpt *reinit_in_place;
+    int        nb_reinit_in_place;
     SpecifierOpt *fix_sub_duration;
     int        nb_fix_sub_duration;
     SpecifierOpt *canvas_sizes;
@@ -232,6 +235,12 @@ typedef struct OptionsContext {
     int        nb_autoscale;
     SpecifierOpt *bits_per_raw_sample;
     int        nb_bits_per_raw_sample;
+    SpecifierOpt *enc_segments;
+    int        nb_enc_segments;
+    SpecifierOpt *enc_segment_frames;
+    int        nb_enc_segment_frames;
+    SpecifierOpt *enc_segment_max_memory;
+    int        nb_enc_segment_max_memory;
 } OptionsContext;
 
 typedef struct InputFilter {
@@ -256,6 +265,9 @@ typedef struct InputFilter {
     AVBufferRef *hw_frames_ctx;
     int32_t *displaymatrix;
 
+    // the graph scales this input back to the parameters above
+    int in_place;
+
     int eof;
 } InputFilter;
 
@@ -367,6 +379,7 @@ typedef struct InputStream {
     int        nb_filters;
 
     int reinit_filters;
+    int reinit_in_place;
 
     /* hwaccel options */
     enum HWAccelID hwaccel_id;
@@ -448,6 +461,8 @@ typedef enum {
     MUXER_FINISHED = 2,
 } OSTFinished ;
 
+typedef struct SegmentEncoder SegmentEncoder;
+
 typedef struct OutputStream {
     int file_index;          /* file index */
     int index;               /* stream index in the output file */
@@ -571,6 +586,19 @@ typedef struct OutputStream {
 
     /* frame encode sum of squared error values */
     int64_t error[4];
+
+    /* segment-parallel encoding */
+    int enc_segments;
+    int enc_segment_frames;
+    int enc_segment_max_memory;
+    SegmentEncoder *segenc;
+
+    /* the frames are encoded by the muxing thread of the output file */
+    int threaded_encode;
+    /* pts of the last frame sent to the muxing thread, in the encoder time base */
+    int64_t last_enc_pts;
+    /* end pts of the stream, copied by the muxing thread */
+    int64_t mux_end_pts;
 } OutputStream;
 
 typedef struct OutputFile {
@@ -584,6 +612,16 @@ typedef struct OutputFile {
     int shortest;
 
     int header_written;
+
+#if HAVE_THREADS
+    AVThreadMessageQueue *mux_thread_queue;
+    pthread_t mux_thread;       /* thread writing packets to this file */
+    int thread_queue_size;      /* maximum number of queued packets */
+    int mux_thread_ret;         /* error returned by the muxer in the thread */
+    int enc_failed;             /* an encoder failed in the thread */
+    atomic_int_least64_t mux_filesize; /* bytes written so far, updated by the thread */
+    pthread_mutex_t stats_lock; /* protects the stream statistics updated by the thread */
+#endif
 } OutputFile;
 
 extern InputStream **input_streams;
@@ -631,6 +669,7 @@ extern float max_error_rate;
 
 extern char *filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int filter_complex_pipeline;
 extern int vstats_version;
 extern int auto_conversion_filters;
 
@@ -678,4 +717,9 @@ int hw_device_setup_for_filter(FilterGraph *fg);
 
 int hwaccel_decode_init(AVCodecContext *avctx);
 
+int segenc_init(OutputStream *ost);
+int segenc_send_frame(SegmentEncoder *se, const AVFrame *frame);
+int segenc_receive_packet(SegmentEncoder *se, AVPacket *pkt);
+void segenc_free(SegmentEncoder **pse);
+
 #endif /* FFTOOLS_FFMPEG_H */
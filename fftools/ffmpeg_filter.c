@@ -26,6 +26,8 @@
 #include "libavfilter/buffersink.h"
 #include "libavfilter/buffersrc.h"
 
+#include "libswscale/swscale.h"
+
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/bprint.h"
@@ -751,6 +753,29 @@ static int configure_input_video_filter(FilterGraph *fg, InputFilter *ifilter,
     desc = av_pix_fmt_desc_get(ifilter->format);
     av_assert0(desc);
 
+    /* Pin the size and pixel format seen by the rest of the graph, so that
+     * changes of the input parameters only reconfigure this scaler. */
+    ifilter->in_place = CONFIG_SWSCALE && ist->reinit_in_place &&
+                        ist->dec_ctx->codec_type == AVMEDIA_TYPE_VIDEO &&
+                        !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL) &&
+                        sws_isSupportedInput(ifilter->format) &&
+                        sws_isSupportedOutput(ifilter->format);
+    if (ifilter->in_place) {
+        char scale_args[256];
+
+        snprintf(scale_args, sizeof(scale_args), "w=%d:h=%d%s%s",
+                 ifilter->width, ifilter->height,
+                 fg->graph->scale_sws_opts ? ":" : "",
+                 fg->graph->scale_sws_opts ? fg->graph->scale_sws_opts : "");
+        ret = insert_filter(&last_filter, &pad_idx, "scale", scale_args);
+        if (ret < 0)
+            return ret;
+        ret = insert_filter(&last_filter, &pad_idx, "format",
+                            av_get_pix_fmt_name(ifilter->format));
+        if (ret < 0)
+            return ret;
+    }
+
     // TODO: insert hwaccel enabled filters like transpose_vaapi into the graph
     if (ist->autorotate && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
         int32_t *displaymatrix = ifilter->displaymatrix;
@@ -1018,6 +1043,8 @@ int configure_filtergraph(FilterGraph *fg)
         av_opt_set(fg->graph, "aresample_swr_opts", args, 0);
     } else {
         fg->graph->nb_threads = filter_complex_nbthreads;
+        if (filter_complex_pipeline)
+            fg->graph->thread_type |= AVFILTER_THREAD_PIPELINE;
     }
 
     if ((ret = avfilter_graph_parse2(fg->graph, graph_desc, &inputs, &outputs)) < 0)
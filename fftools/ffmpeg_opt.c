@@ -85,6 +85,7 @@ static const char *const opt_name_copy_prior_start[]          = {"copypriorss",
 static const char *const opt_name_filters[]                   = {"filter", "af", "vf", NULL};
 static const char *const opt_name_filter_scripts[]            = {"filter_script", NULL};
 static const char *const opt_name_reinit_filters[]            = {"reinit_filter", NULL};
+static const char *const opt_name_reinit_in_place[]           = {"reinit_in_place", NULL};
 static const char *const opt_name_fix_sub_duration[]          = {"fix_sub_duration", NULL};
 static const char *const opt_name_canvas_sizes[]              = {"canvas_size", NULL};
 static const char *const opt_name_pass[]                      = {"pass", NULL};
@@ -98,6 +99,9 @@ static const char *const opt_name_disposition[]               = {"disposition",
 static const char *const opt_name_time_bases[]                = {"time_base", NULL};
 static const char *const opt_name_enc_time_bases[]            = {"enc_time_base", NULL};
 static const char *const opt_name_bits_per_raw_sample[]       = {"bits_per_raw_sample", NULL};
+static const char *const opt_name_enc_segments[]              = {"enc_segments", NULL};
+static const char *const opt_name_enc_segment_frames[]        = {"enc_segment_frames", NULL};
+static const char *const opt_name_enc_segment_max_memory[]    = {"enc_segment_max_memory", NULL};
 
 #define WARN_MULTIPLE_OPT_USAGE(name, type, so, st)\
 {\
@@ -165,6 +169,7 @@ int stdin_interaction = 1;
 float max_error_rate  = 2.0/3;
 char *filter_nbthreads;
 int filter_complex_nbthreads = 0;
+int filter_complex_pipeline = 0;
 int vstats_version = 2;
 int auto_conversion_filters = 1;
 int64_t stats_period = 500000;
@@ -829,6 +834,7 @@ static void add_input_streams(OptionsContext *o, AVFormatContext *ic)
 
         ist->reinit_filters = -1;
         MATCH_PER_STREAM_OPT(reinit_filters, i, ist->reinit_filters, ic, st);
+        MATCH_PER_STREAM_OPT(reinit_in_place, i, ist->reinit_in_place, ic, st);
 
         MATCH_PER_STREAM_OPT(discard, str, discard_str, ic, st);
         ist->user_set_discard = AVDISCARD_NONE;
@@ -1892,6 +1898,11 @@ static OutputStream *new_video_stream(OptionsContext *o, AVFormatContext *oc, in
 
         MATCH_PER_STREAM_OPT(force_fps, i, ost->force_fps, oc, st);
 
+        MATCH_PER_STREAM_OPT(enc_segments, i, ost->enc_segments, oc, st);
+        MATCH_PER_STREAM_OPT(enc_segment_frames, i, ost->enc_segment_frames, oc, st);
+        ost->enc_segment_max_memory = 4096;
+        MATCH_PER_STREAM_OPT(enc_segment_max_memory, i, ost->enc_segment_max_memory, oc, st);
+
         ost->top_field_first = -1;
         MATCH_PER_STREAM_OPT(top_field_first, i, ost->top_field_first, oc, st);
 
@@ -2288,6 +2299,9 @@ static int open_output_file(OptionsContext *o, const char *filename)
     of->start_time     = o->start_time;
     of->limit_filesize = o->limit_filesize;
     of->shortest       = o->shortest;
+#if HAVE_THREADS
+    of->thread_queue_size = o->thread_queue_size;
+#endif
     av_dict_copy(&of->opts, o->g->format_opts, 0);
 
     if (!strcmp(filename, "-"))
@@ -3662,10 +3676,14 @@ const OptionDef options[] = {
         "read stream filtergraph description from a file", "filename" },
     { "reinit_filter",  HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,    { .off = OFFSET(reinit_filters) },
         "reinit filtergraph on input parameter changes", "" },
+    { "reinit_in_place", HAS_ARG | OPT_INT | OPT_SPEC | OPT_INPUT,   { .off = OFFSET(reinit_in_place) },
+        "scale video input parameter changes instead of reinitializing the filtergraph", "" },
     { "filter_complex", HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_threads", HAS_ARG | OPT_INT,                   { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
+    { "filter_complex_pipeline", OPT_BOOL | OPT_EXPERT,              { &filter_complex_pipeline },
+        "run independent filters of -filter_complex concurrently" },
     { "lavfi",          HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
     { "filter_complex_script", HAS_ARG | OPT_EXPERT,                 { .func_arg = opt_filter_complex_script },
@@ -3694,9 +3712,9 @@ const OptionDef options[] = {
     { "disposition",    OPT_STRING | HAS_ARG | OPT_SPEC |
                         OPT_OUTPUT,                                  { .off = OFFSET(disposition) },
         "disposition", "" },
-    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
+    { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT | OPT_OUTPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
-        "set the maximum number of queued packets from the demuxer" },
+        "set the maximum number of queued packets from the demuxer or frames and packets for an output" },
     { "find_stream_info", OPT_BOOL | OPT_PERFILE | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
     { "bits_per_raw_sample", OPT_INT | HAS_ARG | OPT_EXPERT | OPT_SPEC | OPT_OUTPUT,
@@ -3772,6 +3790,15 @@ const OptionDef options[] = {
     { "force_key_frames", OPT_VIDEO | OPT_STRING | HAS_ARG | OPT_EXPERT |
                           OPT_SPEC | OPT_OUTPUT,                                 { .off = OFFSET(forced_key_frames) },
         "force key frames at specified timestamps", "timestamps" },
+    { "enc_segments", OPT_VIDEO | HAS_ARG | OPT_INT | OPT_EXPERT | OPT_SPEC |
+                      OPT_OUTPUT,                                                { .off = OFFSET(enc_segments) },
+        "encode that many segments of the stream in parallel", "number" },
+    { "enc_segment_frames", OPT_VIDEO | HAS_ARG | OPT_INT | OPT_EXPERT | OPT_SPEC |
+                          OPT_OUTPUT,                                            { .off = OFFSET(enc_segment_frames) },
+        "set the number of frames of the segments encoded in parallel", "number" },
+    { "enc_segment_max_memory", OPT_VIDEO | HAS_ARG | OPT_INT | OPT_EXPERT | OPT_SPEC |
+                                OPT_OUTPUT,                                      { .off = OFFSET(enc_segment_max_memory) },
+        "maximum memory in MiB for the raw frames of the segments encoded in parallel", "size" },
     { "ab",           OPT_VIDEO | HAS_ARG | OPT_PERFILE | OPT_OUTPUT,            { .func_arg = opt_bitrate },
         "audio bitrate (please use -b:a)", "bitrate" },
     { "b",            OPT_VIDEO | HAS_ARG | OPT_PERFILE | OPT_OUTPUT,            { .func_arg = opt_bitrate },
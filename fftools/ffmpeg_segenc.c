@@ -0,0 +1,457 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Segment-parallel encoding.
+ *
+ * The frames sent to an output stream are cut into segments of a whole
+ * number of GOPs. Every segment is encoded from scratch by its own encoder
+ * instance on one of the worker threads, so that it starts with a keyframe
+ * and does not reference any other segment, and the packets are returned to
+ * the caller in order, through the same send/receive pattern as the encoder
+ * itself.
+ */
+
+#include <string.h>
+
+#include "libavutil/cpu.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+
+#include "ffmpeg.h"
+
+#if HAVE_THREADS
+
+typedef struct EncSegment {
+    AVFrame  **frames;
+    int     nb_frames;
+    AVPacket **pkts;
+    int     nb_pkts;
+    int        pkt_index;   /* next packet to return */
+    int        done;        /* set by the worker once the segment is encoded */
+    int        ret;
+} EncSegment;
+
+struct SegmentEncoder {
+    const AVCodec  *codec;
+    AVCodecContext *settings;   /* unopened copy of the encoder context */
+    AVDictionary   *opts;
+    int             segment_frames;
+
+    pthread_t      *threads;
+    int          nb_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+
+    /* Segments are indexed by their sequence number modulo nb_segments. The
+     * segments first..queued-1 are in flight, the segment queued is being
+     * filled by the caller and the segment next is the next one picked up
+     * by a worker. */
+    EncSegment     *segments;
+    int          nb_segments;
+    unsigned        first;
+    unsigned        next;
+    unsigned        queued;
+    int             max_queued;
+
+    int             flushing;
+    int             exiting;
+};
+
+static int copy_settings(AVCodecContext *dst, const AVCodecContext *src)
+{
+    int ret = av_opt_copy(dst, src);
+    if (ret < 0)
+        return ret;
+
+    dst->framerate = src->framerate;
+
+#define COPY_MATRIX(m)                                                  \
+    if (src->m && !(dst->m = av_memdup(src->m, 64 * sizeof(*src->m)))) \
+        return AVERROR(ENOMEM);
+    COPY_MATRIX(intra_matrix);
+    COPY_MATRIX(inter_matrix);
+    COPY_MATRIX(chroma_intra_matrix);
+#undef COPY_MATRIX
+
+    if (src->rc_override_count) {
+        dst->rc_override = av_memdup(src->rc_override,
+                                     src->rc_override_count * sizeof(*src->rc_override));
+        if (!dst->rc_override)
+            return AVERROR(ENOMEM);
+        dst->rc_override_count = src->rc_override_count;
+    }
+
+    return 0;
+}
+
+static void segment_reset(EncSegment *seg)
+{
+    int i;
+
+    for (i = 0; i < seg->nb_frames; i++)
+        av_frame_free(&seg->frames[i]);
+    av_freep(&seg->frames);
+    seg->nb_frames = 0;
+
+    for (i = 0; i < seg->nb_pkts; i++)
+        av_packet_free(&seg->pkts[i]);
+    av_freep(&seg->pkts);
+    seg->nb_pkts   = 0;
+    seg->pkt_index = 0;
+
+    seg->done = 0;
+    seg->ret  = 0;
+}
+
+static int encode_segment(SegmentEncoder *se, EncSegment *seg)
+{
+    AVCodecContext *enc;
+    AVDictionary *opts = NULL;
+    AVPacket *pkt = NULL;
+    int i, ret;
+
+    enc = avcodec_alloc_context3(se->codec);
+    if (!enc)
+        return AVERROR(ENOMEM);
+
+    if ((ret = copy_settings(enc, se->settings)) < 0 ||
+        (ret = av_dict_copy(&opts, se->opts, 0)) < 0 ||
+        (ret = avcodec_open2(enc, se->codec, &opts)) < 0)
+        goto end;
+
+    for (i = 0; i <= seg->nb_frames; i++) {
+        ret = avcodec_send_frame(enc, i < seg->nb_frames ? seg->frames[i] : NULL);
+        if (ret < 0)
+            goto end;
+        if (i < seg->nb_frames)
+            av_frame_free(&seg->frames[i]);
+
+        while (1) {
+            if (!pkt && !(pkt = av_packet_alloc())) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            ret = avcodec_receive_packet(enc, pkt);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                break;
+            if (ret < 0)
+                goto end;
+            if ((ret = av_dynarray_add_nofree(&seg->pkts, &seg->nb_pkts, pkt)) < 0)
+                goto end;
+            pkt = NULL;
+        }
+    }
+    ret = 0;
+
+end:
+    av_packet_free(&pkt);
+    av_dict_free(&opts);
+    avcodec_free_context(&enc);
+    return ret;
+}
+
+static void *segment_worker(void *arg)
+{
+    SegmentEncoder *se = arg;
+    EncSegment *seg;
+    int ret;
+
+    pthread_mutex_lock(&se->lock);
+    while (1) {
+        while (!se->exiting && se->next == se->queued)
+            pthread_cond_wait(&se->cond, &se->lock);
+        if (se->exiting)
+            break;
+        seg = &se->segments[se->next++ % se->nb_segments];
+        pthread_mutex_unlock(&se->lock);
+
+        ret = encode_segment(se, seg);
+
+        pthread_mutex_lock(&se->lock);
+        seg->ret  = ret;
+        seg->done = 1;
+        pthread_cond_broadcast(&se->cond);
+    }
+    pthread_mutex_unlock(&se->lock);
+
+    return NULL;
+}
+
+/* Must be called with the lock held. */
+static void submit_segment(SegmentEncoder *se)
+{
+    se->queued++;
+    pthread_cond_broadcast(&se->cond);
+}
+
+int segenc_init(OutputStream *ost)
+{
+    AVCodecContext *enc_ctx = ost->enc_ctx;
+    AVDictionary *opts = NULL;
+    AVDictionaryEntry *e;
+    SegmentEncoder *se;
+    int64_t segment_size, max_segments;
+    int i, ret, gop_size, frame_size;
+
+    if (enc_ctx->codec_type != AVMEDIA_TYPE_VIDEO)
+        return 0;
+    if (enc_ctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2) ||
+        enc_ctx->hw_frames_ctx || enc_ctx->hw_device_ctx) {
+        av_log(NULL, AV_LOG_WARNING, "Segment-parallel encoding is not supported "
+               "with two-pass or hardware encoding, disabling it for output "
+               "stream #%d:%d.\n", ost->file_index, ost->index);
+        return 0;
+    }
+
+    se = av_mallocz(sizeof(*se));
+    if (!se)
+        return AVERROR(ENOMEM);
+    ost->segenc = se;
+
+    se->codec    = ost->enc;
+    se->settings = avcodec_alloc_context3(ost->enc);
+    if (!se->settings)
+        return AVERROR(ENOMEM);
+    if ((ret = copy_settings(se->settings, enc_ctx)) < 0 ||
+        (ret = av_dict_copy(&se->opts, ost->encoder_opts, 0)) < 0)
+        return ret;
+
+    /* The encoder options are only applied when the segment encoders are
+     * opened, apply them here as well to see the GOP size and rate control
+     * settings they end up with. */
+    if ((ret = av_dict_copy(&opts, se->opts, 0)) >= 0)
+        ret = av_opt_set_dict2(se->settings, &opts, AV_OPT_SEARCH_CHILDREN);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    if (se->settings->rc_max_rate || se->settings->rc_buffer_size)
+        av_log(NULL, AV_LOG_WARNING, "The rate control buffer is not carried "
+               "over from one segment to the next, the maxrate and bufsize "
+               "constraints of output stream #%d:%d may not be met at the "
+               "segment boundaries.\n", ost->file_index, ost->index);
+
+    /* Default to one GOP per segment, which places the keyframes as the
+     * encoder would by itself while keeping the number of buffered frames
+     * low. */
+    gop_size = se->settings->gop_size > 0 ? se->settings->gop_size : 250;
+    se->segment_frames = ost->enc_segment_frames > 0 ? ost->enc_segment_frames :
+                                                       gop_size;
+
+    /* Besides the segment being filled, every queued segment holds its raw
+     * frames until a worker has encoded them. Bound the number of queued
+     * segments by the memory limit, at the cost of fewer segments being
+     * encoded at the same time. */
+    frame_size = av_image_get_buffer_size(enc_ctx->pix_fmt, enc_ctx->width,
+                                          enc_ctx->height, 1);
+    if (frame_size < 0)
+        return frame_size;
+    segment_size = FFMAX((int64_t)frame_size * se->segment_frames, 1);
+    max_segments = ((int64_t)ost->enc_segment_max_memory << 20) / segment_size;
+    if (max_segments < 2) {
+        av_log(NULL, AV_LOG_ERROR, "Segments of %d frames of output stream "
+               "#%d:%d need %"PRId64" MiB each, at least two of them have to "
+               "fit into -enc_segment_max_memory %d.\n", se->segment_frames,
+               ost->file_index, ost->index, (segment_size >> 20) + 1,
+               ost->enc_segment_max_memory);
+        return AVERROR(EINVAL);
+    }
+
+    /* Keep every worker busy plus one segment waiting, besides the one being
+     * filled. */
+    se->max_queued = FFMIN(ost->enc_segments + 1, max_segments - 1);
+    se->nb_threads = FFMIN(ost->enc_segments, se->max_queued);
+    if (se->nb_threads < ost->enc_segments)
+        av_log(NULL, AV_LOG_WARNING, "Limiting output stream #%d:%d to %d "
+               "parallel segment encoders to stay within "
+               "-enc_segment_max_memory %d.\n", ost->file_index, ost->index,
+               se->nb_threads, ost->enc_segment_max_memory);
+    se->nb_segments = se->max_queued + 1;
+
+    /* Share the cores among the segment encoders instead of letting each
+     * of them start one thread per core. */
+    e = av_dict_get(se->opts, "threads", NULL, 0);
+    if (e && !strcmp(e->value, "auto"))
+        av_dict_set_int(&se->opts, "threads",
+                        FFMAX(1, av_cpu_count() / se->nb_threads), 0);
+
+    se->segments    = av_calloc(se->nb_segments, sizeof(*se->segments));
+    if (!se->segments)
+        return AVERROR(ENOMEM);
+
+    pthread_mutex_init(&se->lock, NULL);
+    pthread_cond_init(&se->cond, NULL);
+
+    se->threads = av_calloc(se->nb_threads, sizeof(*se->threads));
+    if (!se->threads)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < se->nb_threads; i++) {
+        if ((ret = pthread_create(&se->threads[i], NULL, segment_worker, se))) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+            se->nb_threads = i;
+            return AVERROR(ret);
+        }
+    }
+
+    av_log(NULL, AV_LOG_VERBOSE, "Encoding output stream #%d:%d in segments of "
+           "%d frames with %d encoders\n", ost->file_index, ost->index,
+           se->segment_frames, se->nb_threads);
+
+    return 0;
+}
+
+int segenc_send_frame(SegmentEncoder *se, const AVFrame *frame)
+{
+    EncSegment *seg;
+    AVFrame *clone;
+    int ret;
+
+    if (se->flushing)
+        return AVERROR_EOF;
+
+    /* The segment being filled is not visible to the workers until it is
+     * submitted, so it can be modified without taking the lock. */
+    seg = &se->segments[se->queued % se->nb_segments];
+
+    if (!frame) {
+        pthread_mutex_lock(&se->lock);
+        if (seg->nb_frames)
+            submit_segment(se);
+        se->flushing = 1;
+        pthread_mutex_unlock(&se->lock);
+        return 0;
+    }
+
+    clone = av_frame_clone(frame);
+    if (!clone)
+        return AVERROR(ENOMEM);
+    if ((ret = av_dynarray_add_nofree(&seg->frames, &seg->nb_frames, clone)) < 0) {
+        av_frame_free(&clone);
+        return ret;
+    }
+
+    if (seg->nb_frames == se->segment_frames) {
+        pthread_mutex_lock(&se->lock);
+        submit_segment(se);
+        pthread_mutex_unlock(&se->lock);
+    }
+
+    return 0;
+}
+
+int segenc_receive_packet(SegmentEncoder *se, AVPacket *pkt)
+{
+    EncSegment *seg;
+    int ret;
+
+    pthread_mutex_lock(&se->lock);
+    while (1) {
+        if (se->first == se->queued) {
+            ret = se->flushing ? AVERROR_EOF : AVERROR(EAGAIN);
+            break;
+        }
+
+        seg = &se->segments[se->first % se->nb_segments];
+        if (!seg->done) {
+            /* Only wait when no more segments can be queued. */
+            if (se->flushing || se->queued - se->first >= se->max_queued) {
+                pthread_cond_wait(&se->cond, &se->lock);
+                continue;
+            }
+            ret = AVERROR(EAGAIN);
+            break;
+        }
+
+        if (seg->ret < 0) {
+            ret = seg->ret;
+            break;
+        }
+        if (seg->pkt_index < seg->nb_pkts) {
+            av_packet_move_ref(pkt, seg->pkts[seg->pkt_index++]);
+            ret = 0;
+            break;
+        }
+
+        segment_reset(seg);
+        se->first++;
+    }
+    pthread_mutex_unlock(&se->lock);
+
+    return ret;
+}
+
+void segenc_free(SegmentEncoder **pse)
+{
+    SegmentEncoder *se = *pse;
+    int i;
+
+    if (!se)
+        return;
+
+    if (se->threads) {
+        pthread_mutex_lock(&se->lock);
+        se->exiting = 1;
+        pthread_cond_broadcast(&se->cond);
+        pthread_mutex_unlock(&se->lock);
+
+        for (i = 0; i < se->nb_threads; i++)
+            pthread_join(se->threads[i], NULL);
+        av_freep(&se->threads);
+
+        pthread_mutex_destroy(&se->lock);
+        pthread_cond_destroy(&se->cond);
+    }
+
+    if (se->segments)
+        for (i = 0; i < se->nb_segments; i++)
+            segment_reset(&se->segments[i]);
+    av_freep(&se->segments);
+
+    avcodec_free_context(&se->settings);
+    av_dict_free(&se->opts);
+    av_freep(pse);
+}
+
+#else
+
+int segenc_init(OutputStream *ost)
+{
+    av_log(NULL, AV_LOG_WARNING, "Segment-parallel encoding needs thread "
+           "support, disabling it for output stream #%d:%d.\n",
+           ost->file_index, ost->index);
+    return 0;
+}
+
+int segenc_send_frame(SegmentEncoder *se, const AVFrame *frame)
+{
+    return AVERROR(ENOSYS);
+}
+
+int segenc_receive_packet(SegmentEncoder *se, AVPacket *pkt)
+{
+    return AVERROR(ENOSYS);
+}
+
+void segenc_free(SegmentEncoder **pse)
+{
+}
+
+#endif /* HAVE_THREADS */
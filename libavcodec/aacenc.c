@@ -553,6 +553,41 @@ static void copy_input_samples(AACEncContext *s, const AVFrame *frame)
     }
 }
 
+typedef struct AACQuantSearchJob {
+    SingleChannelElement *sce;
+    enum RawDataBlockType tag;
+    int channel;
+    int bitres_alloc;
+} AACQuantSearchJob;
+
+/**
+ * Copy the state read by the quantizer search into a slice context,
+ * leaving its scratch buffers and band cost cache untouched.
+ */
+static void update_slice_context(AACEncContext *dst, const AACEncContext *src)
+{
+    memcpy(dst, src, offsetof(AACEncContext, qcoefs));
+    dst->abs_pow34   = src->abs_pow34;
+    dst->quant_bands = src->quant_bands;
+}
+
+static int search_quantizers_thread(AVCodecContext *avctx, void *arg,
+                                    int jobnr, int threadnr)
+{
+    AACEncContext *s = avctx->priv_data;
+    AACEncContext *ctx = s->slice_ctx[jobnr];
+    const AACQuantSearchJob *job = (const AACQuantSearchJob *)arg + jobnr;
+
+    ctx->cur_type           = job->tag;
+    ctx->cur_channel        = job->channel;
+    ctx->psy.bitres.alloc   = job->bitres_alloc;
+    if (ctx->options.pns && ctx->coder->mark_pns)
+        ctx->coder->mark_pns(ctx, avctx, job->sce);
+    ctx->coder->search_for_quantizers(avctx, ctx, job->sce, ctx->lambda);
+
+    return 0;
+}
+
 static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
                             const AVFrame *frame, int *got_packet_ptr)
 {
@@ -566,6 +601,8 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     int ms_mode = 0, is_mode = 0, tns_mode = 0, pred_mode = 0;
     int chan_el_counter[4];
     FFPsyWindowInfo windows[AAC_MAX_CHANNELS];
+    AACQuantSearchJob jobs[AAC_MAX_CHANNELS];
+    int threaded;
 
     /* add current frame to queue */
     if (frame) {
@@ -680,6 +717,12 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
     }
     if ((ret = ff_alloc_packet(avctx, avpkt, 8192 * s->channels)) < 0)
         return ret;
+
+    /* The quantizer search of the first frame settles the psychoacoustic
+     * cutoff read by the analysis of the following elements, so that frame
+     * is always coded in element order. */
+    threaded = s->nb_slice_ctx && s->lambda_count;
+
     frame_bits = its = 0;
     do {
         init_put_bits(&s->pb, avpkt->data, avpkt->size);
@@ -698,8 +741,6 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
             cpe->common_window = 0;
             memset(cpe->is_mask, 0, sizeof(cpe->is_mask));
             memset(cpe->ms_mask, 0, sizeof(cpe->ms_mask));
-            put_bits(&s->pb, 3, tag);
-            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             for (ch = 0; ch < chans; ch++) {
                 sce = &cpe->ch[ch];
                 coeffs[ch] = sce->coeffs;
@@ -724,10 +765,36 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
             s->cur_type = tag;
             for (ch = 0; ch < chans; ch++) {
                 s->cur_channel = start_ch + ch;
+                if (threaded) {
+                    jobs[s->cur_channel].sce          = &cpe->ch[ch];
+                    jobs[s->cur_channel].tag          = tag;
+                    jobs[s->cur_channel].channel      = s->cur_channel;
+                    jobs[s->cur_channel].bitres_alloc = s->psy.bitres.alloc;
+                    continue;
+                }
                 if (s->options.pns && s->coder->mark_pns)
                     s->coder->mark_pns(s, avctx, &cpe->ch[ch]);
                 s->coder->search_for_quantizers(avctx, s, &cpe->ch[ch], s->lambda);
             }
+            start_ch += chans;
+        }
+
+        /* The searches of all channels are independent of each other. */
+        if (threaded) {
+            for (i = 0; i < s->nb_slice_ctx; i++)
+                update_slice_context(s->slice_ctx[i], s);
+            avctx->execute2(avctx, search_quantizers_thread, jobs, NULL, s->channels);
+        }
+
+        start_ch = 0;
+        for (i = 0; i < s->chan_map[0]; i++) {
+            FFPsyWindowInfo* wi = windows + start_ch;
+            tag      = s->chan_map[i+1];
+            chans    = tag == TYPE_CPE ? 2 : 1;
+            cpe      = &s->cpe[i];
+            s->cur_type = tag;
+            put_bits(&s->pb, 3, tag);
+            put_bits(&s->pb, 4, chan_el_counter[tag]++);
             if (chans > 1
                 && wi[0].window_type[0] == wi[1].window_type[0]
                 && wi[0].window_shape   == wi[1].window_shape) {
@@ -899,6 +966,7 @@ static int aac_encode_frame(AVCodecContext *avctx, AVPacket *avpkt,
 static av_cold int aac_encode_end(AVCodecContext *avctx)
 {
     AACEncContext *s = avctx->priv_data;
+    int i;
 
     av_log(avctx, AV_LOG_INFO, "Qavg: %.3f\n", s->lambda_count ? s->lambda_sum / s->lambda_count : NAN);
 
@@ -911,6 +979,9 @@ static av_cold int aac_encode_end(AVCodecContext *avctx)
     av_freep(&s->buffer.samples);
     av_freep(&s->cpe);
     av_freep(&s->fdsp);
+    for (i = 0; i < s->nb_slice_ctx; i++)
+        av_freep(&s->slice_ctx[i]);
+    av_freep(&s->slice_ctx);
     ff_af_queue_close(&s->afq);
     return 0;
 }
@@ -944,6 +1015,18 @@ static av_cold int alloc_buffers(AVCodecContext *avctx, AACEncContext *s)
     for(ch = 0; ch < s->channels; ch++)
         s->planar_samples[ch] = s->buffer.samples + 3 * 1024 * ch;
 
+    if (avctx->active_thread_type & FF_THREAD_SLICE && avctx->thread_count > 1 &&
+        s->channels > 1) {
+        int i;
+        if (!FF_ALLOCZ_TYPED_ARRAY(s->slice_ctx, s->channels))
+            return AVERROR(ENOMEM);
+        for (i = 0; i < s->channels; i++) {
+            if (!(s->slice_ctx[i] = av_mallocz(sizeof(*s->slice_ctx[i]))))
+                return AVERROR(ENOMEM);
+            s->nb_slice_ctx++;
+        }
+    }
+
     return 0;
 }
 
@@ -1145,7 +1228,8 @@ const AVCodec ff_aac_encoder = {
     .defaults       = aac_encode_defaults,
     .supported_samplerates = ff_mpeg4audio_sample_rates,
     .caps_internal  = FF_CODEC_CAP_INIT_THREADSAFE | FF_CODEC_CAP_INIT_CLEANUP,
-    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY,
+    .capabilities   = AV_CODEC_CAP_SMALL_LAST_FRAME | AV_CODEC_CAP_DELAY |
+                      AV_CODEC_CAP_SLICE_THREADS,
     .sample_fmts    = (const enum AVSampleFormat[]){ AV_SAMPLE_FMT_FLTP,
                                                      AV_SAMPLE_FMT_NONE },
     .priv_class     = &aacenc_class,
@@ -407,6 +407,8 @@ typedef struct AACEncContext {
     enum RawDataBlockType cur_type;              ///< channel group type cur_channel belongs to
 
     AudioFrameQueue afq;
+
+    /* The fields below are scratch state private to each slice context. */
     DECLARE_ALIGNED(16, int,   qcoefs)[96];      ///< quantized coefficients
     DECLARE_ALIGNED(32, float, scoefs)[1024];    ///< scaled coefficients
 
@@ -421,6 +423,9 @@ typedef struct AACEncContext {
     struct {
         float *samples;
     } buffer;
+
+    struct AACEncContext **slice_ctx;            ///< per-channel contexts for the threaded quantizer search
+    int nb_slice_ctx;
 } AACEncContext;
 
 void ff_aac_dsp_init_x86(AACEncContext *s);
@@ -33,11 +33,8 @@
 #include "thread.h"
 
 #define MAX_THREADS 64
-/* There can be as many as MAX_THREADS + 1 outstanding tasks.
- * An additional + 1 is needed so that one can distinguish
- * the case of zero and MAX_THREADS + 1 outstanding tasks modulo
- * the number of buffers. */
-#define BUFFER_SIZE (MAX_THREADS + 2)
+/* Upper bound on the number of frames buffered in GOP mode. */
+#define MAX_GOP_TASKS 4096
 
 typedef struct{
     AVFrame  *indata;
@@ -46,6 +43,11 @@ typedef struct{
     int       finished;
 } Task;
 
+typedef struct{
+    AVCodecContext *avctx;
+    uint64_t next_task;     /* sequence number of the next task to encode */
+} GOPWorker;
+
 typedef struct{
     AVCodecContext *parent_avctx;
     pthread_mutex_t buffer_mutex;
@@ -54,8 +56,13 @@ typedef struct{
     pthread_cond_t task_fifo_cond;
 
     unsigned pthread_init_cnt;
+    /* There can be as many as max_queued + 1 outstanding tasks.
+     * An additional + 1 is needed so that one can distinguish
+     * the case of zero and max_queued + 1 outstanding tasks modulo
+     * the number of buffers. */
+    unsigned max_queued;
     unsigned max_tasks;
-    Task tasks[BUFFER_SIZE];
+    Task *tasks;
     pthread_mutex_t finished_task_mutex; /* Guards tasks[i].finished */
     pthread_cond_t finished_task_cond;
 
@@ -63,6 +70,13 @@ typedef struct{
     unsigned task_index;
     unsigned finished_task_index;
 
+    /* GOP mode: each run of gop_size tasks is encoded by the same worker,
+     * the workers taking the runs in turn. */
+    int gop_size;
+    int nb_gop_workers;
+    uint64_t nb_tasks;              /* number of tasks submitted so far */
+    GOPWorker gop_worker[MAX_THREADS];
+
     pthread_t worker[MAX_THREADS];
     atomic_int exit;
 } ThreadContext;
@@ -73,15 +87,45 @@ DEFINE_OFFSET_ARRAY(ThreadContext, thread_ctx, pthread_init_cnt,
                     (OFF(task_fifo_cond), OFF(finished_task_cond)));
 #undef OFF
 
+static void encode_task(AVCodecContext *avctx, ThreadContext *c, Task *task)
+{
+    AVFrame  *frame = task->indata;
+    AVPacket *pkt   = task->outdata;
+    int got_packet = 0, ret;
+
+    ret = avctx->codec->encode2(avctx, pkt, frame, &got_packet);
+    if(got_packet) {
+        int ret2 = av_packet_make_refcounted(pkt);
+        if (ret >= 0 && ret2 < 0)
+            ret = ret2;
+        pkt->pts = pkt->dts = frame->pts;
+    } else {
+        pkt->data = NULL;
+        pkt->size = 0;
+    }
+    pthread_mutex_lock(&c->buffer_mutex);
+    av_frame_unref(frame);
+    pthread_mutex_unlock(&c->buffer_mutex);
+    pthread_mutex_lock(&c->finished_task_mutex);
+    task->return_code = ret;
+    task->finished    = 1;
+    pthread_cond_signal(&c->finished_task_cond);
+    pthread_mutex_unlock(&c->finished_task_mutex);
+}
+
+static void close_thread_avctx(AVCodecContext *avctx, ThreadContext *c)
+{
+    pthread_mutex_lock(&c->buffer_mutex);
+    avcodec_close(avctx);
+    pthread_mutex_unlock(&c->buffer_mutex);
+    av_freep(&avctx);
+}
+
 static void * attribute_align_arg worker(void *v){
     AVCodecContext *avctx = v;
     ThreadContext *c = avctx->internal->frame_thread_encoder;
 
     while (!atomic_load(&c->exit)) {
-        int got_packet = 0, ret;
-        AVPacket *pkt;
-        AVFrame *frame;
-        Task *task;
         unsigned task_index;
 
         pthread_mutex_lock(&c->task_fifo_mutex);
@@ -99,46 +143,73 @@ static void * attribute_align_arg worker(void *v){
          * different indices, ergo each worker thread owns its element
          * of c->tasks with the exception of finished, which is shared
          * with the main thread and guarded by finished_task_mutex. */
-        task  = &c->tasks[task_index];
-        frame = task->indata;
-        pkt   = task->outdata;
-
-        ret = avctx->codec->encode2(avctx, pkt, frame, &got_packet);
-        if(got_packet) {
-            int ret2 = av_packet_make_refcounted(pkt);
-            if (ret >= 0 && ret2 < 0)
-                ret = ret2;
-            pkt->pts = pkt->dts = frame->pts;
-        } else {
-            pkt->data = NULL;
-            pkt->size = 0;
-        }
-        pthread_mutex_lock(&c->buffer_mutex);
-        av_frame_unref(frame);
-        pthread_mutex_unlock(&c->buffer_mutex);
-        pthread_mutex_lock(&c->finished_task_mutex);
-        task->return_code = ret;
-        task->finished    = 1;
-        pthread_cond_signal(&c->finished_task_cond);
-        pthread_mutex_unlock(&c->finished_task_mutex);
+        encode_task(avctx, c, &c->tasks[task_index]);
     }
 end:
-    pthread_mutex_lock(&c->buffer_mutex);
-    avcodec_close(avctx);
-    pthread_mutex_unlock(&c->buffer_mutex);
-    av_freep(&avctx);
+    close_thread_avctx(avctx, c);
     return NULL;
 }
 
+static void * attribute_align_arg gop_worker(void *v){
+    GOPWorker *w = v;
+    AVCodecContext *avctx = w->avctx;
+    ThreadContext *c = avctx->internal->frame_thread_encoder;
+
+    while (1) {
+        uint64_t n;
+
+        pthread_mutex_lock(&c->task_fifo_mutex);
+        while (c->nb_tasks <= w->next_task && !atomic_load(&c->exit))
+            pthread_cond_wait(&c->task_fifo_cond, &c->task_fifo_mutex);
+        pthread_mutex_unlock(&c->task_fifo_mutex);
+        if (atomic_load(&c->exit))
+            break;
+
+        /* Tasks are only ever given to the worker owning their GOP, so the
+         * same ownership rules as in worker() apply. */
+        n = w->next_task++;
+        encode_task(avctx, c, &c->tasks[n % c->max_tasks]);
+        if (w->next_task % c->gop_size == 0)
+            w->next_task += (uint64_t)(c->nb_gop_workers - 1) * c->gop_size;
+    }
+
+    close_thread_avctx(avctx, c);
+    return NULL;
+}
+
+/**
+ * Check whether the encoder can be threaded by encoding each GOP on its own
+ * instance, see FF_CODEC_CAP_GOP_THREADS.
+ */
+static int gop_threads_supported(AVCodecContext *avctx)
+{
+    if (!(avctx->codec->caps_internal & FF_CODEC_CAP_GOP_THREADS) ||
+        avctx->thread_type != FF_THREAD_FRAME || avctx->gop_size <= 0)
+        return 0;
+
+    if (avctx->flags & (AV_CODEC_FLAG_PASS1 | AV_CODEC_FLAG_PASS2) ||
+        avctx->rc_buffer_size) {
+        av_log(avctx, AV_LOG_WARNING,
+               "Frame threading is not supported with two-pass encoding or "
+               "a rate control buffer, disabling it.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
 av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
 {
     int i=0;
     ThreadContext *c;
     AVCodecContext *thread_avctx = NULL;
-    int ret;
+    int thread_count = avctx->thread_count;
+    int gop_mode, ret;
 
-    if(   !(avctx->thread_type & FF_THREAD_FRAME)
-       || !(avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+    if (!(avctx->thread_type & FF_THREAD_FRAME))
+        return 0;
+    gop_mode = !(avctx->codec->capabilities & AV_CODEC_CAP_FRAME_THREADS);
+    if (gop_mode && !gop_threads_supported(avctx))
         return 0;
 
     if(   !avctx->thread_count
@@ -181,12 +252,22 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
         avctx->thread_count = FFMIN(avctx->thread_count, MAX_THREADS);
     }
 
-    if(avctx->thread_count <= 1)
-        return 0;
-
     if(avctx->thread_count > MAX_THREADS)
         return AVERROR(EINVAL);
 
+    /* Every worker needs a whole GOP of frames buffered. */
+    if (gop_mode && avctx->thread_count > 1 &&
+        avctx->gop_size > MAX_GOP_TASKS / avctx->thread_count) {
+        int nb_threads = FFMAX(MAX_GOP_TASKS / avctx->gop_size, 1);
+        av_log(avctx, AV_LOG_WARNING, "GOP size %d too large for frame "
+               "threading with %d threads, using %d threads\n",
+               avctx->gop_size, avctx->thread_count, nb_threads);
+        avctx->thread_count = nb_threads;
+    }
+
+    if(avctx->thread_count <= 1)
+        return 0;
+
     av_assert0(!avctx->internal->frame_thread_encoder);
     c = avctx->internal->frame_thread_encoder = av_mallocz(sizeof(ThreadContext));
     if(!c)
@@ -199,7 +280,19 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
         goto fail;
     atomic_init(&c->exit, 0);
 
-    c->max_tasks = avctx->thread_count + 2;
+    if (gop_mode) {
+        /* Buffer enough frames for every worker to get a GOP to encode. */
+        c->gop_size       = avctx->gop_size;
+        c->nb_gop_workers = avctx->thread_count;
+        c->max_queued     = avctx->gop_size * avctx->thread_count;
+    } else
+        c->max_queued = avctx->thread_count;
+    c->max_tasks = c->max_queued + 2;
+    c->tasks = av_calloc(c->max_tasks, sizeof(*c->tasks));
+    if (!c->tasks) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
     for (unsigned j = 0; j < c->max_tasks; j++) {
         if (!(c->tasks[j].indata  = av_frame_alloc()) ||
             !(c->tasks[j].outdata = av_packet_alloc())) {
@@ -235,7 +328,23 @@ av_cold int ff_frame_thread_encoder_init(AVCodecContext *avctx)
             goto fail;
         av_assert0(!thread_avctx->internal->frame_thread_encoder);
         thread_avctx->internal->frame_thread_encoder = c;
-        if ((ret = pthread_create(&c->worker[i], NULL, worker, thread_avctx))) {
+        if (gop_mode && !i && thread_avctx->has_b_frames) {
+            av_log(avctx, AV_LOG_VERBOSE, "Frame threading is only supported "
+                   "by this encoder without delay, disabling it.\n");
+            avcodec_close(thread_avctx);
+            av_freep(&thread_avctx);
+            avctx->thread_count = 0;
+            ff_frame_thread_encoder_free(avctx);
+            avctx->thread_count = thread_count;
+            return 0;
+        }
+        if (gop_mode) {
+            c->gop_worker[i].avctx     = thread_avctx;
+            c->gop_worker[i].next_task = (uint64_t)i * c->gop_size;
+            ret = pthread_create(&c->worker[i], NULL, gop_worker, &c->gop_worker[i]);
+        } else
+            ret = pthread_create(&c->worker[i], NULL, worker, thread_avctx);
+        if (ret) {
             ret = AVERROR(ret);
             goto fail;
         }
@@ -270,10 +379,11 @@ av_cold void ff_frame_thread_encoder_free(AVCodecContext *avctx)
             pthread_join(c->worker[i], NULL);
     }
 
-    for (unsigned i = 0; i < c->max_tasks; i++) {
+    for (unsigned i = 0; c->tasks && i < c->max_tasks; i++) {
         av_frame_free(&c->tasks[i].indata);
         av_packet_free(&c->tasks[i].outdata);
     }
+    av_freep(&c->tasks);
 
     ff_pthread_free(c, thread_ctx_offsets);
     av_freep(&avctx->internal->frame_thread_encoder);
@@ -288,11 +398,18 @@ int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
     av_assert1(!*got_packet_ptr);
 
     if(frame){
+        /* Start every GOP with a keyframe, as it is encoded from scratch. */
+        if (c->gop_size && !(c->nb_tasks % c->gop_size))
+            frame->pict_type = AV_PICTURE_TYPE_I;
         av_frame_move_ref(c->tasks[c->task_index].indata, frame);
 
         pthread_mutex_lock(&c->task_fifo_mutex);
         c->task_index = (c->task_index + 1) % c->max_tasks;
-        pthread_cond_signal(&c->task_fifo_cond);
+        c->nb_tasks++;
+        if (c->gop_size)
+            pthread_cond_broadcast(&c->task_fifo_cond);
+        else
+            pthread_cond_signal(&c->task_fifo_cond);
         pthread_mutex_unlock(&c->task_fifo_mutex);
     }
 
@@ -302,7 +419,7 @@ int ff_thread_video_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
      * because it is only ever changed by the main thread. */
     if (c->task_index == c->finished_task_index ||
         (frame && !outtask->finished &&
-         (c->task_index - c->finished_task_index + c->max_tasks) % c->max_tasks <= avctx->thread_count)) {
+         (c->task_index - c->finished_task_index + c->max_tasks) % c->max_tasks <= c->max_queued)) {
             pthread_mutex_unlock(&c->finished_task_mutex);
             return 0;
         }
@@ -896,6 +896,7 @@ static int hls_slice_header(HEVCContext *s)
     }
 
     sh->num_entry_point_offsets = 0;
+    s->enable_parallel_tiles    = 0;
     if (s->ps.pps->tiles_enabled_flag || s->ps.pps->entropy_coding_sync_enabled_flag) {
         unsigned num_entry_point_offsets = get_ue_golomb_long(gb);
         // It would be possible to bound this tighter but this here is simpler
@@ -930,8 +931,13 @@ static int hls_slice_header(HEVCContext *s)
                 sh->entry_point_offset[i] = val + 1; // +1; // +1 to get the size
             }
             if (s->threads_number > 1 && (s->ps.pps->num_tile_rows > 1 || s->ps.pps->num_tile_columns > 1)) {
-                s->enable_parallel_tiles = 0; // TODO: you can enable tiles in parallel here
-                s->threads_number = 1;
+                if (s->parallel_tiles && !s->ps.pps->entropy_coding_sync_enabled_flag)
+                    s->enable_parallel_tiles = 1;
+                else {
+                    // tiles combined with WPP are decoded by a single thread
+                    s->enable_parallel_tiles = 0;
+                    s->threads_number = 1;
+                }
             } else
                 s->enable_parallel_tiles = 0;
         } else
@@ -2575,6 +2581,11 @@ static int hls_decode_entry_wpp(AVCodecContext *avctxt, void *input_ctb_row, int
         if (ret < 0)
             goto error;
         hls_sao_param(s, x_ctb >> s->ps.sps->log2_ctb_size, y_ctb >> s->ps.sps->log2_ctb_size);
+
+        s->deblock[ctb_addr_rs].beta_offset = s->sh.beta_offset;
+        s->deblock[ctb_addr_rs].tc_offset   = s->sh.tc_offset;
+        s->filter_slice_edges[ctb_addr_rs]  = s->sh.slice_loop_filter_across_slices_enabled_flag;
+
         more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->ps.sps->log2_ctb_size, 0);
 
         if (more_data < 0) {
@@ -2616,6 +2627,169 @@ error:
     return ret;
 }
 
+static int hls_decode_entry_tile(AVCodecContext *avctxt, void *input_tile, int job, int self_id)
+{
+    HEVCContext *s1 = avctxt->priv_data, *s;
+    HEVCLocalContext *lc;
+    int more_data   = 1;
+    int *tile_p     = input_tile;
+    int tile_id     = tile_p[job];
+    int ctb_addr_ts = s1->ps.pps->ctb_addr_rs_to_ts[s1->ps.pps->tile_pos_rs[tile_id]];
+    int ctb_addr_rs;
+    int ret;
+
+    s = s1->sList[self_id];
+    lc = s->HEVClc;
+
+    /* The first job is always run with self_id 0, whose local context holds
+     * the slice data following the header. */
+    if (job) {
+        ret = init_get_bits8(&lc->gb, s->data + s->sh.offset[job - 1], s->sh.size[job - 1]);
+        if (ret < 0)
+            return ret;
+        ff_init_cabac_decoder(&lc->cc, s->data + s->sh.offset[job - 1], s->sh.size[job - 1]);
+    } else
+        ctb_addr_ts = s->ps.pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs];
+
+    while (more_data && ctb_addr_ts < s->ps.sps->ctb_size &&
+           s->ps.pps->tile_id[ctb_addr_ts] == tile_id) {
+        int x_ctb, y_ctb;
+
+        ctb_addr_rs = s->ps.pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+        x_ctb = (ctb_addr_rs % s->ps.sps->ctb_width) << s->ps.sps->log2_ctb_size;
+        y_ctb = (ctb_addr_rs / s->ps.sps->ctb_width) << s->ps.sps->log2_ctb_size;
+        hls_decode_neighbour(s, x_ctb, y_ctb, ctb_addr_ts);
+
+        ret = ff_hevc_cabac_init(s, ctb_addr_ts, 0);
+        if (ret < 0)
+            goto error;
+
+        hls_sao_param(s, x_ctb >> s->ps.sps->log2_ctb_size, y_ctb >> s->ps.sps->log2_ctb_size);
+
+        s->deblock[ctb_addr_rs].beta_offset = s->sh.beta_offset;
+        s->deblock[ctb_addr_rs].tc_offset   = s->sh.tc_offset;
+        s->filter_slice_edges[ctb_addr_rs]  = s->sh.slice_loop_filter_across_slices_enabled_flag;
+
+        more_data = hls_coding_quadtree(s, x_ctb, y_ctb, s->ps.sps->log2_ctb_size, 0);
+        if (more_data < 0) {
+            ret = more_data;
+            goto error;
+        }
+
+        ctb_addr_ts++;
+    }
+
+    if (job == s->sh.num_entry_point_offsets) {
+        /* Report which thread decoded the last tile, a following dependent
+         * slice segment continues with its entropy coder state. */
+        tile_p[job] = self_id;
+        return ctb_addr_ts;
+    }
+    if (!more_data) {
+        av_log(s->avctx, AV_LOG_ERROR, "Slice segment ends before its last tile\n");
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+error:
+    s->tab_slice_address[ctb_addr_rs] = -1;
+    return ret;
+}
+
+/**
+ * Decode the tiles of a slice segment in parallel, then run the in-loop
+ * filters over it in decoding order. The filters of a CTB read its
+ * neighbours, which may belong to another tile, so they cannot run while
+ * the tiles are being decoded.
+ */
+static int hls_slice_data_tiles(HEVCContext *s, int *arg, int *ret)
+{
+    const HEVCPPS *pps  = s->ps.pps;
+    const HEVCSPS *sps  = s->ps.sps;
+    int ctb_size        = 1 << sps->log2_ctb_size;
+    int start_ts        = pps->ctb_addr_rs_to_ts[s->sh.slice_ctb_addr_rs];
+    int first_tile      = pps->tile_id[start_ts];
+    int nb_tiles        = s->sh.num_entry_point_offsets + 1;
+    HEVCLocalContext *lc = s->HEVClc, *lc_last;
+    int end_ts, ctb_addr_ts, first_qp_group, i;
+    int x_ctb = 0, y_ctb = 0;
+
+    if (first_tile + nb_tiles > pps->num_tile_columns * pps->num_tile_rows) {
+        av_log(s->avctx, AV_LOG_ERROR, "Too many tiles in slice segment (%d %d)\n",
+               first_tile, nb_tiles);
+        return AVERROR_INVALIDDATA;
+    }
+    if (s->sh.dependent_slice_segment_flag) {
+        int prev_rs;
+        if (!start_ts) {
+            av_log(s->avctx, AV_LOG_ERROR, "Impossible initial tile.\n");
+            return AVERROR_INVALIDDATA;
+        }
+        prev_rs = pps->ctb_addr_ts_to_rs[start_ts - 1];
+        if (s->tab_slice_address[prev_rs] != s->sh.slice_addr) {
+            av_log(s->avctx, AV_LOG_ERROR, "Previous slice segment missing\n");
+            return AVERROR_INVALIDDATA;
+        }
+    }
+
+    end_ts = first_tile + nb_tiles < pps->num_tile_columns * pps->num_tile_rows ?
+             pps->ctb_addr_rs_to_ts[pps->tile_pos_rs[first_tile + nb_tiles]] :
+             sps->ctb_size;
+
+    /* Mark the whole slice segment beforehand, so that the neighbour
+     * availability derived while decoding does not depend on the progress
+     * of the other tiles. */
+    for (ctb_addr_ts = start_ts; ctb_addr_ts < end_ts; ctb_addr_ts++)
+        s->tab_slice_address[pps->ctb_addr_ts_to_rs[ctb_addr_ts]] = s->sh.slice_addr;
+
+    for (i = 0; i < nb_tiles; i++) {
+        arg[i] = first_tile + i;
+        ret[i] = 0;
+    }
+
+    s->avctx->execute2(s->avctx, hls_decode_entry_tile, arg, ret, nb_tiles);
+
+    for (i = 0; i < nb_tiles; i++)
+        if (ret[i] < 0)
+            return ret[i];
+    end_ts         = ret[nb_tiles - 1];
+    lc_last        = s->HEVClcList[arg[nb_tiles - 1]];
+    first_qp_group = lc_last->first_qp_group;
+
+    for (ctb_addr_ts = start_ts; ctb_addr_ts < end_ts; ctb_addr_ts++) {
+        int ctb_addr_rs = pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+
+        x_ctb = (ctb_addr_rs % sps->ctb_width) << sps->log2_ctb_size;
+        y_ctb = (ctb_addr_rs / sps->ctb_width) << sps->log2_ctb_size;
+        hls_decode_neighbour(s, x_ctb, y_ctb, ctb_addr_ts);
+        ff_hevc_deblocking_boundary_strengths_tiles(s, x_ctb, y_ctb);
+    }
+
+    /* The pass above sets first_qp_group again at every tile start, so the
+     * state a following dependent slice segment continues from is restored
+     * only after it. */
+    if (lc_last != lc) {
+        memcpy(lc->cabac_state, lc_last->cabac_state, HEVC_CONTEXTS);
+        memcpy(lc->stat_coeff,  lc_last->stat_coeff,  HEVC_STAT_COEFFS);
+        lc->qp_y     = lc_last->qp_y;
+        lc->qPy_pred = lc_last->qPy_pred;
+    }
+    lc->first_qp_group = first_qp_group;
+
+    for (ctb_addr_ts = start_ts; ctb_addr_ts < end_ts; ctb_addr_ts++) {
+        int ctb_addr_rs = pps->ctb_addr_ts_to_rs[ctb_addr_ts];
+
+        x_ctb = (ctb_addr_rs % sps->ctb_width) << sps->log2_ctb_size;
+        y_ctb = (ctb_addr_rs / sps->ctb_width) << sps->log2_ctb_size;
+        ff_hevc_hls_filters(s, x_ctb, y_ctb, ctb_size);
+    }
+
+    if (x_ctb + ctb_size >= sps->width &&
+        y_ctb + ctb_size >= sps->height)
+        ff_hevc_hls_filter(s, x_ctb, y_ctb, ctb_size);
+
+    return end_ts;
+}
+
 static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
 {
     const uint8_t *data = nal->data;
@@ -2633,7 +2807,8 @@ static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
         return AVERROR(ENOMEM);
     }
 
-    if (s->sh.slice_ctb_addr_rs + s->sh.num_entry_point_offsets * s->ps.sps->ctb_width >= s->ps.sps->ctb_width * s->ps.sps->ctb_height) {
+    if (!s->enable_parallel_tiles &&
+        s->sh.slice_ctb_addr_rs + s->sh.num_entry_point_offsets * s->ps.sps->ctb_width >= s->ps.sps->ctb_width * s->ps.sps->ctb_height) {
         av_log(s->avctx, AV_LOG_ERROR, "WPP ctb addresses are wrong (%d %d %d %d)\n",
             s->sh.slice_ctb_addr_rs, s->sh.num_entry_point_offsets,
             s->ps.sps->ctb_width, s->ps.sps->ctb_height
@@ -2709,6 +2884,11 @@ static int hls_slice_data_wpp(HEVCContext *s, const H2645NAL *nal)
         ret[i] = 0;
     }
 
+    if (s->enable_parallel_tiles) {
+        res = hls_slice_data_tiles(s, arg, ret);
+        goto error;
+    }
+
     if (s->ps.pps->entropy_coding_sync_enabled_flag)
         s->avctx->execute2(s->avctx, hls_decode_entry_wpp, arg, ret, s->sh.num_entry_point_offsets + 1);
 
@@ -3845,6 +4025,8 @@ static const AVOption options[] = {
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
     { "strict-displaywin", "stricly apply default display window size", OFFSET(apply_defdispwin),
         AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
+    { "parallel_tiles", "Decode the tiles of a slice segment in parallel with slice threads", OFFSET(parallel_tiles),
+        AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, PAR },
     { NULL },
 };
 
@@ -84,6 +84,14 @@
  * internal logic derive them from AVCodecInternal.last_pkt_props.
  */
 #define FF_CODEC_CAP_SETS_FRAME_PROPS       (1 << 8)
+/**
+ * The encoder has inter-frame dependencies, but can be frame-threaded by
+ * encoding each GOP on its own instance of the encoder, as long as it outputs
+ * a packet for every frame without delay and starts a new GOP on a frame
+ * flagged with AV_PICTURE_TYPE_I. This is only used when frame threading
+ * is the only threading method requested.
+ */
+#define FF_CODEC_CAP_GOP_THREADS            (1 << 9)
 
 /**
  * AVCodec.codec_tags termination value
@@ -30,6 +30,8 @@
  * MJPEG decoder.
  */
 
+#include <stdatomic.h>
+
 #include "libavutil/display.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/avassert.h"
@@ -784,10 +786,11 @@ int ff_mjpeg_decode_sof(MJpegDecodeContext *s)
     return 0;
 }
 
-static inline int mjpeg_decode_dc(MJpegDecodeContext *s, int dc_index)
+static inline int mjpeg_decode_dc(MJpegDecodeContext *s, GetBitContext *gb,
+                                  int dc_index)
 {
     int code;
-    code = get_vlc2(&s->gb, s->vlcs[0][dc_index].table, 9, 2);
+    code = get_vlc2(gb, s->vlcs[0][dc_index].table, 9, 2);
     if (code < 0 || code > 16) {
         av_log(s->avctx, AV_LOG_WARNING,
                "mjpeg_decode_dc: bad vlc: %d:%d (%p)\n",
@@ -796,47 +799,48 @@ static inline int mjpeg_decode_dc(MJpegDecodeContext *s, int dc_index)
     }
 
     if (code)
-        return get_xbits(&s->gb, code);
+        return get_xbits(gb, code);
     else
         return 0;
 }
 
 /* decode block and dequantize */
-static int decode_block(MJpegDecodeContext *s, int16_t *block, int component,
+static int decode_block(MJpegDecodeContext *s, GetBitContext *gb,
+                        int *last_dc, int16_t *block,
                         int dc_index, int ac_index, uint16_t *quant_matrix)
 {
     int code, i, j, level, val;
 
     /* DC coef */
-    val = mjpeg_decode_dc(s, dc_index);
+    val = mjpeg_decode_dc(s, gb, dc_index);
     if (val == 0xfffff) {
         av_log(s->avctx, AV_LOG_ERROR, "error dc\n");
         return AVERROR_INVALIDDATA;
     }
-    val = val * (unsigned)quant_matrix[0] + s->last_dc[component];
+    val = val * (unsigned)quant_matrix[0] + *last_dc;
     val = av_clip_int16(val);
-    s->last_dc[component] = val;
+    *last_dc = val;
     block[0] = val;
     /* AC coefs */
     i = 0;
-    {OPEN_READER(re, &s->gb);
+    {OPEN_READER(re, gb);
     do {
-        UPDATE_CACHE(re, &s->gb);
-        GET_VLC(code, re, &s->gb, s->vlcs[1][ac_index].table, 9, 2);
+        UPDATE_CACHE(re, gb);
+        GET_VLC(code, re, gb, s->vlcs[1][ac_index].table, 9, 2);
 
         i += ((unsigned)code) >> 4;
             code &= 0xf;
         if (code) {
             if (code > MIN_CACHE_BITS - 16)
-                UPDATE_CACHE(re, &s->gb);
+                UPDATE_CACHE(re, gb);
 
             {
-                int cache = GET_CACHE(re, &s->gb);
+                int cache = GET_CACHE(re, gb);
                 int sign  = (~cache) >> 31;
                 level     = (NEG_USR32(sign ^ cache,code) ^ sign) - sign;
             }
 
-            LAST_SKIP_BITS(re, &s->gb, code);
+            LAST_SKIP_BITS(re, gb, code);
 
             if (i > 63) {
                 av_log(s->avctx, AV_LOG_ERROR, "error count: %d\n", i);
@@ -846,7 +850,7 @@ static int decode_block(MJpegDecodeContext *s, int16_t *block, int component,
             block[j] = level * quant_matrix[i];
         }
     } while (i < 63);
-    CLOSE_READER(re, &s->gb);}
+    CLOSE_READER(re, gb);}
 
     return 0;
 }
@@ -857,7 +861,7 @@ static int decode_dc_progressive(MJpegDecodeContext *s, int16_t *block,
 {
     unsigned val;
     s->bdsp.clear_block(block);
-    val = mjpeg_decode_dc(s, dc_index);
+    val = mjpeg_decode_dc(s, &s->gb, dc_index);
     if (val == 0xfffff) {
         av_log(s->avctx, AV_LOG_ERROR, "error dc\n");
         return AVERROR_INVALIDDATA;
@@ -1147,7 +1151,7 @@ static int ljpeg_decode_rgb_scan(MJpegDecodeContext *s, int nb_components, int p
                 topleft[i] = top[i];
                 top[i]     = buffer[mb_x][i];
 
-                dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                 if(dc == 0xFFFFF)
                     return -1;
 
@@ -1279,7 +1283,7 @@ static int ljpeg_decode_yuv_scan(MJpegDecodeContext *s, int predictor,
                     for(j=0; j<n; j++) {
                         int pred, dc;
 
-                        dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                        dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                         if(dc == 0xFFFFF)
                             return -1;
                         if (   h * mb_x + x >= s->width
@@ -1350,7 +1354,7 @@ static int ljpeg_decode_yuv_scan(MJpegDecodeContext *s, int predictor,
                     for (j = 0; j < n; j++) {
                         int pred;
 
-                        dc = mjpeg_decode_dc(s, s->dc_index[i]);
+                        dc = mjpeg_decode_dc(s, &s->gb, s->dc_index[i]);
                         if(dc == 0xFFFFF)
                             return -1;
                         if (   h * mb_x + x >= s->width
@@ -1419,6 +1423,156 @@ static void shift_output(MJpegDecodeContext *s, uint8_t *ptr, int linesize)
     }
 }
 
+typedef struct MJpegScanSlices {
+    int nb_components;
+    int nb_segments;
+    int nb_jobs;
+    int chroma_width, chroma_height;
+    int bytes_per_pixel;
+    uint8_t *data[MAX_COMPONENTS];
+    int linesize[MAX_COMPONENTS];
+    const uint8_t *buf;         ///< unescaped scan data
+    int buf_size;
+    const int *segment_start;   ///< byte offset of each restart interval in buf
+    int end_bits;               ///< bit position in buf where the last interval ended
+    atomic_int error;
+} MJpegScanSlices;
+
+/* Decode a range of restart intervals of a sequential DCT scan. */
+static int mjpeg_decode_scan_slice(AVCodecContext *avctx, void *arg,
+                                   int jobnr, int threadnr)
+{
+    MJpegDecodeContext *s = avctx->priv_data;
+    MJpegScanSlices *sl   = arg;
+    const int nb_mbs      = s->mb_width * s->mb_height;
+    const int seg_first   = (int64_t) jobnr      * sl->nb_segments / sl->nb_jobs;
+    const int seg_last    = (int64_t)(jobnr + 1) * sl->nb_segments / sl->nb_jobs;
+    LOCAL_ALIGNED_32(int16_t, block, [64]);
+    int last_dc[MAX_COMPONENTS];
+    GetBitContext gb;
+    int seg, i;
+
+    for (seg = seg_first; seg < seg_last; seg++) {
+        const int start    = sl->segment_start[seg];
+        const int end      = seg + 1 < sl->nb_segments ? sl->segment_start[seg + 1]
+                                                        : sl->buf_size;
+        const int mb_start = seg * s->restart_interval;
+        const int mb_end   = FFMIN(mb_start + s->restart_interval, nb_mbs);
+        int mb;
+
+        init_get_bits8(&gb, sl->buf + start, end - start);
+        for (i = 0; i < sl->nb_components; i++)
+            last_dc[i] = 4 << s->bits;
+
+        for (mb = mb_start; mb < mb_end; mb++) {
+            const int mb_x = mb % s->mb_width;
+            const int mb_y = mb / s->mb_width;
+
+            if (get_bits_left(&gb) < 0) {
+                av_log(avctx, AV_LOG_ERROR, "overread %d\n", -get_bits_left(&gb));
+                atomic_store(&sl->error, AVERROR_INVALIDDATA);
+                break;
+            }
+            for (i = 0; i < sl->nb_components; i++) {
+                const int n = s->nb_blocks[i];
+                const int c = s->comp_index[i];
+                const int h = s->h_scount[i];
+                const int v = s->v_scount[i];
+                const int linesize = sl->linesize[c];
+                int x = 0, y = 0, j;
+
+                for (j = 0; j < n; j++) {
+                    int block_offset = (((linesize * (v * mb_y + y) * 8) +
+                                         (h * mb_x + x) * 8 * sl->bytes_per_pixel) >> avctx->lowres);
+
+                    s->bdsp.clear_block(block);
+                    if (decode_block(s, &gb, &last_dc[i], block,
+                                     s->dc_index[i], s->ac_index[i],
+                                     s->quant_matrixes[s->quant_sindex[i]]) < 0) {
+                        av_log(avctx, AV_LOG_ERROR,
+                               "error y=%d x=%d\n", mb_y, mb_x);
+                        atomic_store(&sl->error, AVERROR_INVALIDDATA);
+                        goto next_segment;
+                    }
+                    if (   8*(h * mb_x + x) < ((c == 1) || (c == 2) ? sl->chroma_width  : s->width)
+                        && 8*(v * mb_y + y) < ((c == 1) || (c == 2) ? sl->chroma_height : s->height)) {
+                        uint8_t *ptr = sl->data[c] + block_offset;
+                        s->idsp.idct_put(ptr, linesize, block);
+                        if (s->bits & 7)
+                            shift_output(s, ptr, linesize);
+                    }
+                    if (++x == h) {
+                        x = 0;
+                        y++;
+                    }
+                }
+            }
+        }
+next_segment:
+        if (seg == sl->nb_segments - 1)
+            sl->end_bits = start * 8 + get_bits_count(&gb);
+    }
+
+    return 0;
+}
+
+/*
+ * Decode the restart intervals of a sequential DCT scan concurrently.
+ * Returns 1 if the scan was decoded, 0 if it cannot be split and must be
+ * decoded serially, or a negative error code.
+ */
+static int mjpeg_decode_scan_threaded(MJpegDecodeContext *s, int nb_components,
+                                      uint8_t **data, const int *linesize,
+                                      int chroma_width, int chroma_height)
+{
+    AVCodecContext *avctx = s->avctx;
+    MJpegScanSlices sl    = { 0 };
+    const int nb_mbs      = s->mb_width * s->mb_height;
+    int start, i, first;
+
+    if (!(avctx->active_thread_type & FF_THREAD_SLICE) ||
+        avctx->thread_count <= 1 || !s->restart_interval ||
+        s->interlaced || avctx->codec_id == AV_CODEC_ID_THP ||
+        get_bits_count(&s->gb) & 7)
+        return 0;
+
+    sl.nb_segments = (nb_mbs + s->restart_interval - 1) / s->restart_interval;
+    if (sl.nb_segments < 2)
+        return 0;
+
+    /* Every RSTn marker following the current position starts a new
+     * restart interval; the slot before the first one holds the start of
+     * the scan data. */
+    start = get_bits_count(&s->gb) >> 3;
+    for (first = 0; first < s->nb_rst_offsets; first++)
+        if (s->rst_offsets[first + 1] > start)
+            break;
+    if (s->nb_rst_offsets - first < sl.nb_segments - 1)
+        return 0;
+    s->rst_offsets[first] = start;
+
+    sl.nb_components   = nb_components;
+    sl.nb_jobs         = FFMIN(avctx->thread_count, sl.nb_segments);
+    sl.chroma_width    = chroma_width;
+    sl.chroma_height   = chroma_height;
+    sl.bytes_per_pixel = 1 + (s->bits > 8);
+    sl.buf             = s->gb.buffer;
+    sl.buf_size        = (get_bits_count(&s->gb) + get_bits_left(&s->gb)) >> 3;
+    sl.segment_start   = s->rst_offsets + first;
+    atomic_init(&sl.error, 0);
+    for (i = 0; i < nb_components; i++) {
+        int c = s->comp_index[i];
+        sl.data[c]     = data[c];
+        sl.linesize[c] = linesize[c];
+    }
+
+    avctx->execute2(avctx, mjpeg_decode_scan_slice, &sl, NULL, sl.nb_jobs);
+
+    skip_bits_long(&s->gb, sl.end_bits - get_bits_count(&s->gb));
+
+    return atomic_load(&sl.error) < 0 ? atomic_load(&sl.error) : 1;
+}
+
 static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
                              int Al, const uint8_t *mb_bitmask,
                              int mb_bitmask_size,
@@ -1454,6 +1608,13 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
         s->coefs_finished[c] |= 1;
     }
 
+    if (!s->progressive && !mb_bitmask) {
+        int ret = mjpeg_decode_scan_threaded(s, nb_components, data, linesize,
+                                             chroma_width, chroma_height);
+        if (ret)
+            return FFMIN(ret, 0);
+    }
+
     for (mb_y = 0; mb_y < s->mb_height; mb_y++) {
         for (mb_x = 0; mb_x < s->mb_width; mb_x++) {
             const int copy_mb = mb_bitmask && !get_bits1(&mb_bitmask_gb);
@@ -1495,7 +1656,7 @@ static int mjpeg_decode_scan(MJpegDecodeContext *s, int nb_components, int Ah,
 
                         } else {
                             s->bdsp.clear_block(s->block);
-                            if (decode_block(s, s->block, i,
+                            if (decode_block(s, &s->gb, &s->last_dc[i], s->block,
                                              s->dc_index[i], s->ac_index[i],
                                              s->quant_matrixes[s->quant_sindex[i]]) < 0) {
                                 av_log(s->avctx, AV_LOG_ERROR,
@@ -2212,6 +2373,8 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
     if (!s->buffer)
         return AVERROR(ENOMEM);
 
+    s->nb_rst_offsets = 0;
+
     /* unescape buffer of SOS, use special treatment for JPEG-LS */
     if (start_code == SOS && !s->ls) {
         const uint8_t *src = *buf_ptr;
@@ -2255,6 +2418,15 @@ int ff_mjpeg_find_marker(MJpegDecodeContext *s,
                         copy_data_segment(1);
                         if (x)
                             break;
+                    } else {
+                        /* remember where each restart interval starts,
+                         * slot 0 is reserved for the scan start */
+                        int *offsets = av_fast_realloc(s->rst_offsets, &s->rst_offsets_size,
+                                                       (s->nb_rst_offsets + 2) * sizeof(*offsets));
+                        if (!offsets)
+                            return AVERROR(ENOMEM);
+                        s->rst_offsets = offsets;
+                        offsets[++s->nb_rst_offsets] = (dst - s->buffer) + (ptr - src);
                     }
                 }
             }
@@ -2963,6 +3135,7 @@ av_cold int ff_mjpeg_decode_end(AVCodecContext *avctx)
     av_freep(&s->buffer);
     av_freep(&s->stereo3d);
     av_freep(&s->ljpeg_buffer);
+    av_freep(&s->rst_offsets);
     s->ljpeg_buffer_size = 0;
 
     for (i = 0; i < 3; i++) {
@@ -3018,7 +3191,7 @@ const AVCodec ff_mjpeg_decoder = {
     .close          = ff_mjpeg_decode_end,
     .receive_frame  = ff_mjpeg_receive_frame,
     .flush          = decode_flush,
-    .capabilities   = AV_CODEC_CAP_DR1,
+    .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_SLICE_THREADS,
     .max_lowres     = 3,
     .priv_class     = &mjpegdec_class,
     .profiles       = NULL_IF_CONFIG_SMALL(ff_mjpeg_profiles),
@@ -393,6 +393,7 @@ typedef struct VC1Context{
     uint8_t closed_entry;        ///< Closed entry point flag (CLOSED_ENTRY syntax element)
 
     int end_mb_x;                ///< Horizontal macroblock limit (used only by mss2)
+    int row_progress;            ///< report the decoded rows to the other frame threads
 
     int parse_only;              ///< Context is used within parser
     int resync_marker;           ///< could this stream contain resync markers
@@ -30,6 +30,7 @@
 #include "mpegutils.h"
 #include "mpegvideo.h"
 #include "msmpeg4data.h"
+#include "thread.h"
 #include "unary.h"
 #include "vc1.h"
 #include "vc1_pred.h"
@@ -2522,6 +2523,14 @@ static int vc1_decode_b_mb_intfr(VC1Context *v)
     return 0;
 }
 
+/** Tell the other frame threads that a row of the picture is final.
+ */
+static void vc1_report_row(VC1Context *v, int mb_y)
+{
+    if (v->row_progress && !v->s.er.error_occurred && mb_y >= 0)
+        ff_thread_report_progress(&v->s.current_picture_ptr->tf, mb_y, 0);
+}
+
 /** Decode blocks of I-frame
  */
 static void vc1_decode_i_blocks(VC1Context *v)
@@ -2636,6 +2645,9 @@ static void vc1_decode_i_blocks(VC1Context *v)
             ff_mpeg_draw_horiz_band(s, s->mb_y * 16, 16);
         else if (s->mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y - 1) * 16, 16);
+        /* the loop filter trails by up to two rows and changes the last
+         * lines of the row above the ones it filters */
+        vc1_report_row(v, s->mb_y - 4);
 
         s->first_slice_line = 0;
     }
@@ -2782,6 +2794,7 @@ static int vc1_decode_i_blocks_adv(VC1Context *v)
             ff_mpeg_draw_horiz_band(s, s->mb_y * 16, 16);
         else if (s->mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y-1) * 16, 16);
+        vc1_report_row(v, s->mb_y - 4);
         s->first_slice_line = 0;
     }
 
@@ -2876,6 +2889,7 @@ static void vc1_decode_p_blocks(VC1Context *v)
                 sizeof(v->luma_mv_base[0]) * 2 * s->mb_stride);
         if (s->mb_y != s->start_mb_y)
             ff_mpeg_draw_horiz_band(s, (s->mb_y - 1) * 16, 16);
+        vc1_report_row(v, s->mb_y - 4);
         s->first_slice_line = 0;
     }
     if (s->end_mb_y >= s->start_mb_y)
@@ -2917,6 +2931,9 @@ static void vc1_decode_b_blocks(VC1Context *v)
     for (s->mb_y = s->start_mb_y; s->mb_y < s->end_mb_y; s->mb_y++) {
         s->mb_x = 0;
         init_block_index(v);
+        /* direct prediction reads the MVs of the next anchor picture */
+        ff_thread_await_progress(&s->next_picture.tf,
+                                 v->field_mode ? INT_MAX : s->mb_y, 0);
         for (; s->mb_x < s->mb_width; s->mb_x++) {
             ff_update_block_index(s);
 
@@ -2981,10 +2998,12 @@ static void vc1_decode_skip_blocks(VC1Context *v)
         s->mb_x = 0;
         init_block_index(v);
         ff_update_block_index(s);
+        ff_thread_await_progress(&s->last_picture.tf, s->mb_y, 0);
         memcpy(s->dest[0], s->last_picture.f->data[0] + s->mb_y * 16 * s->linesize,   s->linesize   * 16);
         memcpy(s->dest[1], s->last_picture.f->data[1] + s->mb_y *  8 * s->uvlinesize, s->uvlinesize *  8);
         memcpy(s->dest[2], s->last_picture.f->data[2] + s->mb_y *  8 * s->uvlinesize, s->uvlinesize *  8);
         ff_mpeg_draw_horiz_band(s, s->mb_y * 16, 16);
+        vc1_report_row(v, s->mb_y);
         s->first_slice_line = 0;
     }
     s->pict_type = AV_PICTURE_TYPE_P;
@@ -30,6 +30,7 @@
 #include "h264chroma.h"
 #include "mathops.h"
 #include "mpegvideo.h"
+#include "thread.h"
 #include "vc1.h"
 
 static av_always_inline void vc1_scale_luma(uint8_t *srcY,
@@ -166,6 +167,26 @@ static av_always_inline int get_chroma_mv(VC1Context *v, int dir, int16_t *tx, i
     return valid_count;
 }
 
+/** Wait for another frame thread to decode the reference lines read by MC.
+ * @param y first line read, in lines of the current field or frame
+ * @param h number of lines read below y, counting the filter taps
+ */
+static av_always_inline void vc1_await_ref(VC1Context *v, ThreadFrame *ref,
+                                           int y, int h)
+{
+    MpegEncContext *s = &v->s;
+    int bottom;
+
+    if (!(s->avctx->active_thread_type & FF_THREAD_FRAME))
+        return;
+
+    /* field MVs of interlaced frames read every other line */
+    bottom = y + (h << (v->fcm == ILACE_FRAME));
+    if (v->field_mode)
+        bottom = 2 * bottom + 1;
+    ff_thread_await_progress(ref, av_clip(bottom >> 4, 0, s->mb_height - 1), 0);
+}
+
 /** Do motion compensation over 1 macroblock
  * Mostly adapted hpel_motion and qpel_motion from mpegvideo.c
  */
@@ -272,6 +293,10 @@ void ff_vc1_mc_1mv(VC1Context *v, int dir)
         }
     }
 
+    if (srcY != s->current_picture.f->data[0])
+        vc1_await_ref(v, dir ? &s->next_picture.tf : &s->last_picture.tf,
+                      FFMAX(src_y, 2 * uvsrc_y), 18);
+
     srcY += src_y   * s->linesize   + src_x;
     srcU += uvsrc_y * s->uvlinesize + uvsrc_x;
     srcV += uvsrc_y * s->uvlinesize + uvsrc_x;
@@ -553,6 +578,10 @@ void ff_vc1_mc_4mv_luma(VC1Context *v, int n, int dir, int avg)
             src_y = av_clip(src_y, -18, s->avctx->coded_height + 1);
     }
 
+    if (srcY != s->current_picture.f->data[0])
+        vc1_await_ref(v, dir ? &s->next_picture.tf : &s->last_picture.tf,
+                      src_y, 10);
+
     srcY += src_y * s->linesize + src_x;
     if (v->field_mode && v->ref_field_type[dir])
         srcY += linesize;
@@ -723,6 +752,10 @@ void ff_vc1_mc_4mv_chroma(VC1Context *v, int dir)
         return;
     }
 
+    if (srcU != s->current_picture.f->data[1])
+        vc1_await_ref(v, dir ? &s->next_picture.tf : &s->last_picture.tf,
+                      2 * uvsrc_y, 18);
+
     srcU += uvsrc_y * s->uvlinesize + uvsrc_x;
     srcV += uvsrc_y * s->uvlinesize + uvsrc_x;
 
@@ -894,6 +927,8 @@ void ff_vc1_mc_4mv_chroma4(VC1Context *v, int dir, int dir2, int avg)
         }
         if (!srcU)
             return;
+        vc1_await_ref(v, (i < 2 ? dir : dir2) ? &s->next_picture.tf : &s->last_picture.tf,
+                      2 * uvsrc_y, 10);
         srcU += uvsrc_y * s->uvlinesize + uvsrc_x;
         srcV += uvsrc_y * s->uvlinesize + uvsrc_x;
         uvmx_field[i] = (uvmx_field[i] & 3) << 1;
@@ -1058,6 +1093,8 @@ void ff_vc1_interp_mc(VC1Context *v)
         }
     }
 
+    vc1_await_ref(v, &s->next_picture.tf, FFMAX(src_y, 2 * uvsrc_y), 18);
+
     srcY += src_y   * s->linesize   + src_x;
     srcU += uvsrc_y * s->uvlinesize + uvsrc_x;
     srcV += uvsrc_y * s->uvlinesize + uvsrc_x;
@@ -36,6 +36,7 @@
 #include "msmpeg4.h"
 #include "msmpeg4data.h"
 #include "profiles.h"
+#include "thread.h"
 #include "vc1.h"
 #include "vc1data.h"
 #include "libavutil/avassert.h"
@@ -616,6 +617,206 @@ av_cold int ff_vc1_decode_end(AVCodecContext *avctx)
 }
 
 
+#if HAVE_THREADS
+/* The decoders do not set AV_CODEC_CAP_FRAME_THREADS and
+ * FF_CODEC_CAP_ALLOCATE_PROGRESS yet, the frame threaded output still has
+ * to be checked against the VC-1 and WMV3 FATE samples. */
+static int vc1_update_thread_context(AVCodecContext *dst,
+                                     const AVCodecContext *src)
+{
+    VC1Context *v = dst->priv_data;
+    const VC1Context *v1 = src->priv_data;
+    MpegEncContext *s = &v->s;
+    const MpegEncContext *s1 = &v1->s;
+    int init, ret, i;
+
+    if (dst == src || !s1->context_initialized)
+        return 0;
+
+    /* the VC-1 tables are sized for the old dimensions */
+    if (s->context_initialized &&
+        (s->width != s1->width || s->height != s1->height))
+        ff_vc1_decode_end(dst);
+
+    init = s->context_initialized;
+    if ((ret = ff_mpeg_update_thread_context(dst, src)) < 0)
+        return ret;
+    if (!init && (ret = ff_vc1_decode_init_alloc_tables(v)) < 0)
+        return ret;
+
+    s->h_edge_pos  = s1->h_edge_pos;
+    s->v_edge_pos  = s1->v_edge_pos;
+    s->loop_filter = s1->loop_filter;
+    s->mspel       = s1->mspel;
+
+    /* copy the sequence, entry point and picture header state, leaving
+     * out the tables and the state only used while decoding the blocks */
+    v->res_sprite            = v1->res_sprite;
+    v->res_y411              = v1->res_y411;
+    v->res_x8                = v1->res_x8;
+    v->multires              = v1->multires;
+    v->res_fasttx            = v1->res_fasttx;
+    v->res_transtab          = v1->res_transtab;
+    v->rangered              = v1->rangered;
+    v->res_rtm_flag          = v1->res_rtm_flag;
+    v->reserved              = v1->reserved;
+    v->level                 = v1->level;
+    v->chromaformat          = v1->chromaformat;
+    v->postprocflag          = v1->postprocflag;
+    v->broadcast             = v1->broadcast;
+    v->interlace             = v1->interlace;
+    v->tfcntrflag            = v1->tfcntrflag;
+    v->panscanflag           = v1->panscanflag;
+    v->refdist_flag          = v1->refdist_flag;
+    v->extended_dmv          = v1->extended_dmv;
+    v->color_prim            = v1->color_prim;
+    v->transfer_char         = v1->transfer_char;
+    v->matrix_coef           = v1->matrix_coef;
+    v->hrd_param_flag        = v1->hrd_param_flag;
+    v->psf                   = v1->psf;
+    v->profile               = v1->profile;
+    v->frmrtq_postproc       = v1->frmrtq_postproc;
+    v->bitrtq_postproc       = v1->bitrtq_postproc;
+    v->max_coded_width       = v1->max_coded_width;
+    v->max_coded_height      = v1->max_coded_height;
+    v->fastuvmc              = v1->fastuvmc;
+    v->extended_mv           = v1->extended_mv;
+    v->dquant                = v1->dquant;
+    v->vstransform           = v1->vstransform;
+    v->overlap               = v1->overlap;
+    v->quantizer_mode        = v1->quantizer_mode;
+    v->finterpflag           = v1->finterpflag;
+    v->mv_mode               = v1->mv_mode;
+    v->mv_mode2              = v1->mv_mode2;
+    v->k_x                   = v1->k_x;
+    v->k_y                   = v1->k_y;
+    v->range_x               = v1->range_x;
+    v->range_y               = v1->range_y;
+    v->pq                    = v1->pq;
+    v->altpq                 = v1->altpq;
+    memcpy(v->zz_8x8, v1->zz_8x8, sizeof(v->zz_8x8));
+    v->left_blk_sh           = v1->left_blk_sh;
+    v->top_blk_sh            = v1->top_blk_sh;
+    v->zz_8x4                = v1->zz_8x4;
+    v->zz_4x8                = v1->zz_4x8;
+    v->dquantfrm             = v1->dquantfrm;
+    v->dqprofile             = v1->dqprofile;
+    v->dqsbedge              = v1->dqsbedge;
+    v->dqbilevel             = v1->dqbilevel;
+    v->c_ac_table_index      = v1->c_ac_table_index;
+    v->y_ac_table_index      = v1->y_ac_table_index;
+    v->ttfrm                 = v1->ttfrm;
+    v->ttmbf                 = v1->ttmbf;
+    v->pqindex               = v1->pqindex;
+    v->lumscale              = v1->lumscale;
+    v->lumshift              = v1->lumshift;
+    v->bfraction             = v1->bfraction;
+    v->halfpq                = v1->halfpq;
+    v->respic                = v1->respic;
+    v->buffer_fullness       = v1->buffer_fullness;
+    v->mvrange               = v1->mvrange;
+    v->pquantizer            = v1->pquantizer;
+    v->cbpcy_vlc             = v1->cbpcy_vlc;
+    v->tt_index              = v1->tt_index;
+    v->mv_type_is_raw        = v1->mv_type_is_raw;
+    v->dmb_is_raw            = v1->dmb_is_raw;
+    v->fmb_is_raw            = v1->fmb_is_raw;
+    v->skip_is_raw           = v1->skip_is_raw;
+    memcpy(v->last_luty, v1->last_luty, sizeof(v->last_luty));
+    memcpy(v->last_lutuv, v1->last_lutuv, sizeof(v->last_lutuv));
+    memcpy(v->aux_luty, v1->aux_luty, sizeof(v->aux_luty));
+    memcpy(v->aux_lutuv, v1->aux_lutuv, sizeof(v->aux_lutuv));
+    memcpy(v->next_luty, v1->next_luty, sizeof(v->next_luty));
+    memcpy(v->next_lutuv, v1->next_lutuv, sizeof(v->next_lutuv));
+    v->last_use_ic           = v1->last_use_ic;
+    v->next_use_ic           = v1->next_use_ic;
+    v->aux_use_ic            = v1->aux_use_ic;
+    v->rnd                   = v1->rnd;
+    v->cbptab                = v1->cbptab;
+    v->rangeredfrm           = v1->rangeredfrm;
+    v->interpfrm             = v1->interpfrm;
+    v->fcm                   = v1->fcm;
+    v->numpanscanwin         = v1->numpanscanwin;
+    v->tfcntr                = v1->tfcntr;
+    v->rptfrm                = v1->rptfrm;
+    v->tff                   = v1->tff;
+    v->rff                   = v1->rff;
+    v->topleftx              = v1->topleftx;
+    v->toplefty              = v1->toplefty;
+    v->bottomrightx          = v1->bottomrightx;
+    v->bottomrighty          = v1->bottomrighty;
+    v->uvsamp                = v1->uvsamp;
+    v->postproc              = v1->postproc;
+    v->hrd_num_leaky_buckets = v1->hrd_num_leaky_buckets;
+    v->bit_rate_exponent     = v1->bit_rate_exponent;
+    v->buffer_size_exponent  = v1->buffer_size_exponent;
+    v->acpred_is_raw         = v1->acpred_is_raw;
+    v->overflg_is_raw        = v1->overflg_is_raw;
+    v->condover              = v1->condover;
+    v->range_mapy_flag       = v1->range_mapy_flag;
+    v->range_mapuv_flag      = v1->range_mapuv_flag;
+    v->range_mapy            = v1->range_mapy;
+    v->range_mapuv           = v1->range_mapuv;
+    v->dmvrange              = v1->dmvrange;
+    v->fourmvswitch          = v1->fourmvswitch;
+    v->intcomp               = v1->intcomp;
+    v->lumscale2             = v1->lumscale2;
+    v->lumshift2             = v1->lumshift2;
+    v->mbmode_vlc            = v1->mbmode_vlc;
+    v->imv_vlc               = v1->imv_vlc;
+    v->twomvbp_vlc           = v1->twomvbp_vlc;
+    v->fourmvbp_vlc          = v1->fourmvbp_vlc;
+    v->fieldtx_is_raw        = v1->fieldtx_is_raw;
+    memcpy(v->zzi_8x8, v1->zzi_8x8, sizeof(v->zzi_8x8));
+    v->field_mode            = v1->field_mode;
+    v->fptype                = v1->fptype;
+    v->refdist               = v1->refdist;
+    v->numref                = v1->numref;
+    v->reffield              = v1->reffield;
+    v->intcompfield          = v1->intcompfield;
+    v->cur_field_type        = v1->cur_field_type;
+    v->qs_last               = v1->qs_last;
+    v->frfd                  = v1->frfd;
+    v->brfd                  = v1->brfd;
+    v->mbmodetab             = v1->mbmodetab;
+    v->icbptab               = v1->icbptab;
+    v->imvtab                = v1->imvtab;
+    v->twomvbptab            = v1->twomvbptab;
+    v->fourmvbptab           = v1->fourmvbptab;
+    v->p_frame_skipped       = v1->p_frame_skipped;
+    v->bi_type               = v1->bi_type;
+    v->x8_type               = v1->x8_type;
+    v->bfraction_lut_index   = v1->bfraction_lut_index;
+    v->broken_link           = v1->broken_link;
+    v->closed_entry          = v1->closed_entry;
+    v->parse_only            = v1->parse_only;
+    v->resync_marker         = v1->resync_marker;
+
+    /* the current intensity compensation tables point into the context */
+#define REBASE_LUT(lut, last, next, aux)                          \
+    v->lut = v1->lut == v1->last ? v->last :                      \
+             v1->lut == v1->next ? v->next :                      \
+             v1->lut == v1->aux  ? v->aux  : NULL
+    REBASE_LUT(curr_luty,   last_luty,  next_luty,  aux_luty);
+    REBASE_LUT(curr_lutuv,  last_lutuv, next_lutuv, aux_lutuv);
+    v->curr_use_ic = v1->curr_use_ic == &v1->last_use_ic ? &v->last_use_ic :
+                     v1->curr_use_ic == &v1->next_use_ic ? &v->next_use_ic :
+                     v1->curr_use_ic == &v1->aux_use_ic  ? &v->aux_use_ic  : NULL;
+
+    /* B field pictures read the field MV flags of their anchor */
+    if (v1->interlace && v->mv_f_next_base && v1->mv_f_next_base) {
+        int mb_height = FFALIGN(s1->mb_height, 2);
+        int size      = s1->b8_stride * (mb_height * 2 + 1) + s1->mb_stride * (mb_height + 1) * 2;
+
+        for (i = 0; i < 2; i++)
+            memcpy(v->mv_f_next[i]  - s->b8_stride  - 1,
+                   v1->mv_f_next[i] - s1->b8_stride - 1, size);
+    }
+
+    return 0;
+}
+#endif
+
 /** Decode a VC1/WMV3 frame
  * @todo TODO: Handle VC-1 IDUs (Transport level?)
  */
@@ -630,6 +831,7 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
     uint8_t *buf2 = NULL;
     const uint8_t *buf_start = buf, *buf_start_second_field = NULL;
     int mb_height, n_slices1=-1;
+    int frame_started = 0, late_setup = 1;
     struct {
         uint8_t *buf;
         GetBitContext gb;
@@ -882,6 +1084,7 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
     if ((ret = ff_mpv_frame_start(s, avctx)) < 0) {
         goto err;
     }
+    frame_started = 1;
 
     v->s.current_picture_ptr->field_picture = v->field_mode;
     v->s.current_picture_ptr->f->interlaced_frame = (v->fcm != PROGRESSIVE);
@@ -1025,10 +1228,20 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
                 goto err;
         }
     } else {
-        int header_ret = 0;
+        int header_ret = 0, next_mb_y = 0;
 
         ff_mpeg_er_frame_start(s);
 
+        /* The next frame thread can start as soon as the header state is
+         * known, which for field pictures and slices with picture headers
+         * is only after all of them are parsed. */
+        late_setup = v->field_mode;
+        for (i = 0; i < n_slices && !late_setup; i++)
+            late_setup = show_bits1(&slices[i].gb);
+        if (!late_setup)
+            ff_thread_finish_setup(avctx);
+        v->row_progress = !v->field_mode && s->current_picture.reference;
+
         v->end_mb_x = s->mb_width;
         if (v->field_mode) {
             s->current_picture.f->linesize[0] <<= 1;
@@ -1101,6 +1314,10 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
                 av_log(v->s.avctx, AV_LOG_ERROR, "missing cbpcy_vlc\n");
                 continue;
             }
+            /* rows skipped or decoded twice are only final at the end */
+            if (s->start_mb_y != next_mb_y)
+                v->row_progress = 0;
+            next_mb_y = s->end_mb_y;
             ff_vc1_decode_blocks(v);
             if (i != n_slices) {
                 s->gb = slices[i].gb;
@@ -1134,6 +1351,9 @@ static int vc1_decode_frame(AVCodecContext *avctx, void *data,
 
     ff_mpv_frame_end(s);
 
+    if (late_setup)
+        ff_thread_finish_setup(avctx);
+
     if (avctx->codec_id == AV_CODEC_ID_WMV3IMAGE || avctx->codec_id == AV_CODEC_ID_VC1IMAGE) {
 image:
         avctx->width  = avctx->coded_width  = v->output_width;
@@ -1176,6 +1396,9 @@ end:
     return buf_size;
 
 err:
+    /* do not leave the other frame threads waiting for this picture */
+    if (frame_started)
+        ff_thread_report_progress(&s->current_picture_ptr->tf, INT_MAX, 0);
     av_free(buf2);
     for (i = 0; i < n_slices; i++)
         av_free(slices[i].buf);
@@ -1215,6 +1438,7 @@ const AVCodec ff_vc1_decoder = {
     .close          = ff_vc1_decode_end,
     .decode         = vc1_decode_frame,
     .flush          = ff_mpeg_flush,
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(vc1_update_thread_context),
     .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY,
     .pix_fmts       = vc1_hwaccel_pixfmt_list_420,
     .hw_configs     = (const AVCodecHWConfigInternal *const []) {
@@ -1252,6 +1476,7 @@ const AVCodec ff_wmv3_decoder = {
     .close          = ff_vc1_decode_end,
     .decode         = vc1_decode_frame,
     .flush          = ff_mpeg_flush,
+    .update_thread_context = ONLY_IF_THREADS_ENABLED(vc1_update_thread_context),
     .capabilities   = AV_CODEC_CAP_DR1 | AV_CODEC_CAP_DELAY,
     .pix_fmts       = vc1_hwaccel_pixfmt_list_420,
     .hw_configs     = (const AVCodecHWConfigInternal *const []) {
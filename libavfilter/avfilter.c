@@ -43,6 +43,7 @@
 #include "formats.h"
 #include "framepool.h"
 #include "internal.h"
+#include "thread.h"
 
 #include "libavutil/ffversion.h"
 const char av_filter_ffversion[] = "FFmpeg version " FFMPEG_VERSION;
@@ -210,19 +211,32 @@ void avfilter_link_free(AVFilterLink **link)
 
 void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
 {
+    if (filter->graph && filter->graph->internal->pipeline_active) {
+        ff_graph_pipeline_lock(filter->graph);
+        filter->ready = FFMAX(filter->ready, priority);
+        ff_graph_pipeline_unlock(filter->graph);
+        return;
+    }
     filter->ready = FFMAX(filter->ready, priority);
 }
 
 /**
  * Clear frame_blocked_in on all outputs.
  * This is necessary whenever something changes on input.
+ * With the pipeline active, the filters downstream of the outputs can be
+ * running at the same time and clear the flag from their side.
  */
 static void filter_unblock(AVFilterContext *filter)
 {
+    int pipeline = filter->graph && filter->graph->internal->pipeline_active;
     unsigned i;
 
+    if (pipeline)
+        ff_graph_pipeline_lock(filter->graph);
     for (i = 0; i < filter->nb_outputs; i++)
         filter->outputs[i]->frame_blocked_in = 0;
+    if (pipeline)
+        ff_graph_pipeline_unlock(filter->graph);
 }
 
 
@@ -545,8 +559,14 @@ void ff_update_link_current_pts(AVFilterLink *link, int64_t pts)
     link->current_pts = pts;
     link->current_pts_us = av_rescale_q(pts, link->time_base, AV_TIME_BASE_Q);
     /* TODO use duration */
-    if (link->graph && link->age_index >= 0)
-        ff_avfilter_graph_update_heap(link->graph, link);
+    if (link->graph && link->age_index >= 0) {
+        if (link->graph->internal->pipeline_active) {
+            ff_graph_pipeline_lock(link->graph);
+            ff_avfilter_graph_update_heap(link->graph, link);
+            ff_graph_pipeline_unlock(link->graph);
+        } else
+            ff_avfilter_graph_update_heap(link->graph, link);
+    }
 }
 
 int avfilter_process_command(AVFilterContext *filter, const char *cmd, const char *arg, char *res, int res_len, int flags)
@@ -626,13 +646,16 @@ static const AVClass *filter_child_class_iterate(void **iter)
 #define TFLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_RUNTIME_PARAM
 static const AVOption avfilter_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
-        { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, FLAGS, "thread_type" },
-        { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = FLAGS, .unit = "thread_type" },
+        { .i64 = AVFILTER_THREAD_SLICE | AVFILTER_THREAD_PIPELINE }, 0, INT_MAX, FLAGS, "thread_type" },
+        { "slice",    NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE    }, .flags = FLAGS, .unit = "thread_type" },
+        { "pipeline", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_PIPELINE }, .flags = FLAGS, .unit = "thread_type" },
     { "enable", "set enable expression", OFFSET(enable_str), AV_OPT_TYPE_STRING, {.str=NULL}, .flags = TFLAGS },
     { "threads", "Allowed number of threads", OFFSET(nb_threads), AV_OPT_TYPE_INT,
         { .i64 = 0 }, 0, INT_MAX, FLAGS },
     { "extra_hw_frames", "Number of extra hardware frames to allocate for the user",
         OFFSET(extra_hw_frames), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, FLAGS },
+    { "pipeline_concurrency", "Maximum number of filters activated together with this one",
+        OFFSET(pipeline_concurrency), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, FLAGS },
     { NULL },
 };
 
@@ -894,6 +917,7 @@ int ff_filter_process_command(AVFilterContext *ctx, const char *cmd,
 
 int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
 {
+    int thread_type = 0;
     int ret = 0;
 
     ret = av_opt_set_dict(ctx, options);
@@ -905,11 +929,13 @@ int avfilter_init_dict(AVFilterContext *ctx, AVDictionary **options)
     if (ctx->filter->flags & AVFILTER_FLAG_SLICE_THREADS &&
         ctx->thread_type & ctx->graph->thread_type & AVFILTER_THREAD_SLICE &&
         ctx->graph->internal->thread_execute) {
-        ctx->thread_type       = AVFILTER_THREAD_SLICE;
+        thread_type            = AVFILTER_THREAD_SLICE;
         ctx->internal->execute = ctx->graph->internal->thread_execute;
-    } else {
-        ctx->thread_type = 0;
     }
+    if (ctx->thread_type & ctx->graph->thread_type & AVFILTER_THREAD_PIPELINE &&
+        ctx->graph->internal->pipeline)
+        thread_type |= AVFILTER_THREAD_PIPELINE;
+    ctx->thread_type = thread_type;
 
     if (ctx->filter->priv_class) {
         ret = av_opt_set_dict2(ctx->priv, options, AV_OPT_SEARCH_CHILDREN);
@@ -1544,7 +1570,12 @@ void ff_inlink_set_status(AVFilterLink *link, int status)
     if (link->status_out)
         return;
     link->frame_wanted_out = 0;
-    link->frame_blocked_in = 0;
+    if (link->graph && link->graph->internal->pipeline_active) {
+        ff_graph_pipeline_lock(link->graph);
+        link->frame_blocked_in = 0;
+        ff_graph_pipeline_unlock(link->graph);
+    } else
+        link->frame_blocked_in = 0;
     ff_avfilter_link_set_out_status(link, status, AV_NOPTS_VALUE);
     while (ff_framequeue_queued_frames(&link->fifo)) {
            AVFrame *frame = ff_framequeue_take(&link->fifo);
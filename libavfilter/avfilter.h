@@ -396,6 +396,11 @@ unsigned avfilter_filter_pad_count(const AVFilter *filter, int is_output);
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
 
+/**
+ * Activate filters of the graph which do not share a link concurrently.
+ */
+#define AVFILTER_THREAD_PIPELINE (1 << 1)
+
 typedef struct AVFilterInternal AVFilterInternal;
 
 /** An instance of a filter */
@@ -486,6 +491,14 @@ struct AVFilterContext {
      * configured.
      */
     int extra_hw_frames;
+
+    /**
+     * Maximum number of filters, this one included, that may be activated
+     * together when the graph uses AVFILTER_THREAD_PIPELINE and this filter
+     * is among them. 0 means no limit besides the number of threads of the
+     * graph, 1 means this filter is always activated alone.
+     */
+    int pipeline_concurrency;
 };
 
 /**
@@ -49,7 +49,8 @@
 static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, "thread_type" },
-        { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "slice",    NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE    }, .flags = F|V|A, .unit = "thread_type" },
+        { "pipeline", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_PIPELINE }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads), AV_OPT_TYPE_INT,
         { .i64 = 0 }, 0, INT_MAX, F|V|A, "threads"},
         {"auto", "autodetect a suitable number of threads to use", 0, AV_OPT_TYPE_CONST, {.i64 = 0 }, .flags = F|V|A, .unit = "threads"},
@@ -79,6 +80,19 @@ int ff_graph_thread_init(AVFilterGraph *graph)
     graph->nb_threads  = 1;
     return 0;
 }
+
+int ff_graph_pipeline_run_once(AVFilterGraph *graph)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_graph_pipeline_lock(AVFilterGraph *graph)
+{
+}
+
+void ff_graph_pipeline_unlock(AVFilterGraph *graph)
+{
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -340,6 +354,29 @@ static int filter_check_formats(AVFilterContext *ctx)
     return 0;
 }
 
+static int formats_declared(AVFilterContext *f)
+{
+    int i;
+
+    for (i = 0; i < f->nb_inputs; i++) {
+        if (!f->inputs[i]->outcfg.formats)
+            return 0;
+        if (f->inputs[i]->type == AVMEDIA_TYPE_AUDIO &&
+            !(f->inputs[i]->outcfg.samplerates &&
+              f->inputs[i]->outcfg.channel_layouts))
+            return 0;
+    }
+    for (i = 0; i < f->nb_outputs; i++) {
+        if (!f->outputs[i]->incfg.formats)
+            return 0;
+        if (f->outputs[i]->type == AVMEDIA_TYPE_AUDIO &&
+            !(f->outputs[i]->incfg.samplerates &&
+              f->outputs[i]->incfg.channel_layouts))
+            return 0;
+    }
+    return 1;
+}
+
 static int filter_query_formats(AVFilterContext *ctx)
 {
     int ret;
@@ -359,6 +396,11 @@ static int filter_query_formats(AVFilterContext *ctx)
     if (ret < 0)
         return ret;
 
+    /* Most filters set all their lists themselves, do not build the
+     * lists of all formats just to drop them. */
+    if (formats_declared(ctx))
+        return 0;
+
     formats = ff_all_formats(type);
     if ((ret = ff_set_common_formats(ctx, formats)) < 0)
         return ret;
@@ -372,29 +414,6 @@ static int filter_query_formats(AVFilterContext *ctx)
     return 0;
 }
 
-static int formats_declared(AVFilterContext *f)
-{
-    int i;
-
-    for (i = 0; i < f->nb_inputs; i++) {
-        if (!f->inputs[i]->outcfg.formats)
-            return 0;
-        if (f->inputs[i]->type == AVMEDIA_TYPE_AUDIO &&
-            !(f->inputs[i]->outcfg.samplerates &&
-              f->inputs[i]->outcfg.channel_layouts))
-            return 0;
-    }
-    for (i = 0; i < f->nb_outputs; i++) {
-        if (!f->outputs[i]->incfg.formats)
-            return 0;
-        if (f->outputs[i]->type == AVMEDIA_TYPE_AUDIO &&
-            !(f->outputs[i]->incfg.samplerates &&
-              f->outputs[i]->incfg.channel_layouts))
-            return 0;
-    }
-    return 1;
-}
-
 /**
  * Perform one round of query_formats() and merging formats lists on the
  * filter graph.
@@ -1332,6 +1351,8 @@ int ff_filter_graph_run_once(AVFilterGraph *graph)
     unsigned i;
 
     av_assert0(graph->nb_filters);
+    if (graph->internal->pipeline)
+        return ff_graph_pipeline_run_once(graph);
     filter = graph->filters[0];
     for (i = 1; i < graph->nb_filters; i++)
         if (graph->filters[i]->ready > filter->ready)
@@ -57,6 +57,8 @@ typedef struct DeshakeContext {
     int counts[2*MAX_R+1][2*MAX_R+1]; /// < Scratch buffer for motion search
     double *angles;            ///< Scratch buffer for block angles
     unsigned angles_size;
+    IntMotionVector *block_mvs; ///< Scratch buffer for the motion of each block
+    unsigned block_mvs_size;
     AVFrame *ref;              ///< Previous frame
     int rx;                    ///< Maximum horizontal shift
     int ry;                    ///< Maximum vertical shift
@@ -228,6 +228,7 @@ const AVFilter ff_vf_zmq = {
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(ZMQContext),
+    .flags_internal = FF_FILTER_FLAG_PIPELINE_EXCLUSIVE,
     FILTER_INPUTS(zmq_inputs),
     FILTER_OUTPUTS(zmq_outputs),
     .priv_class  = &zmq_class,
@@ -259,6 +260,7 @@ const AVFilter ff_af_azmq = {
     .init        = init,
     .uninit      = uninit,
     .priv_size   = sizeof(ZMQContext),
+    .flags_internal = FF_FILTER_FLAG_PIPELINE_EXCLUSIVE,
     FILTER_INPUTS(azmq_inputs),
     FILTER_OUTPUTS(azmq_outputs),
 };
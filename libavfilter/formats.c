@@ -93,18 +93,28 @@ do {                                                                       \
     MERGE_REF(a, b, fmts, type, return AVERROR(ENOMEM););                  \
 } while (0)
 
+#define MAX_FORMATS FFMAX((int)AV_PIX_FMT_NB, (int)AV_SAMPLE_FMT_NB)
+
 static int merge_formats_internal(AVFilterFormats *a, AVFilterFormats *b,
                                   enum AVMediaType type, int check)
 {
-    int i, j;
-    int alpha1=0, alpha2=0;
-    int chroma1=0, chroma2=0;
+    uint8_t in_b[MAX_FORMATS] = { 0 };
+    int i, j, k = 0;
+    int alpha1=0, alpha2=0, alpha_b=0;
+    int chroma1=0, chroma2=0, chroma_b=0;
 
     av_assert2(check || (a->refcount && b->refcount));
 
     if (a == b)
         return 1;
 
+    /* Mark the formats of b, so that both the checks below and the
+     * intersection only take a single pass over each list. */
+    for (j = 0; j < b->nb_formats; j++) {
+        av_assert1((unsigned)b->formats[j] < MAX_FORMATS);
+        in_b[b->formats[j]] = 1;
+    }
+
     /* Do not lose chroma or alpha in merging.
        It happens if both lists have formats with chroma (resp. alpha), but
        the only formats in common do not have it (e.g. YUV+gray vs.
@@ -112,25 +122,41 @@ static int merge_formats_internal(AVFilterFormats *a, AVFilterFormats *b,
        possibly causing a lossy conversion elsewhere in the graph.
        To avoid that, pretend that there are no common formats to force the
        insertion of a conversion filter. */
-    if (type == AVMEDIA_TYPE_VIDEO)
+    if (type == AVMEDIA_TYPE_VIDEO) {
+        for (j = 0; j < b->nb_formats; j++) {
+            const AVPixFmtDescriptor *const bdesc = av_pix_fmt_desc_get(b->formats[j]);
+            alpha_b |= bdesc->flags & AV_PIX_FMT_FLAG_ALPHA;
+            chroma_b|= bdesc->nb_components > 1;
+        }
         for (i = 0; i < a->nb_formats; i++) {
             const AVPixFmtDescriptor *const adesc = av_pix_fmt_desc_get(a->formats[i]);
-            for (j = 0; j < b->nb_formats; j++) {
-                const AVPixFmtDescriptor *bdesc = av_pix_fmt_desc_get(b->formats[j]);
-                alpha2 |= adesc->flags & bdesc->flags & AV_PIX_FMT_FLAG_ALPHA;
-                chroma2|= adesc->nb_components > 1 && bdesc->nb_components > 1;
-                if (a->formats[i] == b->formats[j]) {
-                    alpha1 |= adesc->flags & AV_PIX_FMT_FLAG_ALPHA;
-                    chroma1|= adesc->nb_components > 1;
-                }
+            alpha2 |= adesc->flags & alpha_b;
+            chroma2|= adesc->nb_components > 1 && chroma_b;
+            if (in_b[a->formats[i]]) {
+                alpha1 |= adesc->flags & AV_PIX_FMT_FLAG_ALPHA;
+                chroma1|= adesc->nb_components > 1;
             }
         }
+    }
 
     // If chroma or alpha can be lost through merging then do not merge
     if (alpha2 > alpha1 || chroma2 > chroma1)
         return 0;
 
-    MERGE_FORMATS(a, b, formats, nb_formats, AVFilterFormats, check, 0);
+    for (i = 0; i < a->nb_formats; i++)
+        if (in_b[a->formats[i]]) {
+            if (check)
+                return 1;
+            a->formats[k++] = a->formats[i];
+        }
+    /* Check that there was at least one common format.
+     * Notice that both a and b are unchanged if not. */
+    if (!k)
+        return 0;
+    av_assert2(!check);
+    a->nb_formats = k;
+
+    MERGE_REF(a, b, formats, AVFilterFormats, return AVERROR(ENOMEM););
 
     return 1;
 }
@@ -829,14 +855,45 @@ static int check_list(void *log, const char *name, const AVFilterFormats *fmts)
     return 0;
 }
 
+/**
+ * Same as check_list() for the lists of enumerated formats, which can be
+ * checked in a single pass.
+ */
+static int check_format_list(void *log, const char *name, const AVFilterFormats *fmts,
+                             int nb_values)
+{
+    uint8_t seen[MAX_FORMATS] = { 0 };
+    unsigned i;
+
+    if (!fmts)
+        return 0;
+    if (!fmts->nb_formats) {
+        av_log(log, AV_LOG_ERROR, "Empty %s list\n", name);
+        return AVERROR(EINVAL);
+    }
+    for (i = 0; i < fmts->nb_formats; i++) {
+        const int fmt = fmts->formats[i];
+        if (fmt < 0 || fmt >= nb_values) {
+            av_log(log, AV_LOG_ERROR, "Invalid %s %d\n", name, fmt);
+            return AVERROR(EINVAL);
+        }
+        if (seen[fmt]) {
+            av_log(log, AV_LOG_ERROR, "Duplicated %s\n", name);
+            return AVERROR(EINVAL);
+        }
+        seen[fmt] = 1;
+    }
+    return 0;
+}
+
 int ff_formats_check_pixel_formats(void *log, const AVFilterFormats *fmts)
 {
-    return check_list(log, "pixel format", fmts);
+    return check_format_list(log, "pixel format", fmts, AV_PIX_FMT_NB);
 }
 
 int ff_formats_check_sample_formats(void *log, const AVFilterFormats *fmts)
 {
-    return check_list(log, "sample format", fmts);
+    return check_format_list(log, "sample format", fmts, AV_SAMPLE_FMT_NB);
 }
 
 int ff_formats_check_sample_rates(void *log, const AVFilterFormats *fmts)
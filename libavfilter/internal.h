@@ -134,10 +134,22 @@ struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    void *pipeline;
+    /**
+     * Set while filters are being activated concurrently.
+     */
+    int pipeline_active;
 };
 
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+
+    /**
+     * Last round of the pipeline scheduler in which this filter or one of
+     * its neighbours was selected for activation.
+     */
+    unsigned pipeline_round;
 };
 
 static av_always_inline int ff_filter_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -370,6 +382,12 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
  */
 #define FF_FILTER_FLAG_HWFRAME_AWARE (1 << 0)
 
+/**
+ * The filter must not be activated concurrently with other filters of the
+ * graph, e.g. because it sends commands to them.
+ */
+#define FF_FILTER_FLAG_PIPELINE_EXCLUSIVE (1 << 1)
+
 /**
  * Run one round of processing on a filter graph.
  */
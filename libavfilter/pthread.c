@@ -37,12 +37,33 @@ typedef struct ThreadContext {
     AVSliceThread *thread;
     avfilter_action_func *func;
 
+    /* serializes execute calls from filters activated concurrently */
+    pthread_mutex_t execute_lock;
+
     /* per-execute parameters */
     AVFilterContext *ctx;
     void *arg;
     int   *rets;
 } ThreadContext;
 
+typedef struct PipelineContext {
+    AVSliceThread *thread;
+    int nb_threads;
+
+    /* protects the state shared between concurrently activated filters */
+    pthread_mutex_t lock;
+    unsigned round;
+
+    /* filters activated in the current round */
+    AVFilterContext **filters;
+    int *rets;
+    int nb_filters;
+
+    /* ready filters, sorted by decreasing priority */
+    AVFilterContext **candidates;
+    unsigned candidates_size;
+} PipelineContext;
+
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
 {
     ThreadContext *c = priv;
@@ -51,9 +72,16 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
         c->rets[jobnr] = ret;
 }
 
+static void pipeline_worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    PipelineContext *p = priv;
+    p->rets[jobnr] = ff_filter_activate(p->filters[jobnr]);
+}
+
 static void slice_thread_uninit(ThreadContext *c)
 {
     avpriv_slicethread_free(&c->thread);
+    pthread_mutex_destroy(&c->execute_lock);
 }
 
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -63,12 +91,15 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
 
     if (nb_jobs <= 0)
         return 0;
+
+    pthread_mutex_lock(&c->execute_lock);
     c->ctx         = ctx;
     c->arg         = arg;
     c->func        = func;
     c->rets        = ret;
 
     avpriv_slicethread_execute(c->thread, nb_jobs, 0);
+    pthread_mutex_unlock(&c->execute_lock);
     return 0;
 }
 
@@ -80,6 +111,52 @@ static int thread_init_internal(ThreadContext *c, int nb_threads)
     return FFMAX(nb_threads, 1);
 }
 
+static void pipeline_uninit(PipelineContext *p)
+{
+    avpriv_slicethread_free(&p->thread);
+    pthread_mutex_destroy(&p->lock);
+    av_freep(&p->filters);
+    av_freep(&p->rets);
+    av_freep(&p->candidates);
+}
+
+static int pipeline_init(AVFilterGraph *graph)
+{
+    PipelineContext *p;
+    int ret;
+
+    p = av_mallocz(sizeof(*p));
+    if (!p)
+        return AVERROR(ENOMEM);
+
+    ret = pthread_mutex_init(&p->lock, NULL);
+    if (ret) {
+        av_free(p);
+        return AVERROR(ret);
+    }
+
+    ret = avpriv_slicethread_create(&p->thread, p, pipeline_worker_func, NULL,
+                                    graph->nb_threads);
+    if (ret <= 1) {
+        pipeline_uninit(p);
+        av_free(p);
+        graph->thread_type &= ~AVFILTER_THREAD_PIPELINE;
+        return (ret < 0) ? ret : 0;
+    }
+    p->nb_threads = ret;
+
+    p->filters = av_calloc(p->nb_threads, sizeof(*p->filters));
+    p->rets    = av_calloc(p->nb_threads, sizeof(*p->rets));
+    if (!p->filters || !p->rets) {
+        pipeline_uninit(p);
+        av_free(p);
+        return AVERROR(ENOMEM);
+    }
+
+    graph->internal->pipeline = p;
+    return 0;
+}
+
 int ff_graph_thread_init(AVFilterGraph *graph)
 {
     int ret;
@@ -93,8 +170,15 @@ int ff_graph_thread_init(AVFilterGraph *graph)
     if (!graph->internal->thread)
         return AVERROR(ENOMEM);
 
+    ret = pthread_mutex_init(&((ThreadContext *)graph->internal->thread)->execute_lock, NULL);
+    if (ret) {
+        av_freep(&graph->internal->thread);
+        return AVERROR(ret);
+    }
+
     ret = thread_init_internal(graph->internal->thread, graph->nb_threads);
     if (ret <= 1) {
+        slice_thread_uninit(graph->internal->thread);
         av_freep(&graph->internal->thread);
         graph->thread_type = 0;
         graph->nb_threads  = 1;
@@ -104,11 +188,119 @@ int ff_graph_thread_init(AVFilterGraph *graph)
 
     graph->internal->thread_execute = thread_execute;
 
+    if (graph->thread_type & AVFILTER_THREAD_PIPELINE) {
+        ret = pipeline_init(graph);
+        if (ret < 0)
+            return ret;
+    }
+
     return 0;
 }
 
+/* Maximum number of filters activated together when ctx is one of them. */
+static int filter_concurrency(const AVFilterContext *ctx, int nb_threads)
+{
+    if (!(ctx->thread_type & AVFILTER_THREAD_PIPELINE) ||
+        ctx->filter->flags_internal & FF_FILTER_FLAG_PIPELINE_EXCLUSIVE)
+        return 1;
+    if (ctx->pipeline_concurrency)
+        return FFMIN(ctx->pipeline_concurrency, nb_threads);
+    return nb_threads;
+}
+
+static void pipeline_mark(AVFilterContext *ctx, unsigned round)
+{
+    unsigned i;
+
+    ctx->internal->pipeline_round = round;
+    for (i = 0; i < ctx->nb_inputs; i++)
+        if (ctx->inputs[i])
+            ctx->inputs[i]->src->internal->pipeline_round = round;
+    for (i = 0; i < ctx->nb_outputs; i++)
+        if (ctx->outputs[i])
+            ctx->outputs[i]->dst->internal->pipeline_round = round;
+}
+
+int ff_graph_pipeline_run_once(AVFilterGraph *graph)
+{
+    PipelineContext *p = graph->internal->pipeline;
+    AVFilterContext **candidates;
+    int nb_candidates = 0, limit;
+    int i, j, ret = 0;
+
+    candidates = av_fast_realloc(p->candidates, &p->candidates_size,
+                                 graph->nb_filters * sizeof(*candidates));
+    if (!candidates)
+        return AVERROR(ENOMEM);
+    p->candidates = candidates;
+
+    /* Keep the graph order among filters of equal priority, so that the
+     * first candidate is the filter ff_filter_graph_run_once() would pick. */
+    for (i = 0; i < graph->nb_filters; i++) {
+        AVFilterContext *ctx = graph->filters[i];
+        if (!ctx->ready)
+            continue;
+        for (j = nb_candidates; j > 0 && candidates[j - 1]->ready < ctx->ready; j--)
+            candidates[j] = candidates[j - 1];
+        candidates[j] = ctx;
+        nb_candidates++;
+    }
+    if (!nb_candidates)
+        return AVERROR(EAGAIN);
+    limit = filter_concurrency(candidates[0], p->nb_threads);
+    if (nb_candidates == 1 || limit == 1)
+        return ff_filter_activate(candidates[0]);
+
+    /* Filters sharing a link are never activated together: a link is only
+     * accessed by the filters at its two ends. The exceptions are the
+     * ready flags, the link heap and frame_blocked_in, which is also
+     * cleared from the upstream side of the link source; these go through
+     * the pipeline lock. The concurrency limit of the round is the lowest
+     * one among the filters selected for it. */
+    p->round++;
+    p->nb_filters = 0;
+    for (i = 0; i < nb_candidates && p->nb_filters < limit; i++) {
+        AVFilterContext *ctx = candidates[i];
+        int concurrency = filter_concurrency(ctx, p->nb_threads);
+        if (concurrency <= p->nb_filters ||
+            ctx->internal->pipeline_round == p->round)
+            continue;
+        pipeline_mark(ctx, p->round);
+        p->filters[p->nb_filters++] = ctx;
+        limit = FFMIN(limit, concurrency);
+    }
+    if (p->nb_filters == 1)
+        return ff_filter_activate(p->filters[0]);
+
+    graph->internal->pipeline_active = 1;
+    avpriv_slicethread_execute(p->thread, p->nb_filters, 0);
+    graph->internal->pipeline_active = 0;
+
+    for (i = 0; i < p->nb_filters; i++)
+        if (p->rets[i] < 0) {
+            ret = p->rets[i];
+            break;
+        }
+    return ret;
+}
+
+void ff_graph_pipeline_lock(AVFilterGraph *graph)
+{
+    PipelineContext *p = graph->internal->pipeline;
+    pthread_mutex_lock(&p->lock);
+}
+
+void ff_graph_pipeline_unlock(AVFilterGraph *graph)
+{
+    PipelineContext *p = graph->internal->pipeline;
+    pthread_mutex_unlock(&p->lock);
+}
+
 void ff_graph_thread_free(AVFilterGraph *graph)
 {
+    if (graph->internal->pipeline)
+        pipeline_uninit(graph->internal->pipeline);
+    av_freep(&graph->internal->pipeline);
     if (graph->internal->thread)
         slice_thread_uninit(graph->internal->thread);
     av_freep(&graph->internal->thread);
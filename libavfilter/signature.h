@@ -140,6 +140,8 @@ typedef struct SignatureContext {
 
     uint8_t l1distlut[243*242/2]; /* 243 + 242 + 241 ... */
     StreamContext* streamcontexts;
+    uint64_t (*job_intpics)[32][32]; /* block sums of each job */
+    int nb_threads;
 } SignatureContext;
 
 
@@ -23,6 +23,24 @@
 
 int ff_graph_thread_init(AVFilterGraph *graph);
 
+/**
+ * Activate the ready filters of a graph, running as many of them
+ * concurrently as possible. Used instead of activating the single most
+ * urgent filter when the graph has AVFILTER_THREAD_PIPELINE enabled.
+ *
+ * @return the first error returned by an activated filter, 0 on success,
+ *         AVERROR(EAGAIN) if no filter is ready
+ */
+int ff_graph_pipeline_run_once(AVFilterGraph *graph);
+
+/**
+ * Lock and unlock the state shared between filters that may be activated
+ * concurrently, i.e. the ready status of the filters and the sink links
+ * heap. Only needed while AVFilterGraphInternal.pipeline_active is set.
+ */
+void ff_graph_pipeline_lock(AVFilterGraph *graph);
+void ff_graph_pipeline_unlock(AVFilterGraph *graph);
+
 void ff_graph_thread_free(AVFilterGraph *graph);
 
 #endif /* AVFILTER_THREAD_H */
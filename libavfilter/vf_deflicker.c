@@ -57,7 +57,7 @@ typedef struct DeflickerContext {
     int planewidth[4];
     int planeheight[4];
 
-    uint64_t *histogram;
+    int64_t *sum;
     float luminance[SIZE];
     float sorted[SIZE];
 
@@ -65,11 +65,15 @@ typedef struct DeflickerContext {
     int available;
 
     void (*get_factor)(AVFilterContext *ctx, float *f);
-    float (*calc_avgy)(AVFilterContext *ctx, AVFrame *in);
-    int (*deflicker)(AVFilterContext *ctx, const uint8_t *src, ptrdiff_t src_linesize,
-                     uint8_t *dst, ptrdiff_t dst_linesize, int w, int h, float f);
+    int (*calc_sum)(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs);
+    int (*deflicker)(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs);
 } DeflickerContext;
 
+typedef struct ThreadData {
+    AVFrame *in, *out;
+    float f;
+} ThreadData;
+
 #define OFFSET(x) offsetof(DeflickerContext, x)
 #define FLAGS AV_OPT_FLAG_VIDEO_PARAM|AV_OPT_FLAG_FILTERING_PARAM
 
@@ -114,14 +118,22 @@ static const enum AVPixelFormat pixel_fmts[] = {
     AV_PIX_FMT_NONE
 };
 
-static int deflicker8(AVFilterContext *ctx,
-                      const uint8_t *src, ptrdiff_t src_linesize,
-                      uint8_t *dst, ptrdiff_t dst_linesize,
-                      int w, int h, float f)
+static int deflicker8(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+    DeflickerContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int h = s->planeheight[0];
+    const int w = s->planewidth[0];
+    const int slice_start = (h * jobnr) / nb_jobs;
+    const int slice_end = (h * (jobnr+1)) / nb_jobs;
+    const ptrdiff_t src_linesize = td->in->linesize[0];
+    const ptrdiff_t dst_linesize = td->out->linesize[0];
+    const uint8_t *src = td->in->data[0] + slice_start * src_linesize;
+    uint8_t *dst = td->out->data[0] + slice_start * dst_linesize;
+    const float f = td->f;
     int x, y;
 
-    for (y = 0; y < h; y++) {
+    for (y = slice_start; y < slice_end; y++) {
         for (x = 0; x < w; x++) {
             dst[x] = av_clip_uint8(src[x] * f);
         }
@@ -133,71 +145,91 @@ static int deflicker8(AVFilterContext *ctx,
     return 0;
 }
 
-static int deflicker16(AVFilterContext *ctx,
-                       const uint8_t *ssrc, ptrdiff_t src_linesize,
-                       uint8_t *ddst, ptrdiff_t dst_linesize,
-                       int w, int h, float f)
+static int deflicker16(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
     DeflickerContext *s = ctx->priv;
-    const uint16_t *src = (const uint16_t *)ssrc;
-    uint16_t *dst = (uint16_t *)ddst;
+    ThreadData *td = arg;
+    const int h = s->planeheight[0];
+    const int w = s->planewidth[0];
+    const int slice_start = (h * jobnr) / nb_jobs;
+    const int slice_end = (h * (jobnr+1)) / nb_jobs;
+    const ptrdiff_t src_linesize = td->in->linesize[0] / 2;
+    const ptrdiff_t dst_linesize = td->out->linesize[0] / 2;
+    const uint16_t *src = (const uint16_t *)td->in->data[0] + slice_start * src_linesize;
+    uint16_t *dst = (uint16_t *)td->out->data[0] + slice_start * dst_linesize;
     const int max = (1 << s->depth) - 1;
+    const float f = td->f;
     int x, y;
 
-    for (y = 0; y < h; y++) {
+    for (y = slice_start; y < slice_end; y++) {
         for (x = 0; x < w; x++) {
             dst[x] = av_clip(src[x] * f, 0, max);
         }
 
-        dst += dst_linesize / 2;
-        src += src_linesize / 2;
+        dst += dst_linesize;
+        src += src_linesize;
     }
 
     return 0;
 }
 
-static float calc_avgy8(AVFilterContext *ctx, AVFrame *in)
+static int calc_sum8(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
     DeflickerContext *s = ctx->priv;
-    const uint8_t *src = in->data[0];
+    AVFrame *in = arg;
+    const int h = s->planeheight[0];
+    const int slice_start = (h * jobnr) / nb_jobs;
+    const int slice_end = (h * (jobnr+1)) / nb_jobs;
+    const uint8_t *src = in->data[0] + slice_start * in->linesize[0];
     int64_t sum = 0;
     int y, x;
 
-    memset(s->histogram, 0, (1 << s->depth) * sizeof(*s->histogram));
+    for (y = slice_start; y < slice_end; y++) {
+        unsigned line_sum = 0;
 
-    for (y = 0; y < s->planeheight[0]; y++) {
         for (x = 0; x < s->planewidth[0]; x++) {
-            s->histogram[src[x]]++;
+            line_sum += src[x];
         }
+        sum += line_sum;
         src += in->linesize[0];
     }
 
-    for (y = 0; y < 1 << s->depth; y++) {
-        sum += s->histogram[y] * y;
-    }
-
-    return 1.0f * sum / (s->planeheight[0] * s->planewidth[0]);
+    s->sum[jobnr] = sum;
+    return 0;
 }
 
-static float calc_avgy16(AVFilterContext *ctx, AVFrame *in)
+static int calc_sum16(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
     DeflickerContext *s = ctx->priv;
-    const uint16_t *src = (const uint16_t *)in->data[0];
+    AVFrame *in = arg;
+    const int h = s->planeheight[0];
+    const int slice_start = (h * jobnr) / nb_jobs;
+    const int slice_end = (h * (jobnr+1)) / nb_jobs;
+    const uint16_t *src = (const uint16_t *)(in->data[0] + slice_start * in->linesize[0]);
     int64_t sum = 0;
     int y, x;
 
-    memset(s->histogram, 0, (1 << s->depth) * sizeof(*s->histogram));
-
-    for (y = 0; y < s->planeheight[0]; y++) {
+    for (y = slice_start; y < slice_end; y++) {
         for (x = 0; x < s->planewidth[0]; x++) {
-            s->histogram[src[x]]++;
+            sum += src[x];
         }
         src += in->linesize[0] / 2;
     }
 
-    for (y = 0; y < 1 << s->depth; y++) {
-        sum += s->histogram[y] * y;
-    }
+    s->sum[jobnr] = sum;
+    return 0;
+}
+
+static float calc_avgy(AVFilterContext *ctx, AVFrame *in)
+{
+    DeflickerContext *s = ctx->priv;
+    const int nb_jobs = FFMIN(s->planeheight[0], ff_filter_get_nb_threads(ctx));
+    int64_t sum = 0;
+    int i;
+
+    ff_filter_execute(ctx, s->calc_sum, in, NULL, nb_jobs);
+    for (i = 0; i < nb_jobs; i++)
+        sum += s->sum[i];
 
     return 1.0f * sum / (s->planeheight[0] * s->planewidth[0]);
 }
@@ -327,14 +359,15 @@ static int config_input(AVFilterLink *inlink)
     s->depth = desc->comp[0].depth;
     if (s->depth == 8) {
         s->deflicker = deflicker8;
-        s->calc_avgy = calc_avgy8;
+        s->calc_sum  = calc_sum8;
     } else {
         s->deflicker = deflicker16;
-        s->calc_avgy = calc_avgy16;
+        s->calc_sum  = calc_sum16;
     }
 
-    s->histogram = av_calloc(1 << s->depth, sizeof(*s->histogram));
-    if (!s->histogram)
+    av_freep(&s->sum);
+    s->sum = av_calloc(ff_filter_get_nb_threads(ctx), sizeof(*s->sum));
+    if (!s->sum)
         return AVERROR(ENOMEM);
 
     switch (s->mode) {
@@ -357,11 +390,12 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *buf)
     DeflickerContext *s = ctx->priv;
     AVDictionary **metadata;
     AVFrame *out, *in;
+    ThreadData td;
     float f;
     int y;
 
     if (s->q.available < s->size && !s->eof) {
-        s->luminance[s->available] = s->calc_avgy(ctx, buf);
+        s->luminance[s->available] = calc_avgy(ctx, buf);
         ff_bufqueue_add(ctx, &s->q, buf);
         s->available++;
         return 0;
@@ -376,9 +410,13 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *buf)
     }
 
     s->get_factor(ctx, &f);
-    if (!s->bypass)
-        s->deflicker(ctx, in->data[0], in->linesize[0], out->data[0], out->linesize[0],
-                     outlink->w, outlink->h, f);
+    if (!s->bypass) {
+        td.in  = in;
+        td.out = out;
+        td.f   = f;
+        ff_filter_execute(ctx, s->deflicker, &td, NULL,
+                          FFMIN(s->planeheight[0], ff_filter_get_nb_threads(ctx)));
+    }
     for (y = 1 - s->bypass; y < s->nb_planes; y++) {
         av_image_copy_plane(out->data[y], out->linesize[y],
                             in->data[y], in->linesize[y],
@@ -403,7 +441,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *buf)
     in = ff_bufqueue_get(&s->q);
     av_frame_free(&in);
     memmove(&s->luminance[0], &s->luminance[1], sizeof(*s->luminance) * (s->size - 1));
-    s->luminance[s->available - 1] = s->calc_avgy(ctx, buf);
+    s->luminance[s->available - 1] = calc_avgy(ctx, buf);
     ff_bufqueue_add(ctx, &s->q, buf);
 
     return ff_filter_frame(outlink, out);
@@ -437,7 +475,7 @@ static av_cold void uninit(AVFilterContext *ctx)
     DeflickerContext *s = ctx->priv;
 
     ff_bufqueue_discard_all(&s->q);
-    av_freep(&s->histogram);
+    av_freep(&s->sum);
 }
 
 static const AVFilterPad inputs[] = {
@@ -466,4 +504,5 @@ const AVFilter ff_vf_deflicker = {
     FILTER_INPUTS(inputs),
     FILTER_OUTPUTS(outputs),
     FILTER_PIXFMTS_ARRAY(pixel_fmts),
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -88,6 +88,17 @@ static const AVOption deshake_options[] = {
 
 AVFILTER_DEFINE_CLASS(deshake);
 
+typedef struct ThreadData {
+    uint8_t *src1, *src2;
+    int stride;
+    int nb_blocks_x, nb_blocks_y;
+    const float *matrix[3];
+    int plane_w[3], plane_h[3];
+    enum InterpolateMethod interpolate;
+    enum FillMethod fill;
+    AVFrame *in, *out;
+} ThreadData;
+
 static int cmp(const void *a, const void *b)
 {
     return FFDIFFSIGN(*(const double *)a, *(const double *)b);
@@ -225,6 +236,42 @@ static double block_angle(int x, int y, int cx, int cy, IntMotionVector *shift)
            diff;
 }
 
+/**
+ * Find the most likely shift of every block of a band of block rows.
+ * Blocks skipped for their low contrast get the same (-1, -1) shift as
+ * blocks for which no good match was found.
+ */
+static int find_block_motions(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    DeshakeContext *deshake = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->nb_blocks_y * jobnr) / nb_jobs;
+    const int slice_end = (td->nb_blocks_y * (jobnr+1)) / nb_jobs;
+    IntMotionVector mv = {0, 0};
+    int bx, by, x, y;
+
+    for (by = slice_start; by < slice_end; by++) {
+        y = deshake->ry + by * deshake->blocksize * 2;
+        // We use a width of 16 here to match the sad function
+        for (bx = 0; bx < td->nb_blocks_x; bx++) {
+            IntMotionVector *block_mv = &deshake->block_mvs[bx + by * td->nb_blocks_x];
+
+            x = deshake->rx + bx * 16;
+            // If the contrast is too low, just skip this block as it probably
+            // won't be very useful to us.
+            if (block_contrast(td->src2, x, y, td->stride, deshake->blocksize) > deshake->contrast) {
+                find_block_motion(deshake, td->src1, td->src2, x, y, td->stride, &mv);
+                *block_mv = mv;
+            } else {
+                block_mv->x = -1;
+                block_mv->y = -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 /**
  * Find the estimated global motion for a scene given the most likely shift
  * for each block in the frame. The global motion is estimated to be the
@@ -232,13 +279,16 @@ static double block_angle(int x, int y, int cx, int cy, IntMotionVector *shift)
  * move one pixel to the right and two pixels down, this would yield a
  * motion vector (1, -2).
  */
-static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
-                        int width, int height, int stride, Transform *t)
+static int find_motion(AVFilterContext *ctx, uint8_t *src1, uint8_t *src2,
+                       int width, int height, int stride, Transform *t)
 {
-    int x, y;
-    IntMotionVector mv = {0, 0};
+    DeshakeContext *deshake = ctx->priv;
+    ThreadData td = { .src1 = src1, .src2 = src2, .stride = stride };
+    const int blocks_w = width - deshake->rx * 2 - 16;
+    const int blocks_h = height - deshake->ry * 2 - deshake->blocksize * 2;
+    int x, y, nb_jobs;
+    IntMotionVector *mv;
     int count_max_value = 0;
-    int contrast;
 
     int pos;
     int center_x = 0, center_y = 0;
@@ -246,6 +296,24 @@ static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
 
     av_fast_malloc(&deshake->angles, &deshake->angles_size, width * height / (16 * deshake->blocksize) * sizeof(*deshake->angles));
 
+    td.nb_blocks_x = blocks_w > 0 ? (blocks_w + 15) / 16 : 0;
+    td.nb_blocks_y = blocks_h > 0 ? (blocks_h + deshake->blocksize * 2 - 1) / (deshake->blocksize * 2) : 0;
+    if (td.nb_blocks_x && td.nb_blocks_y) {
+        av_fast_malloc(&deshake->block_mvs, &deshake->block_mvs_size,
+                       td.nb_blocks_x * td.nb_blocks_y * sizeof(*deshake->block_mvs));
+        if (!deshake->angles || !deshake->block_mvs)
+            return AVERROR(ENOMEM);
+
+        // Find motion for every block, in bands of block rows. Without a
+        // coarse search pass, the less exhaustive search starts from the
+        // shift of the previous block, so the blocks are then searched in
+        // a single job.
+        nb_jobs = FFMIN(td.nb_blocks_y, ff_filter_get_nb_threads(ctx));
+        if (deshake->search == SMART_EXHAUSTIVE && (!deshake->rx || !deshake->ry))
+            nb_jobs = 1;
+        ff_filter_execute(ctx, find_block_motions, &td, NULL, nb_jobs);
+    }
+
     // Reset counts to zero
     for (x = 0; x < deshake->rx * 2 + 1; x++) {
         for (y = 0; y < deshake->ry * 2 + 1; y++) {
@@ -254,24 +322,17 @@ static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
     }
 
     pos = 0;
-    // Find motion for every block and store the motion vector in the counts
+    // Store the motion vectors in the counts, in raster order
+    mv = deshake->block_mvs;
     for (y = deshake->ry; y < height - deshake->ry - (deshake->blocksize * 2); y += deshake->blocksize * 2) {
-        // We use a width of 16 here to match the sad function
-        for (x = deshake->rx; x < width - deshake->rx - 16; x += 16) {
-            // If the contrast is too low, just skip this block as it probably
-            // won't be very useful to us.
-            contrast = block_contrast(src2, x, y, stride, deshake->blocksize);
-            if (contrast > deshake->contrast) {
-                //av_log(NULL, AV_LOG_ERROR, "%d\n", contrast);
-                find_block_motion(deshake, src1, src2, x, y, stride, &mv);
-                if (mv.x != -1 && mv.y != -1) {
-                    deshake->counts[mv.x + deshake->rx][mv.y + deshake->ry] += 1;
-                    if (x > deshake->rx && y > deshake->ry)
-                        deshake->angles[pos++] = block_angle(x, y, 0, 0, &mv);
-
-                    center_x += mv.x;
-                    center_y += mv.y;
-                }
+        for (x = deshake->rx; x < width - deshake->rx - 16; x += 16, mv++) {
+            if (mv->x != -1 && mv->y != -1) {
+                deshake->counts[mv->x + deshake->rx][mv->y + deshake->ry] += 1;
+                if (x > deshake->rx && y > deshake->ry)
+                    deshake->angles[pos++] = block_angle(x, y, 0, 0, mv);
+
+                center_x += mv->x;
+                center_y += mv->y;
             }
         }
     }
@@ -310,6 +371,18 @@ static void find_motion(DeshakeContext *deshake, uint8_t *src1, uint8_t *src2,
     t->angle = av_clipf(t->angle, -0.1, 0.1);
 
     //av_log(NULL, AV_LOG_ERROR, "%d x %d\n", avg->x, avg->y);
+
+    return 0;
+}
+
+static int transform_plane(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ThreadData *td = arg;
+
+    return ff_affine_transform(td->in->data[jobnr], td->out->data[jobnr],
+                               td->in->linesize[jobnr], td->out->linesize[jobnr],
+                               td->plane_w[jobnr], td->plane_h[jobnr],
+                               td->matrix[jobnr], td->interpolate, td->fill);
 }
 
 static int deshake_transform_c(AVFilterContext *ctx,
@@ -318,25 +391,22 @@ static int deshake_transform_c(AVFilterContext *ctx,
                                     enum InterpolateMethod interpolate,
                                     enum FillMethod fill, AVFrame *in, AVFrame *out)
 {
-    int i = 0, ret = 0;
-    const float *matrixs[3];
-    int plane_w[3], plane_h[3];
-    matrixs[0] = matrix_y;
-    matrixs[1] =  matrixs[2] = matrix_uv;
-    plane_w[0] = width;
-    plane_w[1] = plane_w[2] = cw;
-    plane_h[0] = height;
-    plane_h[1] = plane_h[2] = ch;
-
-    for (i = 0; i < 3; i++) {
-        // Transform the luma and chroma planes
-        ret = ff_affine_transform(in->data[i], out->data[i], in->linesize[i],
-                                  out->linesize[i], plane_w[i], plane_h[i],
-                                  matrixs[i], interpolate, fill);
-        if (ret < 0)
-            return ret;
-    }
-    return ret;
+    ThreadData td = { .interpolate = interpolate, .fill = fill, .in = in, .out = out };
+    int i, ret[3];
+
+    td.matrix[0] = matrix_y;
+    td.matrix[1] = td.matrix[2] = matrix_uv;
+    td.plane_w[0] = width;
+    td.plane_w[1] = td.plane_w[2] = cw;
+    td.plane_h[0] = height;
+    td.plane_h[1] = td.plane_h[2] = ch;
+
+    // Transform the luma and chroma planes
+    ff_filter_execute(ctx, transform_plane, &td, ret, 3);
+    for (i = 0; i < 3; i++)
+        if (ret[i] < 0)
+            return ret[i];
+    return 0;
 }
 
 static av_cold int init(AVFilterContext *ctx)
@@ -397,6 +467,8 @@ static av_cold void uninit(AVFilterContext *ctx)
     av_frame_free(&deshake->ref);
     av_freep(&deshake->angles);
     deshake->angles_size = 0;
+    av_freep(&deshake->block_mvs);
+    deshake->block_mvs_size = 0;
     if (deshake->fp)
         fclose(deshake->fp);
 }
@@ -431,7 +503,7 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
 
     if (deshake->cx < 0 || deshake->cy < 0 || deshake->cw < 0 || deshake->ch < 0) {
         // Find the most likely global motion for the current frame
-        find_motion(deshake, (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0], in->data[0], link->w, link->h, in->linesize[0], &t);
+        ret = find_motion(link->dst, (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0], in->data[0], link->w, link->h, in->linesize[0], &t);
     } else {
         uint8_t *src1 = (deshake->ref == NULL) ? in->data[0] : deshake->ref->data[0];
         uint8_t *src2 = in->data[0];
@@ -448,8 +520,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
         src1 += deshake->cy * in->linesize[0] + deshake->cx;
         src2 += deshake->cy * in->linesize[0] + deshake->cx;
 
-        find_motion(deshake, src1, src2, deshake->cw, deshake->ch, in->linesize[0], &t);
+        ret = find_motion(link->dst, src1, src2, deshake->cw, deshake->ch, in->linesize[0], &t);
     }
+    if (ret < 0)
+        goto fail;
 
 
     // Copy transform so we can output it later to compare to the smoothed value
@@ -522,6 +596,7 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
 
     return ff_filter_frame(outlink, out);
 fail:
+    av_frame_free(&in);
     av_frame_free(&out);
     return ret;
 }
@@ -552,4 +627,5 @@ const AVFilter ff_vf_deshake = {
     FILTER_OUTPUTS(deshake_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .priv_class    = &deshake_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
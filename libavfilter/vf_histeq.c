@@ -47,6 +47,8 @@
 #define LCG(x) (((x) * LCG_A + LCG_C) % LCG_M)
 #define LCG_SEED 739187
 
+#define MAX_JOBS 32
+
 enum HisteqAntibanding {
     HISTEQ_ANTIBANDING_NONE   = 0,
     HISTEQ_ANTIBANDING_WEAK   = 1,
@@ -61,6 +63,8 @@ typedef struct HisteqContext {
     int antibanding;               ///< HisteqAntibanding
     int in_histogram [256];        ///< input histogram
     int out_histogram[256];        ///< output histogram
+    int jobs_in_histogram [MAX_JOBS][256]; ///< input histogram of each job
+    int jobs_out_histogram[MAX_JOBS][256]; ///< output histogram of each job
     int LUT[256];                  ///< lookup table derived from histogram[]
     uint8_t rgba_map[4];           ///< components position
     int bpp;                       ///< bytes per pixel
@@ -122,77 +126,70 @@ static int config_input(AVFilterLink *inlink)
     b = src[x + map[B]];                       \
 } while (0)
 
-static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
-{
-    AVFilterContext   *ctx     = inlink->dst;
-    HisteqContext     *histeq  = ctx->priv;
-    AVFilterLink      *outlink = ctx->outputs[0];
-    int strength  = histeq->strength  * 1000;
-    int intensity = histeq->intensity * 1000;
-    int x, y, i, luthi, lutlo, lut, luma, oluma, m;
-    AVFrame *outpic;
-    unsigned int r, g, b, jran;
-    uint8_t *src, *dst;
-
-    outpic = ff_get_video_buffer(outlink, outlink->w, outlink->h);
-    if (!outpic) {
-        av_frame_free(&inpic);
-        return AVERROR(ENOMEM);
-    }
-    av_frame_copy_props(outpic, inpic);
-
-    /* Seed random generator for antibanding. */
-    jran = LCG_SEED;
+typedef struct ThreadData {
+    AVFrame *in, *out;
+} ThreadData;
 
-    /* Calculate and store the luminance and calculate the global histogram
-       based on the luminance. */
-    memset(histeq->in_histogram, 0, sizeof(histeq->in_histogram));
-    src = inpic->data[0];
-    dst = outpic->data[0];
-    for (y = 0; y < inlink->h; y++) {
-        for (x = 0; x < inlink->w * histeq->bpp; x += histeq->bpp) {
+static int compute_histogram(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    HisteqContext *histeq = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *in = td->in;
+    const int slice_start = (in->height * jobnr) / nb_jobs;
+    const int slice_end = (in->height * (jobnr+1)) / nb_jobs;
+    int *histogram = histeq->jobs_in_histogram[jobnr];
+    unsigned int r, g, b;
+    const uint8_t *src;
+    int x, y, luma;
+
+    memset(histogram, 0, sizeof(histeq->jobs_in_histogram[0]));
+    src = in->data[0] + slice_start * in->linesize[0];
+    for (y = slice_start; y < slice_end; y++) {
+        for (x = 0; x < in->width * histeq->bpp; x += histeq->bpp) {
             GET_RGB_VALUES(r, g, b, src, histeq->rgba_map);
             luma = (55 * r + 182 * g + 19 * b) >> 8;
-            dst[x + histeq->rgba_map[A]] = luma;
-            histeq->in_histogram[luma]++;
+            histogram[luma]++;
         }
-        src += inpic->linesize[0];
-        dst += outpic->linesize[0];
+        src += in->linesize[0];
     }
 
-#ifdef DEBUG
-    for (x = 0; x < 256; x++)
-        ff_dlog(ctx, "in[%d]: %u\n", x, histeq->in_histogram[x]);
-#endif
-
-    /* Calculate the lookup table. */
-    histeq->LUT[0] = histeq->in_histogram[0];
-    /* Accumulate */
-    for (x = 1; x < 256; x++)
-        histeq->LUT[x] = histeq->LUT[x-1] + histeq->in_histogram[x];
-
-    /* Normalize */
-    for (x = 0; x < 256; x++)
-        histeq->LUT[x] = (histeq->LUT[x] * intensity) / (inlink->h * inlink->w);
+    return 0;
+}
 
-    /* Adjust the LUT based on the selected strength. This is an alpha
-       mix of the calculated LUT and a linear LUT with gain 1. */
-    for (x = 0; x < 256; x++)
-        histeq->LUT[x] = (strength * histeq->LUT[x]) / 255 +
-                         ((255 - strength) * x)      / 255;
+/**
+ * Output the equalized pixels of a band of rows. The luminance is
+ * recomputed from the input, and stored in the alpha component of the
+ * formats which have one.
+ */
+static int equalize_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    HisteqContext *histeq = ctx->priv;
+    ThreadData *td = arg;
+    AVFrame *in = td->in, *out = td->out;
+    const int slice_start = (in->height * jobnr) / nb_jobs;
+    const int slice_end = (in->height * (jobnr+1)) / nb_jobs;
+    const int has_alpha = histeq->bpp == 4;
+    int *histogram = histeq->jobs_out_histogram[jobnr];
+    int x, y, i, luthi, lutlo, lut, luma, oluma, m;
+    unsigned int r, g, b, jran;
+    const uint8_t *src;
+    uint8_t *dst;
 
-    /* Output the equalized frame. */
-    memset(histeq->out_histogram, 0, sizeof(histeq->out_histogram));
+    /* Seed random generator for antibanding. It is only used with a
+       single job, as the sequence depends on all the previous pixels. */
+    jran = LCG_SEED;
 
-    src = inpic->data[0];
-    dst = outpic->data[0];
-    for (y = 0; y < inlink->h; y++) {
-        for (x = 0; x < inlink->w * histeq->bpp; x += histeq->bpp) {
-            luma = dst[x + histeq->rgba_map[A]];
+    memset(histogram, 0, sizeof(histeq->jobs_out_histogram[0]));
+    src = in->data[0] + slice_start * in->linesize[0];
+    dst = out->data[0] + slice_start * out->linesize[0];
+    for (y = slice_start; y < slice_end; y++) {
+        for (x = 0; x < in->width * histeq->bpp; x += histeq->bpp) {
+            GET_RGB_VALUES(r, g, b, src, histeq->rgba_map);
+            luma = (55 * r + 182 * g + 19 * b) >> 8;
             if (luma == 0) {
                 for (i = 0; i < histeq->bpp; ++i)
                     dst[x + i] = 0;
-                histeq->out_histogram[0]++;
+                histogram[0]++;
             } else {
                 lut = histeq->LUT[luma];
                 if (histeq->antibanding != HISTEQ_ANTIBANDING_NONE) {
@@ -216,7 +213,6 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
                     }
                 }
 
-                GET_RGB_VALUES(r, g, b, src, histeq->rgba_map);
                 if (((m = FFMAX3(r, g, b)) * lut) / luma > 255) {
                     r = (r * 255) / m;
                     g = (g * 255) / m;
@@ -229,13 +225,77 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
                 dst[x + histeq->rgba_map[R]] = r;
                 dst[x + histeq->rgba_map[G]] = g;
                 dst[x + histeq->rgba_map[B]] = b;
+                if (has_alpha)
+                    dst[x + histeq->rgba_map[A]] = luma;
                 oluma = av_clip_uint8((55 * r + 182 * g + 19 * b) >> 8);
-                histeq->out_histogram[oluma]++;
+                histogram[oluma]++;
             }
         }
-        src += inpic->linesize[0];
-        dst += outpic->linesize[0];
+        src += in->linesize[0];
+        dst += out->linesize[0];
     }
+
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
+{
+    AVFilterContext   *ctx     = inlink->dst;
+    HisteqContext     *histeq  = ctx->priv;
+    AVFilterLink      *outlink = ctx->outputs[0];
+    int strength  = histeq->strength  * 1000;
+    int intensity = histeq->intensity * 1000;
+    int nb_jobs = FFMIN3(MAX_JOBS, inlink->h, ff_filter_get_nb_threads(ctx));
+    int x, j;
+    AVFrame *outpic;
+    ThreadData td;
+
+    outpic = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+    if (!outpic) {
+        av_frame_free(&inpic);
+        return AVERROR(ENOMEM);
+    }
+    av_frame_copy_props(outpic, inpic);
+    td.in  = inpic;
+    td.out = outpic;
+
+    /* Calculate the global histogram based on the luminance. */
+    ff_filter_execute(ctx, compute_histogram, &td, NULL, nb_jobs);
+    memset(histeq->in_histogram, 0, sizeof(histeq->in_histogram));
+    for (j = 0; j < nb_jobs; j++)
+        for (x = 0; x < 256; x++)
+            histeq->in_histogram[x] += histeq->jobs_in_histogram[j][x];
+
+#ifdef DEBUG
+    for (x = 0; x < 256; x++)
+        ff_dlog(ctx, "in[%d]: %u\n", x, histeq->in_histogram[x]);
+#endif
+
+    /* Calculate the lookup table. */
+    histeq->LUT[0] = histeq->in_histogram[0];
+    /* Accumulate */
+    for (x = 1; x < 256; x++)
+        histeq->LUT[x] = histeq->LUT[x-1] + histeq->in_histogram[x];
+
+    /* Normalize */
+    for (x = 0; x < 256; x++)
+        histeq->LUT[x] = (histeq->LUT[x] * intensity) / (inlink->h * inlink->w);
+
+    /* Adjust the LUT based on the selected strength. This is an alpha
+       mix of the calculated LUT and a linear LUT with gain 1. */
+    for (x = 0; x < 256; x++)
+        histeq->LUT[x] = (strength * histeq->LUT[x]) / 255 +
+                         ((255 - strength) * x)      / 255;
+
+    /* Output the equalized frame. */
+    if (histeq->antibanding != HISTEQ_ANTIBANDING_NONE)
+        nb_jobs = 1;
+    ff_filter_execute(ctx, equalize_slice, &td, NULL, nb_jobs);
+    memset(histeq->out_histogram, 0, sizeof(histeq->out_histogram));
+    for (j = 0; j < nb_jobs; j++)
+        for (x = 0; x < 256; x++)
+            histeq->out_histogram[x] += histeq->jobs_out_histogram[j][x];
+
 #ifdef DEBUG
     for (x = 0; x < 256; x++)
         ff_dlog(ctx, "out[%d]: %u\n", x, histeq->out_histogram[x]);
@@ -270,5 +330,5 @@ const AVFilter ff_vf_histeq = {
     FILTER_OUTPUTS(histeq_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .priv_class    = &histeq_class,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
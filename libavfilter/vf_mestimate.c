@@ -118,18 +118,6 @@ static void add_mv_data(AVMotionVector *mv, int mb_size,
     mv->flags = 0;
 }
 
-#define SEARCH_MV(method)\
-    do {\
-        for (mb_y = 0; mb_y < s->b_height; mb_y++)\
-            for (mb_x = 0; mb_x < s->b_width; mb_x++) {\
-                const int x_mb = mb_x << s->log2_mb_size;\
-                const int y_mb = mb_y << s->log2_mb_size;\
-                int mv[2] = {x_mb, y_mb};\
-                ff_me_search_##method(me_ctx, x_mb, y_mb, mv);\
-                add_mv_data(((AVMotionVector *) sd->data) + mv_count++, me_ctx->mb_size, x_mb, y_mb, mv[0], mv[1], dir);\
-            }\
-    } while (0)
-
 #define ADD_PRED(preds, px, py)\
     do {\
         preds.mvs[preds.nb][0] = px;\
@@ -137,15 +125,190 @@ static void add_mv_data(AVMotionVector *mv, int mb_size,
         preds.nb++;\
     } while(0)
 
+typedef struct ThreadData {
+    AVMotionVector *mvs;
+    int dir;
+    int wave;
+} ThreadData;
+
+static void search_mv(MEContext *s, AVMotionEstContext *me_ctx, AVMotionVector *mvs,
+                      int mb_x, int mb_y, int dir)
+{
+    AVMotionEstPredictor *preds = me_ctx->preds;
+    const int mb_i = mb_x + mb_y * s->b_width;
+    const int x_mb = mb_x << s->log2_mb_size;
+    const int y_mb = mb_y << s->log2_mb_size;
+    int mv[2] = {x_mb, y_mb};
+
+    switch (s->method) {
+        case AV_ME_METHOD_DS:
+            ff_me_search_ds(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_ESA:
+            ff_me_search_esa(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_FSS:
+            ff_me_search_fss(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_NTSS:
+            ff_me_search_ntss(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_TDLS:
+            ff_me_search_tdls(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_TSS:
+            ff_me_search_tss(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_HEXBS:
+            ff_me_search_hexbs(me_ctx, x_mb, y_mb, mv);
+            break;
+        case AV_ME_METHOD_UMH:
+            preds[0].nb = 0;
+
+            ADD_PRED(preds[0], 0, 0);
+
+            //left mb in current frame
+            if (mb_x > 0)
+                ADD_PRED(preds[0], s->mv_table[0][mb_i - 1][dir][0], s->mv_table[0][mb_i - 1][dir][1]);
+
+            if (mb_y > 0) {
+                //top mb in current frame
+                ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width][dir][0], s->mv_table[0][mb_i - s->b_width][dir][1]);
+
+                //top-right mb in current frame
+                if (mb_x + 1 < s->b_width)
+                    ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width + 1][dir][0], s->mv_table[0][mb_i - s->b_width + 1][dir][1]);
+                //top-left mb in current frame
+                else if (mb_x > 0)
+                    ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width - 1][dir][0], s->mv_table[0][mb_i - s->b_width - 1][dir][1]);
+            }
+
+            //median predictor
+            if (preds[0].nb == 4) {
+                me_ctx->pred_x = mid_pred(preds[0].mvs[1][0], preds[0].mvs[2][0], preds[0].mvs[3][0]);
+                me_ctx->pred_y = mid_pred(preds[0].mvs[1][1], preds[0].mvs[2][1], preds[0].mvs[3][1]);
+            } else if (preds[0].nb == 3) {
+                me_ctx->pred_x = mid_pred(0, preds[0].mvs[1][0], preds[0].mvs[2][0]);
+                me_ctx->pred_y = mid_pred(0, preds[0].mvs[1][1], preds[0].mvs[2][1]);
+            } else if (preds[0].nb == 2) {
+                me_ctx->pred_x = preds[0].mvs[1][0];
+                me_ctx->pred_y = preds[0].mvs[1][1];
+            } else {
+                me_ctx->pred_x = 0;
+                me_ctx->pred_y = 0;
+            }
+
+            ff_me_search_umh(me_ctx, x_mb, y_mb, mv);
+
+            s->mv_table[0][mb_i][dir][0] = mv[0] - x_mb;
+            s->mv_table[0][mb_i][dir][1] = mv[1] - y_mb;
+            break;
+        case AV_ME_METHOD_EPZS:
+            preds[0].nb = 0;
+            preds[1].nb = 0;
+
+            ADD_PRED(preds[0], 0, 0);
+
+            //left mb in current frame
+            if (mb_x > 0)
+                ADD_PRED(preds[0], s->mv_table[0][mb_i - 1][dir][0], s->mv_table[0][mb_i - 1][dir][1]);
+
+            //top mb in current frame
+            if (mb_y > 0)
+                ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width][dir][0], s->mv_table[0][mb_i - s->b_width][dir][1]);
+
+            //top-right mb in current frame
+            if (mb_y > 0 && mb_x + 1 < s->b_width)
+                ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width + 1][dir][0], s->mv_table[0][mb_i - s->b_width + 1][dir][1]);
+
+            //median predictor
+            if (preds[0].nb == 4) {
+                me_ctx->pred_x = mid_pred(preds[0].mvs[1][0], preds[0].mvs[2][0], preds[0].mvs[3][0]);
+                me_ctx->pred_y = mid_pred(preds[0].mvs[1][1], preds[0].mvs[2][1], preds[0].mvs[3][1]);
+            } else if (preds[0].nb == 3) {
+                me_ctx->pred_x = mid_pred(0, preds[0].mvs[1][0], preds[0].mvs[2][0]);
+                me_ctx->pred_y = mid_pred(0, preds[0].mvs[1][1], preds[0].mvs[2][1]);
+            } else if (preds[0].nb == 2) {
+                me_ctx->pred_x = preds[0].mvs[1][0];
+                me_ctx->pred_y = preds[0].mvs[1][1];
+            } else {
+                me_ctx->pred_x = 0;
+                me_ctx->pred_y = 0;
+            }
+
+            //collocated mb in prev frame
+            ADD_PRED(preds[0], s->mv_table[1][mb_i][dir][0], s->mv_table[1][mb_i][dir][1]);
+
+            //accelerator motion vector of collocated block in prev frame
+            ADD_PRED(preds[1], s->mv_table[1][mb_i][dir][0] + (s->mv_table[1][mb_i][dir][0] - s->mv_table[2][mb_i][dir][0]),
+                               s->mv_table[1][mb_i][dir][1] + (s->mv_table[1][mb_i][dir][1] - s->mv_table[2][mb_i][dir][1]));
+
+            //left mb in prev frame
+            if (mb_x > 0)
+                ADD_PRED(preds[1], s->mv_table[1][mb_i - 1][dir][0], s->mv_table[1][mb_i - 1][dir][1]);
+
+            //top mb in prev frame
+            if (mb_y > 0)
+                ADD_PRED(preds[1], s->mv_table[1][mb_i - s->b_width][dir][0], s->mv_table[1][mb_i - s->b_width][dir][1]);
+
+            //right mb in prev frame
+            if (mb_x + 1 < s->b_width)
+                ADD_PRED(preds[1], s->mv_table[1][mb_i + 1][dir][0], s->mv_table[1][mb_i + 1][dir][1]);
+
+            //bottom mb in prev frame
+            if (mb_y + 1 < s->b_height)
+                ADD_PRED(preds[1], s->mv_table[1][mb_i + s->b_width][dir][0], s->mv_table[1][mb_i + s->b_width][dir][1]);
+
+            ff_me_search_epzs(me_ctx, x_mb, y_mb, mv);
+
+            s->mv_table[0][mb_i][dir][0] = mv[0] - x_mb;
+            s->mv_table[0][mb_i][dir][1] = mv[1] - y_mb;
+            break;
+    }
+
+    add_mv_data(mvs + dir * s->b_count + mb_i, s->mb_size, x_mb, y_mb, mv[0], mv[1], dir);
+}
+
+static int search_mv_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    MEContext *s = ctx->priv;
+    ThreadData *td = arg;
+    AVMotionEstContext me_ctx = s->me_ctx;
+    const int slice_start = (s->b_height * jobnr) / nb_jobs;
+    const int slice_end = (s->b_height * (jobnr+1)) / nb_jobs;
+    int mb_x, mb_y;
+
+    for (mb_y = slice_start; mb_y < slice_end; mb_y++)
+        for (mb_x = 0; mb_x < s->b_width; mb_x++)
+            search_mv(s, &me_ctx, td->mvs, mb_x, mb_y, td->dir);
+
+    return 0;
+}
+
+static int search_mv_wave(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    MEContext *s = ctx->priv;
+    ThreadData *td = arg;
+    AVMotionEstContext me_ctx = s->me_ctx;
+    const int first = FFMAX(0, (td->wave - s->b_width + 2) / 2);
+    const int last = FFMIN(s->b_height - 1, td->wave / 2);
+    int mb_y;
+
+    for (mb_y = first + jobnr; mb_y <= last; mb_y += nb_jobs)
+        search_mv(s, &me_ctx, td->mvs, td->wave - 2 * mb_y, mb_y, td->dir);
+
+    return 0;
+}
+
 static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
 {
     AVFilterContext *ctx = inlink->dst;
     MEContext *s = ctx->priv;
     AVMotionEstContext *me_ctx = &s->me_ctx;
+    const int nb_threads = ff_filter_get_nb_threads(ctx);
     AVFrameSideData *sd;
     AVFrame *out;
-    int mb_x, mb_y, dir;
-    int32_t mv_count = 0;
+    ThreadData td;
     int ret;
 
     if (frame->pts == AV_NOPTS_VALUE) {
@@ -182,146 +345,27 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *frame)
 
     me_ctx->data_cur = s->cur->data[0];
     me_ctx->linesize = s->cur->linesize[0];
-
-    for (dir = 0; dir < 2; dir++) {
-        me_ctx->data_ref = (dir ? s->next : s->prev)->data[0];
-
-        if (s->method == AV_ME_METHOD_DS)
-            SEARCH_MV(ds);
-        else if (s->method == AV_ME_METHOD_ESA)
-            SEARCH_MV(esa);
-        else if (s->method == AV_ME_METHOD_FSS)
-            SEARCH_MV(fss);
-        else if (s->method == AV_ME_METHOD_NTSS)
-            SEARCH_MV(ntss);
-        else if (s->method == AV_ME_METHOD_TDLS)
-            SEARCH_MV(tdls);
-        else if (s->method == AV_ME_METHOD_TSS)
-            SEARCH_MV(tss);
-        else if (s->method == AV_ME_METHOD_HEXBS)
-            SEARCH_MV(hexbs);
-        else if (s->method == AV_ME_METHOD_UMH) {
-            for (mb_y = 0; mb_y < s->b_height; mb_y++)
-                for (mb_x = 0; mb_x < s->b_width; mb_x++) {
-                    const int mb_i = mb_x + mb_y * s->b_width;
-                    const int x_mb = mb_x << s->log2_mb_size;
-                    const int y_mb = mb_y << s->log2_mb_size;
-                    int mv[2] = {x_mb, y_mb};
-
-                    AVMotionEstPredictor *preds = me_ctx->preds;
-                    preds[0].nb = 0;
-
-                    ADD_PRED(preds[0], 0, 0);
-
-                    //left mb in current frame
-                    if (mb_x > 0)
-                        ADD_PRED(preds[0], s->mv_table[0][mb_i - 1][dir][0], s->mv_table[0][mb_i - 1][dir][1]);
-
-                    if (mb_y > 0) {
-                        //top mb in current frame
-                        ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width][dir][0], s->mv_table[0][mb_i - s->b_width][dir][1]);
-
-                        //top-right mb in current frame
-                        if (mb_x + 1 < s->b_width)
-                            ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width + 1][dir][0], s->mv_table[0][mb_i - s->b_width + 1][dir][1]);
-                        //top-left mb in current frame
-                        else if (mb_x > 0)
-                            ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width - 1][dir][0], s->mv_table[0][mb_i - s->b_width - 1][dir][1]);
-                    }
-
-                    //median predictor
-                    if (preds[0].nb == 4) {
-                        me_ctx->pred_x = mid_pred(preds[0].mvs[1][0], preds[0].mvs[2][0], preds[0].mvs[3][0]);
-                        me_ctx->pred_y = mid_pred(preds[0].mvs[1][1], preds[0].mvs[2][1], preds[0].mvs[3][1]);
-                    } else if (preds[0].nb == 3) {
-                        me_ctx->pred_x = mid_pred(0, preds[0].mvs[1][0], preds[0].mvs[2][0]);
-                        me_ctx->pred_y = mid_pred(0, preds[0].mvs[1][1], preds[0].mvs[2][1]);
-                    } else if (preds[0].nb == 2) {
-                        me_ctx->pred_x = preds[0].mvs[1][0];
-                        me_ctx->pred_y = preds[0].mvs[1][1];
-                    } else {
-                        me_ctx->pred_x = 0;
-                        me_ctx->pred_y = 0;
-                    }
-
-                    ff_me_search_umh(me_ctx, x_mb, y_mb, mv);
-
-                    s->mv_table[0][mb_i][dir][0] = mv[0] - x_mb;
-                    s->mv_table[0][mb_i][dir][1] = mv[1] - y_mb;
-                    add_mv_data(((AVMotionVector *) sd->data) + mv_count++, me_ctx->mb_size, x_mb, y_mb, mv[0], mv[1], dir);
-                }
-
-        } else if (s->method == AV_ME_METHOD_EPZS) {
-
-            for (mb_y = 0; mb_y < s->b_height; mb_y++)
-                for (mb_x = 0; mb_x < s->b_width; mb_x++) {
-                    const int mb_i = mb_x + mb_y * s->b_width;
-                    const int x_mb = mb_x << s->log2_mb_size;
-                    const int y_mb = mb_y << s->log2_mb_size;
-                    int mv[2] = {x_mb, y_mb};
-
-                    AVMotionEstPredictor *preds = me_ctx->preds;
-                    preds[0].nb = 0;
-                    preds[1].nb = 0;
-
-                    ADD_PRED(preds[0], 0, 0);
-
-                    //left mb in current frame
-                    if (mb_x > 0)
-                        ADD_PRED(preds[0], s->mv_table[0][mb_i - 1][dir][0], s->mv_table[0][mb_i - 1][dir][1]);
-
-                    //top mb in current frame
-                    if (mb_y > 0)
-                        ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width][dir][0], s->mv_table[0][mb_i - s->b_width][dir][1]);
-
-                    //top-right mb in current frame
-                    if (mb_y > 0 && mb_x + 1 < s->b_width)
-                        ADD_PRED(preds[0], s->mv_table[0][mb_i - s->b_width + 1][dir][0], s->mv_table[0][mb_i - s->b_width + 1][dir][1]);
-
-                    //median predictor
-                    if (preds[0].nb == 4) {
-                        me_ctx->pred_x = mid_pred(preds[0].mvs[1][0], preds[0].mvs[2][0], preds[0].mvs[3][0]);
-                        me_ctx->pred_y = mid_pred(preds[0].mvs[1][1], preds[0].mvs[2][1], preds[0].mvs[3][1]);
-                    } else if (preds[0].nb == 3) {
-                        me_ctx->pred_x = mid_pred(0, preds[0].mvs[1][0], preds[0].mvs[2][0]);
-                        me_ctx->pred_y = mid_pred(0, preds[0].mvs[1][1], preds[0].mvs[2][1]);
-                    } else if (preds[0].nb == 2) {
-                        me_ctx->pred_x = preds[0].mvs[1][0];
-                        me_ctx->pred_y = preds[0].mvs[1][1];
-                    } else {
-                        me_ctx->pred_x = 0;
-                        me_ctx->pred_y = 0;
-                    }
-
-                    //collocated mb in prev frame
-                    ADD_PRED(preds[0], s->mv_table[1][mb_i][dir][0], s->mv_table[1][mb_i][dir][1]);
-
-                    //accelerator motion vector of collocated block in prev frame
-                    ADD_PRED(preds[1], s->mv_table[1][mb_i][dir][0] + (s->mv_table[1][mb_i][dir][0] - s->mv_table[2][mb_i][dir][0]),
-                                       s->mv_table[1][mb_i][dir][1] + (s->mv_table[1][mb_i][dir][1] - s->mv_table[2][mb_i][dir][1]));
-
-                    //left mb in prev frame
-                    if (mb_x > 0)
-                        ADD_PRED(preds[1], s->mv_table[1][mb_i - 1][dir][0], s->mv_table[1][mb_i - 1][dir][1]);
-
-                    //top mb in prev frame
-                    if (mb_y > 0)
-                        ADD_PRED(preds[1], s->mv_table[1][mb_i - s->b_width][dir][0], s->mv_table[1][mb_i - s->b_width][dir][1]);
-
-                    //right mb in prev frame
-                    if (mb_x + 1 < s->b_width)
-                        ADD_PRED(preds[1], s->mv_table[1][mb_i + 1][dir][0], s->mv_table[1][mb_i + 1][dir][1]);
-
-                    //bottom mb in prev frame
-                    if (mb_y + 1 < s->b_height)
-                        ADD_PRED(preds[1], s->mv_table[1][mb_i + s->b_width][dir][0], s->mv_table[1][mb_i + s->b_width][dir][1]);
-
-                    ff_me_search_epzs(me_ctx, x_mb, y_mb, mv);
-
-                    s->mv_table[0][mb_i][dir][0] = mv[0] - x_mb;
-                    s->mv_table[0][mb_i][dir][1] = mv[1] - y_mb;
-                    add_mv_data(((AVMotionVector *) sd->data) + mv_count++, s->mb_size, x_mb, y_mb, mv[0], mv[1], dir);
-                }
+    td.mvs = (AVMotionVector *)sd->data;
+
+    for (td.dir = 0; td.dir < 2; td.dir++) {
+        me_ctx->data_ref = (td.dir ? s->next : s->prev)->data[0];
+
+        if (s->method == AV_ME_METHOD_UMH || s->method == AV_ME_METHOD_EPZS) {
+            /* The spatial predictors come from the left, top and top-right
+             * (or top-left) blocks, so the blocks of a wave mb_x + 2 * mb_y
+             * only depend on the previous waves. */
+            const int nb_waves = s->b_width + 2 * (s->b_height - 1);
+
+            for (td.wave = 0; td.wave < nb_waves; td.wave++) {
+                const int first = FFMAX(0, (td.wave - s->b_width + 2) / 2);
+                const int last = FFMIN(s->b_height - 1, td.wave / 2);
+
+                ff_filter_execute(ctx, search_mv_wave, &td, NULL,
+                                  FFMIN(last - first + 1, nb_threads));
+            }
+        } else {
+            ff_filter_execute(ctx, search_mv_slice, &td, NULL,
+                              FFMIN(s->b_height, nb_threads));
         }
     }
 
@@ -363,7 +407,7 @@ const AVFilter ff_vf_mestimate = {
     .priv_size     = sizeof(MEContext),
     .priv_class    = &mestimate_class,
     .uninit        = uninit,
-    .flags         = AVFILTER_FLAG_METADATA_ONLY,
+    .flags         = AVFILTER_FLAG_METADATA_ONLY | AVFILTER_FLAG_SLICE_THREADS,
     FILTER_INPUTS(mestimate_inputs),
     FILTER_OUTPUTS(mestimate_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
@@ -143,54 +143,130 @@ static inline void compose(float *dst, const float *src_l, const float *src_h,
     }
 }
 
-static inline void decompose2D(float *dst_l, float *dst_h, const float *src,
-                               int xlinesize, int ylinesize,
-                               int step, int w, int h)
+typedef struct ThreadData {
+    float *dst[2];
+    const float *src[2];
+    int xlinesize, ylinesize;
+    int step, w, h;
+    int depth;
+    double strength;
+} ThreadData;
+
+static int decompose2D_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+    ThreadData *td = arg;
+    const int slice_start = (td->h * jobnr) / nb_jobs;
+    const int slice_end = (td->h * (jobnr+1)) / nb_jobs;
+    const int xlinesize = td->xlinesize, ylinesize = td->ylinesize;
+    const int step = td->step, w = td->w;
     int y, x;
-    for (y = 0; y < h; y++)
+
+    for (y = slice_start; y < slice_end; y++)
         for (x = 0; x < step; x++)
-            decompose(dst_l + ylinesize*y + xlinesize*x,
-                      dst_h + ylinesize*y + xlinesize*x,
-                      src   + ylinesize*y + xlinesize*x,
+            decompose(td->dst[0] + ylinesize*y + xlinesize*x,
+                      td->dst[1] + ylinesize*y + xlinesize*x,
+                      td->src[0] + ylinesize*y + xlinesize*x,
                       step * xlinesize, (w - x + step - 1) / step);
+    return 0;
 }
 
-static inline void compose2D(float *dst, const float *src_l, const float *src_h,
-                             int xlinesize, int ylinesize,
-                             int step, int w, int h)
+static int compose2D_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+    ThreadData *td = arg;
+    const int slice_start = (td->h * jobnr) / nb_jobs;
+    const int slice_end = (td->h * (jobnr+1)) / nb_jobs;
+    const int xlinesize = td->xlinesize, ylinesize = td->ylinesize;
+    const int step = td->step, w = td->w;
     int y, x;
-    for (y = 0; y < h; y++)
+
+    for (y = slice_start; y < slice_end; y++)
         for (x = 0; x < step; x++)
-            compose(dst   + ylinesize*y + xlinesize*x,
-                    src_l + ylinesize*y + xlinesize*x,
-                    src_h + ylinesize*y + xlinesize*x,
+            compose(td->dst[0] + ylinesize*y + xlinesize*x,
+                    td->src[0] + ylinesize*y + xlinesize*x,
+                    td->src[1] + ylinesize*y + xlinesize*x,
                     step * xlinesize, (w - x + step - 1) / step);
+    return 0;
+}
+
+/**
+ * The lines of a 2D (de)composition pass are independent, so they are
+ * split between the jobs.
+ */
+static inline void decompose2D(AVFilterContext *ctx,
+                               float *dst_l, float *dst_h, const float *src,
+                               int xlinesize, int ylinesize,
+                               int step, int w, int h)
+{
+    ThreadData td = { .dst = { dst_l, dst_h }, .src = { src },
+                      .xlinesize = xlinesize, .ylinesize = ylinesize,
+                      .step = step, .w = w, .h = h };
+
+    ff_filter_execute(ctx, decompose2D_slice, &td, NULL,
+                      FFMIN(h, ff_filter_get_nb_threads(ctx)));
 }
 
-static void decompose2D2(float *dst[4], float *src, float *temp[2],
+static inline void compose2D(AVFilterContext *ctx,
+                             float *dst, const float *src_l, const float *src_h,
+                             int xlinesize, int ylinesize,
+                             int step, int w, int h)
+{
+    ThreadData td = { .dst = { dst }, .src = { src_l, src_h },
+                      .xlinesize = xlinesize, .ylinesize = ylinesize,
+                      .step = step, .w = w, .h = h };
+
+    ff_filter_execute(ctx, compose2D_slice, &td, NULL,
+                      FFMIN(h, ff_filter_get_nb_threads(ctx)));
+}
+
+static void decompose2D2(AVFilterContext *ctx, float *dst[4], float *src, float *temp[2],
                          int linesize, int step, int w, int h)
 {
-    decompose2D(temp[0], temp[1], src,     1, linesize, step, w, h);
-    decompose2D( dst[0],  dst[1], temp[0], linesize, 1, step, h, w);
-    decompose2D( dst[2],  dst[3], temp[1], linesize, 1, step, h, w);
+    decompose2D(ctx, temp[0], temp[1], src,     1, linesize, step, w, h);
+    decompose2D(ctx,  dst[0],  dst[1], temp[0], linesize, 1, step, h, w);
+    decompose2D(ctx,  dst[2],  dst[3], temp[1], linesize, 1, step, h, w);
 }
 
-static void compose2D2(float *dst, float *src[4], float *temp[2],
+static void compose2D2(AVFilterContext *ctx, float *dst, float *src[4], float *temp[2],
                        int linesize, int step, int w, int h)
 {
-    compose2D(temp[0],  src[0],  src[1], linesize, 1, step, h, w);
-    compose2D(temp[1],  src[2],  src[3], linesize, 1, step, h, w);
-    compose2D(dst,     temp[0], temp[1], 1, linesize, step, w, h);
+    compose2D(ctx, temp[0],  src[0],  src[1], linesize, 1, step, h, w);
+    compose2D(ctx, temp[1],  src[2],  src[3], linesize, 1, step, h, w);
+    compose2D(ctx, dst,     temp[0], temp[1], 1, linesize, step, w, h);
+}
+
+static int threshold_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    OWDenoiseContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->h * jobnr) / nb_jobs;
+    const int slice_end = (td->h * (jobnr+1)) / nb_jobs;
+    const double strength = td->strength;
+    int x, y, i, j;
+
+    for (i = 0; i < td->depth; i++) {
+        for (j = 1; j < 4; j++) {
+            for (y = slice_start; y < slice_end; y++) {
+                for (x = 0; x < td->w; x++) {
+                    double v = s->plane[i + 1][j][y*s->linesize + x];
+                    if      (v >  strength) v -= strength;
+                    else if (v < -strength) v += strength;
+                    else                    v  = 0;
+                    s->plane[i + 1][j][x + y*s->linesize] = v;
+                }
+            }
+        }
+    }
+    return 0;
 }
 
-static void filter(OWDenoiseContext *s,
+static void filter(AVFilterContext *ctx,
                    uint8_t       *dst, int dst_linesize,
                    const uint8_t *src, int src_linesize,
                    int width, int height, double strength)
 {
-    int x, y, i, j, depth = s->depth;
+    OWDenoiseContext *s = ctx->priv;
+    int x, y, i, depth = s->depth;
+    ThreadData td;
 
     while (1<<depth > width || 1<<depth > height)
         depth--;
@@ -209,23 +285,17 @@ static void filter(OWDenoiseContext *s,
     }
 
     for (i = 0; i < depth; i++)
-        decompose2D2(s->plane[i + 1], s->plane[i][0], s->plane[0] + 1, s->linesize, 1<<i, width, height);
+        decompose2D2(ctx, s->plane[i + 1], s->plane[i][0], s->plane[0] + 1, s->linesize, 1<<i, width, height);
+
+    td.w        = width;
+    td.h        = height;
+    td.depth    = depth;
+    td.strength = strength;
+    ff_filter_execute(ctx, threshold_slice, &td, NULL,
+                      FFMIN(height, ff_filter_get_nb_threads(ctx)));
 
-    for (i = 0; i < depth; i++) {
-        for (j = 1; j < 4; j++) {
-            for (y = 0; y < height; y++) {
-                for (x = 0; x < width; x++) {
-                    double v = s->plane[i + 1][j][y*s->linesize + x];
-                    if      (v >  strength) v -= strength;
-                    else if (v < -strength) v += strength;
-                    else                    v  = 0;
-                    s->plane[i + 1][j][x + y*s->linesize] = v;
-                }
-            }
-        }
-    }
     for (i = depth-1; i >= 0; i--)
-        compose2D2(s->plane[i][0], s->plane[i + 1], s->plane[0] + 1, s->linesize, 1<<i, width, height);
+        compose2D2(ctx, s->plane[i][0], s->plane[i + 1], s->plane[0] + 1, s->linesize, 1<<i, width, height);
 
     if (s->pixel_depth <= 8) {
         for (y = 0; y < height; y++) {
@@ -261,10 +331,10 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
         out = in;
 
         if (s->luma_strength > 0)
-            filter(s, out->data[0], out->linesize[0], in->data[0], in->linesize[0], inlink->w, inlink->h, s->luma_strength);
+            filter(ctx, out->data[0], out->linesize[0], in->data[0], in->linesize[0], inlink->w, inlink->h, s->luma_strength);
         if (s->chroma_strength > 0) {
-            filter(s, out->data[1], out->linesize[1], in->data[1], in->linesize[1], cw,        ch,        s->chroma_strength);
-            filter(s, out->data[2], out->linesize[2], in->data[2], in->linesize[2], cw,        ch,        s->chroma_strength);
+            filter(ctx, out->data[1], out->linesize[1], in->data[1], in->linesize[1], cw,        ch,        s->chroma_strength);
+            filter(ctx, out->data[2], out->linesize[2], in->data[2], in->linesize[2], cw,        ch,        s->chroma_strength);
         }
     } else {
         out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
@@ -275,13 +345,13 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
         av_frame_copy_props(out, in);
 
         if (s->luma_strength > 0) {
-            filter(s, out->data[0], out->linesize[0], in->data[0], in->linesize[0], inlink->w, inlink->h, s->luma_strength);
+            filter(ctx, out->data[0], out->linesize[0], in->data[0], in->linesize[0], inlink->w, inlink->h, s->luma_strength);
         } else {
             av_image_copy_plane(out->data[0], out->linesize[0], in ->data[0], in ->linesize[0], inlink->w, inlink->h);
         }
         if (s->chroma_strength > 0) {
-            filter(s, out->data[1], out->linesize[1], in->data[1], in->linesize[1], cw, ch, s->chroma_strength);
-            filter(s, out->data[2], out->linesize[2], in->data[2], in->linesize[2], cw, ch, s->chroma_strength);
+            filter(ctx, out->data[1], out->linesize[1], in->data[1], in->linesize[1], cw, ch, s->chroma_strength);
+            filter(ctx, out->data[2], out->linesize[2], in->data[2], in->linesize[2], cw, ch, s->chroma_strength);
         } else {
             av_image_copy_plane(out->data[1], out->linesize[1], in ->data[1], in ->linesize[1], inlink->w, inlink->h);
             av_image_copy_plane(out->data[2], out->linesize[2], in ->data[2], in ->linesize[2], inlink->w, inlink->h);
@@ -370,5 +440,5 @@ const AVFilter ff_vf_owdenoise = {
     FILTER_OUTPUTS(owdenoise_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .priv_class    = &owdenoise_class,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
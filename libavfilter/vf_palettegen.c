@@ -60,6 +60,7 @@ enum {
 
 #define NBITS 5
 #define HIST_SIZE (1<<(4*NBITS))
+#define MAX_JOBS 32
 
 typedef struct PaletteGenContext {
     const AVClass *class;
@@ -444,10 +445,9 @@ static inline unsigned color_hash(uint32_t color, int use_alpha)
 /**
  * Locate the color in the hash table and increment its counter.
  */
-static int color_inc(struct hist_node *hist, uint32_t color, int use_alpha)
+static int color_inc(struct hist_node *hist, uint32_t color, unsigned hash)
 {
     int i;
-    const unsigned hash = color_hash(color, use_alpha);
     struct hist_node *node = &hist[hash];
     struct color_ref *e;
 
@@ -468,12 +468,25 @@ static int color_inc(struct hist_node *hist, uint32_t color, int use_alpha)
     return 1;
 }
 
+typedef struct ThreadData {
+    const AVFrame *prev, *in;
+    int nb_diff_colors[MAX_JOBS];
+} ThreadData;
+
 /**
- * Update histogram when pixels differ from previous frame.
+ * Update the histogram with the pixels of the frame (or only the ones
+ * differing from the previous frame) whose hash belongs to the job. Each
+ * bucket of the hash table is only ever touched by one job, in raster
+ * order, so the entries are the same as with a single job.
  */
-static int update_histogram_diff(struct hist_node *hist,
-                                 const AVFrame *f1, const AVFrame *f2, int use_alpha)
+static int update_histogram(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+    PaletteGenContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const AVFrame *f1 = td->prev ? td->prev : td->in;
+    const AVFrame *f2 = td->in;
+    const unsigned hash_start = (HIST_SIZE * jobnr) / nb_jobs;
+    const unsigned hash_end = (HIST_SIZE * (jobnr+1)) / nb_jobs;
     int x, y, ret, nb_diff_colors = 0;
 
     for (y = 0; y < f1->height; y++) {
@@ -481,35 +494,22 @@ static int update_histogram_diff(struct hist_node *hist,
         const uint32_t *q = (const uint32_t *)(f2->data[0] + y*f2->linesize[0]);
 
         for (x = 0; x < f1->width; x++) {
-            if (p[x] == q[x])
-                continue;
-            ret = color_inc(hist, p[x], use_alpha);
-            if (ret < 0)
-                return ret;
-            nb_diff_colors += ret;
-        }
-    }
-    return nb_diff_colors;
-}
+            const unsigned hash = color_hash(p[x], s->use_alpha);
 
-/**
- * Simple histogram of the frame.
- */
-static int update_histogram_frame(struct hist_node *hist, const AVFrame *f, int use_alpha)
-{
-    int x, y, ret, nb_diff_colors = 0;
-
-    for (y = 0; y < f->height; y++) {
-        const uint32_t *p = (const uint32_t *)(f->data[0] + y*f->linesize[0]);
-
-        for (x = 0; x < f->width; x++) {
-            ret = color_inc(hist, p[x], use_alpha);
-            if (ret < 0)
+            if (hash < hash_start || hash >= hash_end)
+                continue;
+            if (td->prev && p[x] == q[x])
+                continue;
+            ret = color_inc(s->histogram, p[x], hash);
+            if (ret < 0) {
+                td->nb_diff_colors[jobnr] = ret;
                 return ret;
+            }
             nb_diff_colors += ret;
         }
     }
-    return nb_diff_colors;
+    td->nb_diff_colors[jobnr] = nb_diff_colors;
+    return 0;
 }
 
 /**
@@ -519,18 +519,24 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 {
     AVFilterContext *ctx = inlink->dst;
     PaletteGenContext *s = ctx->priv;
-    int ret = s->prev_frame ? update_histogram_diff(s->histogram, s->prev_frame, in, s->use_alpha)
-                            : update_histogram_frame(s->histogram, in, s->use_alpha);
-
-    if (ret > 0)
-        s->nb_refs += ret;
+    ThreadData td = { .prev = s->prev_frame, .in = in };
+    const int nb_jobs = FFMIN(MAX_JOBS, ff_filter_get_nb_threads(ctx));
+    int i, ret = 0;
+
+    ff_filter_execute(ctx, update_histogram, &td, NULL, nb_jobs);
+    for (i = 0; i < nb_jobs; i++) {
+        if (td.nb_diff_colors[i] < 0) {
+            ret = td.nb_diff_colors[i];
+            break;
+        }
+        s->nb_refs += td.nb_diff_colors[i];
+    }
 
     if (s->stats_mode == STATS_MODE_DIFF_FRAMES) {
         av_frame_free(&s->prev_frame);
         s->prev_frame = in;
     } else if (s->stats_mode == STATS_MODE_SINGLE_FRAMES) {
         AVFrame *out;
-        int i;
 
         out = get_palette_frame(ctx);
         out->pts = in->pts;
@@ -627,4 +633,5 @@ const AVFilter ff_vf_palettegen = {
     FILTER_OUTPUTS(palettegen_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .priv_class    = &palettegen_class,
+    .flags         = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -214,21 +214,29 @@ static int config_props(AVFilterLink *inlink)
 
 #define NB_PLANES 4
 
-static void blur(uint8_t       *dst, const int dst_linesize,
-                 const uint8_t *src, const int src_linesize,
-                 const int w, const int h, FilterParam *fp)
+typedef struct ThreadData {
+    uint8_t *dst;
+    int dst_linesize;
+    const uint8_t *src;
+    int src_linesize;
+    int w, h;
+    FilterParam *fp;
+} ThreadData;
+
+static int blur_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
+    ThreadData *td = arg;
+    uint8_t *dst = td->dst;
+    const int dst_linesize = td->dst_linesize;
+    const uint8_t *src = td->src;
+    const int src_linesize = td->src_linesize;
+    const int w = td->w, h = td->h;
+    const int slice_start = (h * jobnr) / nb_jobs;
+    const int slice_end = (h * (jobnr+1)) / nb_jobs;
     int x, y;
-    FilterParam f = *fp;
+    FilterParam f = *td->fp;
     const int radius = f.dist_width/2;
 
-    const uint8_t * const src2[NB_PLANES] = { src };
-    int          src2_linesize[NB_PLANES] = { src_linesize };
-    uint8_t     *dst2[NB_PLANES] = { f.pre_filter_buf };
-    int dst2_linesize[NB_PLANES] = { f.pre_filter_linesize };
-
-    sws_scale(f.pre_filter_context, src2, src2_linesize, 0, h, dst2, dst2_linesize);
-
 #define UPDATE_FACTOR do {                                              \
         int factor;                                                     \
         factor = f.color_diff_coeff[COLOR_DIFF_COEFF_SIZE/2 + pre_val - \
@@ -237,7 +245,7 @@ static void blur(uint8_t       *dst, const int dst_linesize,
         div += factor;                                                  \
     } while (0)
 
-    for (y = 0; y < h; y++) {
+    for (y = slice_start; y < slice_end; y++) {
         for (x = 0; x < w; x++) {
             int sum = 0;
             int div = 0;
@@ -270,12 +278,33 @@ static void blur(uint8_t       *dst, const int dst_linesize,
             dst[x + y*dst_linesize] = (sum + div/2) / div;
         }
     }
+
+    return 0;
+}
+
+static void blur(AVFilterContext *ctx,
+                 uint8_t       *dst, const int dst_linesize,
+                 const uint8_t *src, const int src_linesize,
+                 const int w, const int h, FilterParam *fp)
+{
+    ThreadData td = { dst, dst_linesize, src, src_linesize, w, h, fp };
+
+    const uint8_t * const src2[NB_PLANES] = { src };
+    int          src2_linesize[NB_PLANES] = { src_linesize };
+    uint8_t     *dst2[NB_PLANES] = { fp->pre_filter_buf };
+    int dst2_linesize[NB_PLANES] = { fp->pre_filter_linesize };
+
+    sws_scale(fp->pre_filter_context, src2, src2_linesize, 0, h, dst2, dst2_linesize);
+
+    ff_filter_execute(ctx, blur_slice, &td, NULL,
+                      FFMIN(h, ff_filter_get_nb_threads(ctx)));
 }
 
 static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
 {
-    SabContext  *s = inlink->dst->priv;
-    AVFilterLink *outlink = inlink->dst->outputs[0];
+    AVFilterContext *ctx = inlink->dst;
+    SabContext  *s = ctx->priv;
+    AVFilterLink *outlink = ctx->outputs[0];
     AVFrame *outpic;
 
     outpic = ff_get_video_buffer(outlink, outlink->w, outlink->h);
@@ -285,13 +314,13 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *inpic)
     }
     av_frame_copy_props(outpic, inpic);
 
-    blur(outpic->data[0], outpic->linesize[0], inpic->data[0],  inpic->linesize[0],
+    blur(ctx, outpic->data[0], outpic->linesize[0], inpic->data[0],  inpic->linesize[0],
          inlink->w, inlink->h, &s->luma);
     if (inpic->data[2]) {
         int cw = AV_CEIL_RSHIFT(inlink->w, s->hsub);
         int ch = AV_CEIL_RSHIFT(inlink->h, s->vsub);
-        blur(outpic->data[1], outpic->linesize[1], inpic->data[1], inpic->linesize[1], cw, ch, &s->chroma);
-        blur(outpic->data[2], outpic->linesize[2], inpic->data[2], inpic->linesize[2], cw, ch, &s->chroma);
+        blur(ctx, outpic->data[1], outpic->linesize[1], inpic->data[1], inpic->linesize[1], cw, ch, &s->chroma);
+        blur(ctx, outpic->data[2], outpic->linesize[2], inpic->data[2], inpic->linesize[2], cw, ch, &s->chroma);
     }
 
     av_frame_free(&inpic);
@@ -324,5 +353,5 @@ const AVFilter ff_vf_sab = {
     FILTER_OUTPUTS(sab_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
     .priv_class    = &sab_class,
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -105,8 +105,10 @@ enum EvalMode {
 
 typedef struct ScaleContext {
     const AVClass *class;
-    struct SwsContext *sws;     ///< software scaler context
-    struct SwsContext *isws[2]; ///< software scaler context for interlaced material
+    struct SwsContext **sws;     ///< software scaler contexts, one per slice job
+    struct SwsContext **isws[2]; ///< software scaler contexts for interlaced material
+    int nb_slice_ctx;            ///< number of contexts in each of the above arrays
+    int *slice_err;              ///< per-slice-job return values
     AVDictionary *opts;
 
     /**
@@ -154,6 +156,12 @@ typedef struct ScaleContext {
 
 const AVFilter ff_vf_scale2ref;
 
+typedef struct ThreadData {
+    struct SwsContext **sws;
+    unsigned int align;
+    int slice_h, dst_h;
+} ThreadData;
+
 static int config_props(AVFilterLink *outlink);
 
 static int check_exprs(AVFilterContext *ctx)
@@ -325,16 +333,43 @@ static av_cold int init_dict(AVFilterContext *ctx, AVDictionary **opts)
     return 0;
 }
 
+static void free_sws_contexts(ScaleContext *scale)
+{
+    struct SwsContext **swscs[3] = { scale->sws, scale->isws[0], scale->isws[1] };
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; swscs[i] && j < scale->nb_slice_ctx; j++)
+            sws_freeContext(swscs[i][j]);
+    av_freep(&scale->sws);
+    av_freep(&scale->isws[0]);
+    av_freep(&scale->isws[1]);
+    av_freep(&scale->slice_err);
+    scale->nb_slice_ctx = 0;
+}
+
+/**
+ * Error diffusion dithering carries state from one output line to the next,
+ * so such a scaler cannot be split into independently scaled slices.
+ */
+static int sws_can_slice(struct SwsContext *s)
+{
+    const AVClass *class = sws_get_class();
+    const AVOption *ed = av_opt_find(&class, "ed", "sws_dither", 0,
+                                     AV_OPT_SEARCH_FAKE_OBJ);
+    int64_t dither;
+
+    if (!ed || av_opt_get_int(s, "sws_dither", 0, &dither) < 0)
+        return 0;
+    return dither != ed->default_val.i64;
+}
+
 static av_cold void uninit(AVFilterContext *ctx)
 {
     ScaleContext *scale = ctx->priv;
     av_expr_free(scale->w_pexpr);
     av_expr_free(scale->h_pexpr);
     scale->w_pexpr = scale->h_pexpr = NULL;
-    sws_freeContext(scale->sws);
-    sws_freeContext(scale->isws[0]);
-    sws_freeContext(scale->isws[1]);
-    scale->sws = NULL;
+    free_sws_contexts(scale);
     av_dict_free(&scale->opts);
 }
 
@@ -507,13 +542,7 @@ static int config_props(AVFilterLink *outlink)
     if (outfmt == AV_PIX_FMT_PAL8) outfmt = AV_PIX_FMT_BGR8;
     scale->output_is_pal = av_pix_fmt_desc_get(outfmt)->flags & AV_PIX_FMT_FLAG_PAL;
 
-    if (scale->sws)
-        sws_freeContext(scale->sws);
-    if (scale->isws[0])
-        sws_freeContext(scale->isws[0]);
-    if (scale->isws[1])
-        sws_freeContext(scale->isws[1]);
-    scale->isws[0] = scale->isws[1] = scale->sws = NULL;
+    free_sws_contexts(scale);
     if (inlink0->w == outlink->w &&
         inlink0->h == outlink->h &&
         !scale->out_color_matrix &&
@@ -521,58 +550,75 @@ static int config_props(AVFilterLink *outlink)
         inlink0->format == outlink->format)
         ;
     else {
-        struct SwsContext **swscs[3] = {&scale->sws, &scale->isws[0], &scale->isws[1]};
-        int i;
+        struct SwsContext ***swscs[3] = {&scale->sws, &scale->isws[0], &scale->isws[1]};
+        int i, j;
+
+        scale->nb_slice_ctx = ff_filter_get_nb_threads(ctx);
+        scale->slice_err    = av_calloc(scale->nb_slice_ctx, sizeof(*scale->slice_err));
+        if (!scale->slice_err)
+            return AVERROR(ENOMEM);
 
         for (i = 0; i < 3; i++) {
-            int in_v_chr_pos = scale->in_v_chr_pos, out_v_chr_pos = scale->out_v_chr_pos;
-            struct SwsContext *const s = sws_alloc_context();
-            if (!s)
+            *swscs[i] = av_calloc(scale->nb_slice_ctx, sizeof(**swscs[i]));
+            if (!*swscs[i])
                 return AVERROR(ENOMEM);
-            *swscs[i] = s;
-
-            av_opt_set_int(s, "srcw", inlink0 ->w, 0);
-            av_opt_set_int(s, "srch", inlink0 ->h >> !!i, 0);
-            av_opt_set_int(s, "src_format", inlink0->format, 0);
-            av_opt_set_int(s, "dstw", outlink->w, 0);
-            av_opt_set_int(s, "dsth", outlink->h >> !!i, 0);
-            av_opt_set_int(s, "dst_format", outfmt, 0);
-            av_opt_set_int(s, "sws_flags", scale->flags, 0);
-            av_opt_set_int(s, "param0", scale->param[0], 0);
-            av_opt_set_int(s, "param1", scale->param[1], 0);
-            av_opt_set_int(s, "threads", ff_filter_get_nb_threads(ctx), 0);
-            if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
-                av_opt_set_int(s, "src_range",
-                               scale->in_range == AVCOL_RANGE_JPEG, 0);
-            if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
-                av_opt_set_int(s, "dst_range",
-                               scale->out_range == AVCOL_RANGE_JPEG, 0);
-
-            if (scale->opts) {
-                AVDictionaryEntry *e = NULL;
-                while ((e = av_dict_get(scale->opts, "", e, AV_DICT_IGNORE_SUFFIX))) {
-                    if ((ret = av_opt_set(s, e->key, e->value, 0)) < 0)
-                        return ret;
-                }
-            }
-            /* Override YUV420P default settings to have the correct (MPEG-2) chroma positions
-             * MPEG-2 chroma positions are used by convention
-             * XXX: support other 4:2:0 pixel formats */
-            if (inlink0->format == AV_PIX_FMT_YUV420P && scale->in_v_chr_pos == -513) {
-                in_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
-            }
 
-            if (outlink->format == AV_PIX_FMT_YUV420P && scale->out_v_chr_pos == -513) {
-                out_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
-            }
+            for (j = 0; j < scale->nb_slice_ctx; j++) {
+                int in_v_chr_pos = scale->in_v_chr_pos, out_v_chr_pos = scale->out_v_chr_pos;
+                struct SwsContext *const s = sws_alloc_context();
+                if (!s)
+                    return AVERROR(ENOMEM);
+                (*swscs[i])[j] = s;
+
+                av_opt_set_int(s, "srcw", inlink0 ->w, 0);
+                av_opt_set_int(s, "srch", inlink0 ->h >> !!i, 0);
+                av_opt_set_int(s, "src_format", inlink0->format, 0);
+                av_opt_set_int(s, "dstw", outlink->w, 0);
+                av_opt_set_int(s, "dsth", outlink->h >> !!i, 0);
+                av_opt_set_int(s, "dst_format", outfmt, 0);
+                av_opt_set_int(s, "sws_flags", scale->flags, 0);
+                av_opt_set_int(s, "param0", scale->param[0], 0);
+                av_opt_set_int(s, "param1", scale->param[1], 0);
+                /* slices run on the filtergraph thread pool, see scale_slices() */
+                av_opt_set_int(s, "threads", 1, 0);
+                if (scale->in_range != AVCOL_RANGE_UNSPECIFIED)
+                    av_opt_set_int(s, "src_range",
+                                   scale->in_range == AVCOL_RANGE_JPEG, 0);
+                if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
+                    av_opt_set_int(s, "dst_range",
+                                   scale->out_range == AVCOL_RANGE_JPEG, 0);
+
+                if (scale->opts) {
+                    AVDictionaryEntry *e = NULL;
+                    while ((e = av_dict_get(scale->opts, "", e, AV_DICT_IGNORE_SUFFIX))) {
+                        if ((ret = av_opt_set(s, e->key, e->value, 0)) < 0)
+                            return ret;
+                    }
+                }
+                /* Override YUV420P default settings to have the correct (MPEG-2) chroma positions
+                 * MPEG-2 chroma positions are used by convention
+                 * XXX: support other 4:2:0 pixel formats */
+                if (inlink0->format == AV_PIX_FMT_YUV420P && scale->in_v_chr_pos == -513) {
+                    in_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
+                }
 
-            av_opt_set_int(s, "src_h_chr_pos", scale->in_h_chr_pos, 0);
-            av_opt_set_int(s, "src_v_chr_pos", in_v_chr_pos, 0);
-            av_opt_set_int(s, "dst_h_chr_pos", scale->out_h_chr_pos, 0);
-            av_opt_set_int(s, "dst_v_chr_pos", out_v_chr_pos, 0);
+                if (outlink->format == AV_PIX_FMT_YUV420P && scale->out_v_chr_pos == -513) {
+                    out_v_chr_pos = (i == 0) ? 128 : (i == 1) ? 64 : 192;
+                }
 
-            if ((ret = sws_init_context(s, NULL, NULL)) < 0)
-                return ret;
+                av_opt_set_int(s, "src_h_chr_pos", scale->in_h_chr_pos, 0);
+                av_opt_set_int(s, "src_v_chr_pos", in_v_chr_pos, 0);
+                av_opt_set_int(s, "dst_h_chr_pos", scale->out_h_chr_pos, 0);
+                av_opt_set_int(s, "dst_v_chr_pos", out_v_chr_pos, 0);
+
+                if ((ret = sws_init_context(s, NULL, NULL)) < 0)
+                    return ret;
+                if (!i && !j && scale->nb_slice_ctx > 1 && !sws_can_slice(s)) {
+                    av_log(ctx, AV_LOG_VERBOSE,
+                           "Error-diffusion dither is in use, scaling will be single-threaded.\n");
+                    scale->nb_slice_ctx = 1;
+                }
+            }
             if (!scale->interlaced)
                 break;
         }
@@ -627,9 +673,56 @@ static void frame_offset(AVFrame *frame, int dir, int is_pal)
     }
 }
 
-static int scale_field(ScaleContext *scale, AVFrame *dst, AVFrame *src,
+static int scale_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ThreadData *td = arg;
+    const int slice_start = jobnr * td->slice_h;
+    const int slice_end   = FFMIN(slice_start + td->slice_h, td->dst_h);
+
+    if (slice_end <= slice_start)
+        return 0;
+    return sws_receive_slice(td->sws[jobnr], slice_start, slice_end - slice_start);
+}
+
+/**
+ * Scale a whole frame, splitting the output into horizontal slices that are
+ * processed on the filtergraph thread pool with one scaler context each.
+ */
+static int scale_slices(AVFilterContext *ctx, struct SwsContext **sws,
+                        AVFrame *dst, const AVFrame *src)
+{
+    ScaleContext *scale = ctx->priv;
+    ThreadData td;
+    int nb_jobs, i, ret = 0;
+
+    td.sws     = sws;
+    td.align   = sws_receive_slice_alignment(sws[0]);
+    td.dst_h   = dst->height;
+    nb_jobs    = FFMAX(FFMIN(scale->nb_slice_ctx, dst->height / td.align), 1);
+    td.slice_h = FFALIGN((dst->height + nb_jobs - 1) / nb_jobs, td.align);
+
+    for (i = 0; i < nb_jobs && ret >= 0; i++) {
+        ret = sws_frame_start(sws[i], dst, src);
+        if (ret >= 0)
+            ret = sws_send_slice(sws[i], 0, src->height);
+    }
+
+    if (ret >= 0) {
+        ff_filter_execute(ctx, scale_slice, &td, scale->slice_err, nb_jobs);
+        for (i = 0; i < nb_jobs && ret >= 0; i++)
+            ret = scale->slice_err[i];
+    }
+
+    for (i = 0; i < nb_jobs; i++)
+        sws_frame_end(sws[i]);
+
+    return ret;
+}
+
+static int scale_field(AVFilterContext *ctx, AVFrame *dst, AVFrame *src,
                        int field)
 {
+    ScaleContext *scale = ctx->priv;
     int orig_h_src = src->height;
     int orig_h_dst = dst->height;
     int ret;
@@ -648,7 +741,7 @@ static int scale_field(ScaleContext *scale, AVFrame *dst, AVFrame *src,
     src->height /= 2;
     dst->height /= 2;
 
-    ret = sws_scale_frame(scale->isws[field], dst, src);
+    ret = scale_slices(ctx, scale->isws[field], dst, src);
     if (ret < 0)
         return ret;
 
@@ -785,7 +878,7 @@ scale:
         int in_full, out_full, brightness, contrast, saturation;
         const int *inv_table, *table;
 
-        sws_getColorspaceDetails(scale->sws, (int **)&inv_table, &in_full,
+        sws_getColorspaceDetails(scale->sws[0], (int **)&inv_table, &in_full,
                                  (int **)&table, &out_full,
                                  &brightness, &contrast, &saturation);
 
@@ -803,17 +896,19 @@ scale:
         if (scale->out_range != AVCOL_RANGE_UNSPECIFIED)
             out_full = (scale->out_range == AVCOL_RANGE_JPEG);
 
-        sws_setColorspaceDetails(scale->sws, inv_table, in_full,
-                                 table, out_full,
-                                 brightness, contrast, saturation);
-        if (scale->isws[0])
-            sws_setColorspaceDetails(scale->isws[0], inv_table, in_full,
-                                     table, out_full,
-                                     brightness, contrast, saturation);
-        if (scale->isws[1])
-            sws_setColorspaceDetails(scale->isws[1], inv_table, in_full,
+        for (int i = 0; i < scale->nb_slice_ctx; i++) {
+            sws_setColorspaceDetails(scale->sws[i], inv_table, in_full,
                                      table, out_full,
                                      brightness, contrast, saturation);
+            if (scale->isws[0])
+                sws_setColorspaceDetails(scale->isws[0][i], inv_table, in_full,
+                                         table, out_full,
+                                         brightness, contrast, saturation);
+            if (scale->isws[1])
+                sws_setColorspaceDetails(scale->isws[1][i], inv_table, in_full,
+                                         table, out_full,
+                                         brightness, contrast, saturation);
+        }
 
         out->color_range = out_full ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
     }
@@ -824,11 +919,11 @@ scale:
               INT_MAX);
 
     if (scale->interlaced>0 || (scale->interlaced<0 && in->interlaced_frame)) {
-        ret = scale_field(scale, out, in, 0);
+        ret = scale_field(ctx, out, in, 0);
         if (ret >= 0)
-            ret = scale_field(scale, out, in, 1);
+            ret = scale_field(ctx, out, in, 1);
     } else {
-        ret = sws_scale_frame(scale->sws, out, in);
+        ret = scale_slices(ctx, scale->sws, out, in);
     }
 
     av_frame_free(&in);
@@ -1000,6 +1095,7 @@ const AVFilter ff_vf_scale = {
     FILTER_OUTPUTS(avfilter_vf_scale_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
 
 static const AVFilterPad avfilter_vf_scale2ref_inputs[] = {
@@ -1041,4 +1137,5 @@ const AVFilter ff_vf_scale2ref = {
     FILTER_OUTPUTS(avfilter_vf_scale2ref_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
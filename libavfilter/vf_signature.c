@@ -96,6 +96,13 @@ static int config_input(AVFilterLink *inlink)
     }
     sc->w = inlink->w;
     sc->h = inlink->h;
+
+    if (!sic->job_intpics) {
+        sic->nb_threads = ff_filter_get_nb_threads(ctx);
+        sic->job_intpics = av_malloc_array(sic->nb_threads, sizeof(*sic->job_intpics));
+        if (!sic->job_intpics)
+            return AVERROR(ENOMEM);
+    }
     return 0;
 }
 
@@ -142,6 +149,32 @@ static void set_bit(uint8_t* data, size_t pos)
     data[pos/8] |= mask;
 }
 
+typedef struct ThreadData {
+    const AVFrame *in;
+    const int *intjlut;
+} ThreadData;
+
+static int block_sums_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    SignatureContext *sic = ctx->priv;
+    ThreadData *td = arg;
+    const AVFrame *in = td->in;
+    const int slice_start = (in->height * jobnr) / nb_jobs;
+    const int slice_end = (in->height * (jobnr+1)) / nb_jobs;
+    uint64_t (*intpic)[32] = sic->job_intpics[jobnr];
+    const uint8_t *p = in->data[0] + slice_start * in->linesize[0];
+    int i, j, inti;
+
+    memset(intpic, 0, sizeof(sic->job_intpics[0]));
+    for (i = slice_start; i < slice_end; i++) {
+        inti = (i*32)/in->height;
+        for (j = 0; j < in->width; j++)
+            intpic[inti][td->intjlut[j]] += p[j];
+        p += in->linesize[0];
+    }
+    return 0;
+}
+
 static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
 {
     AVFilterContext *ctx = inlink->dst;
@@ -159,9 +192,9 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
     uint8_t wordt2b[5] = { 0, 0, 0, 0, 0 }; /* word ternary to binary */
     uint64_t intpic[32][32];
     uint64_t rowcount;
-    uint8_t *p = picref->data[0];
-    int inti, intj;
     int *intjlut;
+    ThreadData td;
+    int nb_jobs;
 
     uint64_t conflist[DIFFELEM_SIZE];
     int f = 0, g = 0, w = 0;
@@ -199,14 +232,14 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *picref)
         intjlut[i] = (i*32)/inlink->w;
     }
 
-    for (i = 0; i < inlink->h; i++) {
-        inti = (i*32)/inlink->h;
-        for (j = 0; j < inlink->w; j++) {
-            intj = intjlut[j];
-            intpic[inti][intj] += p[j];
-        }
-        p += picref->linesize[0];
-    }
+    td.in      = picref;
+    td.intjlut = intjlut;
+    nb_jobs = FFMIN(inlink->h, sic->nb_threads);
+    ff_filter_execute(ctx, block_sums_slice, &td, NULL, nb_jobs);
+    for (k = 0; k < nb_jobs; k++)
+        for (i = 0; i < 32; i++)
+            for (j = 0; j < 32; j++)
+                intpic[i][j] += sic->job_intpics[k][i][j];
     av_freep(&intjlut);
 
     /* The following calculates a summed area table (intpic) and brings the numbers
@@ -723,6 +756,7 @@ static av_cold void uninit(AVFilterContext *ctx)
         }
         av_freep(&sic->streamcontexts);
     }
+    av_freep(&sic->job_intpics);
 }
 
 static int config_output(AVFilterLink *outlink)
@@ -758,5 +792,5 @@ const AVFilter ff_vf_signature = {
     FILTER_OUTPUTS(signature_outputs),
     .inputs        = NULL,
     FILTER_PIXFMTS_ARRAY(pix_fmts),
-    .flags         = AVFILTER_FLAG_DYNAMIC_INPUTS,
+    .flags         = AVFILTER_FLAG_DYNAMIC_INPUTS | AVFILTER_FLAG_SLICE_THREADS,
 };
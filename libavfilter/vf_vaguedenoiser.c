@@ -53,6 +53,8 @@ typedef struct VagueDenoiserContext {
     float *in;
     float *out;
     float *tmp;
+    int buf_size;      ///< size of the line buffers of each job in in, out and tmp
+    int nb_threads;
 
     int hlowsize[4][32];
     int hhighsize[4][32];
@@ -146,10 +148,13 @@ static int config_input(AVFilterLink *inlink)
     s->planewidth[1]  = s->planewidth[2]  = AV_CEIL_RSHIFT(inlink->w, desc->log2_chroma_w);
     s->planewidth[0]  = s->planewidth[3]  = inlink->w;
 
+    s->nb_threads = ff_filter_get_nb_threads(inlink->dst);
+    s->buf_size = 32 + FFMAX(inlink->w, inlink->h);
+
     s->block = av_malloc_array(inlink->w * inlink->h, sizeof(*s->block));
-    s->in    = av_malloc_array(32 + FFMAX(inlink->w, inlink->h), sizeof(*s->in));
-    s->out   = av_malloc_array(32 + FFMAX(inlink->w, inlink->h), sizeof(*s->out));
-    s->tmp   = av_malloc_array(32 + FFMAX(inlink->w, inlink->h), sizeof(*s->tmp));
+    s->in    = av_malloc_array(s->buf_size * s->nb_threads, sizeof(*s->in));
+    s->out   = av_malloc_array(s->buf_size * s->nb_threads, sizeof(*s->out));
+    s->tmp   = av_malloc_array(s->buf_size * s->nb_threads, sizeof(*s->tmp));
 
     if (!s->block || !s->in || !s->out || !s->tmp)
         return AVERROR(ENOMEM);
@@ -403,9 +408,112 @@ static float bayes_threshold(float *block, const int width, const int height,
     return threshold * threshold / (FFMAX(sqrtf(mean - threshold), FLT_EPSILON));
 }
 
-static void filter(VagueDenoiserContext *s, AVFrame *in, AVFrame *out)
+typedef struct ThreadData {
+    int width;
+    int h_size, v_size;
+    float threshold;
+} ThreadData;
+
+static int transform_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    VagueDenoiserContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->v_size * jobnr) / nb_jobs;
+    const int slice_end = (td->v_size * (jobnr+1)) / nb_jobs;
+    const int low_size = (td->h_size + 1) >> 1;
+    float *in  = s->in  + jobnr * s->buf_size;
+    float *out = s->out + jobnr * s->buf_size;
+    float *input = s->block + slice_start * td->width;
+    int j;
+
+    for (j = slice_start; j < slice_end; j++) {
+        copy(input, in + NPAD, td->h_size);
+        transform_step(in, out, td->h_size, low_size, s);
+        copy(out + NPAD, input, td->h_size);
+        input += td->width;
+    }
+    return 0;
+}
+
+static int transform_columns(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    VagueDenoiserContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->h_size * jobnr) / nb_jobs;
+    const int slice_end = (td->h_size * (jobnr+1)) / nb_jobs;
+    const int low_size = (td->v_size + 1) >> 1;
+    float *in  = s->in  + jobnr * s->buf_size;
+    float *out = s->out + jobnr * s->buf_size;
+    float *input = s->block + slice_start;
+    int j;
+
+    for (j = slice_start; j < slice_end; j++) {
+        copyv(input, td->width, in + NPAD, td->v_size);
+        transform_step(in, out, td->v_size, low_size, s);
+        copyh(out + NPAD, input, td->width, td->v_size);
+        input++;
+    }
+    return 0;
+}
+
+static int invert_columns(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    VagueDenoiserContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->h_size * jobnr) / nb_jobs;
+    const int slice_end = (td->h_size * (jobnr+1)) / nb_jobs;
+    float *in  = s->in  + jobnr * s->buf_size;
+    float *out = s->out + jobnr * s->buf_size;
+    float *tmp = s->tmp + jobnr * s->buf_size;
+    float *idx3 = s->block + slice_start;
+    int i;
+
+    for (i = slice_start; i < slice_end; i++) {
+        copyv(idx3, td->width, in + NPAD, td->v_size);
+        invert_step(in, out, tmp, td->v_size, s);
+        copyh(out + NPAD, idx3, td->width, td->v_size);
+        idx3++;
+    }
+    return 0;
+}
+
+static int invert_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    int p, y, x, i, j;
+    VagueDenoiserContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->v_size * jobnr) / nb_jobs;
+    const int slice_end = (td->v_size * (jobnr+1)) / nb_jobs;
+    float *in  = s->in  + jobnr * s->buf_size;
+    float *out = s->out + jobnr * s->buf_size;
+    float *tmp = s->tmp + jobnr * s->buf_size;
+    float *idx3 = s->block + slice_start * td->width;
+    int i;
+
+    for (i = slice_start; i < slice_end; i++) {
+        copy(idx3, in + NPAD, td->h_size);
+        invert_step(in, out, tmp, td->h_size, s);
+        copy(out + NPAD, idx3, td->h_size);
+        idx3 += td->width;
+    }
+    return 0;
+}
+
+static int threshold_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    VagueDenoiserContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int slice_start = (td->v_size * jobnr) / nb_jobs;
+    const int slice_end = (td->v_size * (jobnr+1)) / nb_jobs;
+
+    s->thresholding(s->block + slice_start * td->width, td->h_size, slice_end - slice_start,
+                    td->width, td->threshold, s->percent);
+    return 0;
+}
+
+static void filter(AVFilterContext *ctx, AVFrame *in, AVFrame *out)
+{
+    VagueDenoiserContext *s = ctx->priv;
+    int p, y, x;
 
     for (p = 0; p < s->nb_planes; p++) {
         const int height = s->planeheight[p];
@@ -420,6 +528,7 @@ static void filter(VagueDenoiserContext *s, AVFrame *in, AVFrame *out)
         int nsteps_transform = s->nsteps;
         int nsteps_invert = s->nsteps;
         const float *input = s->block;
+        ThreadData td = { .width = width };
 
         if (!((1 << p) & s->planes)) {
             av_image_copy_plane(out->data[p], out->linesize[p], in->data[p], in->linesize[p],
@@ -443,32 +552,29 @@ static void filter(VagueDenoiserContext *s, AVFrame *in, AVFrame *out)
             }
         }
 
+        /* The lines of each pass are independent, so they are split
+         * between the jobs, each with its own line buffers. */
         while (nsteps_transform--) {
-            int low_size = (h_low_size0 + 1) >> 1;
-            float *input = s->block;
-            for (j = 0; j < v_low_size0; j++) {
-                copy(input, s->in + NPAD, h_low_size0);
-                transform_step(s->in, s->out, h_low_size0, low_size, s);
-                copy(s->out + NPAD, input, h_low_size0);
-                input += width;
-            }
-
-            low_size = (v_low_size0 + 1) >> 1;
-            input = s->block;
-            for (j = 0; j < h_low_size0; j++) {
-                copyv(input, width, s->in + NPAD, v_low_size0);
-                transform_step(s->in, s->out, v_low_size0, low_size, s);
-                copyh(s->out + NPAD, input, width, v_low_size0);
-                input++;
-            }
+            td.h_size = h_low_size0;
+            td.v_size = v_low_size0;
+            ff_filter_execute(ctx, transform_rows, &td, NULL,
+                              FFMIN(v_low_size0, s->nb_threads));
+            ff_filter_execute(ctx, transform_columns, &td, NULL,
+                              FFMIN(h_low_size0, s->nb_threads));
 
             h_low_size0 = (h_low_size0 + 1) >> 1;
             v_low_size0 = (v_low_size0 + 1) >> 1;
         }
 
         if (s->type == 0) {
-            s->thresholding(s->block, width, height, width, s->threshold, s->percent);
+            td.h_size    = width;
+            td.v_size    = height;
+            td.threshold = s->threshold;
+            ff_filter_execute(ctx, threshold_slice, &td, NULL,
+                              FFMIN(height, s->nb_threads));
         } else {
+            /* The float sums of the BayesShrink thresholds depend on the
+             * order of the coefficients, so this part stays serial. */
             for (int n = 0; n < s->nsteps; n++) {
                 float threshold;
                 float *block;
@@ -490,23 +596,12 @@ static void filter(VagueDenoiserContext *s, AVFrame *in, AVFrame *out)
         }
 
         while (nsteps_invert--) {
-            const int idx = s->vlowsize[p][nsteps_invert]  + s->vhighsize[p][nsteps_invert];
-            const int idx2 = s->hlowsize[p][nsteps_invert] + s->hhighsize[p][nsteps_invert];
-            float * idx3 = s->block;
-            for (i = 0; i < idx2; i++) {
-                copyv(idx3, width, s->in + NPAD, idx);
-                invert_step(s->in, s->out, s->tmp, idx, s);
-                copyh(s->out + NPAD, idx3, width, idx);
-                idx3++;
-            }
-
-            idx3 = s->block;
-            for (i = 0; i < idx; i++) {
-                copy(idx3, s->in + NPAD, idx2);
-                invert_step(s->in, s->out, s->tmp, idx2, s);
-                copy(s->out + NPAD, idx3, idx2);
-                idx3 += width;
-            }
+            td.v_size = s->vlowsize[p][nsteps_invert] + s->vhighsize[p][nsteps_invert];
+            td.h_size = s->hlowsize[p][nsteps_invert] + s->hhighsize[p][nsteps_invert];
+            ff_filter_execute(ctx, invert_columns, &td, NULL,
+                              FFMIN(td.h_size, s->nb_threads));
+            ff_filter_execute(ctx, invert_rows, &td, NULL,
+                              FFMIN(td.v_size, s->nb_threads));
         }
 
         if (s->depth <= 8) {
@@ -530,7 +625,6 @@ static void filter(VagueDenoiserContext *s, AVFrame *in, AVFrame *out)
 static int filter_frame(AVFilterLink *inlink, AVFrame *in)
 {
     AVFilterContext *ctx  = inlink->dst;
-    VagueDenoiserContext *s = ctx->priv;
     AVFilterLink *outlink = ctx->outputs[0];
     AVFrame *out;
     int direct = av_frame_is_writable(in);
@@ -547,7 +641,7 @@ static int filter_frame(AVFilterLink *inlink, AVFrame *in)
         av_frame_copy_props(out, in);
     }
 
-    filter(s, in, out);
+    filter(ctx, in, out);
 
     if (!direct)
         av_frame_free(&in);
@@ -611,5 +705,5 @@ const AVFilter ff_vf_vaguedenoiser = {
     FILTER_INPUTS(vaguedenoiser_inputs),
     FILTER_OUTPUTS(vaguedenoiser_outputs),
     FILTER_PIXFMTS_ARRAY(pix_fmts),
-    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
 };
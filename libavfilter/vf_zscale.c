@@ -44,6 +44,8 @@
 #include "libavutil/imgutils.h"
 
 #define ZIMG_ALIGNMENT 32
+#define MAX_THREADS 32
+#define MAX_GRAPHS 4
 
 static const char *const var_names[] = {
     "in_w",   "iw",
@@ -75,6 +77,17 @@ enum var_name {
     VARS_NB
 };
 
+typedef struct ZScaleGraphs {
+    zimg_image_format src_format, dst_format;
+    zimg_graph_builder_params params;
+    int alpha;
+    int nb_jobs;                ///< number of slices, 0 if unused
+    int64_t last_used;
+
+    zimg_filter_graph *graph[MAX_THREADS];
+    zimg_filter_graph *alpha_graph[MAX_THREADS];
+} ZScaleGraphs;
+
 typedef struct ZScaleContext {
     const AVClass *class;
 
@@ -113,13 +126,16 @@ typedef struct ZScaleContext {
 
     int force_original_aspect_ratio;
 
-    void *tmp;
-    size_t tmp_size;
+    void *tmp[MAX_THREADS];
+    size_t tmp_size[MAX_THREADS];
+    int jobs_ret[MAX_THREADS];
 
     zimg_image_format src_format, dst_format;
-    zimg_image_format alpha_src_format, alpha_dst_format;
-    zimg_graph_builder_params alpha_params, params;
-    zimg_filter_graph *alpha_graph, *graph;
+    zimg_graph_builder_params params;
+
+    ZScaleGraphs graphs[MAX_GRAPHS];    ///< graphs of the last used configurations
+    ZScaleGraphs *cur;
+    int64_t nb_used;
 
     enum AVColorSpace in_colorspace, out_colorspace;
     enum AVColorTransferCharacteristic in_trc, out_trc;
@@ -516,6 +532,152 @@ static int graph_build(zimg_filter_graph **graph, zimg_graph_builder_params *par
     return 0;
 }
 
+/**
+ * Get the output rows of a slice and the matching input rows. The slices
+ * start on whole chroma rows, the input rows may be fractional.
+ */
+static void slice_params(const ZScaleGraphs *g, int jobnr,
+                         int *out_start, int *out_end,
+                         double *in_start, double *in_end)
+{
+    const int out_h = g->dst_format.height;
+    const int in_h  = g->src_format.height;
+    const int align = 1 << g->dst_format.subsample_h;
+
+    *out_start = jobnr ? FFALIGN(out_h * jobnr / g->nb_jobs, align) : 0;
+    *out_end   = jobnr == g->nb_jobs - 1 ? out_h :
+                 FFALIGN(out_h * (jobnr + 1) / g->nb_jobs, align);
+    *in_start  = *out_start * (double)in_h / out_h;
+    *in_end    = *out_end   * (double)in_h / out_h;
+}
+
+static void graphs_free(ZScaleGraphs *g)
+{
+    int i;
+
+    for (i = 0; i < MAX_THREADS; i++) {
+        zimg_filter_graph_free(g->graph[i]);
+        zimg_filter_graph_free(g->alpha_graph[i]);
+        g->graph[i] = g->alpha_graph[i] = NULL;
+    }
+    g->nb_jobs = 0;
+}
+
+static int graphs_build(ZScaleContext *s, ZScaleGraphs *g)
+{
+    int i, ret;
+
+    for (i = 0; i < g->nb_jobs; i++) {
+        zimg_image_format src_format = g->src_format;
+        zimg_image_format dst_format = g->dst_format;
+        int out_start, out_end;
+        double in_start, in_end;
+
+        slice_params(g, i, &out_start, &out_end, &in_start, &in_end);
+
+        /* Each slice is a graph of its own. Its input is the area of the
+         * whole frame given by the active region, so that the resampler
+         * can still use the rows around the slice, and its output is an
+         * image of the slice height. */
+        if (g->nb_jobs > 1) {
+            src_format.active_region.left   = 0;
+            src_format.active_region.top    = in_start;
+            src_format.active_region.width  = src_format.width;
+            src_format.active_region.height = in_end - in_start;
+            dst_format.height = out_end - out_start;
+        }
+
+        ret = graph_build(&g->graph[i], &g->params, &src_format, &dst_format,
+                          &s->tmp[i], &s->tmp_size[i]);
+        if (ret < 0)
+            return ret;
+
+        if (g->alpha) {
+            zimg_image_format alpha_src_format, alpha_dst_format;
+            zimg_graph_builder_params alpha_params;
+
+            zimg_image_format_default(&alpha_src_format, ZIMG_API_VERSION);
+            zimg_image_format_default(&alpha_dst_format, ZIMG_API_VERSION);
+            zimg_graph_builder_params_default(&alpha_params, ZIMG_API_VERSION);
+
+            alpha_params.dither_type = g->params.dither_type;
+            alpha_params.cpu_type = ZIMG_CPU_AUTO;
+            alpha_params.resample_filter = g->params.resample_filter;
+
+            alpha_src_format.width = src_format.width;
+            alpha_src_format.height = src_format.height;
+            alpha_src_format.depth = src_format.depth;
+            alpha_src_format.pixel_type = src_format.pixel_type;
+            alpha_src_format.color_family = ZIMG_COLOR_GREY;
+            alpha_src_format.active_region = src_format.active_region;
+
+            alpha_dst_format.width = dst_format.width;
+            alpha_dst_format.height = dst_format.height;
+            alpha_dst_format.depth = dst_format.depth;
+            alpha_dst_format.pixel_type = dst_format.pixel_type;
+            alpha_dst_format.color_family = ZIMG_COLOR_GREY;
+
+            ret = graph_build(&g->alpha_graph[i], &alpha_params,
+                              &alpha_src_format, &alpha_dst_format,
+                              &s->tmp[i], &s->tmp_size[i]);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Select the graphs for the current formats and parameters. The graphs of
+ * the last few configurations are kept, so that switching back and forth
+ * between them does not rebuild anything.
+ */
+static int graphs_get(AVFilterContext *ctx, int alpha, int nb_jobs)
+{
+    ZScaleContext *s = ctx->priv;
+    ZScaleGraphs *g = NULL;
+    int i, ret;
+
+    for (i = 0; i < MAX_GRAPHS; i++) {
+        ZScaleGraphs *e = &s->graphs[i];
+
+        if (e->nb_jobs == nb_jobs && e->alpha == alpha &&
+            !memcmp(&e->src_format, &s->src_format, sizeof(s->src_format)) &&
+            !memcmp(&e->dst_format, &s->dst_format, sizeof(s->dst_format)) &&
+            !memcmp(&e->params,     &s->params,     sizeof(s->params))) {
+            g = e;
+            break;
+        }
+    }
+
+    if (!g) {
+        g = &s->graphs[0];
+        for (i = 1; i < MAX_GRAPHS; i++)
+            if (s->graphs[i].last_used < g->last_used)
+                g = &s->graphs[i];
+
+        graphs_free(g);
+        g->src_format = s->src_format;
+        g->dst_format = s->dst_format;
+        g->params     = s->params;
+        g->alpha      = alpha;
+        g->nb_jobs    = nb_jobs;
+
+        ret = graphs_build(s, g);
+        if (ret < 0) {
+            graphs_free(g);
+            s->cur = NULL;
+            return ret;
+        }
+    }
+
+    g->last_used = ++s->nb_used;
+    s->cur = g;
+
+    return 0;
+}
+
 static int realign_frame(const AVPixFmtDescriptor *desc, AVFrame **frame)
 {
     AVFrame *aligned = NULL;
@@ -572,16 +734,84 @@ static void update_output_color_information(ZScaleContext *s, AVFrame *frame)
         frame->chroma_location = (int)s->dst_format.chroma_location + 1;
 }
 
+typedef struct ThreadData {
+    const AVPixFmtDescriptor *desc, *odesc;
+    AVFrame *in, *out;
+} ThreadData;
+
+static int filter_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    ZScaleContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const ZScaleGraphs *g = s->cur;
+    const AVPixFmtDescriptor *desc = td->desc;
+    const AVPixFmtDescriptor *odesc = td->odesc;
+    AVFrame *in = td->in;
+    AVFrame *out = td->out;
+    zimg_image_buffer_const src_buf = { ZIMG_API_VERSION };
+    zimg_image_buffer dst_buf = { ZIMG_API_VERSION };
+    int out_start, out_end, ret, plane;
+    double in_start, in_end;
+
+    slice_params(g, jobnr, &out_start, &out_end, &in_start, &in_end);
+
+    for (plane = 0; plane < 3; plane++) {
+        const int vsub = plane == 1 || plane == 2 ? odesc->log2_chroma_h : 0;
+        int p = desc->comp[plane].plane;
+        src_buf.plane[plane].data   = in->data[p];
+        src_buf.plane[plane].stride = in->linesize[p];
+        src_buf.plane[plane].mask   = -1;
+
+        p = odesc->comp[plane].plane;
+        dst_buf.plane[plane].data   = out->data[p] + (out_start >> vsub) * out->linesize[p];
+        dst_buf.plane[plane].stride = out->linesize[p];
+        dst_buf.plane[plane].mask   = -1;
+    }
+
+    ret = zimg_filter_graph_process(g->graph[jobnr], &src_buf, &dst_buf, s->tmp[jobnr], 0, 0, 0, 0);
+    if (ret)
+        return print_zimg_error(ctx);
+
+    if (g->alpha) {
+        src_buf.plane[0].data   = in->data[3];
+        src_buf.plane[0].stride = in->linesize[3];
+        src_buf.plane[0].mask   = -1;
+
+        dst_buf.plane[0].data   = out->data[3] + out_start * out->linesize[3];
+        dst_buf.plane[0].stride = out->linesize[3];
+        dst_buf.plane[0].mask   = -1;
+
+        ret = zimg_filter_graph_process(g->alpha_graph[jobnr], &src_buf, &dst_buf, s->tmp[jobnr], 0, 0, 0, 0);
+        if (ret)
+            return print_zimg_error(ctx);
+    } else if (odesc->flags & AV_PIX_FMT_FLAG_ALPHA) {
+        int x, y;
+
+        if (odesc->flags & AV_PIX_FMT_FLAG_FLOAT) {
+            for (y = out_start; y < out_end; y++) {
+                for (x = 0; x < out->width; x++) {
+                    AV_WN32(out->data[3] + x * odesc->comp[3].step + y * out->linesize[3],
+                            av_float2int(1.0f));
+                }
+            }
+        } else {
+            for (y = out_start; y < out_end; y++)
+                memset(out->data[3] + y * out->linesize[3], 0xff, out->width);
+        }
+    }
+
+    return 0;
+}
+
 static int filter_frame(AVFilterLink *link, AVFrame *in)
 {
     ZScaleContext *s = link->dst->priv;
     AVFilterLink *outlink = link->dst->outputs[0];
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(link->format);
     const AVPixFmtDescriptor *odesc = av_pix_fmt_desc_get(outlink->format);
-    zimg_image_buffer_const src_buf = { ZIMG_API_VERSION };
-    zimg_image_buffer dst_buf = { ZIMG_API_VERSION };
+    ThreadData td;
     char buf[32];
-    int ret = 0, plane;
+    int ret = 0, i, alpha, nb_jobs;
     AVFrame *out = NULL;
 
     if ((ret = realign_frame(desc, &in)) < 0)
@@ -596,7 +826,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
     out->width  = outlink->w;
     out->height = outlink->h;
 
-    if(   in->width  != link->w
+    if(   !s->cur
+       || s->cur->dst_format.width  != out->width
+       || s->cur->dst_format.height != out->height
+       || in->width  != link->w
        || in->height != link->h
        || in->format != link->format
        || s->in_colorspace != in->colorspace
@@ -621,6 +854,10 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
         if ((ret = config_props(outlink)) < 0)
             goto fail;
 
+        /* The graph cache compares these as a whole, padding included. */
+        memset(&s->src_format, 0, sizeof(s->src_format));
+        memset(&s->dst_format, 0, sizeof(s->dst_format));
+        memset(&s->params, 0, sizeof(s->params));
         zimg_image_format_default(&s->src_format, ZIMG_API_VERSION);
         zimg_image_format_default(&s->dst_format, ZIMG_API_VERSION);
         zimg_graph_builder_params_default(&s->params, ZIMG_API_VERSION);
@@ -641,8 +878,15 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
 
         update_output_color_information(s, out);
 
-        ret = graph_build(&s->graph, &s->params, &s->src_format, &s->dst_format,
-                          &s->tmp, &s->tmp_size);
+        alpha   = desc->flags & AV_PIX_FMT_FLAG_ALPHA && odesc->flags & AV_PIX_FMT_FLAG_ALPHA;
+        /* Each slice starts its rows at 0, which would restart the dither
+         * pattern at every slice boundary, and error diffusion carries over
+         * from one row to the next, so dithered output is not sliced. */
+        nb_jobs = s->dither != ZIMG_DITHER_NONE ? 1 :
+                  FFMIN3(ff_filter_get_nb_threads(link->dst), MAX_THREADS,
+                         out->height >> odesc->log2_chroma_h);
+
+        ret = graphs_get(link->dst, alpha, FFMAX(nb_jobs, 1));
         if (ret < 0)
             goto fail;
 
@@ -654,35 +898,6 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
         s->out_trc        = out->color_trc;
         s->out_primaries  = out->color_primaries;
         s->out_range      = out->color_range;
-
-        if (desc->flags & AV_PIX_FMT_FLAG_ALPHA && odesc->flags & AV_PIX_FMT_FLAG_ALPHA) {
-            zimg_image_format_default(&s->alpha_src_format, ZIMG_API_VERSION);
-            zimg_image_format_default(&s->alpha_dst_format, ZIMG_API_VERSION);
-            zimg_graph_builder_params_default(&s->alpha_params, ZIMG_API_VERSION);
-
-            s->alpha_params.dither_type = s->dither;
-            s->alpha_params.cpu_type = ZIMG_CPU_AUTO;
-            s->alpha_params.resample_filter = s->filter;
-
-            s->alpha_src_format.width = in->width;
-            s->alpha_src_format.height = in->height;
-            s->alpha_src_format.depth = desc->comp[0].depth;
-            s->alpha_src_format.pixel_type = (desc->flags & AV_PIX_FMT_FLAG_FLOAT) ? ZIMG_PIXEL_FLOAT : desc->comp[0].depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE;
-            s->alpha_src_format.color_family = ZIMG_COLOR_GREY;
-
-            s->alpha_dst_format.width = out->width;
-            s->alpha_dst_format.height = out->height;
-            s->alpha_dst_format.depth = odesc->comp[0].depth;
-            s->alpha_dst_format.pixel_type = (odesc->flags & AV_PIX_FMT_FLAG_FLOAT) ? ZIMG_PIXEL_FLOAT : odesc->comp[0].depth > 8 ? ZIMG_PIXEL_WORD : ZIMG_PIXEL_BYTE;
-            s->alpha_dst_format.color_family = ZIMG_COLOR_GREY;
-
-            zimg_filter_graph_free(s->alpha_graph);
-            s->alpha_graph = zimg_filter_graph_build(&s->alpha_src_format, &s->alpha_dst_format, &s->alpha_params);
-            if (!s->alpha_graph) {
-                ret = print_zimg_error(link->dst);
-                goto fail;
-            }
-        }
     }
 
     update_output_color_information(s, out);
@@ -692,52 +907,16 @@ static int filter_frame(AVFilterLink *link, AVFrame *in)
               (int64_t)in->sample_aspect_ratio.den * outlink->w * link->h,
               INT_MAX);
 
-    for (plane = 0; plane < 3; plane++) {
-        int p = desc->comp[plane].plane;
-        src_buf.plane[plane].data   = in->data[p];
-        src_buf.plane[plane].stride = in->linesize[p];
-        src_buf.plane[plane].mask   = -1;
-
-        p = odesc->comp[plane].plane;
-        dst_buf.plane[plane].data   = out->data[p];
-        dst_buf.plane[plane].stride = out->linesize[p];
-        dst_buf.plane[plane].mask   = -1;
-    }
-
-    ret = zimg_filter_graph_process(s->graph, &src_buf, &dst_buf, s->tmp, 0, 0, 0, 0);
-    if (ret) {
-        ret = print_zimg_error(link->dst);
-        goto fail;
-    }
-
-    if (desc->flags & AV_PIX_FMT_FLAG_ALPHA && odesc->flags & AV_PIX_FMT_FLAG_ALPHA) {
-        src_buf.plane[0].data   = in->data[3];
-        src_buf.plane[0].stride = in->linesize[3];
-        src_buf.plane[0].mask   = -1;
-
-        dst_buf.plane[0].data   = out->data[3];
-        dst_buf.plane[0].stride = out->linesize[3];
-        dst_buf.plane[0].mask   = -1;
-
-        ret = zimg_filter_graph_process(s->alpha_graph, &src_buf, &dst_buf, s->tmp, 0, 0, 0, 0);
-        if (ret) {
-            ret = print_zimg_error(link->dst);
+    td.desc  = desc;
+    td.odesc = odesc;
+    td.in    = in;
+    td.out   = out;
+    ff_filter_execute(link->dst, filter_slice, &td, s->jobs_ret, s->cur->nb_jobs);
+    for (i = 0; i < s->cur->nb_jobs; i++) {
+        if (s->jobs_ret[i] < 0) {
+            ret = s->jobs_ret[i];
             goto fail;
         }
-    } else if (odesc->flags & AV_PIX_FMT_FLAG_ALPHA) {
-        int x, y;
-
-        if (odesc->flags & AV_PIX_FMT_FLAG_FLOAT) {
-            for (y = 0; y < out->height; y++) {
-                for (x = 0; x < out->width; x++) {
-                    AV_WN32(out->data[3] + x * odesc->comp[3].step + y * out->linesize[3],
-                            av_float2int(1.0f));
-                }
-            }
-        } else {
-            for (y = 0; y < outlink->h; y++)
-                memset(out->data[3] + y * out->linesize[3], 0xff, outlink->w);
-        }
     }
 
 fail:
@@ -753,11 +932,14 @@ fail:
 static av_cold void uninit(AVFilterContext *ctx)
 {
     ZScaleContext *s = ctx->priv;
+    int i;
 
-    zimg_filter_graph_free(s->graph);
-    zimg_filter_graph_free(s->alpha_graph);
-    av_freep(&s->tmp);
-    s->tmp_size = 0;
+    for (i = 0; i < MAX_GRAPHS; i++)
+        graphs_free(&s->graphs[i]);
+    for (i = 0; i < MAX_THREADS; i++) {
+        av_freep(&s->tmp[i]);
+        s->tmp_size[i] = 0;
+    }
 }
 
 static int process_command(AVFilterContext *ctx, const char *cmd, const char *args,
@@ -941,4 +1123,5 @@ const AVFilter ff_vf_zscale = {
     FILTER_OUTPUTS(avfilter_vf_zscale_outputs),
     FILTER_QUERY_FUNC(query_formats),
     .process_command = process_command,
+    .flags           = AVFILTER_FLAG_SLICE_THREADS,
 };
@@ -655,6 +655,13 @@ int ffurl_shutdown(URLContext *h, int flags)
     return h->prot->url_shutdown(h, flags);
 }
 
+int ffurl_flush(URLContext *h)
+{
+    if (!h || !h->prot || !h->prot->url_flush)
+        return 0;
+    return h->prot->url_flush(h);
+}
+
 int ff_check_interrupt(AVIOInterruptCB *cb)
 {
     if (cb && cb->callback)
@@ -163,6 +163,15 @@ int ffio_ensure_seekback(AVIOContext *s, int64_t buf_size);
 
 int ffio_limit(AVIOContext *s, int size);
 
+/**
+ * Flush the buffer like avio_flush() and wait until the protocol has
+ * written out all the data passed to it, for protocols completing writes
+ * asynchronously.
+ *
+ * @return a negative AVERROR code if the data could not be written
+ */
+int ffio_flush_sync(AVIOContext *s);
+
 void ffio_init_checksum(AVIOContext *s,
                         unsigned long (*update_checksum)(unsigned long c, const uint8_t *p, unsigned int len),
                         unsigned long checksum);
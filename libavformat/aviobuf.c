@@ -257,6 +257,17 @@ void avio_flush(AVIOContext *s)
         avio_seek(s, seekback, SEEK_CUR);
 }
 
+int ffio_flush_sync(AVIOContext *s)
+{
+    int ret;
+
+    avio_flush(s);
+    ret = ffurl_flush(ffio_geturlcontext(s));
+    if (ret < 0 && s->error >= 0)
+        s->error = ret;
+    return ret;
+}
+
 int64_t avio_seek(AVIOContext *s, int64_t offset, int whence)
 {
     FFIOContext *const ctx = ffiocontext(s);
@@ -28,6 +28,7 @@
 #include "internal.h"
 #include "avio_internal.h"
 #include "dash.h"
+#include "segprefetch.h"
 
 #define INITIAL_BUFFER_SIZE 32768
 #define MAX_BPRINT_READ_SIZE (UINT_MAX - 1)
@@ -79,6 +80,10 @@ struct representation {
     char *url_template;
     FFIOContext pb;
     AVIOContext *input;
+    /* fragments downloaded in advance, indexed by sequence number modulo
+     * prefetch_segments + 1, and the one currently read from if any */
+    SegmentPrefetch **prefetch;
+    SegmentPrefetch *cur_prefetch;
     AVFormatContext *parent;
     AVFormatContext *ctx;
     int stream_index;
@@ -152,6 +157,8 @@ typedef struct DASHContext {
     char *allowed_extensions;
     AVDictionary *avio_opts;
     int max_url_size;
+    int prefetch_segments;
+    int64_t prefetch_max_size;
 
     /* Flags for init section*/
     int is_init_section_common_video;
@@ -346,8 +353,21 @@ static void free_timelines_list(struct representation *pls)
     pls->n_timelines = 0;
 }
 
+static void prefetch_flush(DASHContext *c, struct representation *pls)
+{
+    int i;
+
+    pls->cur_prefetch = NULL;
+    if (!pls->prefetch)
+        return;
+    for (i = 0; i <= c->prefetch_segments; i++)
+        ff_segment_prefetch_free(&pls->prefetch[i], &c->avio_opts);
+}
+
 static void free_representation(struct representation *pls)
 {
+    prefetch_flush(pls->parent->priv_data, pls);
+    av_freep(&pls->prefetch);
     free_fragment_list(pls);
     free_timelines_list(pls);
     free_fragment(&pls->cur_seg);
@@ -1583,29 +1603,67 @@ finish:
     return ret;
 }
 
+static struct fragment *dup_fragment(const struct fragment *src)
+{
+    struct fragment *seg = av_mallocz(sizeof(struct fragment));
+
+    if (!seg)
+        return NULL;
+    seg->url = av_strdup(src->url);
+    if (!seg->url) {
+        av_free(seg);
+        return NULL;
+    }
+    seg->size = src->size;
+    seg->url_offset = src->url_offset;
+    return seg;
+}
+
+static struct fragment *get_template_fragment(struct representation *pls, int64_t seq_no)
+{
+    DASHContext *c = pls->parent->priv_data;
+    struct fragment *seg;
+    char *tmpfilename;
+
+    if (!pls->url_template) {
+        av_log(pls->parent, AV_LOG_ERROR, "Cannot get fragment, missing template URL\n");
+        return NULL;
+    }
+    seg = av_mallocz(sizeof(struct fragment));
+    if (!seg)
+        return NULL;
+    tmpfilename = av_mallocz(c->max_url_size);
+    if (!tmpfilename) {
+        av_free(seg);
+        return NULL;
+    }
+    ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, seq_no, 0, get_segment_start_time_based_on_timeline(pls, seq_no));
+    seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
+    if (!seg->url) {
+        av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
+        seg->url = av_strdup(pls->url_template);
+        if (!seg->url) {
+            av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
+            av_free(tmpfilename);
+            av_free(seg);
+            return NULL;
+        }
+    }
+    av_free(tmpfilename);
+    seg->size = -1;
+
+    return seg;
+}
+
 static struct fragment *get_current_fragment(struct representation *pls)
 {
     int64_t min_seq_no = 0;
     int64_t max_seq_no = 0;
-    struct fragment *seg = NULL;
-    struct fragment *seg_ptr = NULL;
     DASHContext *c = pls->parent->priv_data;
 
     while (( !ff_check_interrupt(c->interrupt_callback)&& pls->n_fragments > 0)) {
         if (pls->cur_seq_no < pls->n_fragments) {
-            seg_ptr = pls->fragments[pls->cur_seq_no];
-            seg = av_mallocz(sizeof(struct fragment));
-            if (!seg) {
-                return NULL;
-            }
-            seg->url = av_strdup(seg_ptr->url);
-            if (!seg->url) {
-                av_free(seg);
-                return NULL;
-            }
-            seg->size = seg_ptr->size;
-            seg->url_offset = seg_ptr->url_offset;
-            return seg;
+            return dup_fragment(pls->fragments[pls->cur_seq_no]);
         } else if (c->is_live) {
             refresh_manifest(pls->parent);
         } else {
@@ -1625,45 +1683,91 @@ static struct fragment *get_current_fragment(struct representation *pls)
         } else if (pls->cur_seq_no > max_seq_no) {
             av_log(pls->parent, AV_LOG_VERBOSE, "new fragment: min[%"PRId64"] max[%"PRId64"]\n", min_seq_no, max_seq_no);
         }
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
-        }
+        return get_template_fragment(pls, pls->cur_seq_no);
     } else if (pls->cur_seq_no <= pls->last_seq_no) {
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
-        }
+        return get_template_fragment(pls, pls->cur_seq_no);
     }
-    if (seg) {
-        char *tmpfilename;
-        if (!pls->url_template) {
-            av_log(pls->parent, AV_LOG_ERROR, "Cannot get fragment, missing template URL\n");
-            av_free(seg);
-            return NULL;
-        }
-        tmpfilename = av_mallocz(c->max_url_size);
-        if (!tmpfilename) {
-            av_free(seg);
+
+    return NULL;
+}
+
+/**
+ * Start the downloads of the current fragment and of the prefetch_segments
+ * next ones of a static manifest, dropping those outside of this window.
+ *
+ * @return the download of the current fragment, NULL if it is not prefetched
+ */
+static SegmentPrefetch *prefetch_update(DASHContext *c, struct representation *pls)
+{
+    int n = c->prefetch_segments + 1;
+    int64_t seq_no;
+    char *url;
+    int i;
+
+    if (!pls->prefetch) {
+        pls->prefetch = av_calloc(n, sizeof(*pls->prefetch));
+        if (!pls->prefetch)
             return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        SegmentPrefetch *pf = pls->prefetch[i];
+        if (pf && (ff_segment_prefetch_seq_no(pf) < pls->cur_seq_no ||
+                   ff_segment_prefetch_seq_no(pf) >= pls->cur_seq_no + n))
+            ff_segment_prefetch_free(&pls->prefetch[i], &c->avio_opts);
+    }
+
+    url = av_mallocz(c->max_url_size);
+    if (!url)
+        return pls->prefetch[pls->cur_seq_no % n];
+    for (seq_no = pls->cur_seq_no; seq_no < pls->cur_seq_no + n; seq_no++) {
+        SegmentPrefetch **ppf = &pls->prefetch[seq_no % n];
+        struct fragment *seg;
+        int ret;
+
+        if (*ppf)
+            continue;
+        if (pls->n_fragments)
+            seg = seq_no < pls->n_fragments ? dup_fragment(pls->fragments[seq_no]) : NULL;
+        else
+            seg = seq_no <= pls->last_seq_no ? get_template_fragment(pls, seq_no) : NULL;
+        if (!seg)
+            break;
+        ff_make_absolute_url(url, c->max_url_size, c->base_url, seg->url);
+        if (!ishttp(url)) {
+            free_fragment(&seg);
+            break;
         }
-        ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, pls->cur_seq_no, 0, get_segment_start_time_based_on_timeline(pls, pls->cur_seq_no));
-        seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
-        if (!seg->url) {
-            av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
-            seg->url = av_strdup(pls->url_template);
-            if (!seg->url) {
-                av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
-                av_free(tmpfilename);
-                av_free(seg);
-                return NULL;
-            }
-        }
-        av_free(tmpfilename);
-        seg->size = -1;
+        av_log(pls->parent, AV_LOG_VERBOSE, "DASH prefetch for url '%s', offset %"PRId64"\n",
+               url, seg->url_offset);
+        ret = ff_segment_prefetch_start(ppf, pls->parent, url, seq_no,
+                                        seg->url_offset, seg->size, c->avio_opts,
+                                        c->prefetch_max_size / n);
+        free_fragment(&seg);
+        if (ret < 0)
+            break;
     }
+    av_free(url);
 
-    return seg;
+    return pls->prefetch[pls->cur_seq_no % n];
+}
+
+static int read_from_prefetch(struct representation *pls, uint8_t *buf, int buf_size)
+{
+    int ret = ff_segment_prefetch_read(pls->cur_prefetch, buf, buf_size);
+
+    if (ret > 0)
+        pls->cur_seg_offset += ret;
+    return ret;
+}
+
+static void prefetch_release(DASHContext *c, struct representation *pls)
+{
+    int64_t seq_no = ff_segment_prefetch_seq_no(pls->cur_prefetch);
+
+    pls->cur_prefetch = NULL;
+    ff_segment_prefetch_free(&pls->prefetch[seq_no % (c->prefetch_segments + 1)],
+                             &c->avio_opts);
 }
 
 static int read_from_url(struct representation *pls, struct fragment *seg,
@@ -1763,7 +1867,7 @@ static int update_init_section(struct representation *pls)
 static int64_t seek_data(void *opaque, int64_t offset, int whence)
 {
     struct representation *v = opaque;
-    if (v->n_fragments && !v->init_sec_data_len) {
+    if (v->n_fragments && !v->init_sec_data_len && !v->cur_prefetch) {
         return avio_seek(v->input, offset, whence);
     }
 
@@ -1777,7 +1881,7 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     DASHContext *c = v->parent->priv_data;
 
 restart:
-    if (!v->input) {
+    if (!v->input && !v->cur_prefetch) {
         free_fragment(&v->cur_seg);
         v->cur_seg = get_current_fragment(v);
         if (!v->cur_seg) {
@@ -1790,7 +1894,18 @@ restart:
         if (ret)
             goto end;
 
-        ret = open_input(c, v, v->cur_seg);
+        /* a single fragment is read and seeked in directly */
+        if (c->prefetch_segments > 0 && !c->is_live && v->n_fragments != 1)
+            v->cur_prefetch = prefetch_update(c, v);
+        if (v->cur_prefetch) {
+            ret = ff_segment_prefetch_wait(v->cur_prefetch);
+            if (ret < 0)
+                prefetch_release(c, v);
+            v->cur_seg_offset = 0;
+            v->cur_seg_size = v->cur_seg->size;
+        }
+        if (!v->cur_prefetch)
+            ret = open_input(c, v, v->cur_seg);
         if (ret < 0) {
             if (ff_check_interrupt(c->interrupt_callback)) {
                 ret = AVERROR_EXIT;
@@ -1819,7 +1934,10 @@ restart:
         ret = AVERROR_EOF;
         goto end;
     }
-    ret = read_from_url(v, v->cur_seg, buf, buf_size);
+    if (v->cur_prefetch)
+        ret = read_from_prefetch(v, buf, buf_size);
+    else
+        ret = read_from_url(v, v->cur_seg, buf, buf_size);
     if (ret > 0)
         goto end;
 
@@ -2157,6 +2275,7 @@ static void recheck_discard_flags(AVFormatContext *s, struct representation **p,
         } else if (!needed && pls->ctx) {
             close_demux_for_component(pls);
             ff_format_io_close(pls->parent, &pls->input);
+            prefetch_flush(s->priv_data, pls);
             av_log(s, AV_LOG_INFO, "No longer receiving stream_index %d\n", pls->stream_index);
         }
     }
@@ -2218,6 +2337,8 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
             cur->cur_seg_offset = 0;
             cur->init_sec_buf_read_offset = 0;
             ff_format_io_close(cur->parent, &cur->input);
+            if (cur->cur_prefetch)
+                prefetch_release(c, cur);
             ret = reopen_demux_for_component(s, cur);
             cur->is_restart_needed = 0;
         }
@@ -2257,6 +2378,8 @@ static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t see
     }
 
     ff_format_io_close(pls->parent, &pls->input);
+    if (pls->cur_prefetch)
+        prefetch_release(s->priv_data, pls);
 
     // find the nearest fragment
     if (pls->n_timelines > 0 && pls->fragment_timescale > 0) {
@@ -2354,6 +2477,10 @@ static const AVOption dash_options[] = {
         OFFSET(allowed_extensions), AV_OPT_TYPE_STRING,
         {.str = "aac,m4a,m4s,m4v,mov,mp4,webm,ts"},
         INT_MIN, INT_MAX, FLAGS},
+    {"prefetch_segments", "Number of fragments to download in advance in parallel",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_max_size", "Maximum amount of prefetched data kept in memory per representation",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 64 << 20}, 0, INT64_MAX, FLAGS},
     {NULL}
 };
 
@@ -35,6 +35,15 @@
 #endif
 #include <sys/stat.h>
 #include <stdlib.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#if HAVE_IO_URING
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 #include "os_support.h"
 #include "url.h"
 
@@ -65,6 +74,48 @@
 #  endif
 #endif
 
+/* Seeks farther than this are taken as a switch to random access. */
+#define MMAP_SEEK_WINDOW   (1 << 20)
+/* Sequential reading needed to switch back from random access. */
+#define MMAP_SEQUENTIAL_RUN (4 << 20)
+
+/* Size of the requests queued by the io_uring backend. */
+#define URING_BLOCK_SIZE   262144
+
+#if HAVE_IO_URING
+typedef struct FileIOSlot {
+    uint8_t *buf;
+    struct iovec iov;
+    int64_t pos;
+    int size;               ///< number of bytes requested
+    int result;             ///< completion result, valid once !pending
+    int pending;
+} FileIOSlot;
+
+typedef struct FileURing {
+    int ring_fd;
+    int fd;                 ///< file the requests operate on
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned to_submit;     ///< queued entries not yet taken by the kernel
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void  *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    int write;              ///< write-behind if set, read-ahead otherwise
+    FileIOSlot *slots;
+    int nb_slots;
+    int head;               ///< oldest queued slot
+    int nb_queued;          ///< number of queued slots, starting at head
+    int64_t pos;            ///< logical file position
+    int64_t next_pos;       ///< read-ahead: position of the next block to request
+    int offset;             ///< read-ahead: bytes of the head slot already returned
+    int64_t size;           ///< write-behind: file size including queued writes
+    int error;              ///< write-behind: failure to report on the next call
+} FileURing;
+#endif
+
 /* standard file protocol */
 
 typedef struct FileContext {
@@ -74,6 +125,20 @@ typedef struct FileContext {
     int blocksize;
     int follow;
     int seekable;
+    int use_mmap;
+#if HAVE_MMAP
+    uint8_t *map;           ///< mapping of the whole file, NULL if unused
+    int64_t map_size;
+    int64_t map_pos;        ///< current read position in the mapping
+    int64_t seq_start;      ///< start of the current sequential read run
+    int map_random;         ///< the mapping is advised for random access
+    int64_t page_size;
+#endif
+    int use_uring;
+    int io_depth;
+#if HAVE_IO_URING
+    FileURing *uring;
+#endif
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
@@ -84,6 +149,9 @@ static const AVOption file_options[] = {
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "seekable", "Sets if the file is seekable", offsetof(FileContext, seekable), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 0, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+    { "mmap", "Map regular files into memory for reading", offsetof(FileContext, use_mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "io_uring", "Use io_uring for read-ahead and write-behind on regular files", offsetof(FileContext, use_uring), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+    { "io_depth", "Number of io_uring requests kept in flight", offsetof(FileContext, io_depth), AV_OPT_TYPE_INT, { .i64 = 4 }, 1, 64, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
     { NULL }
 };
 
@@ -106,11 +174,428 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+#if HAVE_MMAP
+#ifdef POSIX_MADV_NORMAL
+static void file_map_advise(FileContext *c, int64_t pos, int64_t size, int advice)
+{
+    int64_t start = pos & ~(c->page_size - 1);
+    posix_madvise(c->map + start, FFMIN(size + pos - start, c->map_size - start),
+                  advice);
+}
+#endif
+
+static int file_map_read(FileContext *c, unsigned char *buf, int size)
+{
+    if (c->map_pos >= c->map_size)
+        return AVERROR_EOF;
+
+    size = FFMIN(size, c->map_size - c->map_pos);
+    memcpy(buf, c->map + c->map_pos, size);
+    c->map_pos += size;
+
+#ifdef POSIX_MADV_NORMAL
+    if (c->map_random && c->map_pos - c->seq_start >= MMAP_SEQUENTIAL_RUN) {
+        file_map_advise(c, 0, c->map_size, POSIX_MADV_SEQUENTIAL);
+        c->map_random = 0;
+    }
+#endif
+
+    return size;
+}
+
+static int64_t file_map_seek(FileContext *c, int64_t pos, int whence)
+{
+    if (whence == SEEK_CUR)
+        pos += c->map_pos;
+    else if (whence == SEEK_END)
+        pos += c->map_size;
+    else if (whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if (pos < 0)
+        return AVERROR(EINVAL);
+
+#ifdef POSIX_MADV_NORMAL
+    /* Short skips are still covered by the kernel readahead, a jump further
+     * away means e.g. index parsing or interleaved access to distant data,
+     * where readahead only evicts useful pages. Prefetch the new position
+     * explicitly instead. */
+    if (FFABS(pos - c->map_pos) > MMAP_SEEK_WINDOW) {
+        if (!c->map_random) {
+            file_map_advise(c, 0, c->map_size, POSIX_MADV_RANDOM);
+            c->map_random = 1;
+        }
+        if (pos < c->map_size)
+            file_map_advise(c, pos, MMAP_SEEK_WINDOW, POSIX_MADV_WILLNEED);
+        c->seq_start = pos;
+    }
+#endif
+
+    c->map_pos = pos;
+    return pos;
+}
+
+static void file_map(URLContext *h, const struct stat *st)
+{
+    FileContext *c = h->priv_data;
+    void *map;
+
+    if (!S_ISREG(st->st_mode) || st->st_size <= 0 || st->st_size > SIZE_MAX) {
+        av_log(h, AV_LOG_VERBOSE, "Not a mappable file, using read()\n");
+        return;
+    }
+
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (map == MAP_FAILED) {
+        char errbuf[128];
+        av_strerror(AVERROR(errno), errbuf, sizeof(errbuf));
+        av_log(h, AV_LOG_WARNING, "mmap() failed, using read(): %s\n", errbuf);
+        return;
+    }
+
+    c->map       = map;
+    c->map_size  = st->st_size;
+    c->page_size = sysconf(_SC_PAGESIZE);
+#ifdef POSIX_MADV_NORMAL
+    file_map_advise(c, 0, c->map_size, POSIX_MADV_SEQUENTIAL);
+#endif
+}
+#endif /* HAVE_MMAP */
+
+#if HAVE_IO_URING
+static void uring_reap(FileURing *r)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = atomic_load_explicit((atomic_uint *)r->cq_tail,
+                                         memory_order_acquire);
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        FileIOSlot *slot = &r->slots[cqe->user_data];
+
+        slot->result  = cqe->res;
+        slot->pending = 0;
+    }
+    atomic_store_explicit((atomic_uint *)r->cq_head, head, memory_order_release);
+}
+
+static int uring_wait(FileURing *r, FileIOSlot *slot)
+{
+    uring_reap(r);
+    while (slot->pending) {
+        int ret = syscall(__NR_io_uring_enter, r->ring_fd, r->to_submit, 1,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR)
+            return AVERROR(errno);
+        if (ret > 0)
+            r->to_submit -= ret;
+        uring_reap(r);
+    }
+    return 0;
+}
+
+static int uring_submit(FileURing *r, FileIOSlot *slot, int opcode)
+{
+    unsigned tail = *r->sq_tail;
+    unsigned idx  = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    int ret;
+
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len  = slot->size;
+    slot->pending      = 1;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = opcode;
+    sqe->fd        = r->fd;
+    sqe->addr      = (uintptr_t)&slot->iov;
+    sqe->len       = 1;
+    sqe->off       = slot->pos;
+    sqe->user_data = slot - r->slots;
+    r->sq_array[idx] = idx;
+    atomic_store_explicit((atomic_uint *)r->sq_tail, tail + 1, memory_order_release);
+    r->to_submit++;
+
+    /* on failure, the entry stays queued and is submitted by uring_wait() */
+    do {
+        ret = syscall(__NR_io_uring_enter, r->ring_fd, r->to_submit, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        return AVERROR(errno);
+    r->to_submit -= ret;
+    return 0;
+}
+
+/**
+ * Wait for the oldest queued write and dequeue it. Short writes, e.g. when
+ * the disk is running full, are completed synchronously to get a proper
+ * error code.
+ */
+static int uring_complete_write(FileURing *r)
+{
+    FileIOSlot *slot = &r->slots[r->head];
+    int ret = uring_wait(r, slot);
+
+    r->head = (r->head + 1) % r->nb_slots;
+    r->nb_queued--;
+
+    if (ret < 0)
+        return ret;
+    if (slot->result < 0)
+        return AVERROR(-slot->result);
+    while (slot->result < slot->size) {
+        ssize_t n = pwrite(r->fd, slot->buf + slot->result,
+                           slot->size - slot->result, slot->pos + slot->result);
+        if (n < 0 && errno != EINTR)
+            return AVERROR(errno);
+        if (n > 0)
+            slot->result += n;
+    }
+    return 0;
+}
+
+/**
+ * Wait for all queued requests, discarding read-ahead data.
+ */
+static int uring_drain(FileURing *r)
+{
+    int ret = 0;
+
+    if (r->write) {
+        while (r->nb_queued) {
+            int err = uring_complete_write(r);
+            if (err < 0 && !r->error)
+                r->error = err;
+        }
+        ret = r->error;
+    } else {
+        for (; r->nb_queued; r->nb_queued--) {
+            int err = uring_wait(r, &r->slots[r->head]);
+            if (err < 0)
+                ret = err;
+            r->head = (r->head + 1) % r->nb_slots;
+        }
+        r->offset = 0;
+    }
+    return ret;
+}
+
+static int uring_read(FileURing *r, unsigned char *buf, int size)
+{
+    FileIOSlot *slot;
+    int ret;
+
+    while (r->nb_queued < r->nb_slots) {
+        slot = &r->slots[(r->head + r->nb_queued) % r->nb_slots];
+        slot->pos  = r->next_pos;
+        slot->size = URING_BLOCK_SIZE;
+        ret = uring_submit(r, slot, IORING_OP_READV);
+        r->next_pos += URING_BLOCK_SIZE;
+        r->nb_queued++;
+        if (ret < 0)
+            return ret;
+    }
+
+    slot = &r->slots[r->head];
+    for (;;) {
+        ret = uring_wait(r, slot);
+        if (ret < 0)
+            return ret;
+        if (slot->result < 0)
+            return AVERROR(-slot->result);
+        if (r->offset < slot->result)
+            break;
+        if (!slot->result)
+            return AVERROR_EOF;
+        /* Short read before the end of the file: request the remainder
+         * again, the following blocks are unaffected. */
+        slot->pos  += slot->result;
+        slot->size -= slot->result;
+        r->offset   = 0;
+        ret = uring_submit(r, slot, IORING_OP_READV);
+        if (ret < 0)
+            return ret;
+    }
+
+    size = FFMIN(size, slot->result - r->offset);
+    memcpy(buf, slot->buf + r->offset, size);
+    r->offset += size;
+    r->pos    += size;
+
+    if (r->offset == slot->size) {
+        r->head   = (r->head + 1) % r->nb_slots;
+        r->nb_queued--;
+        r->offset = 0;
+    }
+    return size;
+}
+
+static int uring_write(FileURing *r, const unsigned char *buf, int size)
+{
+    FileIOSlot *slot;
+    int ret;
+
+    if (r->error)
+        return r->error;
+
+    if (r->nb_queued == r->nb_slots) {
+        ret = uring_complete_write(r);
+        if (ret < 0)
+            return r->error = ret;
+    }
+
+    slot = &r->slots[(r->head + r->nb_queued) % r->nb_slots];
+    size = FFMIN(size, URING_BLOCK_SIZE);
+    memcpy(slot->buf, buf, size);
+    slot->pos  = r->pos;
+    slot->size = size;
+    r->nb_queued++;
+
+    ret = uring_submit(r, slot, IORING_OP_WRITEV);
+    if (ret < 0)
+        return r->error = ret;
+
+    r->pos += size;
+    r->size = FFMAX(r->size, r->pos);
+    return size;
+}
+
+static int64_t uring_seek(FileURing *r, int64_t pos, int whence)
+{
+    int ret;
+
+    if (whence == SEEK_CUR)
+        pos += r->pos;
+    else if (whence == SEEK_END && r->write)
+        pos += r->size;
+    else if (whence == SEEK_END) {
+        struct stat st;
+        if (fstat(r->fd, &st) < 0)
+            return AVERROR(errno);
+        pos += st.st_size;
+    } else if (whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if (pos < 0)
+        return AVERROR(EINVAL);
+    if (pos == r->pos)
+        return pos;
+
+    /* Queued writes may overlap the data written after the seek, and
+     * io_uring does not order requests, so let them finish first. */
+    ret = uring_drain(r);
+    if (ret < 0)
+        return ret;
+
+    r->pos = r->next_pos = pos;
+    return pos;
+}
+
+static void uring_free(FileURing **pr)
+{
+    FileURing *r = *pr;
+
+    if (!r)
+        return;
+    if (r->slots) {
+        for (int i = 0; i < r->nb_slots; i++)
+            av_freep(&r->slots[i].buf);
+        av_freep(&r->slots);
+    }
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->ring_fd >= 0)
+        close(r->ring_fd);
+    av_freep(pr);
+}
+
+static int uring_init(URLContext *h, int write, const struct stat *st)
+{
+    FileContext *c = h->priv_data;
+    struct io_uring_params p = { 0 };
+    FileURing *r;
+    void *ptr;
+    int ret;
+
+    r = c->uring = av_mallocz(sizeof(*r));
+    if (!r)
+        return AVERROR(ENOMEM);
+    r->fd       = c->fd;
+    r->write    = write;
+    r->nb_slots = c->io_depth;
+    r->size     = st->st_size;
+
+    r->ring_fd = syscall(__NR_io_uring_setup, r->nb_slots, &p);
+    if (r->ring_fd < 0) {
+        ret = AVERROR(errno);
+        goto fail;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ptr = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               r->ring_fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED)
+        goto fail_errno;
+    r->sq_ring = ptr;
+    ptr = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               r->ring_fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED)
+        goto fail_errno;
+    r->cq_ring = ptr;
+    ptr = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               r->ring_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        goto fail_errno;
+    r->sqes = ptr;
+
+    r->sq_tail  = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.array);
+    r->cq_head  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((uint8_t *)r->cq_ring + p.cq_off.cqes);
+
+    r->slots = av_calloc(r->nb_slots, sizeof(*r->slots));
+    if (!r->slots) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (int i = 0; i < r->nb_slots; i++) {
+        r->slots[i].buf = av_malloc(URING_BLOCK_SIZE);
+        if (!r->slots[i].buf) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+    }
+
+    return 0;
+fail_errno:
+    ret = AVERROR(errno);
+fail:
+    uring_free(&c->uring);
+    return ret;
+}
+#endif /* HAVE_IO_URING */
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+#if HAVE_MMAP
+    if (c->map)
+        return file_map_read(c, buf, size);
+#endif
+#if HAVE_IO_URING
+    if (c->uring)
+        return uring_read(c->uring, buf, size);
+#endif
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -124,13 +609,35 @@ static int file_write(URLContext *h, const unsigned char *buf, int size)
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+#if HAVE_IO_URING
+    if (c->uring)
+        return uring_write(c->uring, buf, size);
+#endif
     ret = write(c->fd, buf, size);
     return (ret == -1) ? AVERROR(errno) : ret;
 }
 
+static int file_flush(URLContext *h)
+{
+#if HAVE_IO_URING
+    FileContext *c = h->priv_data;
+
+    /* the queued writes complete in any order, wait for all of them */
+    if (c->uring && c->uring->write)
+        return uring_drain(c->uring);
+#endif
+    return 0;
+}
+
 static int file_get_handle(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if HAVE_IO_URING
+    /* Users of the descriptor expect the data written so far to be in the
+     * file, a failure is reported by the next write. */
+    if (c->uring && c->uring->write)
+        uring_drain(c->uring);
+#endif
     return c->fd;
 }
 
@@ -243,6 +750,36 @@ static int file_open(URLContext *h, const char *filename, int flags)
     if (c->seekable >= 0)
         h->is_streamed = !c->seekable;
 
+    if (c->use_mmap && !(flags & AVIO_FLAG_WRITE)) {
+#if HAVE_MMAP
+        if (c->follow)
+            av_log(h, AV_LOG_WARNING, "mmap cannot be combined with follow, ignoring\n");
+        else if (!fstat(fd, &st))
+            file_map(h, &st);
+#else
+        av_log(h, AV_LOG_WARNING, "mmap is not supported on this platform, ignoring\n");
+#endif
+    }
+
+    if (c->use_uring) {
+#if HAVE_IO_URING
+        int ret;
+        if (c->follow || (flags & AVIO_FLAG_READ && flags & AVIO_FLAG_WRITE) ||
+            fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            av_log(h, AV_LOG_WARNING, "io_uring needs a regular file opened "
+                   "for either reading or writing, ignoring\n");
+        } else if (c->map) {
+            av_log(h, AV_LOG_WARNING, "io_uring cannot be combined with mmap, ignoring\n");
+        } else if ((ret = uring_init(h, flags & AVIO_FLAG_WRITE, &st)) < 0) {
+            char errbuf[128];
+            av_strerror(ret, errbuf, sizeof(errbuf));
+            av_log(h, AV_LOG_WARNING, "io_uring setup failed, using blocking I/O: %s\n", errbuf);
+        }
+#else
+        av_log(h, AV_LOG_WARNING, "io_uring is not supported on this platform, ignoring\n");
+#endif
+    }
+
     return 0;
 }
 
@@ -254,10 +791,23 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 
     if (whence == AVSEEK_SIZE) {
         struct stat st;
+#if HAVE_IO_URING
+        if (c->uring && c->uring->write)
+            return c->uring->size;
+#endif
         ret = fstat(c->fd, &st);
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
+#if HAVE_MMAP
+    if (c->map)
+        return file_map_seek(c, pos, whence);
+#endif
+#if HAVE_IO_URING
+    if (c->uring)
+        return uring_seek(c->uring, pos, whence);
+#endif
+
     ret = lseek(c->fd, pos, whence);
 
     return ret < 0 ? AVERROR(errno) : ret;
@@ -266,7 +816,20 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
-    int ret = close(c->fd);
+    int ret, err = 0;
+#if HAVE_MMAP
+    if (c->map)
+        munmap(c->map, c->map_size);
+#endif
+#if HAVE_IO_URING
+    if (c->uring) {
+        err = uring_drain(c->uring);
+        uring_free(&c->uring);
+    }
+#endif
+    ret = close(c->fd);
+    if (err < 0)
+        return err;
     return (ret == -1) ? AVERROR(errno) : 0;
 }
 
@@ -361,6 +924,7 @@ const URLProtocol ff_file_protocol = {
     .url_write           = file_write,
     .url_seek            = file_seek,
     .url_close           = file_close,
+    .url_flush           = file_flush,
     .url_get_file_handle = file_get_handle,
     .url_check           = file_check,
     .url_delete          = file_delete,
@@ -34,11 +34,13 @@
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "avformat.h"
 #include "internal.h"
 #include "avio_internal.h"
 #include "id3v2.h"
+#include "segprefetch.h"
 
 #include "hls_sample_encryption.h"
 
@@ -101,6 +103,10 @@ struct playlist {
     int input_read_done;
     AVIOContext *input_next;
     int input_next_requested;
+    /* segments downloaded in advance, indexed by sequence number modulo
+     * prefetch_segments + 1, and the one currently read from if any */
+    SegmentPrefetch **prefetch;
+    SegmentPrefetch *cur_prefetch;
     AVFormatContext *parent;
     int index;
     AVFormatContext *ctx;
@@ -218,10 +224,14 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     int http_seekable;
+    int prefetch_segments;
+    int64_t prefetch_max_size;
     AVIOContext *playlist_pb;
     HLSCryptoContext  crypto_ctx;
 } HLSContext;
 
+static void prefetch_flush(HLSContext *c, struct playlist *pls);
+
 static void free_segment_dynarray(struct segment **segments, int n_segments)
 {
     int i;
@@ -269,6 +279,8 @@ static void free_playlist_list(HLSContext *c)
         pls->input_read_done = 0;
         ff_format_io_close(c->ctx, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_flush(c, pls);
+        av_freep(&pls->prefetch);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -1389,6 +1401,88 @@ static int update_init_section(struct playlist *pls, struct segment *seg)
     return 0;
 }
 
+/**
+ * Start the downloads of the current segment and of the prefetch_segments
+ * next ones, dropping those outside of this window.
+ *
+ * @return the download of the current segment, NULL if it is not prefetched
+ */
+static SegmentPrefetch *prefetch_update(HLSContext *c, struct playlist *pls)
+{
+    int n = c->prefetch_segments + 1;
+    AVDictionary *opts = NULL;
+    int64_t seq_no;
+    int i;
+
+    if (!pls->prefetch) {
+        pls->prefetch = av_calloc(n, sizeof(*pls->prefetch));
+        if (!pls->prefetch)
+            return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        SegmentPrefetch *pf = pls->prefetch[i];
+        if (pf && (ff_segment_prefetch_seq_no(pf) < pls->cur_seq_no ||
+                   ff_segment_prefetch_seq_no(pf) >= pls->cur_seq_no + n))
+            ff_segment_prefetch_free(&pls->prefetch[i], &c->avio_opts);
+    }
+
+    if (av_dict_copy(&opts, c->avio_opts, 0) < 0 ||
+        (c->http_persistent && av_dict_set(&opts, "multiple_requests", "1", 0) < 0)) {
+        av_dict_free(&opts);
+        return pls->prefetch[pls->cur_seq_no % n];
+    }
+    for (seq_no = FFMAX(pls->cur_seq_no, pls->start_seq_no);
+         seq_no < pls->cur_seq_no + n && seq_no < pls->start_seq_no + pls->n_segments;
+         seq_no++) {
+        struct segment *seg = pls->segments[seq_no - pls->start_seq_no];
+        SegmentPrefetch **ppf = &pls->prefetch[seq_no % n];
+
+        /* encrypted segments need the key handling of open_input() */
+        if (*ppf || seg->key_type != KEY_NONE || !av_strstart(seg->url, "http", NULL))
+            continue;
+        av_log(pls->parent, AV_LOG_VERBOSE,
+               "HLS prefetch for url '%s', offset %"PRId64", playlist %d\n",
+               seg->url, seg->url_offset, pls->index);
+        if (ff_segment_prefetch_start(ppf, c->ctx, seg->url, seq_no,
+                                      seg->url_offset, seg->size, opts,
+                                      c->prefetch_max_size / n) < 0)
+            break;
+    }
+    av_dict_free(&opts);
+
+    return pls->prefetch[pls->cur_seq_no % n];
+}
+
+static int read_from_prefetch(struct playlist *pls, uint8_t *buf, int buf_size)
+{
+    int ret = ff_segment_prefetch_read(pls->cur_prefetch, buf, buf_size);
+
+    if (ret > 0)
+        pls->cur_seg_offset += ret;
+    return ret;
+}
+
+static void prefetch_release(HLSContext *c, struct playlist *pls)
+{
+    int64_t seq_no = ff_segment_prefetch_seq_no(pls->cur_prefetch);
+
+    pls->cur_prefetch = NULL;
+    ff_segment_prefetch_free(&pls->prefetch[seq_no % (c->prefetch_segments + 1)],
+                             &c->avio_opts);
+}
+
+static void prefetch_flush(HLSContext *c, struct playlist *pls)
+{
+    int i;
+
+    pls->cur_prefetch = NULL;
+    if (!pls->prefetch)
+        return;
+    for (i = 0; i <= c->prefetch_segments; i++)
+        ff_segment_prefetch_free(&pls->prefetch[i], &c->avio_opts);
+}
+
 static int64_t default_reload_interval(struct playlist *pls)
 {
     return pls->n_segments > 0 ?
@@ -1455,7 +1549,7 @@ restart:
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input || (c->http_persistent && v->input_read_done)) && !v->cur_prefetch) {
         int64_t reload_interval;
 
         /* Check that the playlist is still needed before opening a new
@@ -1465,6 +1559,7 @@ restart:
         if (!v->needed) {
             av_log(v->parent, AV_LOG_INFO, "No longer receiving playlist %d ('%s')\n",
                    v->index, v->url);
+            prefetch_flush(c, v);
             return AVERROR_EOF;
         }
 
@@ -1526,7 +1621,16 @@ reload:
         if (ret)
             return ret;
 
-        if (c->http_multiple == 1 && v->input_next_requested) {
+        if (c->prefetch_segments > 0)
+            v->cur_prefetch = prefetch_update(c, v);
+        if (v->cur_prefetch) {
+            ret = ff_segment_prefetch_wait(v->cur_prefetch);
+            if (ret < 0)
+                prefetch_release(c, v);
+            v->cur_seg_offset = 0;
+            /* keep an idle persistent connection for the next segments */
+            v->input_read_done = !!v->input;
+        } else if (c->http_multiple == 1 && v->input_next_requested) {
             FFSWAP(AVIOContext *, v->input, v->input_next);
             v->cur_seg_offset = 0;
             v->input_next_requested = 0;
@@ -1546,7 +1650,7 @@ reload:
         just_opened = 1;
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && !v->cur_prefetch) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1556,7 +1660,7 @@ reload:
     }
 
     seg = next_segment(v);
-    if (c->http_multiple == 1 && !v->input_next_requested &&
+    if (c->http_multiple == 1 && !v->input_next_requested && !v->cur_prefetch &&
         seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         ret = open_input(c, v, seg, &v->input_next);
         if (ret < 0) {
@@ -1579,7 +1683,10 @@ reload:
     }
 
     seg = current_segment(v);
-    ret = read_from_url(v, seg, buf, buf_size);
+    if (v->cur_prefetch)
+        ret = read_from_prefetch(v, buf, buf_size);
+    else
+        ret = read_from_url(v, seg, buf, buf_size);
     if (ret > 0) {
         if (just_opened && v->is_id3_timestamped != 0) {
             /* Intercept ID3 tags here, elementary audio streams are required
@@ -1589,7 +1696,9 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (v->cur_prefetch) {
+        prefetch_release(c, v);
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -2415,6 +2524,7 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
         pls->input_read_done = 0;
         ff_format_io_close(pls->parent, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_flush(c, pls);
         av_packet_unref(pls->pkt);
         pb->eof_reached = 0;
         /* Clear any buffered data */
@@ -2476,6 +2586,10 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"prefetch_segments", "Number of segments to download in advance in parallel",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 64, FLAGS},
+    {"prefetch_max_size", "Maximum amount of prefetched data kept in memory per playlist",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 64 << 20}, 0, INT64_MAX, FLAGS},
     {"seg_format_options", "Set options for segment demuxer",
         OFFSET(seg_format_opts), AV_OPT_TYPE_DICT, {.str = NULL}, 0, 0, FLAGS},
     {NULL}
@@ -31,6 +31,7 @@
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
 
 #include "avformat.h"
 #include "http.h"
@@ -52,6 +53,8 @@
 #define HTTP_MUTLI    2
 #define MAX_EXPIRY    19
 #define WHITESPACES " \n\t\r"
+#define POOL_MAX_IDLE     16
+#define POOL_IDLE_TIMEOUT 5000000
 typedef enum {
     LOWER_PROTO,
     READ_HEADERS,
@@ -59,9 +62,32 @@ typedef enum {
     FINISH
 }HandshakeState;
 
+/**
+ * A connection of the pool shared by the contexts with connection_pool set.
+ * The lower protocol is opened with an interrupt callback forwarding to the
+ * one of the current user, so that the connection can outlive its opener.
+ */
+typedef struct HTTPConnection {
+    URLContext *hd;
+    AVIOInterruptCB owner_cb;
+    /* lower URL, protocol lists and lower protocol options it was opened with */
+    char *key;
+    int64_t idle_since;
+    struct HTTPConnection *next;
+} HTTPConnection;
+
+static AVMutex pool_mutex = AV_MUTEX_INITIALIZER;
+static HTTPConnection *pool;
+static int pool_size;
+
 typedef struct HTTPContext {
     const AVClass *class;
     URLContext *hd;
+    /* set if hd belongs to the connection pool */
+    HTTPConnection *conn;
+    int connection_pool;
+    /* set when a read from hd reported the end of the connection */
+    int hd_eof;
     unsigned char buffer[BUFFER_SIZE], *buf_ptr, *buf_end;
     int line_count;
     int http_code;
@@ -145,6 +171,7 @@ static const AVOption options[] = {
     { "user_agent", "override User-Agent header", OFFSET(user_agent), AV_OPT_TYPE_STRING, { .str = DEFAULT_USER_AGENT }, 0, 0, D },
     { "referer", "override referer header", OFFSET(referer), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, D },
     { "multiple_requests", "use persistent connections", OFFSET(multiple_requests), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D | E },
+    { "connection_pool", "keep idle connections for reuse by later requests to the same host", OFFSET(connection_pool), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D },
     { "post_data", "set custom HTTP post data", OFFSET(post_data), AV_OPT_TYPE_BINARY, .flags = D | E },
     { "mime_type", "export the MIME type", OFFSET(mime_type), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "http_version", "export the http response version", OFFSET(http_version), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
@@ -191,6 +218,175 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+static int pool_interrupt_cb(void *opaque)
+{
+    HTTPConnection *conn = opaque;
+    return ff_check_interrupt(&conn->owner_cb);
+}
+
+static void pool_free_connection(HTTPConnection **conn)
+{
+    /* the lower protocol may still call the interrupt callback */
+    ffurl_closep(&(*conn)->hd);
+    av_freep(&(*conn)->key);
+    av_freep(conn);
+}
+
+/**
+ * Build the key identifying the connections which can serve a request:
+ * everything that affects how the lower protocol was opened has to match,
+ * e.g. the TLS verification settings and certificates.
+ */
+static char *pool_connection_key(URLContext *h, const char *lower_url,
+                                 AVDictionary *options)
+{
+    AVBPrint key;
+    char *opts = NULL, *str;
+
+    if (av_dict_get_string(options, &opts, '=', '\n') < 0)
+        return NULL;
+    av_bprint_init(&key, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&key, "%s\n%s\n%s\n%s", lower_url,
+               h->protocol_whitelist ? h->protocol_whitelist : "",
+               h->protocol_blacklist ? h->protocol_blacklist : "",
+               opts ? opts : "");
+    av_free(opts);
+    if (av_bprint_finalize(&key, &str) < 0)
+        return NULL;
+    return str;
+}
+
+/**
+ * Take an idle connection to lower_url from the pool unless fresh is set,
+ * or open a new one.
+ */
+static int pool_open_connection(URLContext *h, const char *lower_url,
+                                AVDictionary **options, int fresh, int *reused)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPConnection *conn = NULL, **p, *expired = NULL;
+    int64_t now = av_gettime_relative();
+    char *key;
+    int err;
+
+    key = pool_connection_key(h, lower_url, *options);
+    if (!key)
+        return AVERROR(ENOMEM);
+
+    ff_mutex_lock(&pool_mutex);
+    for (p = &pool; *p;) {
+        HTTPConnection *c = *p;
+        if (now - c->idle_since > POOL_IDLE_TIMEOUT) {
+            *p = c->next;
+            c->next = expired;
+            expired = c;
+            pool_size--;
+        } else if (!conn && !fresh && !strcmp(c->key, key)) {
+            *p = c->next;
+            conn = c;
+            pool_size--;
+        } else {
+            p = &c->next;
+        }
+    }
+    ff_mutex_unlock(&pool_mutex);
+
+    while (expired) {
+        HTTPConnection *next = expired->next;
+        pool_free_connection(&expired);
+        expired = next;
+    }
+
+    *reused = !!conn;
+    if (!conn) {
+        AVIOInterruptCB cb;
+
+        conn = av_mallocz(sizeof(*conn));
+        if (!conn) {
+            av_free(key);
+            return AVERROR(ENOMEM);
+        }
+        conn->key = key;
+        cb.callback = pool_interrupt_cb;
+        cb.opaque   = conn;
+        conn->owner_cb = h->interrupt_callback;
+        err = ffurl_open_whitelist(&conn->hd, lower_url, AVIO_FLAG_READ_WRITE,
+                                   &cb, options,
+                                   h->protocol_whitelist, h->protocol_blacklist, h);
+        if (err < 0) {
+            av_free(conn->key);
+            av_free(conn);
+            return err;
+        }
+    } else {
+        av_log(h, AV_LOG_DEBUG, "Reusing pooled connection to %s\n", lower_url);
+        av_free(key);
+    }
+    conn->owner_cb = h->interrupt_callback;
+    conn->next     = NULL;
+    s->conn   = conn;
+    s->hd     = conn->hd;
+    s->hd_eof = 0;
+    return 0;
+}
+
+/**
+ * Close the lower connection, or hand it back to the pool if the response
+ * was fully read and the server keeps the connection open.
+ */
+static void http_close_connection(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    HTTPConnection *conn = s->conn;
+    uint64_t target_end = s->end_off ? s->end_off : s->filesize;
+    int reusable;
+
+    if (!conn) {
+        ffurl_closep(&s->hd);
+        return;
+    }
+    s->conn = NULL;
+    s->hd   = NULL;
+
+    reusable = !s->willclose && !s->hd_eof && !(h->flags & AVIO_FLAG_WRITE) &&
+               s->end_header && s->buf_ptr == s->buf_end &&
+               (s->chunksize == UINT64_MAX ? s->off >= target_end : s->chunkend);
+    if (!reusable) {
+        pool_free_connection(&conn);
+        return;
+    }
+
+    memset(&conn->owner_cb, 0, sizeof(conn->owner_cb));
+    conn->idle_since = av_gettime_relative();
+    ff_mutex_lock(&pool_mutex);
+    if (pool_size < POOL_MAX_IDLE) {
+        conn->next = pool;
+        pool       = conn;
+        pool_size++;
+        conn       = NULL;
+    }
+    ff_mutex_unlock(&pool_mutex);
+    if (conn)
+        pool_free_connection(&conn);
+}
+
+void ff_http_pool_flush(void)
+{
+    HTTPConnection *conn;
+
+    ff_mutex_lock(&pool_mutex);
+    conn      = pool;
+    pool      = NULL;
+    pool_size = 0;
+    ff_mutex_unlock(&pool_mutex);
+
+    while (conn) {
+        HTTPConnection *next = conn->next;
+        pool_free_connection(&conn);
+        conn = next;
+    }
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -199,7 +395,7 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     char auth[1024], proxyauth[1024] = "";
     char path1[MAX_URL_SIZE], sanitized_path[MAX_URL_SIZE + 1];
     char buf[1024], urlbuf[MAX_URL_SIZE];
-    int port, use_proxy, err, location_changed = 0;
+    int port, use_proxy, err, location_changed = 0, reused = 0;
     HTTPContext *s = h->priv_data;
 
     av_url_split(proto, sizeof(proto), auth, sizeof(auth),
@@ -252,15 +448,29 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
     if (!s->hd) {
-        err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
-                                   &h->interrupt_callback, options,
-                                   h->protocol_whitelist, h->protocol_blacklist, h);
+        if (s->connection_pool)
+            err = pool_open_connection(h, buf, options, 0, &reused);
+        else
+            err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
+                                       &h->interrupt_callback, options,
+                                       h->protocol_whitelist, h->protocol_blacklist, h);
         if (err < 0)
             return err;
     }
 
     err = http_connect(h, path, local_path, hoststr,
                        auth, proxyauth, &location_changed);
+    if (err < 0 && reused && !s->line_count && err != AVERROR_EXIT) {
+        /* the server closed the idle connection, retry on a new one */
+        av_log(h, AV_LOG_DEBUG, "Pooled connection to %s failed, reconnecting\n", buf);
+        pool_free_connection(&s->conn);
+        s->hd = NULL;
+        err = pool_open_connection(h, buf, options, 1, &reused);
+        if (err < 0)
+            return err;
+        err = http_connect(h, path, local_path, hoststr,
+                           auth, proxyauth, &location_changed);
+    }
     if (err < 0)
         return err;
 
@@ -331,7 +541,7 @@ redo:
         /* restore the offset (http_connect resets it) */
         s->off = off;
 
-        ffurl_closep(&s->hd);
+        http_close_connection(h);
         goto redo;
     }
 
@@ -339,7 +549,7 @@ redo:
     if (s->http_code == 401) {
         if ((cur_auth_type == HTTP_AUTH_NONE || s->auth_state.stale) &&
             s->auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            http_close_connection(h);
             goto redo;
         } else
             goto fail;
@@ -347,7 +557,7 @@ redo:
     if (s->http_code == 407) {
         if ((cur_proxy_auth_type == HTTP_AUTH_NONE || s->proxy_auth_state.stale) &&
             s->proxy_auth_state.auth_type != HTTP_AUTH_NONE && attempts < 4) {
-            ffurl_closep(&s->hd);
+            http_close_connection(h);
             goto redo;
         } else
             goto fail;
@@ -356,7 +566,7 @@ redo:
          s->http_code == 303 || s->http_code == 307 || s->http_code == 308) &&
         location_changed == 1) {
         /* url moved, get next */
-        ffurl_closep(&s->hd);
+        http_close_connection(h);
         if (redirects++ >= MAX_REDIRECTS)
             return AVERROR(EIO);
         /* Restart the authentication process with the new target, which
@@ -370,7 +580,7 @@ redo:
 
 fail:
     if (s->hd)
-        ffurl_closep(&s->hd);
+        http_close_connection(h);
     if (location_changed < 0)
         return location_changed;
     return ff_http_averror(s->http_code, AVERROR(EIO));
@@ -701,8 +911,10 @@ static int http_getc(HTTPContext *s)
     if (s->buf_ptr >= s->buf_end) {
         len = ffurl_read(s->hd, s->buffer, BUFFER_SIZE);
         if (len < 0) {
+            s->hd_eof = len != AVERROR(EAGAIN);
             return len;
         } else if (len == 0) {
+            s->hd_eof = 1;
             return AVERROR_EOF;
         } else {
             s->buf_ptr = s->buffer;
@@ -1102,7 +1314,7 @@ static int process_line(URLContext *h, char *line, int line_count,
         } else if (!av_strcasecmp(tag, "Proxy-Authenticate")) {
             ff_http_auth_handle_header(&s->proxy_auth_state, tag, p);
         } else if (!av_strcasecmp(tag, "Connection")) {
-            if (!strcmp(p, "close"))
+            if (!av_strcasecmp(p, "close"))
                 s->willclose = 1;
         } else if (!av_strcasecmp(tag, "Server")) {
             if (!av_strcasecmp(p, "AkamaiGHost")) {
@@ -1371,7 +1583,8 @@ static int http_connect(URLContext *h, const char *path, const char *local_path,
         av_bprintf(&request, "Expect: 100-continue\r\n");
 
     if (!has_header(s->headers, "\r\nConnection: "))
-        av_bprintf(&request, "Connection: %s\r\n", s->multiple_requests ? "keep-alive" : "close");
+        av_bprintf(&request, "Connection: %s\r\n",
+                   s->multiple_requests || s->connection_pool ? "keep-alive" : "close");
 
     if (!has_header(s->headers, "\r\nHost: "))
         av_bprintf(&request, "Host: %s\r\n", hoststr);
@@ -1476,7 +1689,7 @@ static int http_buf_read(URLContext *h, uint8_t *buf, int size)
                    "Chunked encoding data size: %"PRIu64"\n",
                     s->chunksize);
 
-            if (!s->chunksize && s->multiple_requests) {
+            if (!s->chunksize && (s->multiple_requests || s->connection_pool)) {
                 http_get_line(s, line, sizeof(line)); // read empty chunk
                 s->chunkend = 1;
                 return 0;
@@ -1507,6 +1720,8 @@ static int http_buf_read(URLContext *h, uint8_t *buf, int size)
         if ((!s->willclose || s->chunksize == UINT64_MAX) && s->off >= target_end)
             return AVERROR_EOF;
         len = ffurl_read(s->hd, buf, size);
+        if (!len || (len < 0 && len != AVERROR(EAGAIN)))
+            s->hd_eof = 1;
         if ((!len || len == AVERROR_EOF) &&
             (!s->willclose || s->chunksize == UINT64_MAX) && s->off < target_end) {
             av_log(h, AV_LOG_ERROR,
@@ -1782,7 +1997,7 @@ static int http_close(URLContext *h)
         ret = http_shutdown(h, h->flags);
 
     if (s->hd)
-        ffurl_closep(&s->hd);
+        http_close_connection(h);
     av_dict_free(&s->chained_options);
     av_dict_free(&s->cookie_dict);
     av_freep(&s->uri);
@@ -1793,6 +2008,7 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
 {
     HTTPContext *s = h->priv_data;
     URLContext *old_hd = s->hd;
+    HTTPConnection *old_conn = s->conn;
     uint64_t old_off = s->off;
     uint8_t old_buf[BUFFER_SIZE];
     int old_buf_size, ret;
@@ -1840,7 +2056,8 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
     /* we save the old context in case the seek fails */
     old_buf_size = s->buf_end - s->buf_ptr;
     memcpy(old_buf, s->buf_ptr, old_buf_size);
-    s->hd = NULL;
+    s->hd   = NULL;
+    s->conn = NULL;
 
     /* if it fails, continue on old connection */
     if ((ret = http_open_cnx(h, &options)) < 0) {
@@ -1849,11 +2066,15 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
         s->buf_ptr = s->buffer;
         s->buf_end = s->buffer + old_buf_size;
         s->hd      = old_hd;
+        s->conn    = old_conn;
         s->off     = old_off;
         return ret;
     }
     av_dict_free(&options);
-    ffurl_close(old_hd);
+    if (old_conn)
+        pool_free_connection(&old_conn);
+    else
+        ffurl_close(old_hd);
     return off;
 }
 
@@ -240,6 +240,8 @@ typedef struct MOVStreamContext {
     uint32_t format;
 
     int has_sidx;  // If there is an sidx entry for this stream.
+    uint32_t index_cache_key; ///< key of the index in the index cache
+    int index_cache_hit;      ///< the index was read from the index cache
     struct {
         struct AVAESCTR* aes_ctr;
         struct AVAES *aes_ctx;
@@ -250,6 +252,12 @@ typedef struct MOVStreamContext {
     } cenc;
 } MOVStreamContext;
 
+/**
+ * Number of video samples at the start of a track whose timestamps are
+ * passed to ff_rfps_add_frame() when the index is built.
+ */
+#define MOV_RFPS_SAMPLES 99
+
 typedef struct MOVContext {
     const AVClass *class; ///< class for private options
     AVFormatContext *fc;
@@ -306,6 +314,13 @@ typedef struct MOVContext {
     int have_read_mfra_size;
     uint32_t mfra_size;
     uint32_t max_stts_delta;
+    char *index_cache;               ///< path of the sample index cache file
+    uint8_t *index_cache_data;       ///< cache file contents read when opening
+    int index_cache_size;
+    AVIOContext *index_cache_out;    ///< cache file contents to write
+    int index_cache_dirty;           ///< some index was not found in the cache
+    int64_t index_cache_rfps[MOV_RFPS_SAMPLES];    ///< timestamps given to ff_rfps_add_frame() by mov_build_index()
+    int index_cache_nb_rfps;
 } MOVContext;
 
 int ff_mp4_read_descr_len(AVIOContext *pb);
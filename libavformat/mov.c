@@ -61,6 +61,7 @@
 #include "libavcodec/get_bits.h"
 #include "id3v1.h"
 #include "mov_chan.h"
+#include "mov_index_cache.h"
 #include "replaygain.h"
 
 #if CONFIG_ZLIB
@@ -3989,8 +3990,11 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
                     av_log(mov->fc, AV_LOG_TRACE, "AVIndex stream %d, sample %u, offset %"PRIx64", dts %"PRId64", "
                             "size %u, distance %u, keyframe %d\n", st->index, current_sample,
                             current_offset, current_dts, sample_size, distance, keyframe);
-                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && sti->nb_index_entries < 100)
+                    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && sti->nb_index_entries <= MOV_RFPS_SAMPLES) {
                         ff_rfps_add_frame(mov->fc, st, current_dts);
+                        if (mov->index_cache_nb_rfps < FF_ARRAY_ELEMS(mov->index_cache_rfps))
+                            mov->index_cache_rfps[mov->index_cache_nb_rfps++] = current_dts;
+                    }
                 }
 
                 current_offset += sample_size;
@@ -4285,7 +4289,19 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 
     avpriv_set_pts_info(st, 64, 1, sc->time_scale);
 
-    mov_build_index(c, st);
+    if (c->index_cache_out) {
+        uint32_t key = ff_mov_index_cache_key(c, st);
+        if ((ret = ff_mov_index_cache_load(c, st, key)) < 0)
+            return ret;
+        if (!ret) {
+            c->index_cache_nb_rfps = 0;
+            mov_build_index(c, st);
+            if ((ret = ff_mov_index_cache_add(c, st, key)) < 0)
+                return ret;
+        }
+    } else {
+        mov_build_index(c, st);
+    }
 
     if (sc->dref_id-1 < sc->drefs_count && sc->drefs[sc->dref_id-1].path) {
         MOVDref *dref = &sc->drefs[sc->dref_id - 1];
@@ -7746,6 +7762,7 @@ static int mov_read_close(AVFormatContext *s)
 
     av_freep(&mov->aes_decrypt);
     av_freep(&mov->chapter_tracks);
+    ff_mov_index_cache_free(mov);
 
     return 0;
 }
@@ -7901,6 +7918,10 @@ static int mov_read_header(AVFormatContext *s)
 
     mov->fc = s;
     mov->trak_index = -1;
+
+    if ((err = ff_mov_index_cache_open(mov)) < 0)
+        return err;
+
     /* .mov and .mp4 aren't streamable anyway (only progressive download if moov is before mdat) */
     if (pb->seekable & AVIO_SEEKABLE_NORMAL)
         atom.size = avio_size(pb);
@@ -8092,6 +8113,9 @@ static int mov_read_header(AVFormatContext *s)
         if (mov->frag_index.item[i].moof_offset <= mov->fragment.moof_offset)
             mov->frag_index.item[i].headers_read = 1;
 
+    ff_mov_index_cache_write(mov);
+    ff_mov_index_cache_free(mov);
+
     return 0;
 }
 
@@ -8552,6 +8576,7 @@ static const AVOption mov_options[] = {
     { "enable_drefs", "Enable external track support.", OFFSET(enable_drefs), AV_OPT_TYPE_BOOL,
         {.i64 = 0}, 0, 1, FLAGS },
     { "max_stts_delta", "treat offsets above this value as invalid", OFFSET(max_stts_delta), AV_OPT_TYPE_INT, {.i64 = UINT_MAX-48000*10 }, 0, UINT_MAX, .flags = AV_OPT_FLAG_DECODING_PARAM },
+    { "index_cache", "File caching the sample index across openings", OFFSET(index_cache), AV_OPT_TYPE_STRING, .flags = AV_OPT_FLAG_DECODING_PARAM },
 
     { NULL },
 };
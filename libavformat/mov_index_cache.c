@@ -0,0 +1,528 @@
+/*
+ * MOV demuxer sample index cache
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Sidecar cache of the AVIndex built from the sample tables.
+ *
+ * The cache file starts with a tag and a version, followed by one record
+ * per track: the stream index, the key of the track (see
+ * ff_mov_index_cache_key()), the payload size, a CRC of the payload and the
+ * payload holding the index entries, the expanded ctts, the edit list index
+ * ranges and the stream fields set while building the index. Fixed size
+ * values are little endian; the index entries and ctts, which make up most
+ * of the file, are delta coded into variable length integers.
+ */
+
+#include "libavutil/avstring.h"
+#include "libavutil/crc.h"
+#include "libavutil/intfloat.h"
+#include "libavutil/intreadwrite.h"
+#include "libavcodec/bytestream.h"
+#include "avio_internal.h"
+#include "internal.h"
+#include "mov_index_cache.h"
+
+#define CACHE_TAG     MKTAG('F', 'M', 'I', 'X')
+#define CACHE_VERSION 2
+#define RECORD_HEADER_SIZE 16
+
+int ff_mov_index_cache_open(MOVContext *c)
+{
+    AVFormatContext *s = c->fc;
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int ret;
+
+    if (!c->index_cache)
+        return 0;
+
+    if ((ret = avio_open_dyn_buf(&c->index_cache_out)) < 0)
+        return ret;
+
+    if (s->io_open(s, &pb, c->index_cache, AVIO_FLAG_READ, NULL) < 0)
+        return 0;
+
+    size = avio_size(pb);
+    if (size < 8 || size > INT_MAX) {
+        ff_format_io_close(s, &pb);
+        return 0;
+    }
+    c->index_cache_data = av_malloc(size);
+    if (!c->index_cache_data) {
+        ff_format_io_close(s, &pb);
+        return AVERROR(ENOMEM);
+    }
+    ret = ffio_read_size(pb, c->index_cache_data, size);
+    ff_format_io_close(s, &pb);
+    if (ret < 0 || AV_RL32(c->index_cache_data) != CACHE_TAG ||
+        AV_RL32(c->index_cache_data + 4) != CACHE_VERSION) {
+        av_log(s, AV_LOG_WARNING, "Ignoring invalid index cache %s\n",
+               c->index_cache);
+        av_freep(&c->index_cache_data);
+        return 0;
+    }
+    c->index_cache_size = size;
+    return 0;
+}
+
+static uint32_t crc_buf(uint32_t crc, const void *buf, size_t size)
+{
+    if (!buf)
+        return crc;
+    return av_crc(av_crc_get_table(AV_CRC_32_IEEE_LE), crc, buf, size);
+}
+
+static uint32_t crc_i64(uint32_t crc, int64_t val)
+{
+    uint8_t buf[8];
+    AV_WL64(buf, val);
+    return crc_buf(crc, buf, sizeof(buf));
+}
+
+uint32_t ff_mov_index_cache_key(const MOVContext *c, const AVStream *st)
+{
+    const MOVStreamContext *sc = st->priv_data;
+    const FFStream *const sti = cffstream(st);
+    uint32_t crc = UINT32_MAX;
+
+    crc = crc_i64(crc, avio_size(c->fc->pb));
+    crc = crc_i64(crc, c->time_scale);
+    crc = crc_i64(crc, c->advanced_editlist);
+    crc = crc_i64(crc, c->ignore_editlist);
+    crc = crc_i64(crc, st->codecpar->codec_type);
+    crc = crc_i64(crc, st->codecpar->codec_id);
+    crc = crc_i64(crc, st->codecpar->video_delay);
+    crc = crc_i64(crc, st->duration);
+    crc = crc_i64(crc, st->start_time);
+    crc = crc_i64(crc, sti->nb_index_entries);
+    crc = crc_i64(crc, sti->skip_samples);
+    crc = crc_i64(crc, sc->time_scale);
+    crc = crc_i64(crc, sc->dts_shift);
+    crc = crc_i64(crc, sc->start_pad);
+    crc = crc_i64(crc, sc->sample_size);
+    crc = crc_i64(crc, sc->stsz_sample_size);
+    crc = crc_i64(crc, sc->keyframe_absent);
+    crc = crc_i64(crc, sc->bytes_per_frame);
+    crc = crc_i64(crc, sc->samples_per_frame);
+    crc = crc_i64(crc, sc->pseudo_stream_id);
+
+    crc = crc_i64(crc, sc->chunk_count);
+    crc = crc_buf(crc, sc->chunk_offsets, sc->chunk_count * sizeof(*sc->chunk_offsets));
+    crc = crc_i64(crc, sc->stts_count);
+    crc = crc_buf(crc, sc->stts_data, sc->stts_count * sizeof(*sc->stts_data));
+    crc = crc_i64(crc, sc->ctts_count);
+    crc = crc_buf(crc, sc->ctts_data, sc->ctts_count * sizeof(*sc->ctts_data));
+    crc = crc_i64(crc, sc->stsc_count);
+    crc = crc_buf(crc, sc->stsc_data, sc->stsc_count * sizeof(*sc->stsc_data));
+    crc = crc_i64(crc, sc->stps_count);
+    crc = crc_buf(crc, sc->stps_data, sc->stps_count * sizeof(*sc->stps_data));
+    crc = crc_i64(crc, sc->sample_count);
+    if (!sc->stsz_sample_size)
+        crc = crc_buf(crc, sc->sample_sizes, sc->sample_count * sizeof(*sc->sample_sizes));
+    crc = crc_i64(crc, sc->keyframe_count);
+    crc = crc_buf(crc, sc->keyframes, sc->keyframe_count * sizeof(*sc->keyframes));
+    crc = crc_i64(crc, sc->rap_group_count);
+    crc = crc_buf(crc, sc->rap_group, sc->rap_group_count * sizeof(*sc->rap_group));
+    crc = crc_i64(crc, sc->elst_count);
+    for (unsigned i = 0; i < sc->elst_count; i++) {
+        crc = crc_i64(crc, sc->elst_data[i].duration);
+        crc = crc_i64(crc, sc->elst_data[i].time);
+        crc = crc_i64(crc, av_float2int(sc->elst_data[i].rate));
+    }
+
+    return crc;
+}
+
+static int find_record(const MOVContext *c, int index, uint32_t key,
+                       const uint8_t **data, int *size)
+{
+    const uint8_t *p   = c->index_cache_data + 8;
+    const uint8_t *end = c->index_cache_data + c->index_cache_size;
+
+    while (end - p >= RECORD_HEADER_SIZE) {
+        uint32_t rec_size = AV_RL32(p + 8);
+        if (rec_size > end - p - RECORD_HEADER_SIZE)
+            break;
+        if (AV_RL32(p) == index && AV_RL32(p + 4) == key) {
+            *data = p;
+            *size = RECORD_HEADER_SIZE + rec_size;
+            return 1;
+        }
+        p += RECORD_HEADER_SIZE + rec_size;
+    }
+    return 0;
+}
+
+static void put_uleb(AVIOContext *pb, uint64_t val)
+{
+    while (val > 0x7F) {
+        avio_w8(pb, val & 0x7F | 0x80);
+        val >>= 7;
+    }
+    avio_w8(pb, val);
+}
+
+static void put_sleb(AVIOContext *pb, int64_t val)
+{
+    put_uleb(pb, val < 0 ? ~((uint64_t)val << 1) : (uint64_t)val << 1);
+}
+
+static av_always_inline uint64_t get_uleb(GetByteContext *gb)
+{
+    unsigned byte = bytestream2_get_byte(gb);
+    uint64_t val = byte & 0x7F;
+
+    for (int shift = 7; byte & 0x80 && shift < 64; shift += 7) {
+        byte = bytestream2_get_byte(gb);
+        val |= (uint64_t)(byte & 0x7F) << shift;
+    }
+    return val;
+}
+
+static av_always_inline int64_t get_sleb(GetByteContext *gb)
+{
+    uint64_t val = get_uleb(gb);
+    return val & 1 ? ~(val >> 1) : val >> 1;
+}
+
+/* Index entries are stored as a header byte holding the flags and telling
+ * which of the position, timestamp delta and distance to the previous
+ * keyframe follow from the previous entry, the fields that do not,
+ * and the size. */
+#define ENTRY_POS_PREDICTED      0x04
+#define ENTRY_DELTA_PREDICTED    0x08
+#define ENTRY_DISTANCE_PREDICTED 0x10
+
+static void write_entries(AVIOContext *pb, const AVIndexEntry *entries, int nb_entries)
+{
+    int64_t pos = 0, ts = 0, delta = 0;
+    int distance = 0;
+
+    put_uleb(pb, nb_entries);
+    for (int i = 0; i < nb_entries; i++) {
+        const AVIndexEntry *e = &entries[i];
+        int head = e->flags & 3;
+
+        if (e->flags & AVINDEX_KEYFRAME)
+            distance = 0;
+        if (e->pos == pos)
+            head |= ENTRY_POS_PREDICTED;
+        if (e->timestamp - ts == delta)
+            head |= ENTRY_DELTA_PREDICTED;
+        if (e->min_distance == distance)
+            head |= ENTRY_DISTANCE_PREDICTED;
+
+        avio_w8(pb, head);
+        if (!(head & ENTRY_POS_PREDICTED))
+            put_sleb(pb, e->pos - pos);
+        if (!(head & ENTRY_DELTA_PREDICTED))
+            put_sleb(pb, e->timestamp - ts - delta);
+        if (!(head & ENTRY_DISTANCE_PREDICTED))
+            put_uleb(pb, e->min_distance);
+        put_uleb(pb, e->size);
+
+        pos      = e->pos + e->size;
+        delta    = e->timestamp - ts;
+        ts       = e->timestamp;
+        distance = e->min_distance + 1;
+    }
+}
+
+static int read_entries(GetByteContext *gb, int64_t file_size,
+                        AVIndexEntry **pentries, unsigned *pnb_entries)
+{
+    AVIndexEntry *entries;
+    uint64_t nb_entries = get_uleb(gb);
+    int64_t pos = 0, ts = 0, delta = 0;
+    int distance = 0;
+
+    /* Every entry takes at least two bytes. */
+    if (nb_entries > bytestream2_get_bytes_left(gb) / 2)
+        return AVERROR_INVALIDDATA;
+    if (!nb_entries)
+        return 0;
+    entries = av_malloc_array(nb_entries, sizeof(*entries));
+    if (!entries)
+        return AVERROR(ENOMEM);
+
+    for (unsigned i = 0; i < nb_entries; i++) {
+        AVIndexEntry *e = &entries[i];
+        int head = bytestream2_get_byte(gb);
+
+        e->flags = head & 3;
+        if (e->flags & AVINDEX_KEYFRAME)
+            distance = 0;
+        e->pos          = head & ENTRY_POS_PREDICTED ? pos :
+                          pos + get_sleb(gb);
+        delta           = head & ENTRY_DELTA_PREDICTED ? delta :
+                          delta + get_sleb(gb);
+        e->timestamp    = ts + delta;
+        e->min_distance = head & ENTRY_DISTANCE_PREDICTED ? distance :
+                          get_uleb(gb);
+        e->size         = get_uleb(gb) & 0x3FFFFFFF;
+
+        /* The key covers the file size, so a valid index never points
+         * past the end of the file. */
+        if (e->pos < 0 || file_size >= 0 && e->pos + e->size > file_size) {
+            av_free(entries);
+            return AVERROR_INVALIDDATA;
+        }
+
+        pos      = e->pos + e->size;
+        ts       = e->timestamp;
+        distance = e->min_distance + 1;
+    }
+    if (bytestream2_get_bytes_left(gb) <= 0) {
+        av_free(entries);
+        return AVERROR_INVALIDDATA;
+    }
+
+    *pentries    = entries;
+    *pnb_entries = nb_entries;
+    return 0;
+}
+
+static int read_record(MOVContext *c, AVStream *st, const uint8_t *data, int size)
+{
+    MOVStreamContext *sc = st->priv_data;
+    FFStream *const sti = ffstream(st);
+    GetByteContext gb;
+    AVIndexEntry *entries = NULL;
+    MOVCtts *ctts = NULL;
+    MOVIndexRange *ranges = NULL;
+    unsigned nb_entries = 0, nb_ctts, nb_ranges, nb_rfps;
+    int64_t time_offset, min_corrected_pts, current_index;
+    int ret;
+
+    bytestream2_init(&gb, data, size);
+
+    if ((ret = read_entries(&gb, avio_size(c->fc->pb), &entries, &nb_entries)) < 0)
+        return ret;
+    ret = AVERROR_INVALIDDATA;
+
+    nb_ctts = get_uleb(&gb);
+    if (nb_ctts > bytestream2_get_bytes_left(&gb) / 2)
+        goto fail;
+    if (nb_ctts && !(ctts = av_malloc_array(nb_ctts, sizeof(*ctts)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (unsigned i = 0; i < nb_ctts; i++) {
+        ctts[i].count    = get_uleb(&gb);
+        ctts[i].duration = get_sleb(&gb);
+    }
+
+    /* Stored along with the zero entry terminating them. */
+    nb_ranges = bytestream2_get_le32(&gb);
+    if (nb_ranges > bytestream2_get_bytes_left(&gb) / 16)
+        goto fail;
+    if (nb_ranges && !(ranges = av_malloc_array(nb_ranges, sizeof(*ranges)))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (unsigned i = 0; i < nb_ranges; i++) {
+        ranges[i].start = bytestream2_get_le64u(&gb);
+        ranges[i].end   = bytestream2_get_le64u(&gb);
+        if (ranges[i].start < 0 || ranges[i].start > ranges[i].end ||
+            ranges[i].end > nb_entries)
+            goto fail;
+    }
+    if (nb_ranges && ranges[nb_ranges - 1].end)
+        goto fail;
+
+    nb_rfps = bytestream2_get_le32(&gb);
+    if (nb_rfps > FF_ARRAY_ELEMS(c->index_cache_rfps) ||
+        bytestream2_get_bytes_left(&gb) != nb_rfps * 8 + 60)
+        goto fail;
+    for (unsigned i = 0; i < nb_rfps; i++)
+        c->index_cache_rfps[i] = bytestream2_get_le64u(&gb);
+
+    time_offset       = bytestream2_get_le64u(&gb);
+    min_corrected_pts = bytestream2_get_le64u(&gb);
+    current_index     = bytestream2_get_le64u(&gb);
+    if (current_index < 0 || current_index > nb_entries)
+        goto fail;
+
+    sc->time_offset           = time_offset;
+    sc->min_corrected_pts     = min_corrected_pts;
+    sc->current_index         = current_index;
+    sc->start_pad             = bytestream2_get_le32u(&gb);
+    sti->skip_samples         = bytestream2_get_le32u(&gb);
+    st->start_time            = bytestream2_get_le64u(&gb);
+    st->duration              = bytestream2_get_le64u(&gb);
+    st->codecpar->bit_rate    = bytestream2_get_le64u(&gb);
+    st->codecpar->video_delay = bytestream2_get_le32u(&gb);
+
+    av_free(sti->index_entries);
+    sti->index_entries                = entries;
+    sti->nb_index_entries             = nb_entries;
+    sti->index_entries_allocated_size = nb_entries * sizeof(*entries);
+    av_free(sc->ctts_data);
+    sc->ctts_data           = ctts;
+    sc->ctts_count          = nb_ctts;
+    sc->ctts_allocated_size = nb_ctts * sizeof(*ctts);
+    av_free(sc->index_ranges);
+    sc->index_ranges        = ranges;
+    sc->current_index_range = ranges;
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        for (unsigned i = 0; i < nb_rfps; i++)
+            ff_rfps_add_frame(c->fc, st, c->index_cache_rfps[i]);
+
+    return 1;
+fail:
+    av_free(entries);
+    av_free(ctts);
+    av_free(ranges);
+    return ret;
+}
+
+int ff_mov_index_cache_load(MOVContext *c, AVStream *st, uint32_t key)
+{
+    MOVStreamContext *sc = st->priv_data;
+    const uint8_t *data;
+    int size, ret;
+
+    sc->index_cache_key = key;
+    if (!c->index_cache_data ||
+        !find_record(c, st->index, key, &data, &size))
+        return 0;
+
+    if (av_crc(av_crc_get_table(AV_CRC_32_IEEE_LE), UINT32_MAX,
+               data + RECORD_HEADER_SIZE, size - RECORD_HEADER_SIZE) != AV_RL32(data + 12))
+        ret = AVERROR_INVALIDDATA;
+    else
+        ret = read_record(c, st, data + RECORD_HEADER_SIZE, size - RECORD_HEADER_SIZE);
+    if (ret == AVERROR_INVALIDDATA) {
+        av_log(c->fc, AV_LOG_WARNING, "Invalid index cache record for stream %d\n",
+               st->index);
+        return 0;
+    }
+    if (ret < 0)
+        return ret;
+
+    sc->index_cache_hit = 1;
+    return 1;
+}
+
+int ff_mov_index_cache_add(MOVContext *c, AVStream *st, uint32_t key)
+{
+    MOVStreamContext *sc = st->priv_data;
+    FFStream *const sti = ffstream(st);
+    AVIOContext *pb;
+    uint8_t *buf;
+    unsigned nb_ranges = 0;
+    int size, ret;
+
+    if ((ret = avio_open_dyn_buf(&pb)) < 0)
+        return ret;
+
+    write_entries(pb, sti->index_entries, sti->nb_index_entries);
+
+    put_uleb(pb, sc->ctts_count);
+    for (unsigned i = 0; i < sc->ctts_count; i++) {
+        put_uleb(pb, sc->ctts_data[i].count);
+        put_sleb(pb, sc->ctts_data[i].duration);
+    }
+
+    if (sc->index_ranges)
+        while (sc->index_ranges[nb_ranges++].end);
+    avio_wl32(pb, nb_ranges);
+    for (unsigned i = 0; i < nb_ranges; i++) {
+        avio_wl64(pb, sc->index_ranges[i].start);
+        avio_wl64(pb, sc->index_ranges[i].end);
+    }
+
+    avio_wl32(pb, c->index_cache_nb_rfps);
+    for (int i = 0; i < c->index_cache_nb_rfps; i++)
+        avio_wl64(pb, c->index_cache_rfps[i]);
+
+    avio_wl64(pb, sc->time_offset);
+    avio_wl64(pb, sc->min_corrected_pts);
+    avio_wl64(pb, sc->current_index);
+    avio_wl32(pb, sc->start_pad);
+    avio_wl32(pb, sti->skip_samples);
+    avio_wl64(pb, st->start_time);
+    avio_wl64(pb, st->duration);
+    avio_wl64(pb, st->codecpar->bit_rate);
+    avio_wl32(pb, st->codecpar->video_delay);
+
+    size = avio_get_dyn_buf(pb, &buf);
+    avio_wl32(c->index_cache_out, st->index);
+    avio_wl32(c->index_cache_out, key);
+    avio_wl32(c->index_cache_out, size);
+    avio_wl32(c->index_cache_out, crc_buf(UINT32_MAX, buf, size));
+    avio_write(c->index_cache_out, buf, size);
+    ffio_free_dyn_buf(&pb);
+
+    c->index_cache_dirty = 1;
+    return 0;
+}
+
+int ff_mov_index_cache_write(MOVContext *c)
+{
+    AVFormatContext *s = c->fc;
+    AVIOContext *pb;
+    uint8_t *buf;
+    char *tmp;
+    int size, ret;
+
+    if (!c->index_cache_out || !c->index_cache_dirty)
+        return 0;
+
+    /* Write a temporary file and move it into place, so that a reader
+     * never sees a partly written cache. */
+    tmp = av_asprintf("%s.tmp", c->index_cache);
+    if (!tmp)
+        return AVERROR(ENOMEM);
+
+    if ((ret = s->io_open(s, &pb, tmp, AVIO_FLAG_WRITE, NULL)) < 0) {
+        av_log(s, AV_LOG_WARNING, "Could not open index cache %s for writing\n",
+               tmp);
+        av_free(tmp);
+        return ret;
+    }
+    avio_wl32(pb, CACHE_TAG);
+    avio_wl32(pb, CACHE_VERSION);
+    size = avio_get_dyn_buf(c->index_cache_out, &buf);
+    avio_write(pb, buf, size);
+    /* Keep the records that were found in the previous cache file. */
+    for (int i = 0; i < s->nb_streams; i++) {
+        const MOVStreamContext *sc = s->streams[i]->priv_data;
+        const uint8_t *data;
+        if (sc->index_cache_hit &&
+            find_record(c, i, sc->index_cache_key, &data, &size))
+            avio_write(pb, data, size);
+    }
+    ret = ff_format_io_close(s, &pb);
+    if (ret >= 0)
+        ret = ff_rename(tmp, c->index_cache, s);
+    av_free(tmp);
+    c->index_cache_dirty = 0;
+    return ret;
+}
+
+void ff_mov_index_cache_free(MOVContext *c)
+{
+    av_freep(&c->index_cache_data);
+    c->index_cache_size = 0;
+    ffio_free_dyn_buf(&c->index_cache_out);
+}
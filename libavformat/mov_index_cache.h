@@ -0,0 +1,62 @@
+/*
+ * MOV demuxer sample index cache
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_MOV_INDEX_CACHE_H
+#define AVFORMAT_MOV_INDEX_CACHE_H
+
+#include <stdint.h>
+
+#include "avformat.h"
+#include "isom.h"
+
+/**
+ * Read the cache file named by the index_cache option, if any.
+ * A missing or unusable file is not an error, it is rewritten once the
+ * header has been read.
+ */
+int ff_mov_index_cache_open(MOVContext *c);
+
+/**
+ * Compute the key identifying the index of a track: a checksum over the
+ * sample tables and every other input of the index building.
+ */
+uint32_t ff_mov_index_cache_key(const MOVContext *c, const AVStream *st);
+
+/**
+ * Restore the index of a track from the cache.
+ *
+ * @return 1 if the index was restored, 0 if the cache holds no index for
+ *         the key, a negative error code on failure
+ */
+int ff_mov_index_cache_load(MOVContext *c, AVStream *st, uint32_t key);
+
+/**
+ * Add the index just built for a track to the cache.
+ */
+int ff_mov_index_cache_add(MOVContext *c, AVStream *st, uint32_t key);
+
+/**
+ * Write the cache file if any index had to be built.
+ */
+int ff_mov_index_cache_write(MOVContext *c);
+
+void ff_mov_index_cache_free(MOVContext *c);
+
+#endif /* AVFORMAT_MOV_INDEX_CACHE_H */
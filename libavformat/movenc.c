@@ -65,7 +65,7 @@
 static const AVOption options[] = {
     { "movflags", "MOV muxer flags", offsetof(MOVMuxContext, flags), AV_OPT_TYPE_FLAGS, {.i64 = 0}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "rtphint", "Add RTP hint tracks", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_RTP_HINT}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
-    { "moov_size", "maximum moov size so it can be placed at the begin", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, 0 },
+    { "moov_size", "maximum moov size so it can be placed at the begin, -1 to estimate it from the stream durations", offsetof(MOVMuxContext, reserved_moov_size), AV_OPT_TYPE_INT, {.i64 = 0}, -1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, 0 },
     { "empty_moov", "Make the initial moov atom empty", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_EMPTY_MOOV}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "frag_keyframe", "Fragment at video keyframes", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_KEYFRAME}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
     { "frag_every_frame", "Fragment at every frame", 0, AV_OPT_TYPE_CONST, {.i64 = FF_MOV_FLAG_FRAG_EVERY_FRAME}, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM, "movflags" },
@@ -95,6 +95,7 @@ static const AVOption options[] = {
     { "frag_duration", "Maximum fragment duration", offsetof(MOVMuxContext, max_fragment_duration), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "min_frag_duration", "Minimum fragment duration", offsetof(MOVMuxContext, min_fragment_duration), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "frag_size", "Maximum fragment size", offsetof(MOVMuxContext, max_fragment_size), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
+    { "frag_chunk_duration", "Maximum duration of the chunks fragments are written in", offsetof(MOVMuxContext, max_chunk_duration), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "ism_lookahead", "Number of lookahead entries for ISM files", offsetof(MOVMuxContext, ism_lookahead), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 255, AV_OPT_FLAG_ENCODING_PARAM},
     { "video_track_timescale", "set timescale of all video tracks", offsetof(MOVMuxContext, video_track_timescale), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM},
     { "brand",    "Override major brand", offsetof(MOVMuxContext, major_brand),   AV_OPT_TYPE_STRING, {.str = NULL}, .flags = AV_OPT_FLAG_ENCODING_PARAM },
@@ -4622,6 +4623,17 @@ static int mov_add_tfra_entries(AVIOContext *pb, MOVMuxContext *mov, int tracks,
         MOVFragmentInfo *info;
         if ((tracks >= 0 && i != tracks) || !track->entry)
             continue;
+        if (track->frag_info_cont) {
+            /* A further chunk of the fragment, only the random access
+             * point at its start is indexed. */
+            if (track->nb_frag_info) {
+                info = &track->frag_info[track->nb_frag_info - 1];
+                info->size    += size;
+                info->duration = track->end_pts - info->time;
+            }
+            continue;
+        }
+        track->frag_info_cont = 1;
         track->nb_frag_info++;
         if (track->nb_frag_info >= track->frag_info_capacity) {
             unsigned new_capacity = track->nb_frag_info + MOV_FRAG_INFO_ALLOC_INCREMENT;
@@ -4760,6 +4772,7 @@ static int mov_write_sidx_tag(AVIOContext *pb,
             duration += presentation_time;
             presentation_time = 0;
         }
+        track->sidx_pts = presentation_time;
     } else {
         entries = track->nb_frag_info;
         if (entries <= 0)
@@ -4787,7 +4800,8 @@ static int mov_write_sidx_tag(AVIOContext *pb,
             duration = track->frag_info[i].duration;
             ref_size = track->frag_info[i].size;
             starts_with_SAP = 1;
-        }
+        } else
+            track->sidx_ref_pos = avio_tell(pb);
         avio_wb32(pb, (0 << 31) | (ref_size & 0x7fffffff)); /* reference_type (0 = media) | referenced_size */
         avio_wb32(pb, duration); /* subsegment_duration */
         avio_wb32(pb, (starts_with_SAP << 31) | (0 << 28) | 0); /* starts_with_SAP | SAP_type | SAP_delta_time */
@@ -4836,6 +4850,24 @@ static int mov_write_sidx_tags(AVIOContext *pb, MOVMuxContext *mov,
     return 0;
 }
 
+/* Make the sidx written before the first chunk of the current fragment
+ * cover the chunks written since. */
+static void mov_update_sidx_tags(AVIOContext *pb, MOVMuxContext *mov)
+{
+    int64_t pos = avio_tell(pb);
+    int i;
+
+    for (i = 0; i < mov->nb_streams; i++) {
+        MOVTrack *track = &mov->tracks[i];
+        if (!track->sidx_ref_pos)
+            continue;
+        avio_seek(pb, track->sidx_ref_pos, SEEK_SET);
+        avio_wb32(pb, mov->sidx_ref_size & 0x7fffffff); /* reference_type (0 = media) | referenced_size */
+        avio_wb32(pb, track->end_pts - track->sidx_pts); /* subsegment_duration */
+    }
+    avio_seek(pb, pos, SEEK_SET);
+}
+
 static int mov_write_prft_tag(AVIOContext *pb, MOVMuxContext *mov, int tracks)
 {
     int64_t pos = avio_tell(pb), pts_us, ntp_ts;
@@ -4898,8 +4930,17 @@ static int mov_write_moof_tag(AVIOContext *pb, MOVMuxContext *mov, int tracks,
     moof_size = ffio_close_null_buf(avio_buf);
 
     if (mov->flags & FF_MOV_FLAG_DASH &&
-        !(mov->flags & (FF_MOV_FLAG_GLOBAL_SIDX | FF_MOV_FLAG_SKIP_SIDX)))
-        mov_write_sidx_tags(pb, mov, tracks, moof_size + 8 + mdat_size);
+        !(mov->flags & (FF_MOV_FLAG_GLOBAL_SIDX | FF_MOV_FLAG_SKIP_SIDX))) {
+        /* A fragment written in chunks gets a single sidx, before its
+         * first chunk, which is extended as further chunks are written. */
+        if (mov->frag_continued) {
+            mov->sidx_ref_size += moof_size + 8 + mdat_size;
+            mov_update_sidx_tags(pb, mov);
+        } else {
+            mov->sidx_ref_size = moof_size + 8 + mdat_size;
+            mov_write_sidx_tags(pb, mov, tracks, mov->sidx_ref_size);
+        }
+    }
 
     if (mov->write_prft > MOV_PRFT_NONE && mov->write_prft < MOV_PRFT_NB)
         mov_write_prft_tag(pb, mov, tracks);
@@ -5505,7 +5546,16 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
         for (i = 0; i < mov->nb_streams; i++) {
             mov->tracks[i].entry = 0;
             mov->tracks[i].end_reliable = 0;
-        }
+            /* The fragment started in the mdat following the moov is not
+             * indexed, nor are its further chunks. */
+            mov->tracks[i].frag_info_cont = mov->chunk_continue;
+            mov->tracks[i].sidx_ref_pos = 0;
+            if (!mov->chunk_continue)
+                mov->tracks[i].frag_start_dts = AV_NOPTS_VALUE;
+        }
+        mov->frag_continued = mov->chunk_continue;
+        if (!mov->chunk_continue)
+            mov->fragment_size = 0;
         avio_write_marker(s->pb, AV_NOPTS_VALUE, AVIO_DATA_MARKER_FLUSH_POINT);
         return 0;
     }
@@ -5595,6 +5645,16 @@ static int mov_flush_fragment(AVFormatContext *s, int force)
         av_free(buf);
     }
 
+    if (!mov->chunk_continue) {
+        for (i = 0; i < mov->nb_streams; i++) {
+            mov->tracks[i].frag_start_dts = AV_NOPTS_VALUE;
+            mov->tracks[i].frag_info_cont = 0;
+            mov->tracks[i].sidx_ref_pos   = 0;
+        }
+        mov->fragment_size = 0;
+    }
+    mov->frag_continued = mov->chunk_continue;
+
     mov->mdat_size = 0;
 
     avio_write_marker(s->pb, AV_NOPTS_VALUE, AVIO_DATA_MARKER_FLUSH_POINT);
@@ -5981,6 +6041,7 @@ int ff_mov_write_packet(AVFormatContext *s, AVPacket *pkt)
     trk->entry++;
     trk->sample_count += samples_in_chunk;
     mov->mdat_size    += size;
+    mov->fragment_size += size;
 
     if (trk->hint_track >= 0 && trk->hint_track < mov->nb_streams)
         ff_mov_add_hinted_packet(s, pkt, trk->hint_track, trk->entry,
@@ -6000,8 +6061,8 @@ static int mov_write_single_packet(AVFormatContext *s, AVPacket *pkt)
     MOVMuxContext *mov = s->priv_data;
     MOVTrack *trk = &mov->tracks[pkt->stream_index];
     AVCodecParameters *par = trk->par;
-    int64_t frag_duration = 0;
-    int size = pkt->size;
+    int64_t frag_duration = 0, chunk_duration = 0;
+    int size = pkt->size, flush = 0;
 
     int ret = check_pkt(s, pkt);
     if (ret < 0)
@@ -6051,38 +6112,55 @@ static int mov_write_single_packet(AVFormatContext *s, AVPacket *pkt)
         return 0;             /* Discard 0 sized packets */
     }
 
+    if (trk->frag_start_dts != AV_NOPTS_VALUE && pkt->stream_index < s->nb_streams)
+        frag_duration = av_rescale_q(pkt->dts - trk->frag_start_dts,
+                s->streams[pkt->stream_index]->time_base,
+                AV_TIME_BASE_Q);
     if (trk->entry && pkt->stream_index < s->nb_streams)
-        frag_duration = av_rescale_q(pkt->dts - trk->cluster[0].dts,
+        chunk_duration = av_rescale_q(pkt->dts - trk->cluster[0].dts,
                 s->streams[pkt->stream_index]->time_base,
                 AV_TIME_BASE_Q);
     if ((mov->max_fragment_duration &&
                 frag_duration >= mov->max_fragment_duration) ||
-            (mov->max_fragment_size && mov->mdat_size + size >= mov->max_fragment_size) ||
+            (mov->max_fragment_size && mov->fragment_size + size >= mov->max_fragment_size) ||
             (mov->flags & FF_MOV_FLAG_FRAG_KEYFRAME &&
              par->codec_type == AVMEDIA_TYPE_VIDEO &&
-             trk->entry && pkt->flags & AV_PKT_FLAG_KEY) ||
+             trk->frag_start_dts != AV_NOPTS_VALUE && pkt->flags & AV_PKT_FLAG_KEY) ||
             (mov->flags & FF_MOV_FLAG_FRAG_EVERY_FRAME)) {
-        if (frag_duration >= mov->min_fragment_duration) {
-            if (trk->entry) {
-                // Set the duration of this track to line up with the next
-                // sample in this track. This avoids relying on AVPacket
-                // duration, but only helps for this particular track, not
-                // for the other ones that are flushed at the same time.
-                //
-                // If we have trk->entry == 0, no fragment will be written
-                // for this track, and we can't adjust the track end here.
-                trk->track_duration = pkt->dts - trk->start_dts;
-                if (pkt->pts != AV_NOPTS_VALUE)
-                    trk->end_pts = pkt->pts;
-                else
-                    trk->end_pts = pkt->dts;
-                trk->end_reliable = 1;
-            }
-            mov_auto_flush_fragment(s, 0);
+        if (frag_duration >= mov->min_fragment_duration)
+            flush = 1;
+    }
+    /* Write what we have as a chunk of the current fragment, so that
+     * it is available without waiting for the end of the fragment. */
+    if (!flush && mov->max_chunk_duration &&
+        chunk_duration >= mov->max_chunk_duration) {
+        flush = 1;
+        mov->chunk_continue = 1;
+    }
+    if (flush) {
+        if (trk->entry) {
+            // Set the duration of this track to line up with the next
+            // sample in this track. This avoids relying on AVPacket
+            // duration, but only helps for this particular track, not
+            // for the other ones that are flushed at the same time.
+            //
+            // If we have trk->entry == 0, no fragment will be written
+            // for this track, and we can't adjust the track end here.
+            trk->track_duration = pkt->dts - trk->start_dts;
+            if (pkt->pts != AV_NOPTS_VALUE)
+                trk->end_pts = pkt->pts;
+            else
+                trk->end_pts = pkt->dts;
+            trk->end_reliable = 1;
         }
+        mov_auto_flush_fragment(s, 0);
+        mov->chunk_continue = 0;
     }
 
-    return ff_mov_write_packet(s, pkt);
+    ret = ff_mov_write_packet(s, pkt);
+    if (ret >= 0 && trk->frag_start_dts == AV_NOPTS_VALUE && trk->entry)
+        trk->frag_start_dts = trk->cluster[0].dts;
+    return ret;
 }
 
 static int mov_write_subtitle_end_packet(AVFormatContext *s,
@@ -6550,6 +6628,44 @@ static int mov_create_dvd_sub_decoder_specific_info(MOVTrack *track,
     return 0;
 }
 
+/**
+ * Estimate an upper bound of the moov atom size from the stream durations,
+ * counting the per-sample table entries generously: sample size, time to
+ * sample, composition offset, sync sample and 64 bit chunk offset entries
+ * for video, and all but the latter two for other tracks.
+ *
+ * @return the estimated size in bytes, 0 if any stream duration is unknown
+ */
+static int estimate_moov_size(AVFormatContext *s)
+{
+    int64_t size = 4096;
+
+    for (int i = 0; i < s->nb_streams; i++) {
+        const AVStream *st = s->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+        double duration, rate;
+        int entry_size;
+
+        if (st->duration <= 0)
+            return 0;
+        duration = st->duration * av_q2d(st->time_base);
+
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+            AVRational fr = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+            rate       = fr.num && fr.den ? av_q2d(fr) : 120;
+            entry_size = 32;
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO && par->sample_rate) {
+            rate       = (double)par->sample_rate / (par->frame_size > 0 ? par->frame_size : 1024);
+            entry_size = 24;
+        } else {
+            rate       = 10;
+            entry_size = 24;
+        }
+        size += 2048 + (int64_t)(duration * rate * 1.1 + 1) * entry_size;
+    }
+    return FFMIN(size, INT_MAX);
+}
+
 static int mov_init(AVFormatContext *s)
 {
     MOVMuxContext *mov = s->priv_data;
@@ -6577,6 +6693,7 @@ static int mov_init(AVFormatContext *s)
     /* Set the FRAGMENT flag if any of the fragmentation methods are
      * enabled. */
     if (mov->max_fragment_duration || mov->max_fragment_size ||
+        mov->max_chunk_duration ||
         mov->flags & (FF_MOV_FLAG_EMPTY_MOOV |
                       FF_MOV_FLAG_FRAG_KEYFRAME |
                       FF_MOV_FLAG_FRAG_CUSTOM |
@@ -6604,7 +6721,17 @@ static int mov_init(AVFormatContext *s)
         mov->flags &= ~FF_MOV_FLAG_SKIP_SIDX;
     }
 
-    if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+    if (mov->reserved_moov_size < 0) {
+        mov->reserved_moov_size = estimate_moov_size(s);
+        if (!mov->reserved_moov_size)
+            av_log(s, AV_LOG_WARNING, "Stream durations unknown, cannot estimate "
+                   "the moov size; not reserving space for it\n");
+        else
+            av_log(s, AV_LOG_VERBOSE, "Reserving %d bytes for the moov atom\n",
+                   mov->reserved_moov_size);
+    }
+
+    if (mov->flags & FF_MOV_FLAG_FASTSTART && !mov->reserved_moov_size) {
         mov->reserved_moov_size = -1;
     }
 
@@ -6651,6 +6778,24 @@ static int mov_init(AVFormatContext *s)
         return AVERROR(EINVAL);
     }
 
+    if (mov->max_chunk_duration && mov->ism_lookahead) {
+        av_log(s, AV_LOG_ERROR,
+               "frag_chunk_duration is not supported together with ism_lookahead\n");
+        return AVERROR(EINVAL);
+    }
+
+    /* The sidx of a fragment written in chunks is completed by seeking back
+     * to it, and it can only reference one contiguous moof and mdat run. */
+    if (mov->max_chunk_duration && mov->flags & FF_MOV_FLAG_DASH &&
+        !(mov->flags & (FF_MOV_FLAG_GLOBAL_SIDX | FF_MOV_FLAG_SKIP_SIDX)) &&
+        (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) ||
+         mov->flags & FF_MOV_FLAG_SEPARATE_MOOF)) {
+        av_log(s, AV_LOG_WARNING, "Per fragment sidx is not supported with "
+               "frag_chunk_duration on non-seekable output or with "
+               "separate_moof, disabling it\n");
+        mov->flags |= FF_MOV_FLAG_SKIP_SIDX;
+    }
+
     /* Non-seekable output is ok if using fragmentation. If ism_lookahead
      * is enabled, we don't support non-seekable output at all. */
     if (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) &&
@@ -6752,6 +6897,7 @@ static int mov_init(AVFormatContext *s)
          * this is updated. */
         track->hint_track = -1;
         track->start_dts  = AV_NOPTS_VALUE;
+        track->frag_start_dts = AV_NOPTS_VALUE;
         track->start_cts  = AV_NOPTS_VALUE;
         track->end_pts    = AV_NOPTS_VALUE;
         track->dts_shift  = AV_NOPTS_VALUE;
@@ -7004,7 +7150,7 @@ static int mov_write_header(AVFormatContext *s)
             !mov->max_fragment_duration && !mov->max_fragment_size)
             mov->flags |= FF_MOV_FLAG_FRAG_KEYFRAME;
     } else {
-        if (mov->flags & FF_MOV_FLAG_FASTSTART)
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size < 0)
             mov->reserved_header_pos = avio_tell(pb);
         mov_write_mdat_tag(pb, mov);
     }
@@ -7222,9 +7368,33 @@ static int mov_write_trailer(AVFormatContext *s)
             ffio_wfourcc(pb, "mdat");
             avio_wb64(pb, mov->mdat_size + 16);
         }
+
+        if (mov->reserved_moov_size > 0) {
+            int moov_size = get_moov_size(s);
+            if (moov_size < 0)
+                return moov_size;
+            if (moov_size > mov->reserved_moov_size - 8) {
+                if (mov->reserved_moov_size < 8) {
+                    av_log(s, AV_LOG_ERROR, "reserved_moov_size is too small, needed %d\n",
+                           moov_size + 8);
+                    return AVERROR(EINVAL);
+                }
+                /* Keep the reserved space as a free atom and place the moov
+                 * after the media data, or in front of it in a second pass. */
+                av_log(s, AV_LOG_WARNING, "reserved_moov_size is too small, "
+                       "needed %d bytes; %s\n", moov_size + 8,
+                       mov->flags & FF_MOV_FLAG_FASTSTART ?
+                       "falling back to a second pass" :
+                       "writing the moov atom at the end");
+                avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
+                avio_wb32(pb, mov->reserved_moov_size);
+                ffio_wfourcc(pb, "free");
+                mov->reserved_moov_size = -1;
+            }
+        }
         avio_seek(pb, mov->reserved_moov_size > 0 ? mov->reserved_header_pos : moov_pos, SEEK_SET);
 
-        if (mov->flags & FF_MOV_FLAG_FASTSTART) {
+        if (mov->flags & FF_MOV_FLAG_FASTSTART && mov->reserved_moov_size < 0) {
             av_log(s, AV_LOG_INFO, "Starting second pass: moving the moov atom to the beginning of the file\n");
             res = shift_data(s);
             if (res < 0)
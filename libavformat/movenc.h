@@ -141,6 +141,10 @@ typedef struct MOVTrack {
     int64_t     data_offset;
     int         frag_discont;
     int         entries_flushed;
+    int64_t     frag_start_dts; ///< dts of the first sample of the current fragment
+    int         frag_info_cont; ///< the last frag_info entry describes the current fragment
+    int64_t     sidx_ref_pos;   ///< position of the reference in the sidx of the current fragment, or 0
+    int64_t     sidx_pts;       ///< earliest presentation time in the sidx of the current fragment
 
     int         nb_frag_info;
     MOVFragmentInfo *frag_info;
@@ -205,6 +209,11 @@ typedef struct MOVMuxContext {
     int max_fragment_duration;
     int min_fragment_duration;
     int max_fragment_size;
+    int max_chunk_duration;
+    int chunk_continue;     ///< the fragment being flushed continues in the next chunk
+    int frag_continued;     ///< the last chunk written did not end its fragment
+    int64_t fragment_size;  ///< sample bytes of the current fragment, over all its chunks
+    int64_t sidx_ref_size;  ///< moof and mdat bytes of the current fragment
     int ism_lookahead;
     AVIOContext *mdat_buf;
     int first_trun;
@@ -2960,6 +2960,45 @@ static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
         avio_skip(pb, skip);
 }
 
+/**
+ * Handle in place the run of packets already present in the I/O buffer.
+ * The sync bytes of the whole run are checked first, so that the dispatch
+ * loop can drop the packets of unwanted pids without a call to
+ * handle_packet(), and the I/O context is advanced once for the run.
+ *
+ * @return the number of packets consumed, or a negative error code
+ */
+static int handle_buffered_packets(MpegTSContext *ts, int max_packets)
+{
+    AVIOContext *pb = ts->stream->pb;
+    const int raw_packet_size = ts->raw_packet_size;
+    const uint8_t *buf = pb->buf_ptr;
+    int64_t pos = avio_tell(pb);
+    int nb, i, ret = 0;
+
+    nb = FFMIN((pb->buf_end - buf) / raw_packet_size, max_packets);
+    for (i = 0; i < nb; i++)
+        if (buf[i * raw_packet_size] != 0x47)
+            break;
+    nb = i;
+
+    for (i = 0; i < nb && !ts->stop_parse; i++) {
+        const uint8_t *packet = buf + i * raw_packet_size;
+        MpegTSFilter *tss = ts->pids[AV_RB16(packet + 1) & 0x1fff];
+
+        /* filters are only created or (un)discarded at a payload start */
+        if (!(packet[1] & 0x40) && (!tss || tss->discard))
+            continue;
+        ret = handle_packet(ts, packet, pos + i * raw_packet_size + TS_PACKET_SIZE);
+        if (ret < 0) {
+            i++;
+            break;
+        }
+    }
+    avio_skip(pb, i * raw_packet_size);
+    return ret < 0 ? ret : i;
+}
+
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
@@ -3001,6 +3040,17 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        if (s->pb->buf_end - s->pb->buf_ptr >= ts->raw_packet_size &&
+            s->pb->buf_ptr[0] == 0x47) {
+            int64_t max_packets = nb_packets ? nb_packets - packet_num : INT_MAX;
+            ret = handle_buffered_packets(ts, FFMIN(max_packets, INT_MAX));
+            if (ret < 0)
+                break;
+            packet_num += ret - 1;
+            ret = 0;
+            continue;
+        }
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
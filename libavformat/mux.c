@@ -20,6 +20,7 @@
  */
 
 #include "avformat.h"
+#include "avio_internal.h"
 #include "internal.h"
 #include "libavcodec/bsf.h"
 #include "libavcodec/internal.h"
@@ -433,7 +434,7 @@ static void flush_if_needed(AVFormatContext *s)
 {
     if (s->pb && s->pb->error >= 0) {
         if (s->flush_packets == 1 || s->flags & AVFMT_FLAG_FLUSH_PACKETS)
-            avio_flush(s->pb);
+            ffio_flush_sync(s->pb);
         else if (s->flush_packets && !(s->oformat->flags & AVFMT_NOFILE))
             avio_write_marker(s->pb, AV_NOPTS_VALUE, AVIO_DATA_MARKER_FLUSH_POINT);
     }
@@ -0,0 +1,282 @@
+/*
+ * Download of media segments in advance
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+
+#include "segprefetch.h"
+#include "url.h"
+
+#define PREFETCH_CHUNK_SIZE 32768
+
+struct SegmentPrefetch {
+    AVFormatContext *s;
+    int64_t seq_no;
+    char *url;
+    int64_t offset;
+    int64_t size;
+    AVDictionary *opts;
+#if HAVE_THREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+    uint8_t *buf;
+    unsigned int buf_size;
+    /* data not read yet is buf[read_pos, data_len) */
+    int64_t data_len;
+    int64_t read_pos;
+    int64_t max_buffered;
+    int done;
+    int ret;
+    int abort;
+};
+
+int64_t ff_segment_prefetch_seq_no(const SegmentPrefetch *pf)
+{
+    return pf->seq_no;
+}
+
+#if HAVE_THREADS
+/* The downloads run outside of the demuxer calls, so they are only
+ * interrupted by ff_segment_prefetch_free(). */
+static int prefetch_interrupt_cb(void *opaque)
+{
+    SegmentPrefetch *pf = opaque;
+    int ret;
+
+    pthread_mutex_lock(&pf->mutex);
+    ret = pf->abort;
+    pthread_mutex_unlock(&pf->mutex);
+    return ret;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    SegmentPrefetch *pf = arg;
+    const AVIOInterruptCB cb = { prefetch_interrupt_cb, pf };
+    AVDictionary *opts = NULL;
+    URLContext *uc = NULL;
+    uint8_t buf[PREFETCH_CHUNK_SIZE];
+    char *new_cookies = NULL;
+    int64_t pos = 0;
+    int ret;
+
+    ret = av_dict_copy(&opts, pf->opts, 0);
+    /* the downloads mostly go to the same host */
+    if (ret >= 0)
+        ret = av_dict_set(&opts, "connection_pool", "1", 0);
+    if (ret >= 0 && pf->size >= 0) {
+        av_dict_set_int(&opts, "offset", pf->offset, 0);
+        ret = av_dict_set_int(&opts, "end_offset", pf->offset + pf->size, 0);
+    }
+    if (ret >= 0)
+        ret = ffurl_open_whitelist(&uc, pf->url, AVIO_FLAG_READ, &cb, &opts,
+                                   pf->s->protocol_whitelist,
+                                   pf->s->protocol_blacklist, NULL);
+    av_dict_free(&opts);
+    if (ret >= 0 &&
+        av_opt_get(uc, "cookies", AV_OPT_SEARCH_CHILDREN, (uint8_t**)&new_cookies) >= 0 &&
+        new_cookies) {
+        pthread_mutex_lock(&pf->mutex);
+        av_dict_set(&pf->opts, "cookies", new_cookies, AV_DICT_DONT_STRDUP_VAL);
+        pthread_mutex_unlock(&pf->mutex);
+    }
+
+    while (ret >= 0) {
+        int len = sizeof(buf);
+        uint8_t *new_buf;
+
+        if (pf->size >= 0)
+            len = FFMIN(len, pf->size - pos);
+        if (!len)
+            break;
+        ret = ffurl_read(uc, buf, len);
+        if (ret <= 0) {
+            ret = ret ? ret : AVERROR_EOF;
+            break;
+        }
+
+        pthread_mutex_lock(&pf->mutex);
+        while (pf->data_len - pf->read_pos >= pf->max_buffered && !pf->abort)
+            pthread_cond_wait(&pf->cond, &pf->mutex);
+        if (pf->abort) {
+            pthread_mutex_unlock(&pf->mutex);
+            ret = AVERROR_EXIT;
+            break;
+        }
+        new_buf = pf->data_len + ret <= UINT_MAX ?
+                  av_fast_realloc(pf->buf, &pf->buf_size, pf->data_len + ret) : NULL;
+        if (!new_buf) {
+            pthread_mutex_unlock(&pf->mutex);
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        pf->buf = new_buf;
+        memcpy(pf->buf + pf->data_len, buf, ret);
+        pf->data_len += ret;
+        pthread_cond_signal(&pf->cond);
+        pthread_mutex_unlock(&pf->mutex);
+        pos += ret;
+    }
+    ffurl_closep(&uc);
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->ret  = ret == AVERROR_EOF ? 0 : FFMIN(ret, 0);
+    pf->done = 1;
+    pthread_cond_signal(&pf->cond);
+    pthread_mutex_unlock(&pf->mutex);
+    return NULL;
+}
+
+int ff_segment_prefetch_start(SegmentPrefetch **ppf, AVFormatContext *s,
+                              const char *url, int64_t seq_no,
+                              int64_t offset, int64_t size,
+                              const AVDictionary *opts, int64_t max_buffered)
+{
+    SegmentPrefetch *pf = av_mallocz(sizeof(*pf));
+    int ret;
+
+    if (!pf)
+        return AVERROR(ENOMEM);
+    pf->s            = s;
+    pf->seq_no       = seq_no;
+    pf->offset       = offset;
+    pf->size         = size;
+    pf->max_buffered = FFMAX(max_buffered, PREFETCH_CHUNK_SIZE);
+    pf->url          = av_strdup(url);
+    if (!pf->url || av_dict_copy(&pf->opts, opts, 0) < 0) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = pthread_mutex_init(&pf->mutex, NULL))) {
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_cond_init(&pf->cond, NULL))) {
+        pthread_mutex_destroy(&pf->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    if ((ret = pthread_create(&pf->thread, NULL, prefetch_thread, pf))) {
+        pthread_cond_destroy(&pf->cond);
+        pthread_mutex_destroy(&pf->mutex);
+        ret = AVERROR(ret);
+        goto fail;
+    }
+    *ppf = pf;
+    return 0;
+fail:
+    av_freep(&pf->url);
+    av_dict_free(&pf->opts);
+    av_free(pf);
+    return ret;
+}
+
+int ff_segment_prefetch_wait(SegmentPrefetch *pf)
+{
+    int ret;
+
+    pthread_mutex_lock(&pf->mutex);
+    while (pf->read_pos == pf->data_len && !pf->done)
+        pthread_cond_wait(&pf->cond, &pf->mutex);
+    ret = pf->read_pos < pf->data_len ? 0 : pf->ret;
+    pthread_mutex_unlock(&pf->mutex);
+    return ret;
+}
+
+int ff_segment_prefetch_read(SegmentPrefetch *pf, uint8_t *buf, int buf_size)
+{
+    int ret;
+
+    pthread_mutex_lock(&pf->mutex);
+    while (pf->read_pos == pf->data_len && !pf->done)
+        pthread_cond_wait(&pf->cond, &pf->mutex);
+    if (pf->read_pos < pf->data_len) {
+        ret = FFMIN(buf_size, pf->data_len - pf->read_pos);
+        memcpy(buf, pf->buf + pf->read_pos, ret);
+        pf->read_pos += ret;
+        /* drop the data read so far once it is most of the buffer */
+        if (pf->read_pos >= pf->data_len - pf->read_pos) {
+            memmove(pf->buf, pf->buf + pf->read_pos, pf->data_len - pf->read_pos);
+            pf->data_len -= pf->read_pos;
+            pf->read_pos  = 0;
+        }
+        pthread_cond_signal(&pf->cond);
+    } else {
+        ret = pf->ret < 0 ? pf->ret : AVERROR_EOF;
+    }
+    pthread_mutex_unlock(&pf->mutex);
+    return ret;
+}
+
+void ff_segment_prefetch_free(SegmentPrefetch **ppf, AVDictionary **opts)
+{
+    SegmentPrefetch *pf = *ppf;
+    AVDictionaryEntry *cookies;
+
+    if (!pf)
+        return;
+
+    pthread_mutex_lock(&pf->mutex);
+    pf->abort = 1;
+    pthread_cond_signal(&pf->cond);
+    pthread_mutex_unlock(&pf->mutex);
+    pthread_join(pf->thread, NULL);
+
+    /* keep the cookies set by the server for the next requests */
+    cookies = av_dict_get(pf->opts, "cookies", NULL, 0);
+    if (cookies && opts)
+        av_dict_set(opts, "cookies", cookies->value, 0);
+
+    pthread_mutex_destroy(&pf->mutex);
+    pthread_cond_destroy(&pf->cond);
+    av_freep(&pf->buf);
+    av_freep(&pf->url);
+    av_dict_free(&pf->opts);
+    av_freep(ppf);
+}
+#else
+int ff_segment_prefetch_start(SegmentPrefetch **ppf, AVFormatContext *s,
+                              const char *url, int64_t seq_no,
+                              int64_t offset, int64_t size,
+                              const AVDictionary *opts, int64_t max_buffered)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segment_prefetch_wait(SegmentPrefetch *pf)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_segment_prefetch_read(SegmentPrefetch *pf, uint8_t *buf, int buf_size)
+{
+    return AVERROR(ENOSYS);
+}
+
+void ff_segment_prefetch_free(SegmentPrefetch **ppf, AVDictionary **opts)
+{
+}
+#endif
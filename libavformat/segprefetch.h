@@ -0,0 +1,82 @@
+/*
+ * Download of media segments in advance
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Download of media segments in advance for the HLS and DASH demuxers.
+ *
+ * Each segment is downloaded into memory by its own thread, over a pooled
+ * HTTP connection, so that the next segments are already there when the
+ * current one ends.
+ */
+
+#ifndef AVFORMAT_SEGPREFETCH_H
+#define AVFORMAT_SEGPREFETCH_H
+
+#include <stdint.h>
+
+#include "libavutil/dict.h"
+#include "avformat.h"
+
+typedef struct SegmentPrefetch SegmentPrefetch;
+
+/**
+ * Start downloading a segment.
+ *
+ * The URL is opened directly with the protocol whitelist and blacklist of s,
+ * not through its io_open callback, and can only be interrupted by
+ * ff_segment_prefetch_free().
+ *
+ * @param seq_no       sequence number of the segment, for the caller
+ * @param offset       byte offset of the segment in the resource
+ * @param size         size of the segment in bytes, or -1 up to the end
+ * @param opts         options of the protocol, copied
+ * @param max_buffered the download pauses when this many bytes are not read yet
+ * @return 0 on success, AVERROR(ENOSYS) if threads are not available
+ */
+int ff_segment_prefetch_start(SegmentPrefetch **ppf, AVFormatContext *s,
+                              const char *url, int64_t seq_no,
+                              int64_t offset, int64_t size,
+                              const AVDictionary *opts, int64_t max_buffered);
+
+/**
+ * Wait for the download to start.
+ *
+ * @return 0 once data is available, a negative error if the download failed
+ */
+int ff_segment_prefetch_wait(SegmentPrefetch *pf);
+
+/**
+ * Read the downloaded data, waiting for it if needed.
+ *
+ * @return the number of bytes read, AVERROR_EOF at the end of the segment
+ */
+int ff_segment_prefetch_read(SegmentPrefetch *pf, uint8_t *buf, int buf_size);
+
+int64_t ff_segment_prefetch_seq_no(const SegmentPrefetch *pf);
+
+/**
+ * Abort the download if still running and free it.
+ *
+ * @param opts if not NULL, the cookies set by the server are stored there
+ */
+void ff_segment_prefetch_free(SegmentPrefetch **ppf, AVDictionary **opts);
+
+#endif /* AVFORMAT_SEGPREFETCH_H */
@@ -787,6 +787,27 @@ int main(int argc, char **argv)
     finish();
     close_out();
 
+    // Write each fragment in chunks of at most a quarter of a second, each
+    // chunk being a moof+mdat pair of its own.
+    init_out("chunked");
+    av_dict_set(&opts, "movflags", "frag_keyframe+delay_moov", 0);
+    av_dict_set(&opts, "frag_chunk_duration", "250000", 0);
+    init(1, 1);
+    mux_gops(2);
+    finish();
+    close_out();
+
+    // The fragment size limit applies to the whole fragment, not to each
+    // of its chunks.
+    init_out("chunked-frag-size");
+    av_dict_set(&opts, "movflags", "delay_moov", 0);
+    av_dict_set(&opts, "frag_size", "400", 0);
+    av_dict_set(&opts, "frag_chunk_duration", "250000", 0);
+    init(0, 0);
+    mux_gops(2);
+    finish();
+    close_out();
+
     av_free(md5);
     av_packet_free(&pkt);
 
@@ -0,0 +1,328 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Test of the HTTP connection pool and of the segment prefetching of the
+ * HLS and DASH demuxers against a local HTTP server serving the files of
+ * a directory.
+ *
+ * segprefetch <dir>             checks which requests reuse a connection
+ * segprefetch <dir> <manifest>  checks that prefetching does not change the
+ *                               packets demuxed from the manifest
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/avstring.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavformat/avformat.h"
+#include "libavformat/http.h"
+#include "libavformat/network.h"
+
+#define MAX_CONNECTIONS 64
+
+static const char *root;
+static int listen_fd;
+static int server_quit;
+static int nb_connections;
+static int nb_requests;
+static int nb_keepalive_requests;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t conn_threads[MAX_CONNECTIONS];
+
+static int send_all(int fd, const char *buf, size_t size)
+{
+    while (size) {
+        int ret = send(fd, buf, size, 0);
+        if (ret <= 0)
+            return -1;
+        buf  += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/* Read a request header, returning its size or -1 when the client is gone. */
+static int read_request(int fd, char *buf, int size)
+{
+    int len = 0;
+
+    while (len < size - 1) {
+        int ret = recv(fd, buf + len, size - 1 - len, 0);
+        if (ret <= 0)
+            return -1;
+        len += ret;
+        buf[len] = '\0';
+        if (strstr(buf, "\r\n\r\n"))
+            return len;
+    }
+    return -1;
+}
+
+/*
+ * Serve the requests of a connection, closing it after the response when
+ * the path starts with /close/.
+ */
+static void *connection_thread(void *arg)
+{
+    int fd = (intptr_t)arg;
+    char req[4096], path[1024], header[256];
+
+    while (read_request(fd, req, sizeof(req)) >= 0) {
+        const char *name = path + 1;
+        int close_after = 0;
+        uint8_t *data = NULL;
+        long size = 0;
+        FILE *f;
+
+        if (sscanf(req, "GET %1023s", path) != 1)
+            break;
+        pthread_mutex_lock(&stats_mutex);
+        nb_requests++;
+        nb_keepalive_requests += !!av_stristr(req, "\r\nConnection: keep-alive\r\n");
+        pthread_mutex_unlock(&stats_mutex);
+
+        if (av_strstart(path, "/close/", &name))
+            close_after = 1;
+        snprintf(header, sizeof(header), "%s/%s", root, name);
+        f = strstr(name, "..") ? NULL : fopen(header, "rb");
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+            fseek(f, 0, SEEK_SET);
+            data = av_malloc(size + 1);
+            if (!data || fread(data, 1, size, f) != size)
+                size = -1;
+            fclose(f);
+        }
+
+        if (!f || size < 0)
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n%s\r\n",
+                     close_after ? "Connection: close\r\n" : "");
+        else
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n%s\r\n",
+                     size, close_after ? "Connection: close\r\n" : "");
+        if (send_all(fd, header, strlen(header)) < 0 ||
+            (size > 0 && send_all(fd, data, size) < 0) || close_after) {
+            av_free(data);
+            break;
+        }
+        av_free(data);
+    }
+    closesocket(fd);
+    return NULL;
+}
+
+static void *server_thread(void *arg)
+{
+    struct pollfd p = { listen_fd, POLLIN, 0 };
+
+    for (;;) {
+        int fd, quit;
+
+        pthread_mutex_lock(&stats_mutex);
+        quit = server_quit;
+        pthread_mutex_unlock(&stats_mutex);
+        if (quit)
+            break;
+        if (poll(&p, 1, 100) <= 0)
+            continue;
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        pthread_mutex_lock(&stats_mutex);
+        if (nb_connections == MAX_CONNECTIONS ||
+            pthread_create(&conn_threads[nb_connections], NULL,
+                           connection_thread, (void *)(intptr_t)fd)) {
+            closesocket(fd);
+        } else {
+            nb_connections++;
+        }
+        pthread_mutex_unlock(&stats_mutex);
+    }
+    return NULL;
+}
+
+static int get_connections(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&stats_mutex);
+    ret = nb_connections;
+    pthread_mutex_unlock(&stats_mutex);
+    return ret;
+}
+
+static int start_server(int *port)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrlen = sizeof(addr);
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_fd = ff_socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return -1;
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(listen_fd, 16) ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen)) {
+        closesocket(listen_fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return 0;
+}
+
+static int fetch(int port, const char *path, const char *options)
+{
+    AVDictionary *opts = NULL;
+    AVIOContext *pb;
+    char url[256];
+    uint8_t buf[4096];
+    int ret, size = 0;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", port, path);
+    av_dict_parse_string(&opts, options, "=", ":", 0);
+    av_dict_set(&opts, "connection_pool", "1", 0);
+    ret = avio_open2(&pb, url, AVIO_FLAG_READ, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+    while ((ret = avio_read(pb, buf, sizeof(buf))) > 0)
+        size += ret;
+    avio_closep(&pb);
+    return ret == AVERROR_EOF ? size : ret;
+}
+
+static void test_pool(int port, const char *file)
+{
+    static const struct {
+        const char *desc, *path, *options;
+    } tests[] = {
+        { "first request",                   "",       ""                            },
+        { "same request",                    "",       ""                            },
+        { "other lower protocol options",    "",       "send_buffer_size=65536"      },
+        { "other protocol whitelist",        "",       "protocol_whitelist=http,tcp" },
+        { "server closing the connection",   "close/", ""                            },
+        { "after the connection was closed", "",       ""                            },
+    };
+    int i;
+
+    for (i = 0; i < FF_ARRAY_ELEMS(tests); i++) {
+        char path[256];
+        int before = get_connections(), ret;
+
+        snprintf(path, sizeof(path), "%s%s", tests[i].path, file);
+        ret = fetch(port, path, tests[i].options);
+        printf("%s: %s, %s connection\n", tests[i].desc,
+               ret > 0 ? "ok" : "failed",
+               get_connections() > before ? "new" : "reused");
+    }
+    printf("keep-alive requested: %d of %d\n", nb_keepalive_requests, nb_requests);
+}
+
+static int demux(int port, const char *manifest, const char *options,
+                 int *nb_packets, uint32_t *checksum)
+{
+    AVFormatContext *s = NULL;
+    AVDictionary *opts = NULL;
+    AVPacket *pkt = av_packet_alloc();
+    char url[256];
+    int ret;
+
+    *nb_packets = 0;
+    *checksum   = 1;
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", port, manifest);
+    av_dict_parse_string(&opts, options, "=", ":", 0);
+    ret = avformat_open_input(&s, url, NULL, &opts);
+    av_dict_free(&opts);
+    while (ret >= 0 && (ret = av_read_frame(s, pkt)) >= 0) {
+        (*nb_packets)++;
+        *checksum = av_adler32_update(*checksum, (const uint8_t *)&pkt->stream_index,
+                                      sizeof(pkt->stream_index));
+        *checksum = av_adler32_update(*checksum, (const uint8_t *)&pkt->pts,
+                                      sizeof(pkt->pts));
+        *checksum = av_adler32_update(*checksum, pkt->data, pkt->size);
+        av_packet_unref(pkt);
+    }
+    avformat_close_input(&s);
+    av_packet_free(&pkt);
+    return ret == AVERROR_EOF ? 0 : ret;
+}
+
+static void test_prefetch(int port, const char *manifest)
+{
+    static const char *const options[] = {
+        "prefetch_segments=2",
+        "prefetch_segments=3:prefetch_max_size=1",
+    };
+    uint32_t ref_checksum, checksum;
+    int ref_packets, packets, i, ret;
+
+    ret = demux(port, manifest, "", &ref_packets, &ref_checksum);
+    printf("without prefetch: %s, %d packets\n", ret < 0 ? "failed" : "ok", ref_packets);
+    for (i = 0; i < FF_ARRAY_ELEMS(options); i++) {
+        ret = demux(port, manifest, options[i], &packets, &checksum);
+        printf("%s: %s, %s\n", options[i], ret < 0 ? "failed" : "ok",
+               packets == ref_packets && checksum == ref_checksum ?
+               "same packets" : "different packets");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t server;
+    int port, i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <dir> [<manifest>]\n", argv[0]);
+        return 1;
+    }
+    root = argv[1];
+    av_log_set_level(AV_LOG_QUIET);
+    avformat_network_init();
+    if (start_server(&port) < 0 ||
+        pthread_create(&server, NULL, server_thread, NULL)) {
+        fprintf(stderr, "Failed to start the server\n");
+        return 1;
+    }
+
+    if (argc > 2)
+        test_prefetch(port, argv[2]);
+    else
+        test_pool(port, "segprefetch.m3u8");
+
+    /* close the idle connections so that their threads end */
+    ff_http_pool_flush();
+    pthread_mutex_lock(&stats_mutex);
+    server_quit = 1;
+    pthread_mutex_unlock(&stats_mutex);
+    pthread_join(server, NULL);
+    for (i = 0; i < nb_connections; i++)
+        pthread_join(conn_threads[i], NULL);
+    closesocket(listen_fd);
+    avformat_network_deinit();
+    return 0;
+}
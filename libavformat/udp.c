@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -80,6 +81,17 @@
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
 
+/* Counters of the receiving or sending thread, protected by the mutex. */
+typedef struct UDPThreadStats {
+    int64_t datagrams;
+    int64_t batches;
+    int64_t overruns;
+    int64_t late;
+    int64_t paced;      ///< batches the sending thread waited for
+    int64_t jitter_sum;
+    int64_t jitter_max;
+} UDPThreadStats;
+
 typedef struct UDPContext {
     const AVClass *class;
     int udp_fd;
@@ -109,6 +121,32 @@ typedef struct UDPContext {
     pthread_cond_t cond;
     int thread_started;
 #endif
+    int recv_batch;
+    int send_batch;
+#if HAVE_RECVMMSG
+    struct mmsghdr *rx_msgs;
+    struct iovec *rx_iov;
+    struct sockaddr_storage *rx_addrs;
+    uint8_t *rx_buf;
+#endif
+#if HAVE_SENDMMSG
+    struct mmsghdr *tx_msgs;
+    struct iovec *tx_iov;
+    uint8_t *tx_buf;
+#endif
+    /* Statistics of the thread. It counts into stats, under the mutex, and
+     * the calling thread copies them into the exported fields below, so
+     * that reading the options does not race with the thread. */
+    UDPThreadStats stats;
+    /* receiving thread statistics */
+    int64_t rx_datagrams;
+    int64_t rx_batches;
+    int64_t rx_overruns;
+    /* sending thread statistics, delays in microseconds */
+    int64_t tx_datagrams;
+    int64_t tx_batches;
+    int64_t tx_late;
+    int64_t tx_jitter_max;
     uint8_t tmp[UDP_MAX_PKT_SIZE+4];
     int remaining_in_dg;
     char *localaddr;
@@ -138,6 +176,15 @@ static const AVOption options[] = {
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
+    { "recv_batch",     "set the maximum number of datagrams read at once by the receiving thread", OFFSET(recv_batch), AV_OPT_TYPE_INT, {.i64 = 1}, 1, 1024, D },
+    { "rx_datagrams",   "number of datagrams queued by the receiving thread", OFFSET(rx_datagrams), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, D | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "rx_batches",     "number of reads done by the receiving thread",   OFFSET(rx_batches),     AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, D | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "send_batch",     "set the maximum number of datagrams sent at once by the sending thread", OFFSET(send_batch), AV_OPT_TYPE_INT, {.i64 = 1}, 1, 1024, E },
+    { "tx_datagrams",   "number of datagrams sent by the sending thread", OFFSET(tx_datagrams),   AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "tx_batches",     "number of writes done by the sending thread",   OFFSET(tx_batches),     AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "tx_late",        "number of writes done after their scheduled time", OFFSET(tx_late),     AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "tx_jitter_max",  "maximum wake up delay of the sending thread, in microseconds", OFFSET(tx_jitter_max), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, E | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "rx_overruns",    "number of datagrams dropped on circular buffer overrun", OFFSET(rx_overruns), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, D | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "timeout",        "set raise error timeout, in microseconds (only in read mode)",OFFSET(timeout),         AV_OPT_TYPE_INT,  {.i64 = 0}, 0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -459,7 +506,118 @@ static int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
+#if HAVE_RECVMMSG
+static void udp_free_rx_batch(UDPContext *s)
+{
+    av_freep(&s->rx_msgs);
+    av_freep(&s->rx_iov);
+    av_freep(&s->rx_addrs);
+    av_freep(&s->rx_buf);
+}
+
+static int udp_alloc_rx_batch(UDPContext *s)
+{
+    int i;
+
+    s->rx_msgs  = av_calloc(s->recv_batch, sizeof(*s->rx_msgs));
+    s->rx_iov   = av_calloc(s->recv_batch, sizeof(*s->rx_iov));
+    s->rx_addrs = av_calloc(s->recv_batch, sizeof(*s->rx_addrs));
+    s->rx_buf   = av_malloc_array(s->recv_batch, sizeof(s->tmp));
+    if (!s->rx_msgs || !s->rx_iov || !s->rx_addrs || !s->rx_buf) {
+        udp_free_rx_batch(s);
+        return AVERROR(ENOMEM);
+    }
+    /* each datagram is read after room for its length prefix */
+    for (i = 0; i < s->recv_batch; i++) {
+        s->rx_iov[i].iov_base = s->rx_buf + i * sizeof(s->tmp) + 4;
+        s->rx_iov[i].iov_len  = sizeof(s->tmp) - 4;
+        s->rx_msgs[i].msg_hdr.msg_iov    = &s->rx_iov[i];
+        s->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        s->rx_msgs[i].msg_hdr.msg_name   = &s->rx_addrs[i];
+    }
+    return 0;
+}
+#endif
+
+#if HAVE_SENDMMSG
+static void udp_free_tx_batch(UDPContext *s)
+{
+    av_freep(&s->tx_msgs);
+    av_freep(&s->tx_iov);
+    av_freep(&s->tx_buf);
+}
+
+static int udp_alloc_tx_batch(UDPContext *s)
+{
+    int i;
+
+    s->tx_msgs = av_calloc(s->send_batch, sizeof(*s->tx_msgs));
+    s->tx_iov  = av_calloc(s->send_batch, sizeof(*s->tx_iov));
+    s->tx_buf  = av_malloc_array(s->send_batch, sizeof(s->tmp));
+    if (!s->tx_msgs || !s->tx_iov || !s->tx_buf) {
+        udp_free_tx_batch(s);
+        return AVERROR(ENOMEM);
+    }
+    /* all datagrams go to the destination address */
+    for (i = 0; i < s->send_batch; i++) {
+        s->tx_iov[i].iov_base = s->tx_buf + i * sizeof(s->tmp);
+        s->tx_msgs[i].msg_hdr.msg_iov    = &s->tx_iov[i];
+        s->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        if (!s->is_connected) {
+            s->tx_msgs[i].msg_hdr.msg_name    = &s->dest_addr;
+            s->tx_msgs[i].msg_hdr.msg_namelen = s->dest_addr_len;
+        }
+    }
+    return 0;
+}
+#endif
+
 #if HAVE_PTHREAD_CANCEL
+/* Copy the statistics of the thread into the exported fields.
+ * Must be called with the mutex held, or after the thread has exited. */
+static void udp_export_stats(URLContext *h)
+{
+    UDPContext *s = h->priv_data;
+
+    if (h->flags & AVIO_FLAG_READ) {
+        s->rx_datagrams  = s->stats.datagrams;
+        s->rx_batches    = s->stats.batches;
+        s->rx_overruns   = s->stats.overruns;
+    } else {
+        s->tx_datagrams  = s->stats.datagrams;
+        s->tx_batches    = s->stats.batches;
+        s->tx_late       = s->stats.late;
+        s->tx_jitter_max = s->stats.jitter_max;
+    }
+}
+
+/* Queue a datagram preceded by 4 bytes of room for its length.
+ * Must be called with the mutex held. */
+static int circular_buffer_push(URLContext *h, uint8_t *buf, int len)
+{
+    UDPContext *s = h->priv_data;
+
+    AV_WL32(buf, len);
+
+    if(av_fifo_space(s->fifo) < len + 4) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            s->stats.overruns++;
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            return AVERROR(EIO);
+        }
+    }
+    av_fifo_generic_write(s->fifo, buf, len+4, NULL);
+    s->stats.datagrams++;
+    return 0;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -474,15 +632,27 @@ static void *circular_buffer_task_rx( void *_URLContext)
         goto end;
     }
     while(1) {
-        int len;
+        int len, ret, i;
         struct sockaddr_storage addr;
         socklen_t addr_len = sizeof(addr);
 
+#if HAVE_RECVMMSG
+        if (s->rx_msgs) {
+            for (i = 0; i < s->recv_batch; i++)
+                s->rx_msgs[i].msg_hdr.msg_namelen = sizeof(*s->rx_addrs);
+        }
+#endif
         pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+#if HAVE_RECVMMSG
+        /* Block for the first datagram only, then take what is queued. */
+        if (s->rx_msgs)
+            len = recvmmsg(s->udp_fd, s->rx_msgs, s->recv_batch, MSG_WAITFORONE, NULL);
+        else
+#endif
         len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
@@ -493,25 +663,31 @@ static void *circular_buffer_task_rx( void *_URLContext)
             }
             continue;
         }
+        s->stats.batches++;
+#if HAVE_RECVMMSG
+        if (s->rx_msgs) {
+            int nb_msgs = len;
+            for (i = 0; i < nb_msgs; i++) {
+                if (ff_ip_check_source_lists(&s->rx_addrs[i], &s->filters))
+                    continue;
+                ret = circular_buffer_push(h, (uint8_t *)s->rx_iov[i].iov_base - 4,
+                                           s->rx_msgs[i].msg_len);
+                if (ret < 0) {
+                    s->circular_buffer_error = ret;
+                    goto end;
+                }
+            }
+            pthread_cond_signal(&s->cond);
+            continue;
+        }
+#endif
         if (ff_ip_check_source_lists(&addr, &s->filters))
             continue;
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
-            }
+        ret = circular_buffer_push(h, s->tmp, len);
+        if (ret < 0) {
+            s->circular_buffer_error = ret;
+            goto end;
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
         pthread_cond_signal(&s->cond);
     }
 
@@ -530,6 +706,14 @@ static void *circular_buffer_task_tx( void *_URLContext)
     int64_t sent_bits = 0;
     int64_t burst_interval = s->bitrate ? (s->burst_bits * 1000000 / s->bitrate) : 0;
     int64_t max_delay = s->bitrate ?  ((int64_t)h->max_packet_size * 8 * 1000000 / s->bitrate + 1) : 0;
+    int batch = 1;
+
+#if HAVE_SENDMMSG
+    if (s->tx_msgs) {
+        batch = s->send_batch;
+        max_delay *= batch;
+    }
+#endif
 
     pthread_mutex_lock(&s->mutex);
 
@@ -540,10 +724,11 @@ static void *circular_buffer_task_tx( void *_URLContext)
     }
 
     for(;;) {
-        int len;
+        int len, nb_msgs = 0, batch_len = 0;
         const uint8_t *p;
         uint8_t tmp[4];
-        int64_t timestamp;
+        int64_t timestamp, jitter = 0;
+        int late = 0, paced = 0;
 
         len = av_fifo_size(s->fifo);
 
@@ -554,13 +739,27 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len = av_fifo_size(s->fifo);
         }
 
-        av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-        len = AV_RL32(tmp);
+        /* Take what is queued, up to a batch, and pace it as a whole. */
+        do {
+            uint8_t *buf = s->tmp;
+#if HAVE_SENDMMSG
+            if (s->tx_msgs)
+                buf = s->tx_iov[nb_msgs].iov_base;
+#endif
+            av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+            len = AV_RL32(tmp);
 
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
+            av_assert0(len >= 0);
+            av_assert0(len <= sizeof(s->tmp));
 
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+            av_fifo_generic_read(s->fifo, buf, len, NULL);
+#if HAVE_SENDMMSG
+            if (s->tx_msgs)
+                s->tx_iov[nb_msgs].iov_len = len;
+#endif
+            batch_len += len;
+            nb_msgs++;
+        } while (nb_msgs < batch && av_fifo_size(s->fifo) >= 4);
 
         pthread_mutex_unlock(&s->mutex);
 
@@ -574,16 +773,40 @@ static void *circular_buffer_task_tx( void *_URLContext)
                     sent_bits = 0;
                 }
                 av_usleep(delay);
+                jitter = FFMAX(av_gettime_relative() - timestamp - delay, 0);
+                paced  = 1;
             } else {
+                late = timestamp > target_timestamp;
                 if (timestamp - burst_interval > target_timestamp) {
                     start_timestamp = timestamp - burst_interval;
                     sent_bits = 0;
                 }
             }
-            sent_bits += len * 8;
+            sent_bits += batch_len * 8;
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
+#if HAVE_SENDMMSG
+        if (s->tx_msgs) {
+            int i = 0;
+            while (i < nb_msgs) {
+                int ret = sendmmsg(s->udp_fd, s->tx_msgs + i, nb_msgs - i, 0);
+                if (ret >= 0) {
+                    i += ret;
+                } else {
+                    ret = ff_neterrno();
+                    if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
+                        pthread_mutex_lock(&s->mutex);
+                        s->circular_buffer_error = ret;
+                        pthread_mutex_unlock(&s->mutex);
+                        return NULL;
+                    }
+                }
+            }
+            len = 0;
+        }
+#endif
+
         p = s->tmp;
         while (len) {
             int ret;
@@ -609,6 +832,12 @@ static void *circular_buffer_task_tx( void *_URLContext)
         }
 
         pthread_mutex_lock(&s->mutex);
+        s->stats.datagrams  += nb_msgs;
+        s->stats.batches++;
+        s->stats.late       += late;
+        s->stats.paced      += paced;
+        s->stats.jitter_sum += jitter;
+        s->stats.jitter_max  = FFMAX(s->stats.jitter_max, jitter);
     }
 
 end:
@@ -697,6 +926,12 @@ static int udp_open(URLContext *h, const char *uri, int flags)
                        "'circular_buffer_size' option was set but it is not supported "
                        "on this build (pthread support is required)\n");
         }
+        if (av_find_info_tag(buf, sizeof(buf), "recv_batch", p)) {
+            s->recv_batch = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
+        if (av_find_info_tag(buf, sizeof(buf), "send_batch", p)) {
+            s->send_batch = av_clip(strtol(buf, NULL, 10), 1, 1024);
+        }
         if (av_find_info_tag(buf, sizeof(buf), "bitrate", p)) {
             s->bitrate = strtoll(buf, NULL, 10);
             if (!HAVE_PTHREAD_CANCEL)
@@ -907,6 +1142,20 @@ static int udp_open(URLContext *h, const char *uri, int flags)
             ret = AVERROR(ENOMEM);
             goto fail;
         }
+#if HAVE_RECVMMSG
+        if (!is_output && s->recv_batch > 1) {
+            ret = udp_alloc_rx_batch(s);
+            if (ret < 0)
+                goto fail;
+        }
+#endif
+#if HAVE_SENDMMSG
+        if (is_output && s->send_batch > 1) {
+            ret = udp_alloc_tx_batch(s);
+            if (ret < 0)
+                goto fail;
+        }
+#endif
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -940,6 +1189,12 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_RECVMMSG
+    udp_free_rx_batch(s);
+#endif
+#if HAVE_SENDMMSG
+    udp_free_tx_batch(s);
+#endif
     ff_ip_reset_filters(&s->filters);
     return ret;
 }
@@ -965,6 +1220,7 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
 
     if (s->fifo) {
         pthread_mutex_lock(&s->mutex);
+        udp_export_stats(h);
         do {
             avail = av_fifo_size(s->fifo);
             if (avail) { // >=size) {
@@ -1028,6 +1284,7 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
         uint8_t tmp[4];
 
         pthread_mutex_lock(&s->mutex);
+        udp_export_stats(h);
 
         /*
           Return error if last tx failed.
@@ -1102,12 +1359,29 @@ static int udp_close(URLContext *h)
         ret = pthread_join(s->circular_buffer_thread, NULL);
         if (ret != 0)
             av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", strerror(ret));
+        udp_export_stats(h);
         pthread_mutex_destroy(&s->mutex);
         pthread_cond_destroy(&s->cond);
+        if (h->flags & AVIO_FLAG_READ)
+            av_log(h, AV_LOG_VERBOSE, "%"PRId64" datagrams received in %"PRId64" reads, "
+                   "%"PRId64" dropped on overrun\n",
+                   s->rx_datagrams, s->rx_batches, s->rx_overruns);
+        else
+            av_log(h, AV_LOG_VERBOSE, "%"PRId64" datagrams sent in %"PRId64" writes, "
+                   "%"PRId64" late, wake up delay %"PRId64" us average, %"PRId64" us max\n",
+                   s->tx_datagrams, s->tx_batches, s->tx_late,
+                   s->stats.paced ? s->stats.jitter_sum / s->stats.paced : 0,
+                   s->tx_jitter_max);
     }
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_RECVMMSG
+    udp_free_rx_batch(s);
+#endif
+#if HAVE_SENDMMSG
+    udp_free_tx_batch(s);
+#endif
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
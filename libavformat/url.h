@@ -87,6 +87,11 @@ typedef struct URLProtocol {
                                      int *numhandles);
     int (*url_get_short_seek)(URLContext *h);
     int (*url_shutdown)(URLContext *h, int flags);
+    /**
+     * Wait until the data passed to url_write() so far has been written,
+     * for protocols completing writes asynchronously.
+     */
+    int (*url_flush)(URLContext *h);
     const AVClass *priv_data_class;
     int priv_data_size;
     int flags;
@@ -266,6 +271,15 @@ int ffurl_get_short_seek(URLContext *h);
  */
 int ffurl_shutdown(URLContext *h, int flags);
 
+/**
+ * Wait until all the data written to the resource has been written out.
+ *
+ * @param h pointer to the resource
+ * @return a negative value if an error condition occurred, 0
+ * otherwise
+ */
+int ffurl_flush(URLContext *h);
+
 /**
  * Check if the user has requested to interrupt a blocking function
  * associated with cb.
@@ -42,6 +42,7 @@
 
 #include "avformat.h"
 #include "avio_internal.h"
+#include "http.h"
 #include "internal.h"
 #if CONFIG_NETWORK
 #include "network.h"
@@ -1314,6 +1315,9 @@ int avformat_network_init(void)
 int avformat_network_deinit(void)
 {
 #if CONFIG_NETWORK
+#if CONFIG_HTTP_PROTOCOL
+    ff_http_pool_flush();
+#endif
     ff_network_close();
     ff_tls_deinit();
 #endif
@@ -265,6 +265,9 @@ AVBufferPool *av_buffer_pool_init2(size_t size, void *opaque,
         return NULL;
 
     ff_mutex_init(&pool->mutex, NULL);
+    atomic_init(&pool->released, 0);
+    atomic_init(&pool->in_use, 0);
+    atomic_init(&pool->peak, 0);
 
     pool->size      = size;
     pool->opaque    = opaque;
@@ -284,6 +287,9 @@ AVBufferPool *av_buffer_pool_init(size_t size, AVBufferRef* (*alloc)(size_t size
         return NULL;
 
     ff_mutex_init(&pool->mutex, NULL);
+    atomic_init(&pool->released, 0);
+    atomic_init(&pool->in_use, 0);
+    atomic_init(&pool->peak, 0);
 
     pool->size     = size;
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
@@ -295,6 +301,18 @@ AVBufferPool *av_buffer_pool_init(size_t size, AVBufferRef* (*alloc)(size_t size
 
 static void buffer_pool_flush(AVBufferPool *pool)
 {
+    BufferPoolEntry *released;
+
+    released = (BufferPoolEntry*)atomic_exchange_explicit(&pool->released, 0,
+                                                          memory_order_acquire);
+    while (released) {
+        BufferPoolEntry *buf = released;
+        released = buf->next;
+
+        buf->free(buf->opaque, buf->data);
+        av_freep(&buf);
+    }
+
     while (pool->pool) {
         BufferPoolEntry *buf = pool->pool;
         pool->pool = buf->next;
@@ -340,14 +358,20 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
 {
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
+    intptr_t head;
 
     if(CONFIG_MEMORY_POISONING)
         memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+
+    head = atomic_load_explicit(&pool->released, memory_order_relaxed);
+    do {
+        buf->next = (BufferPoolEntry*)head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->released, &head,
+                                                    (intptr_t)buf,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -384,12 +408,27 @@ static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
     return ret;
 }
 
+static void pool_add_in_use(AVBufferPool *pool)
+{
+    unsigned in_use = atomic_fetch_add_explicit(&pool->in_use, 1,
+                                                memory_order_relaxed) + 1;
+    intptr_t peak = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+
+    while (peak < (intptr_t)in_use &&
+           !atomic_compare_exchange_weak_explicit(&pool->peak, &peak, in_use,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+}
+
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 {
-    AVBufferRef *ret;
+    AVBufferRef *ret = NULL;
     BufferPoolEntry *buf;
 
     ff_mutex_lock(&pool->mutex);
+    if (!pool->pool)
+        pool->pool = (BufferPoolEntry*)atomic_exchange_explicit(&pool->released, 0,
+                                                                memory_order_acquire);
     buf = pool->pool;
     if (buf) {
         memset(&buf->buffer, 0, sizeof(buf->buffer));
@@ -399,18 +438,37 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
             pool->pool = buf->next;
             buf->next = NULL;
             buf->buffer.flags_internal |= BUFFER_FLAG_NO_FREE;
+            pool->hits++;
         }
     } else {
+        /* The alloc callbacks may rely on being serialized by the mutex. */
         ret = pool_alloc_buffer(pool);
+        if (ret)
+            pool->misses++;
     }
     ff_mutex_unlock(&pool->mutex);
 
-    if (ret)
+    if (ret) {
+        pool_add_in_use(pool);
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
+    }
 
     return ret;
 }
 
+void av_buffer_pool_get_stats(AVBufferPool *pool, uint64_t *hits,
+                              uint64_t *misses, size_t *peak)
+{
+    ff_mutex_lock(&pool->mutex);
+    if (hits)
+        *hits   = pool->hits;
+    if (misses)
+        *misses = pool->misses;
+    ff_mutex_unlock(&pool->mutex);
+    if (peak)
+        *peak   = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+}
+
 void *av_buffer_pool_buffer_get_opaque(const AVBufferRef *ref)
 {
     BufferPoolEntry *buf = ref->buffer->opaque;
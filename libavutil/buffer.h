@@ -302,6 +302,21 @@ void av_buffer_pool_uninit(AVBufferPool **pool);
  */
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool);
 
+/**
+ * Retrieve usage statistics of a buffer pool, e.g. to tune the number of
+ * buffers a caller keeps in flight. This function may be called
+ * simultaneously with av_buffer_pool_get() from other threads.
+ *
+ * @param hits   if non-NULL, set to the number of av_buffer_pool_get() calls
+ *               that reused a buffer previously returned to the pool
+ * @param misses if non-NULL, set to the number of av_buffer_pool_get() calls
+ *               that had to allocate a new buffer
+ * @param peak   if non-NULL, set to the largest number of buffers from this
+ *               pool that were in use at the same time
+ */
+void av_buffer_pool_get_stats(AVBufferPool *pool, uint64_t *hits,
+                              uint64_t *misses, size_t *peak);
+
 /**
  * Query the original opaque parameter of an allocated buffer in the pool.
  *
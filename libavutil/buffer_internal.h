@@ -90,6 +90,17 @@ struct AVBufferPool {
     AVMutex mutex;
     BufferPoolEntry *pool;
 
+    /*
+     * Buffers returned to the pool are pushed onto this list without taking
+     * the mutex, so that releasing a buffer never blocks. Only whole-list
+     * exchanges are done on the consumer side, which keeps it free of ABA
+     * problems: av_buffer_pool_get() takes the entire list over into pool,
+     * under the mutex, whenever pool runs empty.
+     * This is an atomic_intptr_t, as that is the only atomic pointer-sized
+     * type whose base type is the same with C11 and with compat/atomics.
+     */
+    atomic_intptr_t released;
+
     /*
      * This is used to track when the pool is to be freed.
      * The pointer to the pool itself held by the caller is considered to
@@ -101,6 +112,19 @@ struct AVBufferPool {
      */
     atomic_uint refcount;
 
+    /*
+     * Number of buffers currently handed out to callers.
+     */
+    atomic_uint in_use;
+
+    /*
+     * Usage statistics, see av_buffer_pool_get_stats(). hits and misses
+     * are protected by mutex, peak is updated when a buffer is handed out.
+     */
+    uint64_t        hits;
+    uint64_t        misses;
+    atomic_intptr_t peak;
+
     size_t size;
     void *opaque;
     AVBufferRef* (*alloc)(size_t size);
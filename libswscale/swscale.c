@@ -1142,7 +1142,8 @@ int sws_receive_slice(struct SwsContext *c, unsigned int slice_start,
         return AVERROR(EAGAIN);
 
     if ((slice_start > 0 || slice_height < c->dstH) &&
-        (slice_start % align || slice_height % align)) {
+        (slice_start % align ||
+         (slice_height % align && slice_start + slice_height != c->dstH))) {
         av_log(c, AV_LOG_ERROR,
                "Incorrectly aligned output: %u/%u not multiples of %u\n",
                slice_start, slice_height, align);
@@ -1171,7 +1172,8 @@ int sws_receive_slice(struct SwsContext *c, unsigned int slice_start,
     }
 
     for (int i = 0; i < FF_ARRAY_ELEMS(dst); i++) {
-        ptrdiff_t offset = c->frame_dst->linesize[i] * (slice_start >> c->chrDstVSubSample);
+        const int vshift = (i == 1 || i == 2) ? c->chrDstVSubSample : 0;
+        const ptrdiff_t offset = c->frame_dst->linesize[i] * (slice_start >> vshift);
         dst[i] = FF_PTR_ADD(c->frame_dst->data[i], offset);
     }
 
@@ -22,6 +22,8 @@
 #include "libavutil/common.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mem_internal.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
 
 #include "libswscale/swscale.h"
 #include "libswscale/swscale_internal.h"
@@ -133,6 +135,169 @@ static void check_yuv2yuvX(void)
 #undef FILTER_SIZES
 }
 
+#define HBD_FORMATS 4
+static const enum AVPixelFormat hbd_formats[HBD_FORMATS] = {
+    AV_PIX_FMT_YUV420P9, AV_PIX_FMT_YUV420P10,
+    AV_PIX_FMT_YUV420P12, AV_PIX_FMT_YUV420P16,
+};
+
+static struct SwsContext *alloc_output_context(enum AVPixelFormat dst_format)
+{
+    struct SwsContext *ctx = sws_alloc_context();
+    if (!ctx)
+        return NULL;
+
+    av_opt_set_int(ctx, "srcw", 2 * LARGEST_INPUT_SIZE, 0);
+    av_opt_set_int(ctx, "srch", 16, 0);
+    av_opt_set_int(ctx, "dstw", LARGEST_INPUT_SIZE, 0);
+    av_opt_set_int(ctx, "dsth", 8, 0);
+    av_opt_set_int(ctx, "src_format", AV_PIX_FMT_YUV420P, 0);
+    av_opt_set_int(ctx, "dst_format", dst_format, 0);
+    av_opt_set_int(ctx, "sws_flags", SWS_BICUBIC, 0);
+    if (sws_init_context(ctx, NULL, NULL) < 0) {
+        sws_freeContext(ctx);
+        return NULL;
+    }
+    ff_sws_init_scale(ctx);
+    return ctx;
+}
+
+// The vertical scaler input is 15 bits in int16_t for outputs of up to 14
+// bits and 19 bits in int32_t for 16-bit outputs.
+static void randomize_vscale_input(int32_t *buf, int size, int dst_bpc)
+{
+    int i;
+
+    if (dst_bpc == 16) {
+        for (i = 0; i < size; i++)
+            buf[i] = rnd() & ((1 << 19) - 1);
+    } else {
+        int16_t *buf16 = (int16_t *)buf;
+        for (i = 0; i < 2 * size; i++)
+            buf16[i] = rnd() & 0x7FFF;
+    }
+}
+
+static void check_yuv2plane1(void)
+{
+#define INPUT_SIZES 6
+    static const int input_sizes[INPUT_SIZES] = {8, 24, 128, 144, 256, 512};
+    struct SwsContext *ctx;
+    int fmi, isi, dstW;
+    uint8_t dither[8] = { 0 };
+
+    declare_func_emms(AV_CPU_FLAG_MMX, void, const int16_t *src, uint8_t *dest,
+                      int dstW, const uint8_t *dither, int offset);
+
+    LOCAL_ALIGNED_32(int32_t, src, [LARGEST_INPUT_SIZE]);
+    LOCAL_ALIGNED_32(uint16_t, dst0, [LARGEST_INPUT_SIZE]);
+    LOCAL_ALIGNED_32(uint16_t, dst1, [LARGEST_INPUT_SIZE]);
+
+    for (fmi = 0; fmi < HBD_FORMATS; fmi++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(hbd_formats[fmi]);
+
+        ctx = alloc_output_context(hbd_formats[fmi]);
+        if (!ctx) {
+            fail();
+            continue;
+        }
+        randomize_vscale_input(src, LARGEST_INPUT_SIZE, ctx->dstBpc);
+
+        for (isi = 0; isi < INPUT_SIZES; isi++) {
+            dstW = input_sizes[isi];
+            if (check_func(ctx->yuv2plane1, "yuv2plane1_%d_%d",
+                           desc->comp[0].depth, dstW)) {
+                memset(dst0, 0, LARGEST_INPUT_SIZE * sizeof(dst0[0]));
+                memset(dst1, 0, LARGEST_INPUT_SIZE * sizeof(dst1[0]));
+
+                call_ref((const int16_t *)src, (uint8_t *)dst0, dstW, dither, 0);
+                call_new((const int16_t *)src, (uint8_t *)dst1, dstW, dither, 0);
+                if (memcmp(dst0, dst1, dstW * sizeof(dst0[0])))
+                    fail();
+                if (dstW == LARGEST_INPUT_SIZE)
+                    bench_new((const int16_t *)src, (uint8_t *)dst1, dstW, dither, 0);
+            }
+        }
+        sws_freeContext(ctx);
+    }
+#undef INPUT_SIZES
+}
+
+static void check_yuv2planeX_hbd(void)
+{
+#define FILTER_SIZES 4
+    static const int filter_sizes[FILTER_SIZES] = {2, 4, 8, 16};
+#define INPUT_SIZES 6
+    static const int input_sizes[INPUT_SIZES] = {8, 24, 128, 144, 256, 512};
+    struct SwsContext *ctx;
+    int fmi, fsi, isi, i, dstW;
+    uint8_t dither[8] = { 0 };
+    const int16_t *src[LARGEST_FILTER];
+
+    declare_func_emms(AV_CPU_FLAG_MMX, void, const int16_t *filter,
+                      int filterSize, const int16_t **src, uint8_t *dest,
+                      int dstW, const uint8_t *dither, int offset);
+
+    LOCAL_ALIGNED_32(int32_t, src_pixels, [LARGEST_FILTER * LARGEST_INPUT_SIZE]);
+    LOCAL_ALIGNED_32(int16_t, filter, [LARGEST_FILTER]);
+    LOCAL_ALIGNED_32(uint16_t, dst0, [LARGEST_INPUT_SIZE]);
+    LOCAL_ALIGNED_32(uint16_t, dst1, [LARGEST_INPUT_SIZE]);
+
+    for (fmi = 0; fmi < HBD_FORMATS; fmi++) {
+        const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(hbd_formats[fmi]);
+
+        ctx = alloc_output_context(hbd_formats[fmi]);
+        if (!ctx) {
+            fail();
+            continue;
+        }
+        randomize_vscale_input(src_pixels, LARGEST_FILTER * LARGEST_INPUT_SIZE,
+                               ctx->dstBpc);
+
+        for (fsi = 0; fsi < FILTER_SIZES; fsi++) {
+            // Vertical filter coefficients are 12 bits and sum to 1 << 12,
+            // with some negative taps as with bicubic or lanczos scaling.
+            // The 16-bit kernels accumulate 19-bit inputs in 32 bits starting
+            // from -0x40000000, which only holds while the negative taps sum
+            // to more than -2048; the last tap makes up the sum and is never
+            // negative.
+            int neg = 2047 / (filter_sizes[fsi] - 1);
+            int pos = 4096 / (filter_sizes[fsi] - 1);
+            int sum = 0;
+
+            for (i = 0; i < filter_sizes[fsi] - 1; i++) {
+                filter[i] = (int)(rnd() % (pos + neg + 1)) - neg;
+                sum += filter[i];
+            }
+            filter[i] = (1 << 12) - sum;
+
+            for (i = 0; i < filter_sizes[fsi]; i++)
+                src[i] = ctx->dstBpc == 16 ?
+                         (const int16_t *)(src_pixels + i * LARGEST_INPUT_SIZE) :
+                         (const int16_t *)src_pixels + i * LARGEST_INPUT_SIZE;
+
+            for (isi = 0; isi < INPUT_SIZES; isi++) {
+                dstW = input_sizes[isi];
+                if (check_func(ctx->yuv2planeX, "yuv2planeX_%d_%d_%d",
+                               desc->comp[0].depth, filter_sizes[fsi], dstW)) {
+                    memset(dst0, 0, LARGEST_INPUT_SIZE * sizeof(dst0[0]));
+                    memset(dst1, 0, LARGEST_INPUT_SIZE * sizeof(dst1[0]));
+
+                    call_ref(filter, filter_sizes[fsi], src, (uint8_t *)dst0, dstW, dither, 0);
+                    call_new(filter, filter_sizes[fsi], src, (uint8_t *)dst1, dstW, dither, 0);
+                    if (memcmp(dst0, dst1, dstW * sizeof(dst0[0])))
+                        fail();
+                    if (dstW == LARGEST_INPUT_SIZE)
+                        bench_new(filter, filter_sizes[fsi], src, (uint8_t *)dst1, dstW, dither, 0);
+                }
+            }
+        }
+        sws_freeContext(ctx);
+    }
+#undef FILTER_SIZES
+#undef INPUT_SIZES
+}
+
 #undef SRC_PIXELS
 #define SRC_PIXELS 512
 
@@ -241,4 +406,8 @@ void checkasm_check_sw_scale(void)
     report("hscale");
     check_yuv2yuvX();
     report("yuv2yuvX");
+    check_yuv2plane1();
+    report("yuv2plane1");
+    check_yuv2planeX_hbd();
+    report("yuv2planeX_hbd");
 }
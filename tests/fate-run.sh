@@ -502,6 +502,47 @@ concat(){
     fi
 }
 
+reinit_in_place(){
+    src1="${outdir}/${test}-1.m2v"
+    src2="${outdir}/${test}-2.m2v"
+    srcfile="${outdir}/${test}.m2v"
+    cleanfiles="$src1 $src2 $srcfile"
+
+    ffmpeg -f lavfi -i testsrc2=s=320x240:r=25:d=0.4,format=yuv420p -c:v mpeg2video -fflags +bitexact -flags +bitexact -f mpeg2video -y $src1 || return
+    ffmpeg -f lavfi -i testsrc2=s=176x144:r=25:d=0.4,format=yuv420p -c:v mpeg2video -fflags +bitexact -flags +bitexact -f mpeg2video -y $src2 || return
+    cat $src1 $src2 > $srcfile
+    framecrc -idct simple -reinit_in_place 1 -i $srcfile -sws_flags +accurate_rnd+bitexact "$@"
+}
+
+mjpeg_dri(){
+    srcfile="${outdir}/${test}.mjpeg"
+    cleanfiles="$srcfile"
+
+    # the slice threaded encoder writes one restart interval per macroblock row
+    ffmpeg -f lavfi -i testsrc2=s=320x240:r=25:d=0.4,format=yuvj420p -threads 4 -thread_type slice -c:v mjpeg -qscale 5 -fflags +bitexact -flags +bitexact -f mjpeg -y $srcfile || return
+    framecrc -idct simple -i $srcfile "$@"
+}
+
+mov_index_cache(){
+    srcfile="${outdir}/${test}.mov"
+    cachefile="${outdir}/${test}.idx"
+    nocache="${outdir}/${test}.nocache"
+    cold="${outdir}/${test}.cold"
+    warm="${outdir}/${test}.warm"
+    cleanfiles="$srcfile $cachefile $nocache $cold $warm"
+
+    ffmpeg -f lavfi -i testsrc2=s=176x144:r=25:d=2,format=yuv420p -f lavfi -i sine=d=2 \
+        -c:v mpeg4 -bf 2 -g 12 -c:a pcm_s16le -fflags +bitexact -flags +bitexact -f mov -y $srcfile || return
+    framecrc -i $srcfile -map 0 -c copy > $nocache || return
+    # the first run writes the cache, the second one reads it
+    framecrc -index_cache $cachefile -i $srcfile -map 0 -c copy > $cold || return
+    test -f $cachefile || { echo "index cache not written"; return 1; }
+    framecrc -index_cache $cachefile -i $srcfile -map 0 -c copy > $warm || return
+    cmp -s $nocache $cold || echo "output with the cache written differs"
+    cmp -s $nocache $warm || echo "output with the cache read differs"
+    cat $warm
+}
+
 venc_data(){
     file=$1
     stream=$2
@@ -30,6 +30,20 @@ fate-ffmpeg-filter_complex: CMD = framecrc -filter_complex color=d=1:r=5 -fflags
 FATE_FFMPEG-$(call ALLYES, AEVALSRC_FILTER ASETNSAMPLES_FILTER AC3_FIXED_ENCODER) += fate-ffmpeg-filter_complex_audio
 fate-ffmpeg-filter_complex_audio: CMD = framecrc -auto_conversion_filters -filter_complex "aevalsrc=0:d=0.1,asetnsamples=1537" -c ac3_fixed
 
+FATE_FFMPEG-$(call ALLYES, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER MPEG2VIDEO_ENCODER \
+                  MPEG2VIDEO_MUXER MPEGVIDEO_DEMUXER MPEG2VIDEO_DECODER \
+                  SCALE_FILTER FRAMECRC_MUXER FILE_PROTOCOL PIPE_PROTOCOL) += fate-ffmpeg-reinit-in-place
+fate-ffmpeg-reinit-in-place: CMD = reinit_in_place -an
+
+# every segment starts a new GOP, so segment-parallel encoding with one GOP
+# per segment gives the same packets as a single encoder
+FATE_FFMPEG_ENC_SEGMENTS-$(call ALLYES, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER \
+                           MPEG4_ENCODER FRAMECRC_MUXER PIPE_PROTOCOL) += fate-ffmpeg-enc-segments fate-ffmpeg-enc-segments-serial
+fate-ffmpeg-enc-segments: CMD = framecrc -f lavfi -i testsrc2=s=176x144:r=25:d=2,format=yuv420p -enc_segments 3 -c:v mpeg4 -threads 1 -qscale 5 -g 5 -bf 0 -flags +bitexact
+fate-ffmpeg-enc-segments-serial: CMD = framecrc -f lavfi -i testsrc2=s=176x144:r=25:d=2,format=yuv420p -c:v mpeg4 -threads 1 -qscale 5 -g 5 -bf 0 -flags +bitexact
+fate-ffmpeg-enc-segments-serial: REF = $(SRC_PATH)/tests/ref/fate/ffmpeg-enc-segments
+FATE_FFMPEG += $(FATE_FFMPEG_ENC_SEGMENTS-yes)
+
 # Ticket 6375, use case of NoX
 FATE_SAMPLES_FFMPEG-$(call ALLYES, MOV_DEMUXER PNG_DECODER ALAC_DECODER PCM_S16LE_ENCODER RAWVIDEO_ENCODER) += fate-ffmpeg-attached_pics
 fate-ffmpeg-attached_pics: CMD = threads=2 framecrc -i $(TARGET_SAMPLES)/lossless-audio/inside.m4a -c:a pcm_s16le -threads 1 -max_muxing_queue_size 16 -af aresample
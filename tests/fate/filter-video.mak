@@ -122,6 +122,14 @@ FATE_FILTER-$(call ALLYES, FRAMERATE_FILTER TESTSRC2_FILTER FORMAT_FILTER) += fa
 fate-filter-framerate-12bit-up: CMD = framecrc -lavfi testsrc2=r=50:d=1,format=pix_fmts=yuv422p12le,scale,framerate=fps=60,scale -t 1 -pix_fmt yuv422p12le
 fate-filter-framerate-12bit-down: CMD = framecrc -lavfi testsrc2=r=60:d=1,format=pix_fmts=yuv422p12le,scale,framerate=fps=50,scale -t 1 -pix_fmt yuv422p12le
 
+# Activating the branches of a split concurrently must give the same output
+# as running the graph on a single thread.
+FILTER_PIPELINE_GRAPH = "testsrc2=r=5:d=2,split=4[a][b][c][d];[a]scale=w=160:h=120:flags=bicubic+bitexact,scale=w=320:h=240:flags=bicubic+bitexact[a1];[b]hflip[b1];[c]avgblur=2[c1];[d]negate[d1];[a1][b1][c1][d1]hstack=inputs=4"
+FATE_FILTER-$(call ALLYES, TESTSRC2_FILTER SPLIT_FILTER SCALE_FILTER HFLIP_FILTER AVGBLUR_FILTER NEGATE_FILTER HSTACK_FILTER) += fate-filter-pipeline fate-filter-pipeline-serial
+fate-filter-pipeline:        CMD = framecrc -filter_complex_threads 4 -filter_complex_pipeline -lavfi $(FILTER_PIPELINE_GRAPH)
+fate-filter-pipeline-serial: CMD = framecrc -filter_complex_threads 1 -lavfi $(FILTER_PIPELINE_GRAPH)
+fate-filter-pipeline-serial: REF = $(SRC_PATH)/tests/ref/fate/filter-pipeline
+
 FATE_FILTER-$(call ALLYES, MINTERPOLATE_FILTER TESTSRC2_FILTER) += fate-filter-minterpolate-up fate-filter-minterpolate-down
 fate-filter-minterpolate-up: CMD = framecrc -lavfi testsrc2=r=2:d=10,minterpolate=fps=10 -t 1
 fate-filter-minterpolate-down: CMD = framecrc -lavfi testsrc2=r=2:d=10,minterpolate=fps=1 -t 1
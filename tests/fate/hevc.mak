@@ -230,6 +230,18 @@ FATE_HEVC_LARGE += fate-hevc-conformance-$(1)
 fate-hevc-conformance-$(1): CMD = framecrc -flags unaligned -i $(TARGET_SAMPLES)/hevc-conformance/$(1).bit -pix_fmt yuv444p12le -vf scale
 endef
 
+# the tiles of a slice segment are decoded in parallel with slice threads
+# and the parallel_tiles option
+HEVC_SAMPLES_TILES =            \
+    TILES_A_Cisco_2             \
+    TILES_B_Cisco_1             \
+
+define FATE_HEVC_TEST_SLICE_THREADS
+FATE_HEVC += fate-hevc-conformance-$(1)-slice-threads
+fate-hevc-conformance-$(1)-slice-threads: CMD = threads=4 thread_type=slice framecrc -flags unaligned -parallel_tiles 1 -i $(TARGET_SAMPLES)/hevc-conformance/$(1).bit -pix_fmt yuv420p
+fate-hevc-conformance-$(1)-slice-threads: REF = $(SRC_PATH)/tests/ref/fate/hevc-conformance-$(1)
+endef
+
 $(foreach N,$(HEVC_SAMPLES),$(eval $(call FATE_HEVC_TEST,$(N))))
 $(foreach N,$(HEVC_SAMPLES_10BIT),$(eval $(call FATE_HEVC_TEST_10BIT,$(N))))
 $(foreach N,$(HEVC_SAMPLES_422_10BIT),$(eval $(call FATE_HEVC_TEST_422_10BIT,$(N))))
@@ -238,6 +250,7 @@ $(foreach N,$(HEVC_SAMPLES_422_10BIN_LARGE),$(eval $(call FATE_HEVC_TEST_422_10B
 $(foreach N,$(HEVC_SAMPLES_444_8BIT),$(eval $(call FATE_HEVC_TEST_444_8BIT,$(N))))
 $(foreach N,$(HEVC_SAMPLES_444_12BIT),$(eval $(call FATE_HEVC_TEST_444_12BIT,$(N))))
 $(foreach N,$(HEVC_SAMPLES_444_12BIT_LARGE),$(eval $(call FATE_HEVC_TEST_444_12BIT_LARGE,$(N))))
+$(foreach N,$(HEVC_SAMPLES_TILES),$(eval $(call FATE_HEVC_TEST_SLICE_THREADS,$(N))))
 
 fate-hevc-paramchange-yuv420p-yuv420p10: CMD = framecrc -vsync passthrough -i $(TARGET_SAMPLES)/hevc/paramchange_yuv420p_yuv420p10.hevc -sws_flags area+accurate_rnd+bitexact
 FATE_HEVC_LARGE += fate-hevc-paramchange-yuv420p-yuv420p10
@@ -26,6 +26,40 @@ FATE_LIBAVFORMAT-$(CONFIG_IMF_DEMUXER) += fate-imf
 fate-imf: libavformat/tests/imf$(EXESUF)
 fate-imf: CMD = run libavformat/tests/imf$(EXESUF)
 
+tests/data/segprefetch.m3u8: TAG = GEN
+tests/data/segprefetch.m3u8: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i "aevalsrc=cos(2*PI*t)*sin(2*PI*(440+4*t)*t):d=20" -f hls -hls_time 3 \
+        -hls_list_size 0 -hls_playlist_type vod -map 0 -codec:a mp2fixed \
+        -hls_segment_filename $(TARGET_PATH)/tests/data/segprefetch_%03d.ts \
+        $(TARGET_PATH)/tests/data/segprefetch.m3u8 2>/dev/null
+
+SEGPREFETCH_DEPS = HTTP_PROTOCOL TCP_PROTOCOL HLS_MUXER MPEGTS_MUXER \
+                   AEVALSRC_FILTER LAVFI_INDEV MP2FIXED_ENCODER
+
+FATE_SEGPREFETCH-$(call ALLYES, $(SEGPREFETCH_DEPS)) += fate-http-pool
+fate-http-pool: libavformat/tests/segprefetch$(EXESUF) tests/data/segprefetch.m3u8
+fate-http-pool: CMD = run libavformat/tests/segprefetch$(EXESUF) $(TARGET_PATH)/tests/data
+
+FATE_SEGPREFETCH-$(call ALLYES, $(SEGPREFETCH_DEPS) HLS_DEMUXER MPEGTS_DEMUXER) += fate-hls-prefetch
+fate-hls-prefetch: libavformat/tests/segprefetch$(EXESUF) tests/data/segprefetch.m3u8
+fate-hls-prefetch: CMD = run libavformat/tests/segprefetch$(EXESUF) $(TARGET_PATH)/tests/data segprefetch.m3u8
+
+tests/data/segprefetch.mpd: TAG = GEN
+tests/data/segprefetch.mpd: ffmpeg$(PROGSSUF)$(EXESUF) | tests/data
+	$(M)$(TARGET_EXEC) $(TARGET_PATH)/$< -nostdin \
+        -f lavfi -i "aevalsrc=cos(2*PI*t)*sin(2*PI*(440+4*t)*t):d=20" -f dash -seg_duration 3 \
+        -use_template 1 -use_timeline 0 -map 0 -codec:a mp2fixed \
+        -init_seg_name 'segprefetch_init_$$RepresentationID$$.m4s' \
+        -media_seg_name 'segprefetch_$$RepresentationID$$_$$Number%03d$$.m4s' \
+        $(TARGET_PATH)/tests/data/segprefetch.mpd 2>/dev/null
+
+FATE_SEGPREFETCH-$(call ALLYES, $(SEGPREFETCH_DEPS) DASH_MUXER DASH_DEMUXER MOV_DEMUXER) += fate-dash-prefetch
+fate-dash-prefetch: libavformat/tests/segprefetch$(EXESUF) tests/data/segprefetch.mpd
+fate-dash-prefetch: CMD = run libavformat/tests/segprefetch$(EXESUF) $(TARGET_PATH)/tests/data segprefetch.mpd
+
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_SEGPREFETCH-yes)
+
 FATE_LIBAVFORMAT += $(FATE_LIBAVFORMAT-yes)
 FATE-$(CONFIG_AVFORMAT) += $(FATE_LIBAVFORMAT)
 fate-libavformat: $(FATE_LIBAVFORMAT)
@@ -147,4 +147,13 @@ fate-mov-mp4-disposition-mpegts-remux: CMD = transcode mpegts $(TARGET_SAMPLES)/
 
 FATE_SAMPLES_FFMPEG_FFPROBE += $(FATE_MOV_FFMPEG_FFPROBE-yes)
 
-fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART) $(FATE_MOV_FFMPEG_FFPROBE-yes)
+# The index is built on the first run and read from the cache on the second,
+# the packets must match the ones read without a cache.
+FATE_MOV_FFMPEG-$(call ALLYES, LAVFI_INDEV TESTSRC2_FILTER SINE_FILTER FORMAT_FILTER \
+                               MPEG4_ENCODER PCM_S16LE_ENCODER MOV_MUXER MOV_DEMUXER \
+                               FRAMECRC_MUXER FILE_PROTOCOL PIPE_PROTOCOL) += fate-mov-index-cache
+fate-mov-index-cache: CMD = mov_index_cache
+
+FATE_FFMPEG += $(FATE_MOV_FFMPEG-yes)
+
+fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART) $(FATE_MOV_FFMPEG_FFPROBE-yes) $(FATE_MOV_FFMPEG-yes)
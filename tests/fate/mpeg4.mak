@@ -16,4 +16,12 @@ fate-m4v:     CMD = framecrc -flags +bitexact -idct simple -i $(TARGET_SAMPLES)/
 fate-m4v-cfr: CMD = framecrc -flags +bitexact -idct simple -i $(TARGET_SAMPLES)/mpeg4/demo.m4v -vf fps=5
 
 FATE_SAMPLES_AVCONV += $(FATE_MPEG4-yes)
-fate-mpeg4: $(FATE_MPEG4-yes)
+
+# GOP frame threading must give the same packets as a single thread.
+FATE_MPEG4_FFMPEG-$(call ALLYES, LAVFI_INDEV TESTSRC2_FILTER MPEG4_ENCODER) += fate-mpeg4-gop-threads fate-mpeg4-gop-threads-1
+fate-mpeg4-gop-threads:   CMD = framecrc -f lavfi -i testsrc2=s=176x144:r=25:d=4 -c:v mpeg4 -q:v 5 -g 10 -threads 4 -thread_type frame -flags +bitexact -fflags +bitexact
+fate-mpeg4-gop-threads-1: CMD = framecrc -f lavfi -i testsrc2=s=176x144:r=25:d=4 -c:v mpeg4 -q:v 5 -g 10 -threads 1 -flags +bitexact -fflags +bitexact
+fate-mpeg4-gop-threads-1: REF = $(SRC_PATH)/tests/ref/fate/mpeg4-gop-threads
+
+FATE_FFMPEG += $(FATE_MPEG4_FFMPEG-yes)
+fate-mpeg4: $(FATE_MPEG4-yes) $(FATE_MPEG4_FFMPEG-yes)
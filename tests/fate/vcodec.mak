@@ -243,6 +243,15 @@ fate-vsynth%-mjpeg-trell:             ENCOPTS = -qscale 9 -pix_fmt yuvj420p -tre
 fate-vsynth%-mjpeg-huffman:           ENCOPTS = -qscale 9 -pix_fmt yuvj420p -huffman optimal
 fate-vsynth%-mjpeg-trell-huffman:     ENCOPTS = -qscale 9 -pix_fmt yuvj420p -trellis 1 -huffman optimal
 
+FATE_MJPEG_DRI-$(call ALLYES, LAVFI_INDEV TESTSRC2_FILTER FORMAT_FILTER MJPEG_ENCODER \
+                  MJPEG_MUXER MJPEG_DEMUXER MJPEG_DECODER FRAMECRC_MUXER \
+                  FILE_PROTOCOL PIPE_PROTOCOL) += fate-mjpeg-dri fate-mjpeg-dri-slice-threads
+fate-mjpeg-dri: CMD = mjpeg_dri
+fate-mjpeg-dri-slice-threads: CMD = threads=4 thread_type=slice mjpeg_dri
+fate-mjpeg-dri-slice-threads: REF = $(SRC_PATH)/tests/ref/fate/mjpeg-dri
+
+FATE_AVCONV += $(FATE_MJPEG_DRI-yes)
+
 FATE_VCODEC-$(call ENCDEC, MPEG1VIDEO, MPEG1VIDEO MPEGVIDEO) += mpeg1 mpeg1b
 fate-vsynth%-mpeg1:              FMT     = mpeg1video
 fate-vsynth%-mpeg1:              CODEC   = mpeg1video